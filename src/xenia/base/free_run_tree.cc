@@ -0,0 +1,249 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/free_run_tree.h"
+
+#include <algorithm>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/math.h"
+
+namespace xe {
+
+void FreeRunTree::Reset(uint32_t size) {
+  size_ = size;
+  leaf_count_ = 1;
+  while (leaf_count_ * 64 < size) {
+    leaf_count_ <<= 1;
+  }
+  bits_.assign(leaf_count_, 0);
+  for (uint32_t i = 0; i < size / 64; ++i) {
+    bits_[i] = ~uint64_t(0);
+  }
+  if (size & 63) {
+    bits_[size / 64] = (uint64_t(1) << (size & 63)) - 1;
+  }
+  nodes_.resize(leaf_count_ * 2);
+  for (uint32_t i = 0; i < leaf_count_; ++i) {
+    UpdateLeaf(i);
+  }
+  for (uint32_t first = leaf_count_ / 2, child_size = 64; first;
+       first /= 2, child_size *= 2) {
+    for (uint32_t node = first; node < first * 2; ++node) {
+      UpdateParent(node, child_size);
+    }
+  }
+}
+
+void FreeRunTree::SetRange(uint32_t first, uint32_t count, bool free) {
+  if (first >= size_) {
+    return;
+  }
+  count = std::min(count, size_ - first);
+  if (!count) {
+    return;
+  }
+  uint32_t last = first + count - 1;
+  uint32_t first_word = first / 64;
+  uint32_t last_word = last / 64;
+  for (uint32_t word = first_word; word <= last_word; ++word) {
+    uint64_t mask = ~uint64_t(0);
+    if (word == first_word) {
+      mask &= ~uint64_t(0) << (first & 63);
+    }
+    if (word == last_word) {
+      mask &= ~uint64_t(0) >> (63 - (last & 63));
+    }
+    if (free) {
+      bits_[word] |= mask;
+    } else {
+      bits_[word] &= ~mask;
+    }
+    UpdateLeaf(word);
+  }
+  uint32_t first_node = (leaf_count_ + first_word) / 2;
+  uint32_t last_node = (leaf_count_ + last_word) / 2;
+  for (uint32_t child_size = 64; first_node;
+       first_node /= 2, last_node /= 2, child_size *= 2) {
+    for (uint32_t node = first_node; node <= last_node; ++node) {
+      UpdateParent(node, child_size);
+    }
+  }
+}
+
+void FreeRunTree::UpdateLeaf(uint32_t word_index) {
+  uint64_t word = bits_[word_index];
+  Node& node = nodes_[leaf_count_ + word_index];
+  node.prefix = xe::tzcnt(~word);
+  node.suffix = xe::lzcnt(~word);
+  uint32_t longest = 0;
+  for (uint64_t run = word; run; run &= run >> 1) {
+    ++longest;
+  }
+  node.longest = longest;
+}
+
+void FreeRunTree::UpdateParent(uint32_t node_index, uint32_t child_size) {
+  const Node& left = nodes_[node_index * 2];
+  const Node& right = nodes_[node_index * 2 + 1];
+  Node& node = nodes_[node_index];
+  node.prefix =
+      left.prefix == child_size ? child_size + right.prefix : left.prefix;
+  node.suffix =
+      right.suffix == child_size ? child_size + left.suffix : right.suffix;
+  node.longest = std::max(std::max(left.longest, right.longest),
+                          left.suffix + right.prefix);
+}
+
+uint32_t FreeRunTree::FindRunStart(uint32_t node_index, uint32_t node_first,
+                                   uint32_t node_size, uint32_t from,
+                                   uint32_t count, uint32_t& carry) const {
+  if (node_first + node_size <= from) {
+    return kNotFound;
+  }
+  const Node& node = nodes_[node_index];
+  if (node_first >= from) {
+    if (carry + node.prefix >= count) {
+      return node_first - carry;
+    }
+    if (node.longest < count) {
+      // No run fits in the node, only the one continuing past it may.
+      carry = node.prefix == node_size ? carry + node_size : node.suffix;
+      return kNotFound;
+    }
+  }
+  if (node_index >= leaf_count_) {
+    uint64_t word = bits_[node_index - leaf_count_];
+    if (from > node_first) {
+      word &= ~uint64_t(0) << (from - node_first);
+    }
+    for (uint32_t i = 0; i < 64; ++i) {
+      if (!((word >> i) & 1)) {
+        carry = 0;
+      } else if (++carry >= count) {
+        return node_first + i + 1 - carry;
+      }
+    }
+    return kNotFound;
+  }
+  uint32_t child_size = node_size / 2;
+  uint32_t start = FindRunStart(node_index * 2, node_first, child_size, from,
+                                count, carry);
+  if (start != kNotFound) {
+    return start;
+  }
+  return FindRunStart(node_index * 2 + 1, node_first + child_size, child_size,
+                      from, count, carry);
+}
+
+uint32_t FreeRunTree::FindRunEnd(uint32_t node_index, uint32_t node_first,
+                                 uint32_t node_size, uint32_t limit,
+                                 uint32_t count, uint32_t& carry) const {
+  if (node_first >= limit) {
+    return kNotFound;
+  }
+  uint32_t node_end = node_first + node_size;
+  const Node& node = nodes_[node_index];
+  if (node_end <= limit) {
+    if (carry + node.suffix >= count) {
+      return node_end + carry;
+    }
+    if (node.longest < count) {
+      carry = node.suffix == node_size ? carry + node_size : node.prefix;
+      return kNotFound;
+    }
+  }
+  if (node_index >= leaf_count_) {
+    uint64_t word = bits_[node_index - leaf_count_];
+    if (limit < node_end) {
+      word &= (uint64_t(1) << (limit - node_first)) - 1;
+    }
+    for (uint32_t i = 64; i-- > 0;) {
+      if (!((word >> i) & 1)) {
+        carry = 0;
+      } else if (++carry >= count) {
+        return node_first + i + carry;
+      }
+    }
+    return kNotFound;
+  }
+  uint32_t child_size = node_size / 2;
+  uint32_t end = FindRunEnd(node_index * 2 + 1, node_first + child_size,
+                            child_size, limit, count, carry);
+  if (end != kNotFound) {
+    return end;
+  }
+  return FindRunEnd(node_index * 2, node_first, child_size, limit, count,
+                    carry);
+}
+
+uint32_t FreeRunTree::FindFirst(uint32_t low_start, uint32_t high_start,
+                                uint32_t count, uint32_t alignment) const {
+  assert_not_zero(count);
+  assert_not_zero(alignment);
+  uint32_t root_size = leaf_count_ * 64;
+  uint32_t from = xe::round_up(low_start, alignment, false);
+  while (from <= high_start && from < size_) {
+    uint32_t carry = 0;
+    uint32_t start = FindRunStart(1, 0, root_size, from, count, carry);
+    if (start == kNotFound || start > high_start) {
+      return kNotFound;
+    }
+    uint32_t aligned_start = xe::round_up(start, alignment, false);
+    if (aligned_start == start) {
+      return start;
+    }
+    if (aligned_start > high_start) {
+      return kNotFound;
+    }
+    // The run may still be long enough past the alignment. If it isn't, the
+    // search continues from the next run.
+    carry = 0;
+    from = FindRunStart(1, 0, root_size, aligned_start, count, carry);
+    if (from == aligned_start) {
+      return aligned_start;
+    }
+  }
+  return kNotFound;
+}
+
+uint32_t FreeRunTree::FindLast(uint32_t low_start, uint32_t high_start,
+                               uint32_t count, uint32_t alignment) const {
+  assert_not_zero(count);
+  assert_not_zero(alignment);
+  if (count > size_ || low_start > size_ - count) {
+    return kNotFound;
+  }
+  uint32_t root_size = leaf_count_ * 64;
+  uint32_t limit = std::min(high_start, size_ - count) + count;
+  for (;;) {
+    uint32_t carry = 0;
+    uint32_t end = FindRunEnd(1, 0, root_size, limit, count, carry);
+    if (end == kNotFound || end - count < low_start) {
+      return kNotFound;
+    }
+    uint32_t aligned_start = (end - count) / alignment * alignment;
+    if (aligned_start == end - count) {
+      return aligned_start;
+    }
+    if (aligned_start < low_start) {
+      return kNotFound;
+    }
+    carry = 0;
+    limit = FindRunEnd(1, 0, root_size, aligned_start + count, count, carry);
+    if (limit == aligned_start + count) {
+      return aligned_start;
+    }
+    if (limit == kNotFound) {
+      return kNotFound;
+    }
+  }
+}
+
+}  // namespace xe
@@ -0,0 +1,92 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_FREE_RUN_TREE_H_
+#define XENIA_BASE_FREE_RUN_TREE_H_
+
+#include <cstdint>
+#include <vector>
+
+namespace xe {
+
+// Free-run tree: tracks which of a range of units (such as heap pages) are
+// free, and finds aligned runs of free units in O(log n).
+// Units are kept in a bitmap, and a segment tree over its 64-bit words stores
+// the free run at the start and the end of each subtree and the longest one
+// within it. Not thread safe.
+class FreeRunTree {
+ public:
+  static constexpr uint32_t kNotFound = UINT32_MAX;
+
+  FreeRunTree() = default;
+  explicit FreeRunTree(uint32_t size) { Reset(size); }
+
+  // Resizes the tree to the given number of units, all free.
+  void Reset(uint32_t size);
+
+  uint32_t size() const { return size_; }
+  bool IsFree(uint32_t index) const {
+    return (bits_[index >> 6] >> (index & 63)) & 1;
+  }
+  // Length of the longest free run in the whole tree.
+  uint32_t longest_free_run() const {
+    return nodes_.empty() ? 0 : nodes_[1].longest;
+  }
+
+  void MarkUsed(uint32_t first, uint32_t count) {
+    SetRange(first, count, false);
+  }
+  void MarkFree(uint32_t first, uint32_t count) {
+    SetRange(first, count, true);
+  }
+
+  // Returns the lowest start in [low_start, high_start] that is a multiple of
+  // the alignment and is followed by count free units, or kNotFound.
+  uint32_t FindFirst(uint32_t low_start, uint32_t high_start, uint32_t count,
+                     uint32_t alignment = 1) const;
+  // Returns the highest such start, or kNotFound.
+  uint32_t FindLast(uint32_t low_start, uint32_t high_start, uint32_t count,
+                    uint32_t alignment = 1) const;
+
+ private:
+  struct Node {
+    // Free units at the start of the subtree.
+    uint32_t prefix;
+    // Free units at the end of the subtree.
+    uint32_t suffix;
+    // Longest free run within the subtree.
+    uint32_t longest;
+  };
+
+  void SetRange(uint32_t first, uint32_t count, bool free);
+  void UpdateLeaf(uint32_t word_index);
+  void UpdateParent(uint32_t node, uint32_t child_size);
+
+  // Lowest start of count free units at or after from. carry is the length of
+  // the free run ending just before the node, not counting units before from.
+  uint32_t FindRunStart(uint32_t node, uint32_t node_first, uint32_t node_size,
+                        uint32_t from, uint32_t count, uint32_t& carry) const;
+  // Highest end (exclusive) of count free units not reaching past limit.
+  // carry is the length of the free run starting just after the node, not
+  // counting units at or after limit.
+  uint32_t FindRunEnd(uint32_t node, uint32_t node_first, uint32_t node_size,
+                      uint32_t limit, uint32_t count, uint32_t& carry) const;
+
+  uint32_t size_ = 0;
+  // Number of leaves, a power of two. Each leaf covers a word of the bitmap.
+  uint32_t leaf_count_ = 0;
+  // Set bits are free units. Bits past size_ are always used.
+  std::vector<uint64_t> bits_;
+  // Implicit binary tree with the root at 1 and the leaves at leaf_count_.
+  std::vector<Node> nodes_;
+};
+
+}  // namespace xe
+
+#endif  // XENIA_BASE_FREE_RUN_TREE_H_
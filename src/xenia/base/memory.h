@@ -14,6 +14,7 @@
 #include <cstring>
 #include <filesystem>
 #include <functional>
+#include <memory>
 #include <string>
 #include <string_view>
 
@@ -133,6 +134,30 @@ void* MapFileView(FileMappingHandle handle, void* base_address, size_t length,
                   PageAccess access, size_t file_offset);
 bool UnmapFileView(FileMappingHandle handle, void* base_address, size_t length);
 
+// Detects writes to pages in bulk, without the process handling an access
+// violation on the first write to every page like with Protect. Only the pages
+// passed to Watch are tracked.
+class WriteTracker {
+ public:
+  // Returns nullptr if not supported by the host. On Linux, requires
+  // asynchronous userfaultfd write protection and the PAGEMAP_SCAN ioctl
+  // (Linux 6.7).
+  static std::unique_ptr<WriteTracker> Create();
+
+  virtual ~WriteTracker() = default;
+
+  // Starts tracking writes to the pages, forgetting the earlier writes to them.
+  // The pages must be mapped, and tracking stops if they're mapped again.
+  virtual bool Watch(void* base_address, size_t length) = 0;
+  // Calls the callback for the ranges of pages written since they were watched
+  // or collected the last time, and watches them again. Returns false if the
+  // written pages couldn't be retrieved.
+  virtual bool CollectWrites(
+      void* base_address, size_t length,
+      const std::function<void(void* base_address, size_t length)>&
+          callback) = 0;
+};
+
 inline size_t hash_combine(size_t seed) { return seed; }
 
 template <typename T, typename... Ts>
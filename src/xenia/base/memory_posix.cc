@@ -12,6 +12,7 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <unistd.h>
+#include <array>
 #include <cstddef>
 
 #include "xenia/base/math.h"
@@ -27,6 +28,15 @@
 #include "xenia/base/main_android.h"
 #endif
 
+#if XE_PLATFORM_LINUX
+#include <linux/fs.h>
+#include <linux/userfaultfd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#include "xenia/base/logging.h"
+#endif
+
 namespace xe {
 namespace memory {
 
@@ -187,5 +197,140 @@ bool UnmapFileView(FileMappingHandle handle, void* base_address,
   return munmap(base_address, length) == 0;
 }
 
+#if XE_PLATFORM_LINUX
+// Definitions from newer kernel headers than the build may be using.
+#ifndef UFFD_USER_MODE_ONLY
+#define UFFD_USER_MODE_ONLY 1
+#endif
+#ifndef UFFD_FEATURE_WP_HUGETLBFS_SHMEM
+#define UFFD_FEATURE_WP_HUGETLBFS_SHMEM (1 << 12)
+#endif
+#ifndef UFFD_FEATURE_WP_UNPOPULATED
+#define UFFD_FEATURE_WP_UNPOPULATED (1 << 13)
+#endif
+#ifndef UFFD_FEATURE_WP_ASYNC
+#define UFFD_FEATURE_WP_ASYNC (1 << 15)
+#endif
+#ifndef PAGEMAP_SCAN
+#define PAGE_IS_WRITTEN (1 << 1)
+struct page_region {
+  __u64 start;
+  __u64 end;
+  __u64 categories;
+};
+#define PM_SCAN_WP_MATCHING (1 << 0)
+struct pm_scan_arg {
+  __u64 size;
+  __u64 flags;
+  __u64 start;
+  __u64 end;
+  __u64 walk_end;
+  __u64 vec;
+  __u64 vec_len;
+  __u64 max_pages;
+  __u64 category_inverted;
+  __u64 category_mask;
+  __u64 category_anyof_mask;
+  __u64 return_mask;
+};
+#define PAGEMAP_SCAN _IOWR('f', 16, struct pm_scan_arg)
+#endif
+
+// With asynchronous write protection, the kernel resolves the write faults on
+// watched pages itself, only marking the pages as written, and PAGEMAP_SCAN
+// returns the written pages and protects them again atomically.
+class UserfaultfdWriteTracker : public WriteTracker {
+ public:
+  UserfaultfdWriteTracker(int userfaultfd, int pagemap)
+      : userfaultfd_(userfaultfd), pagemap_(pagemap) {}
+  ~UserfaultfdWriteTracker() override {
+    close(pagemap_);
+    close(userfaultfd_);
+  }
+
+  bool Watch(void* base_address, size_t length) override {
+    // Registering again is needed for pages mapped after the previous
+    // registration, and does nothing for the rest.
+    uffdio_register uffd_register = {};
+    uffd_register.range.start = uint64_t(base_address);
+    uffd_register.range.len = length;
+    uffd_register.mode = UFFDIO_REGISTER_MODE_WP;
+    if (ioctl(userfaultfd_, UFFDIO_REGISTER, &uffd_register) < 0) {
+      return false;
+    }
+    uffdio_writeprotect write_protect = {};
+    write_protect.range.start = uint64_t(base_address);
+    write_protect.range.len = length;
+    write_protect.mode = UFFDIO_WRITEPROTECT_MODE_WP;
+    return ioctl(userfaultfd_, UFFDIO_WRITEPROTECT, &write_protect) == 0;
+  }
+
+  bool CollectWrites(void* base_address, size_t length,
+                     const std::function<void(void* base_address,
+                                              size_t length)>& callback)
+      override {
+    pm_scan_arg scan = {};
+    scan.size = sizeof(scan);
+    scan.flags = PM_SCAN_WP_MATCHING;
+    scan.start = uint64_t(base_address);
+    scan.end = uint64_t(base_address) + length;
+    scan.vec = uint64_t(regions_.data());
+    scan.vec_len = regions_.size();
+    scan.category_mask = PAGE_IS_WRITTEN;
+    scan.return_mask = PAGE_IS_WRITTEN;
+    for (;;) {
+      int region_count = ioctl(pagemap_, PAGEMAP_SCAN, &scan);
+      if (region_count < 0) {
+        return false;
+      }
+      for (int i = 0; i < region_count; ++i) {
+        const page_region& region = regions_[i];
+        callback(reinterpret_cast<void*>(region.start),
+                 size_t(region.end - region.start));
+      }
+      // Continue if the region buffer was full.
+      if (scan.walk_end >= scan.end) {
+        return true;
+      }
+      scan.start = scan.walk_end;
+    }
+  }
+
+ private:
+  int userfaultfd_;
+  int pagemap_;
+  std::array<page_region, 256> regions_;
+};
+
+std::unique_ptr<WriteTracker> WriteTracker::Create() {
+  // User mode only faults don't require privileges.
+  int userfaultfd = int(
+      syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY));
+  if (userfaultfd < 0) {
+    XELOGW("Write tracking unavailable: userfaultfd not supported");
+    return nullptr;
+  }
+  uffdio_api api = {};
+  api.api = UFFD_API;
+  api.features = UFFD_FEATURE_WP_ASYNC | UFFD_FEATURE_WP_UNPOPULATED |
+                 UFFD_FEATURE_WP_HUGETLBFS_SHMEM;
+  if (ioctl(userfaultfd, UFFDIO_API, &api) < 0) {
+    XELOGW(
+        "Write tracking unavailable: asynchronous userfaultfd write protection "
+        "not supported");
+    close(userfaultfd);
+    return nullptr;
+  }
+  int pagemap = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+  if (pagemap < 0) {
+    close(userfaultfd);
+    return nullptr;
+  }
+  return std::make_unique<UserfaultfdWriteTracker>(userfaultfd, pagemap);
+}
+#else
+std::unique_ptr<WriteTracker> WriteTracker::Create() { return nullptr; }
+#endif  // XE_PLATFORM_LINUX
+
 }  // namespace memory
 }  // namespace xe
@@ -283,5 +283,9 @@ bool UnmapFileView(FileMappingHandle handle, void* base_address,
   return UnmapViewOfFile(base_address) ? true : false;
 }
 
+// MEM_WRITE_WATCH is only available for VirtualAlloc allocations, not for
+// views of file mappings.
+std::unique_ptr<WriteTracker> WriteTracker::Create() { return nullptr; }
+
 }  // namespace memory
 }  // namespace xe
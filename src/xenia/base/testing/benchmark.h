@@ -0,0 +1,53 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_TESTING_BENCHMARK_H_
+#define XENIA_BASE_TESTING_BENCHMARK_H_
+
+#include <chrono>
+#include <cstddef>
+#include <string_view>
+
+#include "third_party/catch/include/catch.hpp"
+#include "third_party/fmt/include/fmt/format.h"
+
+// Benchmarks only report timings, which depend on the host, so they are
+// hidden from normal test runs. Run them by tag, e.g.
+//   xenia-base-tests [benchmark]
+#define XE_BENCHMARK_CASE(name) TEST_CASE(name, "[.][benchmark]")
+
+namespace xe {
+namespace base {
+namespace test {
+
+// Runs function once and returns the time it took in nanoseconds, divided by
+// the number of operations it performed.
+template <typename F>
+double MeasureNanoseconds(size_t operation_count, F&& function) {
+  auto begin = std::chrono::steady_clock::now();
+  function();
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - begin;
+  return elapsed.count() / double(operation_count);
+}
+
+// Prints a result of the running benchmark as
+//   <benchmark>: <label>: <value> <unit>
+inline void ReportBenchmark(std::string_view label, double value,
+                            std::string_view unit) {
+  fmt::print("{}: {}: {:.1f} {}\n",
+             Catch::getResultCapture().getCurrentTestName(), label, value,
+             unit);
+}
+
+}  // namespace test
+}  // namespace base
+}  // namespace xe
+
+#endif  // XENIA_BASE_TESTING_BENCHMARK_H_
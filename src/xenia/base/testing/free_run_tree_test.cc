@@ -0,0 +1,187 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/free_run_tree.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+#include "xenia/base/testing/benchmark.h"
+
+namespace xe {
+namespace base {
+namespace test {
+
+// Page state array searched linearly, like BaseHeap::AllocRange used to.
+class LinearPageScan {
+ public:
+  explicit LinearPageScan(uint32_t size) : used_(size, false) {}
+
+  void MarkUsed(uint32_t first, uint32_t count) {
+    std::fill_n(used_.begin() + first, count, true);
+  }
+  void MarkFree(uint32_t first, uint32_t count) {
+    std::fill_n(used_.begin() + first, count, false);
+  }
+
+  uint32_t FindFirst(uint32_t low_start, uint32_t high_start, uint32_t count,
+                     uint32_t alignment) const {
+    for (uint32_t start = (low_start + alignment - 1) / alignment * alignment;
+         start <= high_start && start + count <= used_.size();
+         start += alignment) {
+      uint32_t page = start;
+      while (page < start + count && !used_[page]) {
+        ++page;
+      }
+      if (page == start + count) {
+        return start;
+      }
+      // Skip past the used page.
+      start = page / alignment * alignment;
+    }
+    return FreeRunTree::kNotFound;
+  }
+
+  uint32_t FindLast(uint32_t low_start, uint32_t high_start, uint32_t count,
+                    uint32_t alignment) const {
+    if (count > used_.size()) {
+      return FreeRunTree::kNotFound;
+    }
+    int64_t start =
+        std::min(high_start, uint32_t(used_.size()) - count) / alignment *
+        alignment;
+    for (; start >= int64_t(low_start); start -= alignment) {
+      uint32_t page = uint32_t(start);
+      while (page < start + count && !used_[page]) {
+        ++page;
+      }
+      if (page == start + count) {
+        return uint32_t(start);
+      }
+    }
+    return FreeRunTree::kNotFound;
+  }
+
+ private:
+  std::vector<bool> used_;
+};
+
+TEST_CASE("FreeRunTree finds aligned runs", "[free_run_tree]") {
+  FreeRunTree tree(1000);
+  REQUIRE(tree.longest_free_run() == 1000);
+  REQUIRE(tree.FindFirst(0, 999, 1000) == 0);
+  REQUIRE(tree.FindFirst(0, 999, 1001) == FreeRunTree::kNotFound);
+
+  tree.MarkUsed(0, 100);
+  tree.MarkUsed(130, 10);
+  REQUIRE(tree.longest_free_run() == 860);
+  REQUIRE(!tree.IsFree(99));
+  REQUIRE(tree.IsFree(100));
+  REQUIRE(tree.FindFirst(0, 999, 30) == 100);
+  REQUIRE(tree.FindFirst(0, 999, 31) == 140);
+  // The gap at 100 has no 16-aligned start of 30 free units.
+  REQUIRE(tree.FindFirst(0, 999, 20, 16) == 144);
+  REQUIRE(tree.FindFirst(0, 999, 16, 16) == 112);
+  REQUIRE(tree.FindFirst(0, 100, 31) == FreeRunTree::kNotFound);
+
+  REQUIRE(tree.FindLast(0, 999, 10) == 990);
+  REQUIRE(tree.FindLast(0, 989, 10, 16) == 976);
+  REQUIRE(tree.FindLast(0, 139, 20) == 110);
+  REQUIRE(tree.FindLast(0, 139, 20, 8) == 104);
+  REQUIRE(tree.FindLast(105, 139, 20, 8) == FreeRunTree::kNotFound);
+
+  tree.MarkFree(0, 1000);
+  REQUIRE(tree.longest_free_run() == 1000);
+  REQUIRE(tree.FindLast(0, 999, 1000) == 0);
+}
+
+TEST_CASE("FreeRunTree matches a linear scan", "[free_run_tree]") {
+  std::mt19937 random(1234);
+  for (uint32_t size : {1u, 63u, 64u, 65u, 1000u, 4096u, 5000u}) {
+    FreeRunTree tree(size);
+    LinearPageScan scan(size);
+    for (int i = 0; i < 500; ++i) {
+      uint32_t first = random() % size;
+      uint32_t count = 1 + random() % std::min(size - first, 300u);
+      if (random() & 1) {
+        tree.MarkUsed(first, count);
+        scan.MarkUsed(first, count);
+      } else {
+        tree.MarkFree(first, count);
+        scan.MarkFree(first, count);
+      }
+      uint32_t low_start = random() % size;
+      uint32_t high_start = low_start + random() % size;
+      uint32_t find_count = 1 + random() % 100;
+      uint32_t alignment = 1u << (random() % 6);
+      REQUIRE(tree.FindFirst(low_start, high_start, find_count, alignment) ==
+              scan.FindFirst(low_start, high_start, find_count, alignment));
+      REQUIRE(tree.FindLast(low_start, high_start, find_count, alignment) ==
+              scan.FindLast(low_start, high_start, find_count, alignment));
+    }
+  }
+}
+
+// Allocates from a heap of 4 KB pages where the allocations are searched for
+// from the fragmented end, with holes too small for them, and freed again so
+// that the fragmentation stays the same.
+template <typename T>
+static double MeasureFragmentedAllocations(T& pages, uint32_t page_count,
+                                           bool top_down) {
+  std::mt19937 random(5678);
+  // Fragment 7/8 of the heap with small allocations and 1-3 page holes.
+  uint32_t fragmented_count = page_count / 8 * 7;
+  uint32_t fragmented_first = top_down ? page_count - fragmented_count : 0;
+  for (uint32_t page = 0; page < fragmented_count;) {
+    uint32_t count =
+        std::min(1 + uint32_t(random() % 16), fragmented_count - page);
+    pages.MarkUsed(fragmented_first + page, count);
+    page += count + 1 + random() % 3;
+  }
+  constexpr size_t kIterations = 2000;
+  size_t found_count = 0;
+  double nanoseconds = MeasureNanoseconds(kIterations, [&]() {
+    for (size_t i = 0; i < kIterations; ++i) {
+      uint32_t count = 4u << (random() % 4);
+      uint32_t alignment = (i & 1) ? 16 : 1;
+      uint32_t start =
+          top_down ? pages.FindLast(0, page_count - 1, count, alignment)
+                   : pages.FindFirst(0, page_count - 1, count, alignment);
+      if (start != FreeRunTree::kNotFound) {
+        pages.MarkUsed(start, count);
+        pages.MarkFree(start, count);
+        ++found_count;
+      }
+    }
+  });
+  REQUIRE(found_count == kIterations);
+  return nanoseconds;
+}
+
+XE_BENCHMARK_CASE("FreeRunTree fragmented heap allocation") {
+  // 1 GB of 4 KB pages, like the 0x00000000 virtual heap.
+  constexpr uint32_t kPageCount = 0x40000;
+  for (bool top_down : {false, true}) {
+    const char* direction = top_down ? "top-down" : "bottom-up";
+    LinearPageScan scan(kPageCount);
+    ReportBenchmark(fmt::format("{}, linear scan", direction),
+                    MeasureFragmentedAllocations(scan, kPageCount, top_down),
+                    "ns per allocation");
+    FreeRunTree tree(kPageCount);
+    ReportBenchmark(fmt::format("{}, free-run tree", direction),
+                    MeasureFragmentedAllocations(tree, kPageCount, top_down),
+                    "ns per allocation");
+  }
+}
+
+}  // namespace test
+}  // namespace base
+}  // namespace xe
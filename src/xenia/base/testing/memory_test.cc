@@ -13,8 +13,12 @@
 #include "third_party/fmt/include/fmt/format.h"
 
 #include "xenia/base/clock.h"
+#include "xenia/base/exception_handler.h"
+#include "xenia/base/testing/benchmark.h"
 
 #include <array>
+#include <utility>
+#include <vector>
 
 namespace xe {
 namespace base {
@@ -558,6 +562,129 @@ TEST_CASE("read_write_view", "[virtual_memory_mapping]") {
   xe::memory::CloseFileMappingHandle(memory, path);
 }
 
+TEST_CASE("write_tracker", "[write_tracker]") {
+  auto write_tracker = xe::memory::WriteTracker::Create();
+  if (!write_tracker) {
+    WARN("Write tracking is not supported by the host");
+    return;
+  }
+  const size_t page_size = xe::memory::page_size();
+  const size_t length = 64 * page_size;
+  auto path = fmt::format("xenia_test_{}", Clock::QueryHostTickCount());
+  auto memory = xe::memory::CreateFileMappingHandle(
+      path, length, xe::memory::PageAccess::kReadWrite, true);
+  REQUIRE(memory != xe::memory::kFileMappingHandleInvalid);
+  auto pages = static_cast<uint8_t*>(xe::memory::MapFileView(
+      memory, nullptr, length, xe::memory::PageAccess::kReadWrite, 0));
+  REQUIRE(pages);
+
+  std::vector<std::pair<size_t, size_t>> written;
+  auto collect_writes = [&]() {
+    written.clear();
+    return write_tracker->CollectWrites(
+        pages, length, [&](void* base_address, size_t length) {
+          written.emplace_back(
+              static_cast<uint8_t*>(base_address) - pages, length);
+        });
+  };
+
+  REQUIRE(write_tracker->Watch(pages + page_size, length - 2 * page_size));
+  // Not watched.
+  pages[0] = 1;
+  pages[3 * page_size] = 1;
+  pages[4 * page_size + 5] = 1;
+  pages[10 * page_size] = 1;
+  REQUIRE(collect_writes());
+  REQUIRE(written == std::vector<std::pair<size_t, size_t>>{
+                         {3 * page_size, 2 * page_size},
+                         {10 * page_size, page_size}});
+  // The collected pages are watched again.
+  REQUIRE(collect_writes());
+  REQUIRE(written.empty());
+  pages[10 * page_size] = 2;
+  REQUIRE(collect_writes());
+  REQUIRE(written == std::vector<std::pair<size_t, size_t>>{
+                         {10 * page_size, page_size}});
+
+  xe::memory::UnmapFileView(memory, pages, length);
+  xe::memory::CloseFileMappingHandle(memory, path);
+}
+
+struct ProtectedPages {
+  uint8_t* pages;
+  size_t length;
+};
+
+static bool UnprotectWrittenPage(Exception* ex, void* data) {
+  auto& protected_pages = *static_cast<ProtectedPages*>(data);
+  auto address = reinterpret_cast<uint8_t*>(ex->fault_address());
+  if (ex->code() != Exception::Code::kAccessViolation ||
+      address < protected_pages.pages ||
+      address >= protected_pages.pages + protected_pages.length) {
+    return false;
+  }
+  size_t page_size = xe::memory::page_size();
+  xe::memory::Protect(
+      protected_pages.pages +
+          (address - protected_pages.pages) / page_size * page_size,
+      page_size, xe::memory::PageAccess::kReadWrite);
+  return true;
+}
+
+// Compares watching pages with protection and an access violation on each
+// first write, like physical memory watched by the GPU by default, to
+// collecting the writes with a write tracker.
+XE_BENCHMARK_CASE("write_tracker_vs_protect") {
+  const size_t page_size = xe::memory::page_size();
+  const size_t page_count = 4096;
+  const size_t length = page_count * page_size;
+  const int kIterations = 100;
+  auto path = fmt::format("xenia_test_{}", Clock::QueryHostTickCount());
+  auto memory = xe::memory::CreateFileMappingHandle(
+      path, length, xe::memory::PageAccess::kReadWrite, true);
+  REQUIRE(memory != xe::memory::kFileMappingHandleInvalid);
+  auto pages = static_cast<uint8_t*>(xe::memory::MapFileView(
+      memory, nullptr, length, xe::memory::PageAccess::kReadWrite, 0));
+  REQUIRE(pages);
+  std::memset(pages, 0, length);
+
+  ProtectedPages protected_pages = {pages, length};
+  ExceptionHandler::Install(UnprotectWrittenPage, &protected_pages);
+  double protect_ns = MeasureNanoseconds(kIterations * page_count, [&]() {
+    for (int i = 0; i < kIterations; ++i) {
+      xe::memory::Protect(pages, length, xe::memory::PageAccess::kReadOnly);
+      for (size_t page = 0; page < page_count; ++page) {
+        ++pages[page * page_size];
+      }
+    }
+  });
+  ExceptionHandler::Uninstall(UnprotectWrittenPage, &protected_pages);
+  ReportBenchmark("protection", protect_ns, "ns per written page");
+
+  auto write_tracker = xe::memory::WriteTracker::Create();
+  if (write_tracker) {
+    size_t written_length = 0;
+    REQUIRE(write_tracker->Watch(pages, length));
+    double write_tracker_ns =
+        MeasureNanoseconds(kIterations * page_count, [&]() {
+          for (int i = 0; i < kIterations; ++i) {
+            for (size_t page = 0; page < page_count; ++page) {
+              ++pages[page * page_size];
+            }
+            write_tracker->CollectWrites(
+                pages, length, [&](void* base_address, size_t length) {
+                  written_length += length;
+                });
+          }
+        });
+    REQUIRE(written_length == kIterations * length);
+    ReportBenchmark("write tracker", write_tracker_ns, "ns per written page");
+  }
+
+  xe::memory::UnmapFileView(memory, pages, length);
+  xe::memory::CloseFileMappingHandle(memory, path);
+}
+
 TEST_CASE("make_fourcc", "[fourcc]") {
   SECTION("'1234'") {
     const uint32_t fourcc_host = 0x31323334;
@@ -8,6 +8,10 @@
 */
 
 #include <array>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include "xenia/base/threading.h"
 
@@ -15,6 +19,7 @@
 #include "third_party/catch/include/catch.hpp"
 
 #include "third_party/disruptorplus/include/disruptorplus/spin_wait.hpp"
+#include "xenia/base/testing/benchmark.h"
 
 namespace xe {
 namespace base {
@@ -475,6 +480,79 @@ TEST_CASE("Wait on Multiple Events", "[event]") {
   REQUIRE(order[3] == '3');
 }
 
+// Auto-reset event where all objects share one condition variable and mutex,
+// like the POSIX primitives used to, so that every signal wakes every waiter.
+class GlobalConditionEvent {
+ public:
+  void Set() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    signaled_ = true;
+    cond_.notify_all();
+  }
+  void Wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this] { return signaled_; });
+    signaled_ = false;
+  }
+
+ private:
+  static std::condition_variable cond_;
+  static std::mutex mutex_;
+  bool signaled_ = false;
+};
+std::condition_variable GlobalConditionEvent::cond_;
+std::mutex GlobalConditionEvent::mutex_;
+
+class ThreadingEvent {
+ public:
+  void Set() { event_->Set(); }
+  void Wait() { threading::Wait(event_.get(), false); }
+
+ private:
+  std::unique_ptr<Event> event_ = Event::CreateAutoResetEvent(false);
+};
+
+// Passes a token back and forth between the threads of each pair, with all
+// pairs running at the same time, and returns the time of a round trip.
+template <typename T>
+static double MeasurePingPong(size_t pair_count) {
+  constexpr size_t kRoundTrips = 20000;
+  std::vector<T> pings(pair_count);
+  std::vector<T> pongs(pair_count);
+  return MeasureNanoseconds(kRoundTrips, [&]() {
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < pair_count; ++i) {
+      threads.emplace_back([&pings, &pongs, i] {
+        for (size_t j = 0; j < kRoundTrips; ++j) {
+          pings[i].Wait();
+          pongs[i].Set();
+        }
+      });
+      threads.emplace_back([&pings, &pongs, i] {
+        for (size_t j = 0; j < kRoundTrips; ++j) {
+          pings[i].Set();
+          pongs[i].Wait();
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  });
+}
+
+XE_BENCHMARK_CASE("Contended event ping-pong") {
+  for (size_t pair_count : {1, 4, 16}) {
+    ReportBenchmark(
+        fmt::format("{} thread pairs, global condition variable", pair_count),
+        MeasurePingPong<GlobalConditionEvent>(pair_count),
+        "ns per round trip");
+    ReportBenchmark(fmt::format("{} thread pairs, Event", pair_count),
+                    MeasurePingPong<ThreadingEvent>(pair_count),
+                    "ns per round trip");
+  }
+}
+
 TEST_CASE("Wait on Semaphore", "[semaphore]") {
   WaitResult result;
   std::unique_ptr<Semaphore> sem;
@@ -14,6 +14,7 @@
 #include "xenia/base/platform.h"
 #include "xenia/base/threading_timer_queue.h"
 
+#include <linux/futex.h>
 #include <pthread.h>
 #include <sched.h>
 #include <signal.h>
@@ -22,7 +23,9 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <cstddef>
 #include <ctime>
 #include <memory>
@@ -190,99 +193,211 @@ bool SetTlsValue(TlsHandle handle, uintptr_t value) {
                              reinterpret_cast<void*>(value)) == 0;
 }
 
+// Wait queue entry of a thread waiting on one or more objects. Signaling an
+// object only wakes the threads registered on it, which sleep on a futex
+// rather than on a condition variable shared by all objects.
+class PosixWaiter {
+ public:
+  uint32_t wake_count() const {
+    return wake_count_.load(std::memory_order_acquire);
+  }
+
+  // Called with the lock of the signaled object held, so the waiter can't
+  // unregister and go away before it returns.
+  void Wake() {
+    wake_count_.fetch_add(1, std::memory_order_release);
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&wake_count_),
+            FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+  }
+
+  // Sleeps until Wake is called after wake_count() returned seen_wake_count,
+  // or until the deadline. May return early.
+  void Sleep(uint32_t seen_wake_count,
+             std::chrono::steady_clock::time_point deadline) {
+    timespec timeout;
+    timespec* timeout_ptr = nullptr;
+    if (deadline != std::chrono::steady_clock::time_point::max()) {
+      auto remaining = std::max(deadline - std::chrono::steady_clock::now(),
+                                std::chrono::steady_clock::duration::zero());
+      auto seconds = std::chrono::duration_cast<std::chrono::seconds>(remaining);
+      timeout.tv_sec = static_cast<time_t>(seconds.count());
+      timeout.tv_nsec = static_cast<long>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(remaining -
+                                                               seconds)
+              .count());
+      timeout_ptr = &timeout;
+    }
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&wake_count_),
+            FUTEX_WAIT_PRIVATE, seen_wake_count, timeout_ptr, nullptr, 0);
+  }
+
+ private:
+  std::atomic<uint32_t> wake_count_{0};
+};
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+              "Futex words must be plain 32-bit integers");
+
 class PosixConditionBase {
  public:
   virtual bool Signal() = 0;
 
   WaitResult Wait(std::chrono::milliseconds timeout) {
-    bool executed;
-    auto predicate = [this] { return this->signaled(); };
-    auto lock = std::unique_lock<std::mutex>(mutex_);
-    if (predicate()) {
-      executed = true;
-    } else {
-      if (timeout == std::chrono::milliseconds::max()) {
-        cond_.wait(lock, predicate);
-        executed = true;  // Did not time out;
-      } else {
-        executed = cond_.wait_for(lock, timeout, predicate);
-      }
-    }
-    if (executed) {
+    auto deadline = GetDeadline(timeout);
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (signaled()) {
       post_execution();
       return WaitResult::kSuccess;
-    } else {
+    }
+    if (timeout == std::chrono::milliseconds::zero()) {
       return WaitResult::kTimeout;
     }
+    PosixWaiter waiter;
+    waiters_.push_back(&waiter);
+    WaitResult result;
+    for (;;) {
+      // A signal between here and the sleep changes the wake count, so the
+      // sleep returns immediately.
+      uint32_t seen_wake_count = waiter.wake_count();
+      lock.unlock();
+      waiter.Sleep(seen_wake_count, deadline);
+      lock.lock();
+      if (signaled()) {
+        post_execution();
+        result = WaitResult::kSuccess;
+        break;
+      }
+      if (std::chrono::steady_clock::now() >= deadline) {
+        result = WaitResult::kTimeout;
+        break;
+      }
+    }
+    RemoveWaiter(&waiter);
+    return result;
   }
 
   static std::pair<WaitResult, size_t> WaitMultiple(
       std::vector<PosixConditionBase*>&& handles, bool wait_all,
       std::chrono::milliseconds timeout) {
     assert_true(handles.size() > 0);
+    auto deadline = GetDeadline(timeout);
+
+    // Objects are locked in address order, and only once if they're passed
+    // multiple times.
+    std::vector<PosixConditionBase*> unique_handles(handles);
+    std::sort(unique_handles.begin(), unique_handles.end());
+    unique_handles.erase(
+        std::unique(unique_handles.begin(), unique_handles.end()),
+        unique_handles.end());
+
+    PosixWaiter waiter;
+    bool registered = false;
+    std::pair<WaitResult, size_t> result;
+    for (;;) {
+      uint32_t seen_wake_count = waiter.wake_count();
+      if (TryAcquireMultiple(handles, unique_handles, wait_all, result)) {
+        break;
+      }
+      if (std::chrono::steady_clock::now() >= deadline) {
+        result = std::make_pair<WaitResult, size_t>(WaitResult::kTimeout, 0);
+        break;
+      }
+      if (!registered) {
+        // Registered after the first attempt so that waits which succeed
+        // immediately don't touch the queues. Signals in between are caught
+        // by the next attempt.
+        for (auto handle : unique_handles) {
+          std::lock_guard<std::mutex> lock(handle->mutex_);
+          handle->waiters_.push_back(&waiter);
+        }
+        registered = true;
+        continue;
+      }
+      waiter.Sleep(seen_wake_count, deadline);
+    }
+    if (registered) {
+      for (auto handle : unique_handles) {
+        std::lock_guard<std::mutex> lock(handle->mutex_);
+        handle->RemoveWaiter(&waiter);
+      }
+    }
+    return result;
+  }
 
-    // Construct a condition for all or any depending on wait_all
-    std::function<bool()> predicate;
-    {
-      using iter_t = std::vector<PosixConditionBase*>::const_iterator;
-      const auto predicate_inner = [](auto h) { return h->signaled(); };
-      const auto operation =
-          wait_all ? std::all_of<iter_t, decltype(predicate_inner)>
-                   : std::any_of<iter_t, decltype(predicate_inner)>;
-      predicate = [&handles, operation, predicate_inner] {
-        return operation(handles.cbegin(), handles.cend(), predicate_inner);
-      };
+  virtual void* native_handle() const {
+    return const_cast<PosixConditionBase*>(this);
+  }
+
+ protected:
+  inline virtual bool signaled() const = 0;
+  inline virtual void post_execution() = 0;
+
+  // Must be called with mutex_ held after the object becomes signaled.
+  void WakeWaiters() {
+    for (PosixWaiter* waiter : waiters_) {
+      waiter->Wake();
     }
+  }
 
-    // TODO(bwrsandman, Triang3l) This is controversial, see issue #1677
-    // This will probably cause a deadlock on the next thread doing any waiting
-    // if the thread is suspended between locking and waiting
-    std::unique_lock<std::mutex> lock(PosixConditionBase::mutex_);
+  mutable std::mutex mutex_;
 
-    bool wait_success = true;
-    // If the timeout is infinite, wait without timeout.
-    // The predicate will be checked before beginning the wait
+ private:
+  static std::chrono::steady_clock::time_point GetDeadline(
+      std::chrono::milliseconds timeout) {
     if (timeout == std::chrono::milliseconds::max()) {
-      PosixConditionBase::cond_.wait(lock, predicate);
-    } else {
-      // Wait with timeout.
-      wait_success =
-          PosixConditionBase::cond_.wait_for(lock, timeout, predicate);
+      return std::chrono::steady_clock::time_point::max();
     }
-    if (wait_success) {
-      auto first_signaled = std::numeric_limits<size_t>::max();
-      for (auto i = 0u; i < handles.size(); ++i) {
+    return std::chrono::steady_clock::now() + timeout;
+  }
+
+  void RemoveWaiter(PosixWaiter* waiter) {
+    auto it = std::find(waiters_.begin(), waiters_.end(), waiter);
+    assert_true(it != waiters_.end());
+    *it = waiters_.back();
+    waiters_.pop_back();
+  }
+
+  // Locks the objects, and acquires either any or all of them.
+  static bool TryAcquireMultiple(
+      const std::vector<PosixConditionBase*>& handles,
+      const std::vector<PosixConditionBase*>& unique_handles, bool wait_all,
+      std::pair<WaitResult, size_t>& result) {
+    if (!wait_all) {
+      for (size_t i = 0; i < handles.size(); ++i) {
+        std::lock_guard<std::mutex> lock(handles[i]->mutex_);
         if (handles[i]->signaled()) {
-          if (first_signaled > i) {
-            first_signaled = i;
-          }
           handles[i]->post_execution();
-          if (!wait_all) break;
+          result = std::make_pair(WaitResult::kSuccess, i);
+          return true;
         }
       }
-      assert_true(std::numeric_limits<size_t>::max() != first_signaled);
-      return std::make_pair(WaitResult::kSuccess, first_signaled);
-    } else {
-      return std::make_pair<WaitResult, size_t>(WaitResult::kTimeout, 0);
+      return false;
+    }
+    for (auto handle : unique_handles) {
+      handle->mutex_.lock();
+    }
+    bool all_signaled =
+        std::all_of(unique_handles.cbegin(), unique_handles.cend(),
+                    [](auto handle) { return handle->signaled(); });
+    if (all_signaled) {
+      for (auto handle : unique_handles) {
+        handle->post_execution();
+      }
+      result = std::make_pair<WaitResult, size_t>(WaitResult::kSuccess, 0);
     }
+    for (auto handle : unique_handles) {
+      handle->mutex_.unlock();
+    }
+    return all_signaled;
   }
 
-  virtual void* native_handle() const { return cond_.native_handle(); }
-
- protected:
-  inline virtual bool signaled() const = 0;
-  inline virtual void post_execution() = 0;
-  static std::condition_variable cond_;
-  static std::mutex mutex_;
+  // Threads waiting on the object, protected by mutex_.
+  std::vector<PosixWaiter*> waiters_;
 };
 
-std::condition_variable PosixConditionBase::cond_;
-std::mutex PosixConditionBase::mutex_;
-
 // There really is no native POSIX handle for a single wait/signal construct
 // pthreads is at a lower level with more handles for such a mechanism.
-// This simple wrapper class functions as our handle and uses conditional
-// variables for waits and signals.
+// This simple wrapper class functions as our handle and keeps a queue of the
+// threads waiting on it, which are woken when it's signaled.
 template <typename T>
 class PosixCondition {};
 
@@ -296,7 +411,7 @@ class PosixCondition<Event> : public PosixConditionBase {
   bool Signal() override {
     auto lock = std::unique_lock<std::mutex>(mutex_);
     signal_ = true;
-    cond_.notify_all();
+    WakeWaiters();
     return true;
   }
 
@@ -325,11 +440,11 @@ class PosixCondition<Semaphore> : public PosixConditionBase {
   bool Signal() override { return Release(1, nullptr); }
 
   bool Release(uint32_t release_count, int* out_previous_count) {
+    auto lock = std::unique_lock<std::mutex>(mutex_);
     if (maximum_count_ - count_ >= release_count) {
-      auto lock = std::unique_lock<std::mutex>(mutex_);
       if (out_previous_count) *out_previous_count = count_;
       count_ += release_count;
-      cond_.notify_all();
+      WakeWaiters();
       return true;
     }
     return false;
@@ -337,10 +452,7 @@ class PosixCondition<Semaphore> : public PosixConditionBase {
 
  private:
   inline bool signaled() const override { return count_ > 0; }
-  inline void post_execution() override {
-    count_--;
-    cond_.notify_all();
-  }
+  inline void post_execution() override { count_--; }
   uint32_t count_;
   const uint32_t maximum_count_;
 };
@@ -363,7 +475,7 @@ class PosixCondition<Mutant> : public PosixConditionBase {
       --count_;
       // Free to be acquired by another thread
       if (count_ == 0) {
-        cond_.notify_all();
+        WakeWaiters();
       }
       return true;
     }
@@ -395,7 +507,7 @@ class PosixCondition<Timer> : public PosixConditionBase {
   bool Signal() override {
     std::lock_guard<std::mutex> lock(mutex_);
     signal_ = true;
-    cond_.notify_all();
+    WakeWaiters();
     return true;
   }
 
@@ -739,7 +851,7 @@ class PosixCondition<Thread> : public PosixConditionBase {
 
       exit_code_ = exit_code;
       signaled_ = true;
-      cond_.notify_all();
+      WakeWaiters();
     }
     if (is_current_thread) {
       pthread_exit(reinterpret_cast<void*>(exit_code));
@@ -1110,10 +1222,10 @@ void* PosixCondition<Thread>::ThreadStartRoutine(void* parameter) {
     thread->handle_.state_ = State::kFinished;
   }
 
-  std::unique_lock<std::mutex> lock(mutex_);
+  std::unique_lock<std::mutex> lock(thread->handle_.mutex_);
   thread->handle_.exit_code_ = 0;
   thread->handle_.signaled_ = true;
-  cond_.notify_all();
+  thread->handle_.WakeWaiters();
 
   current_thread_ = nullptr;
   return nullptr;
@@ -10,6 +10,7 @@
 #ifndef XENIA_CPU_BACKEND_BACKEND_H_
 #define XENIA_CPU_BACKEND_BACKEND_H_
 
+#include <filesystem>
 #include <memory>
 
 #include "xenia/cpu/backend/machine_info.h"
@@ -85,9 +86,6 @@ class Backend {
   to calling XThread::Reenter this is an opportunity for a backend to clear any
   data related to the guest stack
 
-        in the case of the X64 backend, it means we reset the stackpoint index
-  to 0, since its a new stack and all of our old entries are invalid now
-
   * */
   virtual void PrepareForReentry(void* ctx) {}
 
@@ -95,6 +93,33 @@ class Backend {
   virtual bool PopulatePseudoStacktrace(GuestPseudoStackTrace* st) {
     return false;
   }
+
+  // Walks the guest frames of the calling thread, starting at the interrupted
+  // host PC and stack pointer, and writes the host PC of each frame, innermost
+  // first. Stops at the first non-guest frame. Must be safe to call from a
+  // signal handler. Returns the number of frames captured.
+  virtual size_t CaptureGuestFrames(uint64_t host_pc, uint64_t host_sp,
+                                    uint64_t* frame_host_pcs,
+                                    size_t frame_count) {
+    return 0;
+  }
+
+  // Writes the machine code of all persistable functions defined in the given
+  // module to a file, so it can be restored by LoadPersistentCode on a later
+  // run with the same configuration_hash instead of being retranslated.
+  virtual bool SavePersistentCode(Module* module,
+                                  const std::filesystem::path& path,
+                                  uint64_t configuration_hash) {
+    return false;
+  }
+  // Defines the functions stored in the file in the given module. Must be
+  // called before any guest code of the module has been translated.
+  virtual bool LoadPersistentCode(Module* module,
+                                  const std::filesystem::path& path,
+                                  uint64_t configuration_hash) {
+    return false;
+  }
+
  protected:
   Processor* processor_ = nullptr;
   MachineInfo machine_info_;
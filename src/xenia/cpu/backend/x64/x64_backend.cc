@@ -14,8 +14,11 @@
 #include "third_party/capstone/include/capstone/capstone.h"
 #include "third_party/capstone/include/capstone/x86.h"
 
+#include "build/version.h"
 #include "xenia/base/exception_handler.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/platform_amd64.h"
+#include "xenia/base/xxhash.h"
 #include "xenia/cpu/backend/x64/x64_assembler.h"
 #include "xenia/cpu/backend/x64/x64_code_cache.h"
 #include "xenia/cpu/backend/x64/x64_emitter.h"
@@ -23,6 +26,7 @@
 #include "xenia/cpu/backend/x64/x64_sequences.h"
 #include "xenia/cpu/backend/x64/x64_stack_layout.h"
 #include "xenia/cpu/breakpoint.h"
+#include "xenia/cpu/mmio_handler.h"
 #include "xenia/cpu/processor.h"
 #include "xenia/cpu/stack_walker.h"
 #include "xenia/cpu/xex_module.h"
@@ -33,18 +37,33 @@ DEFINE_bool(record_mmio_access_exceptions, true,
             "instruct the recompiler to emit checks",
             "x64");
 
-DEFINE_int64(max_stackpoints, 65536,
-             "Max number of host->guest stack mappings we can record.", "x64");
-
 DEFINE_bool(enable_host_guest_stack_synchronization, true,
-            "Records entries for guest/host stack mappings at function starts "
-            "and checks for reentry at return sites. Has slight performance "
+            "Checks for reentry at return sites, and unwinds the host stack to "
+            "the frame of the function returned to. Has slight performance "
             "impact, but fixes crashes in games that use setjmp/longjmp.",
             "x64");
 #if XE_X64_PROFILER_AVAILABLE == 1
 DECLARE_bool(instrument_call_times);
 #endif
 
+DECLARE_bool(emit_source_annotations);
+DECLARE_bool(enable_incorrect_roundingmode_behavior);
+DECLARE_uint32(align_all_basic_blocks);
+DECLARE_bool(split_cold_blocks);
+DECLARE_bool(cold_block_profiling);
+DECLARE_bool(elide_e0_check);
+DECLARE_bool(enable_rmw_context_merging);
+DECLARE_bool(emit_mmio_aware_stores_for_recorded_exception_addresses);
+DECLARE_bool(xop_rotates);
+DECLARE_bool(xop_left_shifts);
+DECLARE_bool(xop_right_shifts);
+DECLARE_bool(xop_arithmetic_right_shifts);
+DECLARE_bool(xop_compares);
+DECLARE_bool(use_fast_dot_product);
+DECLARE_bool(no_round_to_single);
+DECLARE_bool(inline_loadclock);
+DECLARE_bool(delay_via_maybeyield);
+
 namespace xe {
 namespace cpu {
 namespace backend {
@@ -233,6 +252,7 @@ bool X64Backend::Initialize(Processor* processor) {
       thunk_emitter.EmitTryAcquireReservationHelper();
   reserved_store_32_helper = thunk_emitter.EmitReservedStoreHelper(false);
   reserved_store_64_helper = thunk_emitter.EmitReservedStoreHelper(true);
+  code_cache_->MarkHelperCodeEnd();
 
   // Set the code cache to use the ResolveFunction thunk for default
   // indirections.
@@ -284,6 +304,81 @@ std::unique_ptr<GuestFunction> X64Backend::CreateGuestFunction(
   return std::make_unique<X64Function>(module, address);
 }
 
+uint64_t X64Backend::ComputeConfigurationHash(
+    uint64_t frontend_configuration_hash) const {
+  // Host addresses of helper functions are covered by the code cache hashing
+  // the helper thunks, everything else baked into generated code is here.
+  const uint64_t values[] = {
+      frontend_configuration_hash,
+      XXH3_64bits(XE_BUILD_COMMIT, sizeof(XE_BUILD_COMMIT) - 1),
+      reinterpret_cast<uint64_t>(processor()->memory()->virtual_membase()),
+      uint64_t(emitter_data_),
+      amd64::GetFeatureFlags(),
+      uint64_t(cvars::x64_extension_mask),
+      cvars::enable_host_guest_stack_synchronization,
+      cvars::record_mmio_access_exceptions,
+      cvars::emit_source_annotations,
+      cvars::enable_incorrect_roundingmode_behavior,
+      cvars::align_all_basic_blocks,
+      cvars::split_cold_blocks,
+      cvars::cold_block_profiling,
+      cvars::elide_e0_check,
+      cvars::enable_rmw_context_merging,
+      cvars::emit_mmio_aware_stores_for_recorded_exception_addresses,
+      cvars::xop_rotates,
+      cvars::xop_left_shifts,
+      cvars::xop_right_shifts,
+      cvars::xop_arithmetic_right_shifts,
+      cvars::xop_compares,
+      cvars::use_fast_dot_product,
+      cvars::no_round_to_single,
+      cvars::inline_loadclock,
+      cvars::delay_via_maybeyield,
+  };
+  return XXH3_64bits(values, sizeof(values));
+}
+
+bool X64Backend::SavePersistentCode(Module* module,
+                                    const std::filesystem::path& path,
+                                    uint64_t configuration_hash) {
+  return code_cache_->SavePersistentCode(
+      path, ComputeConfigurationHash(configuration_hash),
+      [module](GuestFunction* function) {
+        return function->module() == module &&
+               function->status() == Symbol::Status::kDefined;
+      });
+}
+
+bool X64Backend::LoadPersistentCode(Module* module,
+                                    const std::filesystem::path& path,
+                                    uint64_t configuration_hash) {
+  auto definer = [this, module](
+                     const X64CodeCache::PersistentFunctionInfo& info,
+                     uint8_t* machine_code,
+                     std::vector<SourceMapEntry> source_map) -> GuestFunction* {
+    if (!module->ContainsAddress(info.guest_address)) {
+      return nullptr;
+    }
+    auto function = processor()->LookupFunction(module, info.guest_address);
+    if (!function || !function->is_guest() ||
+        module->DefineFunction(function) != Symbol::Status::kNew) {
+      return nullptr;
+    }
+    auto guest_function = static_cast<X64Function*>(function);
+    guest_function->set_end_address(info.guest_end_address);
+    guest_function->source_map() = std::move(source_map);
+    guest_function->Setup(machine_code, info.func_info.code_size.total);
+    guest_function->set_persistable(true);
+    guest_function->set_frame_layout(
+        uint32_t(info.func_info.stack_size),
+        uint32_t(info.func_info.prolog_stack_alloc_offset));
+    guest_function->set_status(Symbol::Status::kDefined);
+    return guest_function;
+  };
+  return code_cache_->LoadPersistentCode(
+      path, ComputeConfigurationHash(configuration_hash), definer);
+}
+
 uint64_t ReadCapstoneReg(HostThreadContext* context, x86_reg reg) {
   switch (reg) {
     case X86_REG_RAX:
@@ -682,7 +777,8 @@ GuestToHostThunk X64HelperEmitter::EmitGuestToHostThunk() {
 }
 
 // X64Emitter handles actually resolving functions.
-uint64_t ResolveFunction(void* raw_context, uint64_t target_address);
+uint64_t ResolveFunctionFromGuest(void* raw_context, uint64_t target_address,
+                                  uint64_t host_sp);
 
 ResolveFunctionThunk X64HelperEmitter::EmitResolveFunctionThunk() {
   // ebx = target PPC address
@@ -705,7 +801,9 @@ ResolveFunctionThunk X64HelperEmitter::EmitResolveFunctionThunk() {
 
   mov(rcx, rsi);  // context
   mov(rdx, rbx);
-  mov(rax, reinterpret_cast<uint64_t>(&ResolveFunction));
+  lea(r8, ptr[rsp + stack_size]);  // return address of the guest call
+  MovHostAddress(rax,
+                 reinterpret_cast<const void*>(&ResolveFunctionFromGuest));
   call(rax);
 
   EmitLoadVolatileRegs();
@@ -731,112 +829,68 @@ ResolveFunctionThunk X64HelperEmitter::EmitResolveFunctionThunk() {
   void* fn = Emplace(func_info);
   return (ResolveFunctionThunk)fn;
 }
+
+// Returns the stack pointer to continue the function at the return site with,
+// or 0 if the stack can't be synchronized.
+static uint64_t SynchronizeGuestAndHostStack(void* raw_context,
+                                             uint64_t return_site,
+                                             uint64_t host_sp,
+                                             uint64_t stack_size) {
+  auto guest_context = reinterpret_cast<ppc::PPCContext*>(raw_context);
+  auto backend = static_cast<X64Backend*>(
+      guest_context->thread_state->processor()->backend());
+  auto function = static_cast<X64Function*>(
+      backend->code_cache()->LookupFunction(return_site));
+  if (!function || function->stack_size() != stack_size) {
+    return 0;
+  }
+  X64Function* frame_function = nullptr;
+  uint64_t frame_sp = backend->FindGuestFrameStack(
+      function->address(), static_cast<uint32_t>(guest_context->r[1]),
+      host_sp, &frame_function);
+  return frame_function == function ? frame_sp : 0;
+}
+
 // r11 = size of callers stack, r8 = return address w/ adjustment
-// i'm not proud of this code, but it shouldn't be executed frequently at all
+// rsp points at the return address of the guest call that got us to the return
+// site, which ResolveFunctionFromGuest only allows if the function returned to
+// is further up the stack. Walking the frames only happens here, so normal
+// calls don't have to record anything.
 void* X64HelperEmitter::EmitGuestAndHostSynchronizeStackHelper() {
   _code_offsets code_offsets = {};
-  code_offsets.prolog = getSize();
-  push(rbx);
-  mov(rbx, GetBackendCtxPtr(offsetof(X64BackendContext, stackpoints)));
-  mov(eax,
-      GetBackendCtxPtr(offsetof(X64BackendContext, current_stackpoint_depth)));
 
-  lea(ecx, ptr[eax - 1]);
-  mov(r9d, ptr[GetContextReg() + offsetof(ppc::PPCContext, r[1])]);
-
-  Xbyak::Label looper{};
-  Xbyak::Label loopout{};
-  Xbyak::Label signed_underflow{};
-  xor_(r12d, r12d);
-
-  // todo: should use Loop instruction here if hasFastLoop,
-  // currently xbyak does not support it but its super easy to modify xbyak to
-  //  have it
-  L(looper);
-  imul(edx, ecx, sizeof(X64BackendStackpoint));
-  mov(r10d, ptr[rbx + rdx + offsetof(X64BackendStackpoint, guest_stack_)]);
-
-  cmp(r10d, r9d);
+  // rsp is misaligned, so this realigns it for the volatile register saves.
+  const size_t stack_size = StackLayout::THUNK_STACK_SIZE;
 
-  jge(loopout, T_NEAR);
+  code_offsets.prolog = getSize();
+  sub(rsp, stack_size);
+  code_offsets.prolog_stack_alloc = getSize();
+  code_offsets.body = getSize();
 
-  inc(r12d);
+  EmitSaveVolatileRegs();
 
-  if (IsFeatureEnabled(kX64FlagsIndependentVars)) {
-    dec(ecx);
-  } else {
-    sub(ecx, 1);
-  }
-  js(signed_underflow, T_NEAR);  // should be impossible!!
-
-  jmp(looper, T_NEAR);
-  L(loopout);
-  Xbyak::Label skip_adjust{};
-  cmp(r12d, 1);  // should never happen?
-  jle(skip_adjust, T_NEAR);
-  Xbyak::Label we_good{};
-
-  // now we need to make sure that the return address matches
-
-  // mov(r9d, ptr[GetContextReg() + offsetof(ppc::PPCContext, lr)]);
-  pop(r9);  // guest retaddr
-  // r10d = the guest_stack
-  // while guest_stack is equal and return address is not equal, decrement
-
-  Xbyak::Label search_for_retaddr{};
-  Xbyak::Label we_good_but_increment{};
-  L(search_for_retaddr);
-
-  imul(edx, ecx, sizeof(X64BackendStackpoint));
-
-  cmp(r10d, ptr[rbx + rdx + offsetof(X64BackendStackpoint, guest_stack_)]);
-
-  jnz(we_good_but_increment, T_NEAR);
-
-  cmp(r9d,
-      ptr[rbx + rdx + offsetof(X64BackendStackpoint, guest_return_address_)]);
-  jz(we_good, T_NEAR);  // stack is equal, return address is equal, we've got
-                        // our destination stack
-  dec(ecx);
-  jmp(search_for_retaddr, T_NEAR);
-  Xbyak::Label checkbp{};
-
-  L(we_good_but_increment);
-  add(edx, sizeof(X64BackendStackpoint));
-  inc(ecx);
-  jmp(checkbp, T_NEAR);
-  L(we_good);
-  // we're popping this return address, so go down by one
-  sub(edx, sizeof(X64BackendStackpoint));
-  dec(ecx);
-  L(checkbp);
-  mov(rsp, ptr[rbx + rdx + offsetof(X64BackendStackpoint, host_stack_)]);
-  if (IsFeatureEnabled(kX64FlagsIndependentVars)) {
-    inc(ecx);
-  } else {
-    add(ecx, 1);
-  }
+  mov(rcx, GetContextReg());
+  mov(rdx, r8);
+  lea(r8, ptr[rsp + stack_size]);
+  mov(r9, r11);
+  MovHostAddress(rax,
+                 reinterpret_cast<const void*>(&SynchronizeGuestAndHostStack));
+  call(rax);
 
-  sub(rsp, r11);  // adjust stack
+  EmitLoadVolatileRegs();
 
-  mov(GetBackendCtxPtr(offsetof(X64BackendContext, current_stackpoint_depth)),
-      ecx);  // set next stackpoint index to be after the one we restored to
-  jmp(r8);
-  L(skip_adjust);
-  pop(rbx);
-  jmp(r8);  // return to caller
-  code_offsets.prolog_stack_alloc = getSize();
-  code_offsets.body = getSize();
   code_offsets.epilog = getSize();
-  code_offsets.tail = getSize();
+  add(rsp, stack_size);
 
-  L(signed_underflow);
-  // find a good, compact way to signal error here
-  //  maybe an invalid opcode that we execute, then detect in an exception
-  // handler?
+  Xbyak::Label not_found;
+  test(rax, rax);
+  jz(not_found);
+  mov(rsp, rax);
+  L(not_found);
+  jmp(r8);
 
-  this->DebugBreak();
-  return EmitCurrentForOffsets(code_offsets);
+  code_offsets.tail = getSize();
+  return EmitCurrentForOffsets(code_offsets, stack_size);
 }
 
 void* X64HelperEmitter::EmitGuestAndHostSynchronizeStackSizeLoadThunk(
@@ -1086,16 +1140,6 @@ void X64Backend::InitializeBackendContext(void* ctx) {
       DEFAULT_FPU_MXCSR;  // idk if this is right, check on rgh what the
                           // rounding on ppc is at startup
 
-  /*
-          todo: stackpoint arrays should be pooled virtual memory at the very
-     least there may be some fancy virtual address tricks we can do here
-
-  */
-
-  bctx->stackpoints = cvars::enable_host_guest_stack_synchronization
-                          ? new X64BackendStackpoint[cvars::max_stackpoints]
-                          : nullptr;
-  bctx->current_stackpoint_depth = 0;
   bctx->mxcsr_vmx = DEFAULT_VMX_MXCSR;
   bctx->flags = 0;
   // https://media.discordapp.net/attachments/440280035056943104/1000765256643125308/unknown.png
@@ -1103,21 +1147,6 @@ void X64Backend::InitializeBackendContext(void* ctx) {
   bctx->guest_tick_count = Clock::GetGuestTickCountPointer();
   bctx->reserve_helper_ = &reserve_helper_;
 }
-void X64Backend::DeinitializeBackendContext(void* ctx) {
-  X64BackendContext* bctx = BackendContextForGuestContext(ctx);
-
-  if (bctx->stackpoints) {
-    delete[] bctx->stackpoints;
-    bctx->stackpoints = nullptr;
-  }
-}
-
-void X64Backend::PrepareForReentry(void* ctx) {
-  X64BackendContext* bctx = BackendContextForGuestContext(ctx);
-
-  bctx->current_stackpoint_depth = 0;
-}
-
 const uint32_t mxcsr_table[8] = {
     0x1F80, 0x7F80, 0x5F80, 0x3F80, 0x9F80, 0xFF80, 0xDF80, 0xBF80,
 };
@@ -1132,37 +1161,133 @@ void X64Backend::SetGuestRoundingMode(void* ctx, unsigned int mode) {
 }
 
 bool X64Backend::PopulatePseudoStacktrace(GuestPseudoStackTrace* st) {
-  if (!cvars::enable_host_guest_stack_synchronization) {
+  // Host code only knows where the guest frames below it start while handling
+  // an MMIO access made by guest code.
+  const HostThreadContext* access_context =
+      MMIOHandler::current_access_context();
+  if (!access_context) {
     return false;
   }
-
-  ThreadState* thrd_state = ThreadState::Get();
-  if (!thrd_state) {
-    return false;  // we're not a guest!
+  uint64_t host_pc = access_context->rip;
+  uint64_t host_sp = access_context->rsp;
+  uint32_t count = 0;
+  bool truncated = false;
+  for (bool interrupted = true;; interrupted = false) {
+    auto function =
+        static_cast<X64Function*>(code_cache_->LookupFunction(host_pc));
+    if (!function || !function->machine_code()) {
+      break;
+    }
+    uint64_t frame_sp = host_sp;
+    if (!UnwindGuestFrame(function, interrupted, host_pc, host_sp)) {
+      break;
+    }
+    if (host_sp == frame_sp + 8) {
+      // Interrupted outside of the allocated frame, which holds the guest
+      // return address.
+      continue;
+    }
+    if (count == MAX_GUEST_PSEUDO_STACKTRACE_ENTRIES) {
+      truncated = true;
+      break;
+    }
+    st->return_addrs[count++] = *reinterpret_cast<const uint32_t*>(
+        frame_sp + StackLayout::GUEST_RET_ADDR);
   }
-  ppc::PPCContext* ctx = thrd_state->context();
-
-  X64BackendContext* backend_ctx = BackendContextForGuestContext(ctx);
-
-  uint32_t depth = backend_ctx->current_stackpoint_depth - 1;
-  if (static_cast<int32_t>(depth) < 1) {
+  if (!count) {
     return false;
   }
-  uint32_t num_entries_to_populate =
-      std::min(MAX_GUEST_PSEUDO_STACKTRACE_ENTRIES, depth);
+  st->count = count;
+  st->truncated_flag = truncated ? 1 : 0;
+  return true;
+}
 
-  st->count = num_entries_to_populate;
-  st->truncated_flag = num_entries_to_populate < depth ? 1 : 0;
+bool X64Backend::UnwindGuestFrame(const X64Function* function,
+                                  bool interrupted, uint64_t& host_pc,
+                                  uint64_t& host_sp) const {
+  uint64_t offset =
+      host_pc - reinterpret_cast<uint64_t>(function->machine_code());
+  if (offset >= function->machine_code_length()) {
+    // Old code of a retranslated function, its frame layout is unknown.
+    return false;
+  }
+  uint64_t frame_sp = host_sp + function->stack_size();
+  if (interrupted) {
+    // The frame isn't allocated yet before the stack allocation in the
+    // prolog, and is gone by the ret of the epilog.
+    if (offset < function->prolog_stack_alloc_offset() ||
+        *reinterpret_cast<const uint8_t*>(host_pc) == 0xC3) {
+      frame_sp = host_sp;
+    }
+  }
+  uint64_t return_address = *reinterpret_cast<const uint64_t*>(frame_sp);
+  if (interrupted && frame_sp != host_sp &&
+      !code_cache_->LookupFunction(return_address)) {
+    // Likely between the stack deallocation and the jump of a tail call.
+    frame_sp = host_sp;
+    return_address = *reinterpret_cast<const uint64_t*>(frame_sp);
+  }
+  host_pc = return_address;
+  host_sp = frame_sp + 8;
+  return true;
+}
 
-  X64BackendStackpoint* current_stackpoint =
-      &backend_ctx->stackpoints[backend_ctx->current_stackpoint_depth - 1];
+size_t X64Backend::CaptureGuestFrames(uint64_t host_pc, uint64_t host_sp,
+                                      uint64_t* frame_host_pcs,
+                                      size_t frame_count) {
+  // The code cache lookup doesn't lock, so this is safe in a signal handler.
+  size_t count = 0;
+  while (count < frame_count) {
+    auto function =
+        static_cast<X64Function*>(code_cache_->LookupFunction(host_pc));
+    if (!function || !function->machine_code()) {
+      break;
+    }
+    frame_host_pcs[count++] = host_pc;
+    if (!UnwindGuestFrame(function, true, host_pc, host_sp)) {
+      break;
+    }
+  }
+  return count;
+}
 
-  for (uint32_t stp_index = 0; stp_index < num_entries_to_populate;
-       ++stp_index) {
-    st->return_addrs[stp_index] = current_stackpoint->guest_return_address_;
-    current_stackpoint--;
+uint64_t X64Backend::FindGuestFrameStack(uint32_t function_address,
+                                         uint32_t guest_sp, uint64_t host_sp,
+                                         X64Function** out_function) const {
+  uint64_t host_pc = *reinterpret_cast<const uint64_t*>(host_sp);
+  host_sp += 8;
+  // Frames of other functions are left behind by calls made from the body of
+  // their caller, so they are always complete. The walk ends at the host frame
+  // that entered guest code, or once the frames are older than guest_sp.
+  for (size_t frame_index = 0;; ++frame_index) {
+    auto frame_function =
+        static_cast<X64Function*>(code_cache_->LookupFunction(host_pc));
+    if (!frame_function || !frame_function->machine_code()) {
+      return 0;
+    }
+    uint32_t frame_guest_sp = *reinterpret_cast<const uint32_t*>(
+        host_sp + StackLayout::GUEST_STACK_POINTER);
+    if (frame_guest_sp > guest_sp) {
+      return 0;
+    }
+    if (!UnwindGuestFrame(frame_function, false, host_pc, host_sp)) {
+      return 0;
+    }
+    // Returning from the innermost frame isn't a longjmp.
+    if (frame_index < 1 || frame_guest_sp != guest_sp) {
+      continue;
+    }
+    auto caller =
+        static_cast<X64Function*>(code_cache_->LookupFunction(host_pc));
+    if (!caller || !caller->machine_code() ||
+        host_pc - reinterpret_cast<uint64_t>(caller->machine_code()) >=
+            caller->machine_code_length() ||
+        caller->address() != function_address) {
+      return 0;
+    }
+    *out_function = caller;
+    return host_sp;
   }
-  return true;
 }
 
 #if XE_X64_PROFILER_AVAILABLE == 1
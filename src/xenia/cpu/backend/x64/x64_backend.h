@@ -24,7 +24,6 @@
 #endif
 
 DECLARE_int64(x64_extension_mask);
-DECLARE_int64(max_stackpoints);
 DECLARE_bool(enable_host_guest_stack_synchronization);
 namespace xe {
 class Exception;
@@ -37,6 +36,7 @@ namespace x64 {
 using GuestProfilerData = std::map<uint32_t, uint64_t>;
 
 class X64CodeCache;
+class X64Function;
 
 typedef void* (*HostToGuestThunk)(void* target, void* arg0, void* arg1);
 typedef void* (*GuestToHostThunk)(void* target, void* arg0, void* arg1);
@@ -53,14 +53,6 @@ struct ReserveHelper {
   ReserveHelper() { memset(blocks, 0, sizeof(blocks)); }
 };
 
-struct X64BackendStackpoint {
-  uint64_t host_stack_;
-  unsigned guest_stack_;
-  // pad to 16 bytes so we never end up having a 64 bit load/store for
-  // host_stack_ straddling two lines. Consider this field reserved for future
-  // use
-  unsigned guest_return_address_;
-};
 // located prior to the ctx register
 // some things it would be nice to have be per-emulator instance instead of per
 // context (somehow placing a global X64BackendCtx prior to membase, so we can
@@ -70,11 +62,8 @@ struct X64BackendContext {
   uint64_t cached_reserve_value_;
   // guest_tick_count is used if inline_loadclock is used
   uint64_t* guest_tick_count;
-  // records mapping of host_stack to guest_stack
-  X64BackendStackpoint* stackpoints;
   uint64_t cached_reserve_offset;
   uint32_t cached_reserve_bit;
-  unsigned int current_stackpoint_depth;
   unsigned int mxcsr_fpu;  // currently, the way we implement rounding mode
                            // affects both vmx and the fpu
   unsigned int mxcsr_vmx;
@@ -131,6 +120,11 @@ class X64Backend : public Backend {
   std::unique_ptr<GuestFunction> CreateGuestFunction(Module* module,
                                                      uint32_t address) override;
 
+  bool SavePersistentCode(Module* module, const std::filesystem::path& path,
+                          uint64_t configuration_hash) override;
+  bool LoadPersistentCode(Module* module, const std::filesystem::path& path,
+                          uint64_t configuration_hash) override;
+
   uint64_t CalculateNextHostInstruction(ThreadDebugInfo* thread_info,
                                         uint64_t current_pc) override;
 
@@ -138,19 +132,41 @@ class X64Backend : public Backend {
   void InstallBreakpoint(Breakpoint* breakpoint, Function* fn) override;
   void UninstallBreakpoint(Breakpoint* breakpoint) override;
   virtual void InitializeBackendContext(void* ctx) override;
-  virtual void DeinitializeBackendContext(void* ctx) override;
-  virtual void PrepareForReentry(void* ctx) override;
   X64BackendContext* BackendContextForGuestContext(void* ctx) {
     return reinterpret_cast<X64BackendContext*>(
         reinterpret_cast<intptr_t>(ctx) - sizeof(X64BackendContext));
   }
   virtual void SetGuestRoundingMode(void* ctx, unsigned int mode) override;
   virtual bool PopulatePseudoStacktrace(GuestPseudoStackTrace* st) override;
+  size_t CaptureGuestFrames(uint64_t host_pc, uint64_t host_sp,
+                            uint64_t* frame_host_pcs,
+                            size_t frame_count) override;
+  // Finds the frame a guest longjmp restoring guest_sp returns to, walking up
+  // from host_sp, which points at the return address of a call made by guest
+  // code. That is the caller of the innermost frame entered with guest_sp as
+  // the guest stack pointer, which must not be the frame the walk starts in,
+  // and must be running code of the guest function at function_address.
+  // Returns the stack pointer of the frame and the function it's running, or 0
+  // if there's no such frame.
+  uint64_t FindGuestFrameStack(uint32_t function_address, uint32_t guest_sp,
+                               uint64_t host_sp,
+                               X64Function** out_function) const;
   void RecordMMIOExceptionForGuestInstruction(void* host_address);
 #if XE_X64_PROFILER_AVAILABLE == 1
   uint64_t* GetProfilerRecordForFunction(uint32_t guest_address);
 #endif
  private:
+  // Combines the frontend configuration hash with everything in the backend
+  // that affects the generated code.
+  uint64_t ComputeConfigurationHash(uint64_t frontend_configuration_hash) const;
+
+  // Moves host_pc and host_sp from the guest frame of the function to the
+  // frame of its caller. If interrupted, host_pc may be anywhere in the
+  // function rather than at a call. Returns false if the caller's frame can't
+  // be located.
+  bool UnwindGuestFrame(const X64Function* function, bool interrupted,
+                        uint64_t& host_pc, uint64_t& host_sp) const;
+
   static bool ExceptionCallbackThunk(Exception* ex, void* data);
   bool ExceptionCallback(Exception* ex);
 
@@ -9,7 +9,7 @@
 
 #include "xenia/cpu/backend/x64/x64_code_cache.h"
 
-#include <cstdlib>
+#include <algorithm>
 #include <cstring>
 
 #if ENABLE_VTUNE
@@ -19,11 +19,14 @@
 
 #include "third_party/fmt/include/fmt/format.h"
 #include "xenia/base/assert.h"
+#include "xenia/base/atomic.h"
 #include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/literals.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
+#include "xenia/base/xxhash.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/module.h"
 
@@ -120,8 +123,12 @@ bool X64CodeCache::Initialize() {
     }
   }
 
-  // Preallocate the function map to a large, reasonable size.
-  generated_code_map_.reserve(kMaximumFunctionCount);
+  // Preallocate the function map to a large, reasonable size. It's never
+  // reallocated, as lookups read it without locking.
+  generated_code_map_.reset(
+      new std::pair<uint64_t, GuestFunction*>[kMaximumFunctionCount]);
+  generated_code_page_map_.reset(
+      new std::atomic<uint32_t>[kGeneratedCodeMapPageCount]());
 
   return true;
 }
@@ -139,6 +146,77 @@ void X64CodeCache::AddIndirection(uint32_t guest_address,
   uint32_t* indirection_slot = reinterpret_cast<uint32_t*>(
       indirection_table_base_ + (guest_address - kIndirectionTableBase));
   *indirection_slot = host_address;
+
+  auto global_lock = global_critical_region_.Acquire();
+  PatchCallSites(guest_address);
+}
+
+void X64CodeCache::AddCallSites(void* code_execute_address,
+                                const std::vector<CallSite>& call_sites) {
+  if (!indirection_table_base_ || call_sites.empty()) {
+    return;
+  }
+  uint32_t code_offset = uint32_t(static_cast<uint8_t*>(code_execute_address) -
+                                  generated_code_execute_base_);
+  auto global_lock = global_critical_region_.Acquire();
+  for (const CallSite& call_site : call_sites) {
+    uint32_t site_offset = code_offset + call_site.code_offset;
+    assert_zero((site_offset + 1) & (kCallSiteTargetAlignment - 1));
+    call_sites_[call_site.guest_address].push_back(
+        {site_offset, code_offset + call_site.stub_offset,
+         call_site.guest_address});
+    uint32_t host_address = *reinterpret_cast<uint32_t*>(
+        indirection_table_base_ +
+        (call_site.guest_address - kIndirectionTableBase));
+    if (host_address != indirection_default_value_ &&
+        host_address - kGeneratedCodeExecuteBase < kGeneratedCodeSize) {
+      PatchCallSite(site_offset, host_address);
+    }
+  }
+}
+
+void X64CodeCache::AddHostAddresses(void* code_execute_address,
+                                    const std::vector<uint32_t>& offsets) {
+  if (offsets.empty()) {
+    return;
+  }
+  uint32_t code_offset = uint32_t(static_cast<uint8_t*>(code_execute_address) -
+                                  generated_code_execute_base_);
+  auto global_lock = global_critical_region_.Acquire();
+  for (uint32_t offset : offsets) {
+    host_address_offsets_.push_back(code_offset + offset);
+  }
+}
+
+void X64CodeCache::PatchCallSites(uint32_t guest_address) {
+  auto it = call_sites_.find(guest_address);
+  if (it == call_sites_.end()) {
+    return;
+  }
+  // Read the slot again instead of trusting the caller, as a newer tier of
+  // the callee may have been installed in the meantime.
+  uint32_t host_address = *reinterpret_cast<uint32_t*>(
+      indirection_table_base_ + (guest_address - kIndirectionTableBase));
+  if (host_address == indirection_default_value_ ||
+      host_address - kGeneratedCodeExecuteBase >= kGeneratedCodeSize) {
+    return;
+  }
+  for (const CallSite& call_site : it->second) {
+    PatchCallSite(call_site.code_offset, host_address);
+  }
+}
+
+void X64CodeCache::PatchCallSite(uint32_t site_offset, uint32_t host_address) {
+  // The site is E8/E9 rel32, a call/jmp to the stub loading the callee from
+  // the indirection table. Only the aligned rel32 changes, with a single
+  // store, so other threads execute either the old or the new target, and no
+  // instruction boundary moves.
+  int32_t rel32 = int32_t(int64_t(host_address) -
+                          int64_t(kGeneratedCodeExecuteBase + site_offset +
+                                  kCallSiteSize));
+  xe::atomic_exchange(uint32_t(rel32),
+                      reinterpret_cast<volatile uint32_t*>(
+                          generated_code_write_base_ + site_offset + 1));
 }
 
 void X64CodeCache::CommitExecutableRange(uint32_t guest_low,
@@ -160,6 +238,57 @@ void X64CodeCache::CommitExecutableRange(uint32_t guest_low,
   }
 }
 
+void X64CodeCache::CommitGeneratedCode(size_t high_mark) {
+  // It's ok if multiple threads do this, as redundant commits aren't harmful.
+  size_t old_commit_mark, new_commit_mark;
+  do {
+    old_commit_mark = generated_code_commit_mark_;
+    if (high_mark <= old_commit_mark) break;
+
+    new_commit_mark = old_commit_mark + 16_MiB;
+    if (generated_code_execute_base_ == generated_code_write_base_) {
+      xe::memory::AllocFixed(generated_code_execute_base_, new_commit_mark,
+                             xe::memory::AllocationType::kCommit,
+                             xe::memory::PageAccess::kExecuteReadWrite);
+    } else {
+      xe::memory::AllocFixed(generated_code_execute_base_, new_commit_mark,
+                             xe::memory::AllocationType::kCommit,
+                             xe::memory::PageAccess::kExecuteReadOnly);
+      xe::memory::AllocFixed(generated_code_write_base_, new_commit_mark,
+                             xe::memory::AllocationType::kCommit,
+                             xe::memory::PageAccess::kReadWrite);
+    }
+  } while (generated_code_commit_mark_.compare_exchange_weak(old_commit_mark,
+                                                             new_commit_mark));
+}
+
+void X64CodeCache::AddGeneratedCodeMapEntry(uint64_t map_key,
+                                            GuestFunction* function) {
+  size_t index = generated_code_map_count_.load(std::memory_order_relaxed);
+#if defined(NDEBUG)
+  if (index >= kMaximumFunctionCount) {
+    xe::FatalError(
+        "Generated code map count (generated_code_map_count_) exceeded "
+        "maximum! Please report this to Xenia/Canary developers");
+  }
+#else
+  assert_false(index >= kMaximumFunctionCount);
+#endif
+  generated_code_map_[index] = {map_key, function};
+  generated_code_map_count_.store(index + 1, std::memory_order_release);
+
+  // Publish the entry to the pages it covers that don't have an earlier one.
+  size_t first_page = size_t(map_key >> 32) >> kGeneratedCodeMapPageShift;
+  size_t last_page =
+      (size_t(uint32_t(map_key)) - 1) >> kGeneratedCodeMapPageShift;
+  for (size_t page = first_page; page <= last_page; ++page) {
+    if (!generated_code_page_map_[page].load(std::memory_order_relaxed)) {
+      generated_code_page_map_[page].store(uint32_t(index + 1),
+                                           std::memory_order_release);
+    }
+  }
+}
+
 void X64CodeCache::PlaceHostCode(uint32_t guest_address, void* machine_code,
                                  const EmitFunctionInfo& func_info,
                                  void*& code_execute_address_out,
@@ -213,38 +342,24 @@ void X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
 
     // Store in map. It is maintained in sorted order of host PC dependent on
     // us also being append-only.
-    generated_code_map_.emplace_back(
+    uint64_t map_key =
         (uint64_t(code_execute_address - generated_code_execute_base_) << 32) |
-            generated_code_offset_,
-        function_info);
+        generated_code_offset_;
+    AddGeneratedCodeMapEntry(map_key, function_info);
+
+    if (function_info && func_info.persistable) {
+      persistent_code_entries_.push_back(
+          {guest_address, uint32_t(low_mark), map_key, func_info,
+           function_info});
+    }
 
     // TODO(DrChat): The following code doesn't really need to be under the
     // global lock except for PlaceCode (but it depends on the previous code
     // already being ran)
 
     // If we are going above the high water mark of committed memory, commit
-    // some more. It's ok if multiple threads do this, as redundant commits
-    // aren't harmful.
-    size_t old_commit_mark, new_commit_mark;
-    do {
-      old_commit_mark = generated_code_commit_mark_;
-      if (high_mark <= old_commit_mark) break;
-
-      new_commit_mark = old_commit_mark + 16_MiB;
-      if (generated_code_execute_base_ == generated_code_write_base_) {
-        xe::memory::AllocFixed(generated_code_execute_base_, new_commit_mark,
-                               xe::memory::AllocationType::kCommit,
-                               xe::memory::PageAccess::kExecuteReadWrite);
-      } else {
-        xe::memory::AllocFixed(generated_code_execute_base_, new_commit_mark,
-                               xe::memory::AllocationType::kCommit,
-                               xe::memory::PageAccess::kExecuteReadOnly);
-        xe::memory::AllocFixed(generated_code_write_base_, new_commit_mark,
-                               xe::memory::AllocationType::kCommit,
-                               xe::memory::PageAccess::kReadWrite);
-      }
-    } while (generated_code_commit_mark_.compare_exchange_weak(
-        old_commit_mark, new_commit_mark));
+    // some more.
+    CommitGeneratedCode(high_mark);
 
     // Copy code.
     std::memcpy(code_write_address, machine_code, func_info.code_size.total);
@@ -279,15 +394,10 @@ void X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
   }
 #endif
 
-  // Now that everything is ready, fix up the indirection table.
-  // Note that we do support code that doesn't have an indirection fixup, so
-  // ignore those when we see them.
-  if (guest_address && indirection_table_base_) {
-    uint32_t* indirection_slot = reinterpret_cast<uint32_t*>(
-        indirection_table_base_ + (guest_address - kIndirectionTableBase));
-    *indirection_slot =
-        uint32_t(reinterpret_cast<uint64_t>(code_execute_address));
-  }
+  // The indirection table isn't fixed up here, as the code is yet to be
+  // relocated, and the function to be set up. The assembler installs it with
+  // AddIndirection once it's ready, which matters for a tier replacing code
+  // that other threads are calling.
 }
 
 uint32_t X64CodeCache::PlaceData(const void* data, size_t length) {
@@ -306,28 +416,8 @@ uint32_t X64CodeCache::PlaceData(const void* data, size_t length) {
   }
 
   // If we are going above the high water mark of committed memory, commit some
-  // more. It's ok if multiple threads do this, as redundant commits aren't
-  // harmful.
-  size_t old_commit_mark, new_commit_mark;
-  do {
-    old_commit_mark = generated_code_commit_mark_;
-    if (high_mark <= old_commit_mark) break;
-
-    new_commit_mark = old_commit_mark + 16_MiB;
-    if (generated_code_execute_base_ == generated_code_write_base_) {
-      xe::memory::AllocFixed(generated_code_execute_base_, new_commit_mark,
-                             xe::memory::AllocationType::kCommit,
-                             xe::memory::PageAccess::kExecuteReadWrite);
-    } else {
-      xe::memory::AllocFixed(generated_code_execute_base_, new_commit_mark,
-                             xe::memory::AllocationType::kCommit,
-                             xe::memory::PageAccess::kExecuteReadOnly);
-      xe::memory::AllocFixed(generated_code_write_base_, new_commit_mark,
-                             xe::memory::AllocationType::kCommit,
-                             xe::memory::PageAccess::kReadWrite);
-    }
-  } while (generated_code_commit_mark_.compare_exchange_weak(old_commit_mark,
-                                                             new_commit_mark));
+  // more.
+  CommitGeneratedCode(high_mark);
 
   // Copy code.
   std::memcpy(data_address, data, length);
@@ -335,31 +425,358 @@ uint32_t X64CodeCache::PlaceData(const void* data, size_t length) {
   return uint32_t(uintptr_t(data_address));
 }
 
+void X64CodeCache::MarkHelperCodeEnd() {
+  auto global_lock = global_critical_region_.Acquire();
+  helper_code_end_ = generated_code_offset_;
+  helper_host_address_offsets_ = std::move(host_address_offsets_);
+  host_address_offsets_.clear();
+}
+
+uint64_t X64CodeCache::HashHelperCode() const {
+  // Persisted code calls the helper thunks at fixed offsets, so their code
+  // must match. The host executable addresses in them move between runs with
+  // address space layout randomization, and are left out.
+  std::vector<uint8_t> code(generated_code_execute_base_,
+                            generated_code_execute_base_ + helper_code_end_);
+  for (uint32_t offset : helper_host_address_offsets_) {
+    std::memset(code.data() + offset, 0, sizeof(uint64_t));
+  }
+  return XXH3_64bits(code.data(), code.size());
+}
+
+
+// Persistent code cache file layout:
+//   PersistentCodeHeader
+//   code bytes [helper_code_end, helper_code_end + code_size)
+//   function_count x (PersistentFunctionRecord, SourceMapEntry[], CallSite[],
+//                     host address offsets uint32_t[])
+namespace {
+constexpr uint32_t kPersistentCodeMagic = 0x48434358;  // 'XCCH'
+// Increment this when the file layout changes.
+constexpr uint32_t kPersistentCodeVersion = 4;
+
+struct PersistentCodeHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t config_hash;
+  uint64_t helper_code_hash;
+  uint64_t code_offset;
+  uint64_t code_size;
+  uint32_t function_count;
+  uint32_t reserved;
+  // GetHostExecutableAnchor() of the run that saved the code.
+  uint64_t host_executable_anchor;
+};
+
+struct PersistentFunctionRecord {
+  uint32_t guest_address;
+  uint32_t guest_end_address;
+  uint64_t map_key;
+  EmitFunctionInfo func_info;
+  uint32_t source_map_count;
+  uint32_t call_site_count;
+  uint32_t host_address_count;
+  uint32_t reserved;
+};
+
+// Any address in the host executable, to find how far the executable has
+// moved since persisted code was saved.
+uint64_t GetHostExecutableAnchor() {
+  return reinterpret_cast<uint64_t>(&GetHostExecutableAnchor);
+}
+}  // namespace
+
+bool X64CodeCache::SavePersistentCode(
+    const std::filesystem::path& path, uint64_t config_hash,
+    std::function<bool(GuestFunction*)> filter) {
+  // Placed code is only modified by call site patching, so only the entry,
+  // call site and host address lists need the lock.
+  std::vector<PersistentCodeEntry> entries;
+  // All call sites, sorted by offset.
+  std::vector<CallSite> call_sites;
+  std::vector<uint32_t> host_address_offsets;
+  {
+    auto global_lock = global_critical_region_.Acquire();
+    for (const auto& entry : persistent_code_entries_) {
+      if (filter(entry.function)) {
+        entries.push_back(entry);
+      }
+    }
+    for (const auto& [guest_address, callee_call_sites] : call_sites_) {
+      call_sites.insert(call_sites.end(), callee_call_sites.begin(),
+                        callee_call_sites.end());
+    }
+    host_address_offsets = host_address_offsets_;
+  }
+  if (entries.empty()) {
+    return false;
+  }
+  std::sort(call_sites.begin(), call_sites.end(),
+            [](const CallSite& a, const CallSite& b) {
+              return a.code_offset < b.code_offset;
+            });
+  std::sort(host_address_offsets.begin(), host_address_offsets.end());
+
+  // Only save up to the end of the last persisted function; anything after it
+  // can't be referenced by persisted code.
+  size_t code_end = size_t(entries.back().map_key & 0xFFFFFFFF);
+
+  // Direct calls patched in at runtime point to callees that may not be
+  // restored, so the call sites are saved in their original form and patched
+  // again after loading.
+  std::vector<uint8_t> code(generated_code_execute_base_ + helper_code_end_,
+                            generated_code_execute_base_ + code_end);
+  for (const CallSite& call_site : call_sites) {
+    if (call_site.code_offset < helper_code_end_ ||
+        call_site.code_offset + kCallSiteSize > code_end) {
+      continue;
+    }
+    int32_t rel32 = int32_t(call_site.stub_offset) -
+                    int32_t(call_site.code_offset + kCallSiteSize);
+    std::memcpy(code.data() + (call_site.code_offset - helper_code_end_) + 1,
+                &rel32, sizeof(rel32));
+  }
+
+  FILE* file = xe::filesystem::OpenFile(path, "wb");
+  if (!file) {
+    XELOGE("Unable to open persistent code cache {} for writing",
+           xe::path_to_utf8(path));
+    return false;
+  }
+
+  PersistentCodeHeader header = {};
+  header.magic = kPersistentCodeMagic;
+  header.version = kPersistentCodeVersion;
+  header.config_hash = config_hash;
+  header.helper_code_hash = HashHelperCode();
+  header.code_offset = helper_code_end_;
+  header.code_size = code_end - helper_code_end_;
+  header.function_count = uint32_t(entries.size());
+  header.host_executable_anchor = GetHostExecutableAnchor();
+  bool success =
+      fwrite(&header, sizeof(header), 1, file) == 1 &&
+      fwrite(code.data(), 1, code.size(), file) == code.size();
+
+  for (const auto& entry : entries) {
+    if (!success) {
+      break;
+    }
+    const auto& source_map = entry.function->source_map();
+    PersistentFunctionRecord record = {};
+    record.guest_address = entry.guest_address;
+    record.guest_end_address = entry.function->end_address();
+    record.map_key = entry.map_key;
+    record.func_info = entry.func_info;
+    record.source_map_count = uint32_t(source_map.size());
+    uint32_t code_offset = uint32_t(entry.map_key >> 32);
+    uint32_t code_size = uint32_t(entry.func_info.code_size.total);
+    std::vector<CallSite> function_call_sites;
+    for (auto it = std::lower_bound(call_sites.begin(), call_sites.end(),
+                                    code_offset,
+                                    [](const CallSite& call_site,
+                                       uint32_t offset) {
+                                      return call_site.code_offset < offset;
+                                    });
+         it != call_sites.end() && it->code_offset < code_offset + code_size;
+         ++it) {
+      function_call_sites.push_back({it->code_offset - code_offset,
+                                     it->stub_offset - code_offset,
+                                     it->guest_address});
+    }
+    record.call_site_count = uint32_t(function_call_sites.size());
+    std::vector<uint32_t> function_host_address_offsets;
+    for (auto it = std::lower_bound(host_address_offsets.begin(),
+                                    host_address_offsets.end(), code_offset);
+         it != host_address_offsets.end() && *it < code_offset + code_size;
+         ++it) {
+      function_host_address_offsets.push_back(*it - code_offset);
+    }
+    record.host_address_count =
+        uint32_t(function_host_address_offsets.size());
+    success = fwrite(&record, sizeof(record), 1, file) == 1 &&
+              fwrite(source_map.data(), sizeof(SourceMapEntry),
+                     source_map.size(), file) == source_map.size() &&
+              fwrite(function_call_sites.data(), sizeof(CallSite),
+                     function_call_sites.size(),
+                     file) == function_call_sites.size() &&
+              fwrite(function_host_address_offsets.data(), sizeof(uint32_t),
+                     function_host_address_offsets.size(),
+                     file) == function_host_address_offsets.size();
+  }
+  fclose(file);
+
+  if (!success) {
+    XELOGE("Failed to write persistent code cache {}", xe::path_to_utf8(path));
+    std::filesystem::remove(path);
+    return false;
+  }
+  XELOGI("Saved {} functions ({} bytes) to the persistent code cache",
+         header.function_count, header.code_size);
+  return true;
+}
+
+bool X64CodeCache::LoadPersistentCode(
+    const std::filesystem::path& path, uint64_t config_hash,
+    const PersistentFunctionDefiner& definer) {
+  FILE* file = xe::filesystem::OpenFile(path, "rb");
+  if (!file) {
+    return false;
+  }
+
+  PersistentCodeHeader header;
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      header.magic != kPersistentCodeMagic ||
+      header.version != kPersistentCodeVersion) {
+    fclose(file);
+    return false;
+  }
+  if (header.config_hash != config_hash ||
+      header.helper_code_hash != HashHelperCode() ||
+      header.code_offset != helper_code_end_) {
+    XELOGI("Persistent code cache was created with a different configuration, "
+           "ignoring it");
+    fclose(file);
+    return false;
+  }
+
+  auto global_lock = global_critical_region_.Acquire();
+  if (generated_code_offset_ != helper_code_end_ ||
+      header.code_size > kGeneratedCodeSize - helper_code_end_) {
+    // Guest code has already been placed where the cached code needs to go.
+    XELOGW("Unable to restore the persistent code cache after guest code has "
+           "been generated");
+    fclose(file);
+    return false;
+  }
+
+  size_t code_end = helper_code_end_ + size_t(header.code_size);
+  CommitGeneratedCode(code_end);
+  if (fread(generated_code_write_base_ + helper_code_end_, 1,
+            size_t(header.code_size), file) != size_t(header.code_size)) {
+    XELOGE("Persistent code cache {} is truncated", xe::path_to_utf8(path));
+    std::memset(generated_code_write_base_ + helper_code_end_, 0xCC,
+                size_t(header.code_size));
+    fclose(file);
+    return false;
+  }
+  generated_code_offset_ = code_end;
+
+  // The host executable may be loaded at another address than when the code
+  // was saved.
+  uint64_t host_address_delta =
+      GetHostExecutableAnchor() - header.host_executable_anchor;
+  uint32_t restored_count = 0;
+  std::vector<SourceMapEntry> source_map;
+  std::vector<CallSite> call_sites;
+  std::vector<uint32_t> host_address_offsets;
+  for (uint32_t i = 0; i < header.function_count; ++i) {
+    PersistentFunctionRecord record;
+    if (fread(&record, sizeof(record), 1, file) != 1) {
+      break;
+    }
+    source_map.resize(record.source_map_count);
+    if (fread(source_map.data(), sizeof(SourceMapEntry), source_map.size(),
+              file) != source_map.size()) {
+      break;
+    }
+    call_sites.resize(record.call_site_count);
+    if (fread(call_sites.data(), sizeof(CallSite), call_sites.size(), file) !=
+        call_sites.size()) {
+      break;
+    }
+    host_address_offsets.resize(record.host_address_count);
+    if (fread(host_address_offsets.data(), sizeof(uint32_t),
+              host_address_offsets.size(),
+              file) != host_address_offsets.size()) {
+      break;
+    }
+    size_t code_offset = size_t(record.map_key >> 32);
+    size_t unwind_offset =
+        code_offset + xe::round_up(record.func_info.code_size.total, 16);
+    if (code_offset < helper_code_end_ || unwind_offset > code_end ||
+        std::any_of(call_sites.begin(), call_sites.end(),
+                    [&record](const CallSite& call_site) {
+                      return call_site.code_offset + kCallSiteSize >
+                                 record.func_info.code_size.total ||
+                             call_site.stub_offset >=
+                                 record.func_info.code_size.total;
+                    }) ||
+        std::any_of(host_address_offsets.begin(), host_address_offsets.end(),
+                    [&record](uint32_t offset) {
+                      return offset + sizeof(uint64_t) >
+                             record.func_info.code_size.total;
+                    })) {
+      break;
+    }
+    for (uint32_t offset : host_address_offsets) {
+      uint8_t* host_address_pointer =
+          generated_code_write_base_ + code_offset + offset;
+      uint64_t host_address;
+      std::memcpy(&host_address, host_address_pointer, sizeof(host_address));
+      host_address += host_address_delta;
+      std::memcpy(host_address_pointer, &host_address, sizeof(host_address));
+    }
+
+    PersistentFunctionInfo info;
+    info.guest_address = record.guest_address;
+    info.guest_end_address = record.guest_end_address;
+    info.func_info = record.func_info;
+    uint8_t* code_execute_address = generated_code_execute_base_ + code_offset;
+    GuestFunction* function =
+        definer(info, code_execute_address, std::move(source_map));
+    source_map = {};
+    if (!function) {
+      continue;
+    }
+
+    // Re-register the same bookkeeping PlaceGuestCode would have done. The
+    // unwind info is rewritten in place over the cached copy.
+    UnwindReservation unwind_reservation = RequestUnwindReservation(
+        generated_code_write_base_ + unwind_offset);
+    PlaceCode(record.guest_address, code_execute_address, record.func_info,
+              code_execute_address, unwind_reservation);
+    AddGeneratedCodeMapEntry(record.map_key, function);
+    persistent_code_entries_.push_back({record.guest_address,
+                                        uint32_t(code_offset), record.map_key,
+                                        record.func_info, function});
+    AddCallSites(code_execute_address, call_sites);
+    AddHostAddresses(code_execute_address, host_address_offsets);
+    AddIndirection(record.guest_address,
+                   uint32_t(reinterpret_cast<uint64_t>(code_execute_address)));
+    ++restored_count;
+  }
+  fclose(file);
+
+  XELOGI("Restored {} of {} functions from the persistent code cache",
+         restored_count, header.function_count);
+  return true;
+}
+
 GuestFunction* X64CodeCache::LookupFunction(uint64_t host_pc) {
-  uint32_t key = uint32_t(host_pc - kGeneratedCodeExecuteBase);
-  void* fn_entry = std::bsearch(
-      &key, generated_code_map_.data(), generated_code_map_.size() + 1,
-      sizeof(std::pair<uint32_t, Function*>),
-      [](const void* key_ptr, const void* element_ptr) {
-        auto key = *reinterpret_cast<const uint32_t*>(key_ptr);
-        auto element =
-            reinterpret_cast<const std::pair<uint64_t, GuestFunction*>*>(
-                element_ptr);
-        if (key < (element->first >> 32)) {
-          return -1;
-        } else if (key > uint32_t(element->first)) {
-          return 1;
-        } else {
-          return 0;
-        }
-      });
-  if (fn_entry) {
-    return reinterpret_cast<const std::pair<uint64_t, GuestFunction*>*>(
-               fn_entry)
-        ->second;
-  } else {
+  uint64_t offset = host_pc - kGeneratedCodeExecuteBase;
+  if (offset >= kGeneratedCodeSize) {
+    return nullptr;
+  }
+  uint32_t key = uint32_t(offset);
+  uint32_t first_index =
+      generated_code_page_map_[key >> kGeneratedCodeMapPageShift].load(
+          std::memory_order_acquire);
+  if (!first_index) {
     return nullptr;
   }
+  // Entries are sorted, so walk from the first one on the page until one
+  // starts past the key.
+  size_t count = generated_code_map_count_.load(std::memory_order_acquire);
+  for (size_t i = first_index - 1; i < count; ++i) {
+    const auto& entry = generated_code_map_[i];
+    if (key < (entry.first >> 32)) {
+      break;
+    }
+    if (key < uint32_t(entry.first)) {
+      return entry.second;
+    }
+  }
+  return nullptr;
 }
 
 }  // namespace x64
@@ -13,8 +13,11 @@
 #include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <filesystem>
+#include <functional>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -37,6 +40,10 @@ struct EmitFunctionInfo {
   } code_size;
   size_t prolog_stack_alloc_offset;  // offset of instruction after stack alloc
   size_t stack_size;
+  // True if the code only references the indirection table, helper thunks and
+  // other persistable functions, so it can be written to the persistent code
+  // cache and placed at the same offset on a later run.
+  bool persistable;
 };
 
 class X64CodeCache : public CodeCache {
@@ -53,7 +60,6 @@ class X64CodeCache : public CodeCache {
   }
   size_t total_size() const override { return kGeneratedCodeSize; }
 
-  // TODO(benvanik): ELF serialization/etc
   // TODO(benvanik): keep track of code blocks
   // TODO(benvanik): padding/guards/etc
 
@@ -63,6 +69,29 @@ class X64CodeCache : public CodeCache {
 
   void CommitExecutableRange(uint32_t guest_low, uint32_t guest_high);
 
+  // Call emitted by X64Emitter::Call as a call/jmp rel32 with a 4 byte aligned
+  // rel32, initially to a stub in the tail of the function doing
+  //   mov ebx, guest_address; mov eax, dword [rbx]; jmp rax
+  // to load the callee from the indirection table. Whenever code for the
+  // callee is installed, the rel32 is atomically replaced to point to it.
+  struct CallSite {
+    // Relative to the start of the function.
+    uint32_t code_offset;
+    uint32_t stub_offset;
+    uint32_t guest_address;
+  };
+  static const size_t kCallSiteSize = 5;
+  static const size_t kCallSiteTargetAlignment = 4;
+  // Registers the call sites of a function that has just been placed,
+  // patching the ones with already installed callees.
+  void AddCallSites(void* code_execute_address,
+                    const std::vector<CallSite>& call_sites);
+  // Registers the offsets, relative to code that has just been placed, of the
+  // 64 bit host executable addresses emitted by X64Emitter::MovHostAddress.
+  // They are relocated when persisted code is restored in another run.
+  void AddHostAddresses(void* code_execute_address,
+                        const std::vector<uint32_t>& offsets);
+
   void PlaceHostCode(uint32_t guest_address, void* machine_code,
                      const EmitFunctionInfo& func_info,
                      void*& code_execute_address_out,
@@ -74,6 +103,34 @@ class X64CodeCache : public CodeCache {
                       void*& code_write_address_out);
   uint32_t PlaceData(const void* data, size_t length);
 
+  // Marks the end of the backend helper thunks. Everything placed after this
+  // point is guest code that may be persisted.
+  void MarkHelperCodeEnd();
+
+  // Description of a function stored in the persistent code cache.
+  struct PersistentFunctionInfo {
+    uint32_t guest_address;
+    uint32_t guest_end_address;
+    EmitFunctionInfo func_info;
+  };
+  // Creates and defines the guest function for a persisted entry. Returns
+  // nullptr if the entry should be skipped.
+  using PersistentFunctionDefiner = std::function<GuestFunction*(
+      const PersistentFunctionInfo& info, uint8_t* machine_code,
+      std::vector<SourceMapEntry> source_map)>;
+
+  // Writes the generated code region along with all persistable functions
+  // accepted by the filter. config_hash must describe everything that affects
+  // code generation.
+  bool SavePersistentCode(const std::filesystem::path& path,
+                          uint64_t config_hash,
+                          std::function<bool(GuestFunction*)> filter);
+  // Restores code written by SavePersistentCode. Only possible while no guest
+  // code has been placed yet, as code is restored at its original offsets.
+  bool LoadPersistentCode(const std::filesystem::path& path,
+                          uint64_t config_hash,
+                          const PersistentFunctionDefiner& definer);
+
   GuestFunction* LookupFunction(uint64_t host_pc) override;
 
  protected:
@@ -96,6 +153,11 @@ class X64CodeCache : public CodeCache {
   //chrispy: raised this, some games that were compiled with low optimization levels can exceed this
   static const size_t kMaximumFunctionCount = 1000000;
 
+  // Granularity of generated_code_page_map_.
+  static const size_t kGeneratedCodeMapPageShift = 12;
+  static const size_t kGeneratedCodeMapPageCount =
+      (kGeneratedCodeSize + 1) >> kGeneratedCodeMapPageShift;
+
   struct UnwindReservation {
     size_t data_size = 0;
     size_t table_slot = 0;
@@ -104,6 +166,22 @@ class X64CodeCache : public CodeCache {
 
   X64CodeCache();
 
+  struct PersistentCodeEntry {
+    uint32_t guest_address;
+    uint32_t code_offset;
+    uint64_t map_key;
+    EmitFunctionInfo func_info;
+    GuestFunction* function;
+  };
+
+  void CommitGeneratedCode(size_t high_mark);
+  // Must be called with the global critical region held.
+  void PatchCallSites(uint32_t guest_address);
+  void PatchCallSite(uint32_t site_offset, uint32_t host_address);
+  // Must be called with the global critical region held, in placement order.
+  void AddGeneratedCodeMapEntry(uint64_t map_key, GuestFunction* function);
+  uint64_t HashHelperCode() const;
+
   virtual UnwindReservation RequestUnwindReservation(uint8_t* entry_address) {
     return UnwindReservation();
   }
@@ -138,10 +216,28 @@ class X64CodeCache : public CodeCache {
   size_t generated_code_offset_ = 0;
   // Current high water mark of COMMITTED code.
   std::atomic<size_t> generated_code_commit_mark_ = {0};
-  // Sorted map by host PC base offsets to source function info.
-  // This can be used to bsearch on host PC to find the guest function.
-  // The key is [start address | end address].
-  std::vector<std::pair<uint64_t, GuestFunction*>> generated_code_map_;
+  // Map by host PC base offsets to source function info, sorted as code is
+  // only appended. The key is [start address | end address]. Entries below
+  // generated_code_map_count_ are immutable, so they can be read without the
+  // lock.
+  std::unique_ptr<std::pair<uint64_t, GuestFunction*>[]> generated_code_map_;
+  std::atomic<size_t> generated_code_map_count_ = {0};
+  // For each page of the generated code, 1 + the index in generated_code_map_
+  // of the first entry overlapping it, or 0 if none does yet. Set once, so a
+  // lookup only needs to walk the few entries sharing a page.
+  std::unique_ptr<std::atomic<uint32_t>[]> generated_code_page_map_;
+  // Offset of the first byte after the backend helper thunks.
+  size_t helper_code_end_ = 0;
+  // Placed guest functions that can be written to the persistent code cache,
+  // in placement order.
+  std::vector<PersistentCodeEntry> persistent_code_entries_;
+  // Call sites in generated code by the guest address of the callee, with
+  // offsets relative to the start of the generated code.
+  std::unordered_map<uint32_t, std::vector<CallSite>> call_sites_;
+  // Offsets of the host executable addresses in the helper thunks, and in the
+  // guest code placed after them.
+  std::vector<uint32_t> helper_host_address_offsets_;
+  std::vector<uint32_t> host_address_offsets_;
 };
 
 }  // namespace x64
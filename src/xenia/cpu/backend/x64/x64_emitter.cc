@@ -11,8 +11,10 @@
 
 #include <stddef.h>
 
+#include <algorithm>
 #include <climits>
 #include <cstring>
+#include <unordered_map>
 
 #include "third_party/fmt/include/fmt/format.h"
 #include "xenia/base/assert.h"
@@ -58,11 +60,23 @@ DEFINE_uint32(align_all_basic_blocks, 0,
               "power of 2, 16 is the recommended value. Results in larger "
               "icache usage, but potentially faster loops",
               "x64");
+DEFINE_bool(split_cold_blocks, true,
+            "Moves blocks that are unlikely to run, such as unconditional "
+            "traps, after the function epilog, so that the hot code is "
+            "contiguous.",
+            "x64");
+DEFINE_bool(cold_block_profiling, false,
+            "Records in the instruction info cache which blocks the baseline "
+            "code of tiered_compilation has run. With split_cold_blocks, "
+            "blocks that never ran are moved out of line when the function is "
+            "optimized, also in later runs.",
+            "x64");
 #if XE_X64_PROFILER_AVAILABLE == 1
 DEFINE_bool(instrument_call_times, false,
             "Compute time taken for functions, for profiling guest code",
             "x64");
 #endif
+DECLARE_int32(tier_up_call_count);
 namespace xe {
 namespace cpu {
 namespace backend {
@@ -120,6 +134,20 @@ bool X64Emitter::Emit(GuestFunction* function, HIRBuilder* builder,
   debug_info_flags_ = debug_info_flags;
   trace_data_ = &function->trace_data();
   source_map_arena_.Reset();
+  call_sites_.clear();
+  host_address_offsets_.clear();
+  // Tracing and profiling embed pointers to per-run host allocations.
+  persistable_ = !debug_info_flags_ && !cvars::instrument_call_times;
+  if (function->tier() == GuestFunction::Tier::kBaseline) {
+    tier_up_function_ = static_cast<X64Function*>(function);
+    *tier_up_function_->tier_up_counter() =
+        std::max(cvars::tier_up_call_count, 1);
+    // Baseline code is replaced at runtime, and its call counter is a host
+    // heap pointer.
+    persistable_ = false;
+  } else {
+    tier_up_function_ = nullptr;
+  }
 
   // Fill the generator with code.
   EmitFunctionInfo func_info = {};
@@ -129,7 +157,12 @@ bool X64Emitter::Emit(GuestFunction* function, HIRBuilder* builder,
 
   // Copy the final code to the cache and relocate it.
   *out_code_size = getSize();
+  func_info.persistable = persistable_;
   *out_code_address = Emplace(func_info, function);
+  static_cast<X64Function*>(function)->set_persistable(persistable_);
+  static_cast<X64Function*>(function)->set_frame_layout(
+      uint32_t(func_info.stack_size),
+      uint32_t(func_info.prolog_stack_alloc_offset));
 
   // Stash source map.
   source_map_arena_.CloneContents(out_source_map);
@@ -160,6 +193,12 @@ void* X64Emitter::Emplace(const EmitFunctionInfo& func_info,
   top_ = reinterpret_cast<uint8_t*>(new_write_address);
   ready();
   top_ = old_address;
+  if (function) {
+    code_cache_->AddCallSites(new_execute_address, call_sites_);
+  }
+  code_cache_->AddHostAddresses(new_execute_address, host_address_offsets_);
+  call_sites_.clear();
+  host_address_offsets_.clear();
   reset();
   tail_code_.clear();
   for (auto&& cached_label : label_cache_) {
@@ -213,7 +252,6 @@ bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
   func_info.stack_size = stack_size;
   stack_size_ = stack_size;
 
-  PushStackpoint();
   sub(rsp, (uint32_t)stack_size);
 
   code_offsets.prolog_stack_alloc = getSize();
@@ -228,6 +266,12 @@ bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
 
   mov(qword[rsp + StackLayout::GUEST_CALL_RET_ADDR], rax);  // 0
 
+  if (cvars::enable_host_guest_stack_synchronization) {
+    // Lets frames be matched to the guest stack pointer a longjmp restores.
+    mov(eax, dword[GetContextReg() + offsetof(ppc::PPCContext, r[1])]);
+    mov(dword[rsp + StackLayout::GUEST_STACK_POINTER], eax);
+  }
+
 #if XE_X64_PROFILER_AVAILABLE == 1
   if (cvars::instrument_call_times) {
     mov(rdx, 0x7ffe0014);  // load pointer to kusershared systemtime
@@ -264,6 +308,10 @@ bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
     bts(qword[low_address(&trace_header->function_thread_use)], rax);
   }
 
+  if (tier_up_function_) {
+    EmitTierUpCounter();
+  }
+
   // Load membase.
   /*
   * chrispy: removed this, as long as we load it in HostToGuestThunk we can
@@ -271,48 +319,62 @@ bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
       qword[GetContextReg() + offsetof(ppc::PPCContext, virtual_membase)]);
   */
   // Body.
-  auto block = builder->first_block();
+  // Cold blocks are emitted after the epilog. A block falling through into a
+  // moved one, or a moved one falling through, jumps to the block that
+  // follows it instead.
+  auto first_block = builder->first_block();
+  bool use_profile = false;
+  if (cvars::cold_block_profiling && !tier_up_function_) {
+    // Only functions that baseline code has run have a profile.
+    InfoCacheFlags* entry_flags = GetBlockInfoCacheFlags(first_block);
+    use_profile = entry_flags && entry_flags->was_executed;
+  }
+  std::vector<const hir::Block*> cold_blocks;
+  std::unordered_map<const hir::Block*, Xbyak::Label*> block_labels;
+  if (cvars::split_cold_blocks) {
+    for (auto block = first_block->next; block; block = block->next) {
+      if (!IsColdBlock(block, use_profile)) {
+        continue;
+      }
+      cold_blocks.push_back(block);
+      block_labels.emplace(block, &NewCachedLabel());
+      if (block->next) {
+        block_labels.emplace(block->next, &NewCachedLabel());
+      }
+    }
+  }
+  auto falls_through = [](const hir::Block* block) {
+    const Instr* tail = block->instr_tail;
+    return !tail || (tail->GetOpcodeNum() != hir::OPCODE_BRANCH &&
+                     tail->GetOpcodeNum() != hir::OPCODE_RETURN);
+  };
+  auto jump_to_next = [&](const hir::Block* block) {
+    if (block->next) {
+      jmp(*block_labels[block->next], T_NEAR);
+    } else {
+      jmp(epilog_label, T_NEAR);
+    }
+  };
   synchronize_stack_on_next_instruction_ = false;
-  while (block) {
-    ForgetMxcsrMode();  // at start of block, mxcsr mode is undefined
-
-    // Mark block labels.
-    auto label = block->label_head;
-    while (label) {
-      L(std::to_string(label->id));
-      label = label->next;
+  for (auto block = first_block; block; block = block->next) {
+    if (std::find(cold_blocks.cbegin(), cold_blocks.cend(), block) !=
+        cold_blocks.cend()) {
+      continue;
     }
-
-    if (cvars::align_all_basic_blocks) {
-      align(cvars::align_all_basic_blocks, true);
+    auto block_label = block_labels.find(block);
+    if (block_label != block_labels.end()) {
+      L(*block_label->second);
     }
-    // Process instructions.
-    const Instr* instr = block->instr_head;
-    while (instr) {
-      if (synchronize_stack_on_next_instruction_) {
-        if (instr->GetOpcodeNum() != hir::OPCODE_SOURCE_OFFSET) {
-          synchronize_stack_on_next_instruction_ = false;
-          EnsureSynchronizedGuestAndHostStack();
-        }
-      }
-      const Instr* new_tail = instr;
-      if (!SelectSequence(this, instr, &new_tail)) {
-        // No sequence found!
-        // NOTE: If you encounter this after adding a new instruction, do a full
-        // rebuild!
-        assert_always();
-        XELOGE("Unable to process HIR opcode {}", GetOpcodeName(instr->opcode));
-        break;
-      }
-      instr = new_tail;
+    EmitBlock(block);
+    if (block->next && falls_through(block) &&
+        std::find(cold_blocks.cbegin(), cold_blocks.cend(), block->next) !=
+            cold_blocks.cend()) {
+      jump_to_next(block);
     }
-
-    block = block->next;
   }
 
   // Function epilog.
   L(epilog_label);
-  epilog_label_ = nullptr;
   EmitTraceUserCallReturn();
   /*
   * chrispy: removed this, it serves no purpose
@@ -322,8 +384,16 @@ bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
   EmitProfilerEpilogue();
 
   add(rsp, (uint32_t)stack_size);
-  PopStackpoint();
   ret();
+
+  for (const hir::Block* block : cold_blocks) {
+    L(*block_labels[block]);
+    EmitBlock(block);
+    if (falls_through(block)) {
+      jump_to_next(block);
+    }
+  }
+  epilog_label_ = nullptr;
   // todo: do some kind of sorting by alignment?
   for (auto&& tail_item : tail_code_) {
     if (tail_item.alignment) {
@@ -349,6 +419,96 @@ bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
 
   return true;
 }
+void X64Emitter::EmitBlock(const hir::Block* block) {
+  ForgetMxcsrMode();  // at start of block, mxcsr mode is undefined
+
+  // Mark block labels.
+  auto label = block->label_head;
+  while (label) {
+    L(std::to_string(label->id));
+    label = label->next;
+  }
+
+  if (cvars::align_all_basic_blocks) {
+    align(cvars::align_all_basic_blocks, true);
+  }
+  if (tier_up_function_ && cvars::cold_block_profiling) {
+    EmitBlockProfile(block);
+  }
+  // Process instructions.
+  const Instr* instr = block->instr_head;
+  while (instr) {
+    if (synchronize_stack_on_next_instruction_) {
+      if (instr->GetOpcodeNum() != hir::OPCODE_SOURCE_OFFSET) {
+        synchronize_stack_on_next_instruction_ = false;
+        EnsureSynchronizedGuestAndHostStack();
+      }
+    }
+    const Instr* new_tail = instr;
+    if (!SelectSequence(this, instr, &new_tail)) {
+      // No sequence found!
+      // NOTE: If you encounter this after adding a new instruction, do a full
+      // rebuild!
+      assert_always();
+      XELOGE("Unable to process HIR opcode {}", GetOpcodeName(instr->opcode));
+      break;
+    }
+    instr = new_tail;
+  }
+}
+
+bool X64Emitter::IsColdBlock(const hir::Block* block, bool use_profile) {
+  // Unconditional traps are only reached on errors. Conditional ones are
+  // already emitted in the tail.
+  for (const Instr* instr = block->instr_head; instr; instr = instr->next) {
+    auto opcode = instr->GetOpcodeNum();
+    if (opcode == hir::OPCODE_TRAP || opcode == hir::OPCODE_DEBUG_BREAK) {
+      return true;
+    }
+  }
+  if (use_profile) {
+    InfoCacheFlags* flags = GetBlockInfoCacheFlags(block);
+    if (flags && !flags->was_executed) {
+      return true;
+    }
+  }
+  return false;
+}
+
+InfoCacheFlags* X64Emitter::GetBlockInfoCacheFlags(const hir::Block* block) {
+  if (!guest_module_) {
+    return nullptr;
+  }
+  for (const Instr* instr = block->instr_head; instr; instr = instr->next) {
+    if (instr->GetOpcodeNum() == hir::OPCODE_SOURCE_OFFSET) {
+      return guest_module_->GetInstructionAddressFlags(
+          static_cast<uint32_t>(instr->src1.offset));
+    }
+  }
+  return nullptr;
+}
+
+void X64Emitter::EmitBlockProfile(const hir::Block* block) {
+  InfoCacheFlags* flags = GetBlockInfoCacheFlags(block);
+  if (!flags || flags->was_executed) {
+    return;
+  }
+  InfoCacheFlags executed = {};
+  executed.was_executed = 1;
+  uint32_t executed_mask;
+  std::memcpy(&executed_mask, &executed, sizeof(executed_mask));
+  // No values are in rax or the flags at the start of a block. Other bits of
+  // the flags may be set concurrently by other threads. The bit is tested
+  // first so that hot blocks only read the shared cache line once it's set.
+  Xbyak::Label already_executed;
+  mov(rax, reinterpret_cast<uint64_t>(flags));
+  test(dword[rax], executed_mask);
+  jnz(already_executed);
+  lock();
+  or_(dword[rax], executed_mask);
+  L(already_executed);
+}
+
 // dont use rax, we do this in tail call handling
 void X64Emitter::EmitProfilerEpilogue() {
 #if XE_X64_PROFILER_AVAILABLE == 1
@@ -372,6 +532,31 @@ void X64Emitter::EmitProfilerEpilogue() {
 #endif
 }
 
+uint64_t TierUpFunction(void* raw_context, uint64_t function_ptr) {
+  auto thread_state =
+      reinterpret_cast<ppc::PPCContext_s*>(raw_context)->thread_state;
+  thread_state->processor()->QueueTierUp(
+      reinterpret_cast<GuestFunction*>(function_ptr));
+  return 0;
+}
+
+void X64Emitter::EmitTierUpCounter() {
+  // Nothing guest related is in registers yet, so the slow path is free to
+  // clobber volatiles.
+  mov(rax, reinterpret_cast<uint64_t>(tier_up_function_->tier_up_counter()));
+  sub(dword[rax], 1);
+  Xbyak::Label& come_back = NewCachedLabel();
+  auto function = tier_up_function_;
+  Xbyak::Label& tier_up = AddToTail(
+      [&come_back, function](X64Emitter& e, Xbyak::Label& thislabel) {
+        e.L(thislabel);
+        e.CallNative(TierUpFunction, reinterpret_cast<uint64_t>(function));
+        e.jmp(come_back, X64Emitter::T_NEAR);
+      });
+  jz(tier_up, T_NEAR);
+  L(come_back);
+}
+
 void X64Emitter::MarkSourceOffset(const Instr* i) {
   auto entry = source_map_arena_.Alloc<SourceMapEntry>();
   entry->guest_address = static_cast<uint32_t>(i->src1.offset);
@@ -460,7 +645,6 @@ void X64Emitter::UnimplementedInstr(const hir::Instr* i) {
   assert_always();
 }
 
-// This is used by the X64ThunkEmitter's ResolveFunctionThunk.
 uint64_t ResolveFunction(void* raw_context, uint64_t target_address) {
   auto guest_context = reinterpret_cast<ppc::PPCContext_s*>(raw_context);
 
@@ -469,9 +653,22 @@ uint64_t ResolveFunction(void* raw_context, uint64_t target_address) {
   // TODO(benvanik): required?
   assert_not_zero(target_address);
 
-  /*
-          todo: refactor this!
+  auto fn = thread_state->processor()->ResolveFunction(
+      static_cast<uint32_t>(target_address));
+  assert_not_null(fn);
+  auto x64_fn = static_cast<X64Function*>(fn);
+  uint64_t addr = reinterpret_cast<uint64_t>(x64_fn->machine_code());
+
+  return addr;
+}
+
+// This is used by the X64ThunkEmitter's ResolveFunctionThunk. host_sp points
+// at the return address of the guest call or tail call being resolved.
+uint64_t ResolveFunctionFromGuest(void* raw_context, uint64_t target_address,
+                                  uint64_t host_sp) {
+  auto guest_context = reinterpret_cast<ppc::PPCContext_s*>(raw_context);
 
+  /*
          The purpose of this code is to allow guest longjmp to call into
      the body of an existing host function. There are a lot of conditions we
      have to check here to ensure that we do not mess up a normal call to a
@@ -480,198 +677,90 @@ uint64_t ResolveFunction(void* raw_context, uint64_t target_address) {
          The address must be within an XexModule (may need to make some changes
      to instructionaddressflags to remove this limitation) The target address
      must be a known return site. The guest address must be part of a function
-     that was already translated.
-
+     that was already translated, and that function must still have a frame on
+     the host stack.
+
+         The only thing recorded about the frames while calls are made is the
+     guest r1 at function entry, instead the host frames are walked from
+     host_sp through the code cache, each one giving the stack size of its
+     function and so the location of the next one, until the frame entered
+     with the r1 the longjmp restored is found. Its caller's frame must be
+     running the function containing the return site, and must not be the
+     frame doing the longjmp. If there is none, the return site is resolved as
+     a new function.
+
+         If there is one, we return the host address of the return site. By
+     calling into the body of an existing function we've pushed our return
+     address onto the stack, so rsp % 16 == 8, and this is the only time
+     outside of the prolog or epilog of a function that this will be the case.
+     After all direct or indirect function calls we set
+     X64Emitter::synchronize_stack_on_next_instruction_ to true, and on the
+     next instruction that is not OPCODE_SOURCE_OFFSET we emit test esp, 15,
+     with the handling for a misaligned stack tail emitted.
+
+         Our handling for the check is implemented in
+     X64HelperEmitter::EmitGuestAndHostSynchronizeStackHelper, through
+     backend()->synchronize_guest_and_host_stack_helper_for_size, which loads
+     the stack size of the function placed after the call instruction. The
+     helper repeats the frame walk from the misaligned rsp, which still points
+     at the return address we checked here, sets rsp to the frame of the
+     function, discarding the frames above it, and jumps back to the return
+     site. it just works!
+
+         Matching the frames by guest r1 picks the right frame of a recursive
+     function that is on the stack more than once.
   */
-
   if (cvars::enable_host_guest_stack_synchronization) {
-    auto processor = thread_state->processor();
+    auto processor = guest_context->thread_state->processor();
 
     auto module_for_address =
         processor->LookupModule(static_cast<uint32_t>(target_address));
 
-    if (module_for_address) {
-      XexModule* xexmod = dynamic_cast<XexModule*>(module_for_address);
-      if (xexmod) {
-        InfoCacheFlags* flags = xexmod->GetInstructionAddressFlags(
+    XexModule* xexmod = dynamic_cast<XexModule*>(module_for_address);
+    InfoCacheFlags* flags =
+        xexmod ? xexmod->GetInstructionAddressFlags(
+                     static_cast<uint32_t>(target_address))
+               : nullptr;
+    if (flags && flags->is_return_site) {
+      auto ones_with_address = processor->FindFunctionsWithAddress(
+          static_cast<uint32_t>(target_address));
+      // this loop to find a host address for the guest address is necessary
+      // because FindFunctionsWithAddress works via a range check, but if the
+      // function consists of multiple blocks scattered around with "holes" of
+      // instructions that cannot be reached in between those holes the
+      // instructions that cannot be reached will incorrectly be considered
+      // members of the function
+      X64Backend* backend = static_cast<X64Backend*>(processor->backend());
+      for (auto&& entry : ones_with_address) {
+        // The frame may be running another translation of the function than
+        // the one the processor knows, such as its optimized code.
+        X64Function* xfunc = nullptr;
+        if (!backend->FindGuestFrameStack(
+                entry->address(), static_cast<uint32_t>(guest_context->r[1]),
+                host_sp, &xfunc)) {
+          continue;
+        }
+        uintptr_t host_address = xfunc->MapGuestAddressToMachineCode(
             static_cast<uint32_t>(target_address));
-        if (flags) {
-          if (flags->is_return_site) {
-            auto ones_with_address = processor->FindFunctionsWithAddress(
-                static_cast<uint32_t>(target_address));
-
-            if (ones_with_address.size() != 0) {
-              // this loop to find a host address for the guest address is
-              // necessary because FindFunctionsWithAddress works via a range
-              // check, but if the function consists of multiple blocks
-              // scattered around with "holes" of instructions that cannot be
-              // reached in between those holes the instructions that cannot be
-              // reached will incorrectly be considered members of the function
-
-              X64Function* candidate = nullptr;
-              uintptr_t host_address = 0;
-              for (auto&& entry : ones_with_address) {
-                X64Function* xfunc = static_cast<X64Function*>(entry);
-
-                host_address = xfunc->MapGuestAddressToMachineCode(
-                    static_cast<uint32_t>(target_address));
-                // host address does exist within the function, and that host
-                // function is not the start of the function, it is instead
-                // somewhere within its existing body
-                // i originally did not have this (xfunc->machine_code() !=
-                // reinterpret_cast<const uint8_t*>(host_address))) condition
-                // here when i distributed builds for testing, no issues arose
-                // related to it but i wanted to be more explicit
-                if (host_address &&
-                    xfunc->machine_code() !=
-                        reinterpret_cast<const uint8_t*>(host_address)) {
-                  candidate = xfunc;
-                  break;
-                }
-              }
-              // we found an existing X64Function, and a return site within that
-              // function that has a host address w/ native code
-              if (candidate && host_address) {
-                X64Backend* backend =
-                    static_cast<X64Backend*>(processor->backend());
-                // grab the backend context, next we have to check whether the
-                // guest and host stack are out of sync if they arent, its fine
-                // for the backend to create a new function for the guest
-                // address we're resolving if they are, it means that the reason
-                // we're resolving this address is because context is being
-                // restored (probably by longjmp)
-                X64BackendContext* backend_context =
-                    backend->BackendContextForGuestContext(guest_context);
-
-                uint32_t current_stackpoint_index =
-                    backend_context->current_stackpoint_depth;
-
-                --current_stackpoint_index;
-
-                X64BackendStackpoint* stackpoints =
-                    backend_context->stackpoints;
-
-                uint32_t current_guest_stackpointer =
-                    static_cast<uint32_t>(guest_context->r[1]);
-                uint32_t num_frames_bigger = 0;
-
-                /*
-                        if the current guest stack pointer is bigger than the
-                   recorded pointer for this stack thats fine, plenty of
-                   functions restore the original stack pointer early
-
-                        if more than 1... we're longjmping and sure of it at
-                   this point (jumping to a return site that has already been
-                   emitted)
-                */
-                while (current_stackpoint_index != 0xFFFFFFFF) {
-                  if (current_guest_stackpointer >
-                      stackpoints[current_stackpoint_index].guest_stack_) {
-                    --current_stackpoint_index;
-                    ++num_frames_bigger;
-
-                  } else {
-                    break;
-                  }
-                }
-                /*
-                                        DEFINITELY a longjmp, return original
-                   host address. returning the existing host address is going to
-                   set off some extra machinery we have set up to support this
-
-                                        to break it down, our caller (us being
-                   this ResolveFunction that this comment is in) is
-                   X64Backend::resolve_function_thunk_ which is implemented in
-                   x64_backend.cc X64HelperEmitter::EmitResolveFunctionThunk, or
-                   a call from the resolver table
-
-                                        the x64 fastcall abi dictates that the
-                   stack must always be 16 byte aligned. We select our stack
-                   size for functions to ensure that we keep rsp aligned to 16
-                   bytes
-
-                                        but by calling into the body of an
-                   existing function we've pushed our return address onto the
-                   stack (dont worry about this return address, it gets
-                   discarded in a later step)
-
-                                        this means that the stack is no longer
-                   16 byte aligned, (rsp % 16) now == 8, and this is the only
-                   time outside of the prolog or epilog of a function that this
-                   will be the case
-
-                                        so, after all direct or indirect
-                   function calls we set
-                   X64Emitter::synchronize_stack_on_next_instruction_ to true.
-                                        On the next instruction that is not
-                   OPCODE_SOURCE_OFFSET we will emit a check when we see
-                   synchronize_stack_on_next_instruction_ is true. We have to
-                   skip OPCODE_SOURCE_OFFSET because its not a "real"
-                   instruction and if we emit on it the return address of the
-                   function call will point to AFTER our check, so itll never be
-                   executed.
-
-                                        our check is just going to do test esp,
-                   15 to see if the stack is misaligned. (using esp instead of
-                   rsp saves 1 byte). We tail emit the handling for when the
-                   check succeeds because in 99.99999% of function calls it will
-                   be aligned, in the end the runtime cost of these checks is 5
-                   bytes for the test instruction which ought to be one cycle
-                   and 5 bytes for the jmp with no cycles taken for the jump
-                   which will be predicted not taken.
-
-                  Our handling for the check is implemented in
-                  X64HelperEmitter::EmitGuestAndHostSynchronizeStackHelper. we
-                  don't call it directly though, instead we go through
-                  backend()->synchronize_guest_and_host_stack_helper_for_size(num_bytes_needed_to_represent_stack_size).
-                  we place the stack size after the call instruction so we can
-                  load it in the helper and readjust the return address to point
-                  after the literal value.
-
-                                  The helper is going to search the array of
-                  stackpoints to find the first one that is greater than or
-                  equal to the current stack pointer, when it finds the entry it
-                  will set the currently host rsp to the host stack pointer
-                  value in the entry, and then subtract the stack size of the
-                  caller from that. the current stackpoint index is adjusted to
-                  point to the one after the stackpoint we restored to.
-
-                                  The helper then jumps back to the function
-                  that was longjmp'ed to, with the host stack in its proper
-                  state. it just works!
-
-
-
-                 */
-
-                if (num_frames_bigger > 1) {
-                  /*
-                   * can't do anything about this right now :(
-                   * epic mickey is quite slow due to having to call resolve on
-                   * every longjmp, and it longjmps a lot but if we add an
-                   * indirection we lose our stack misalignment check
-                   */
-                  /* reinterpret_cast<X64CodeCache*>(backend->code_cache())
-      ->AddIndirection(static_cast<uint32_t>(target_address),
-                       static_cast<uint32_t>(host_address));
-                        */
-
-                  return host_address;
-                }
-              }
-            }
-          }
+        // host address does exist within the function, and that host function
+        // is not the start of the function, it is instead somewhere within its
+        // existing body
+        if (!host_address ||
+            xfunc->machine_code() ==
+                reinterpret_cast<const uint8_t*>(host_address)) {
+          continue;
         }
+        /*
+         * can't do anything about this right now :(
+         * epic mickey is quite slow due to having to call resolve on
+         * every longjmp, and it longjmps a lot but if we add an
+         * indirection we lose our stack misalignment check
+         */
+        return host_address;
       }
     }
   }
-  auto fn = thread_state->processor()->ResolveFunction(
-      static_cast<uint32_t>(target_address));
-  assert_not_null(fn);
-  auto x64_fn = static_cast<X64Function*>(fn);
-  uint64_t addr = reinterpret_cast<uint64_t>(x64_fn->machine_code());
-
-  return addr;
+  return ResolveFunction(raw_context, target_address);
 }
 
 void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
@@ -680,7 +769,14 @@ void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
   auto fn = static_cast<X64Function*>(function);
   // Resolve address to the function to call and store in rax.
 
-  if (fn->machine_code()) {
+  // Calls to baseline code must go through a patchable call site so they pick
+  // up the optimized code once it's ready.
+  if (fn->tier() == GuestFunction::Tier::kOptimized && fn->machine_code()) {
+    // The callee must be restored from the same cache for the direct call
+    // target to be valid.
+    if (!fn->persistable() || fn->module() != guest_module_) {
+      persistable_ = false;
+    }
     if (!(instr->flags & hir::CALL_TAIL)) {
       mov(rcx, qword[rsp + StackLayout::GUEST_CALL_RET_ADDR]);
 
@@ -694,21 +790,33 @@ void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
       mov(rcx, qword[rsp + StackLayout::GUEST_RET_ADDR]);
 
       add(rsp, static_cast<uint32_t>(stack_size()));
-      PopStackpoint();
       jmp((void*)fn->machine_code(), T_NEAR);
     }
 
     return;
   } else if (code_cache_->has_indirection_table()) {
-    // Load the pointer to the indirection table maintained in X64CodeCache.
-    // The target dword will either contain the address of the generated code
-    // or a thunk to ResolveAddress.
-    mov(ebx, function->address());
-    mov(eax, dword[ebx]);
+    // Call through the indirection table maintained in X64CodeCache, which
+    // turns this into a direct call once the callee has been placed.
+    if (instr->flags & hir::CALL_TAIL) {
+      // Since we skip the prolog we need to mark the return here.
+      EmitTraceUserCallReturn();
+      EmitProfilerEpilogue();
+      // Pass the callers return address over.
+      mov(rcx, qword[rsp + StackLayout::GUEST_RET_ADDR]);
+
+      add(rsp, static_cast<uint32_t>(stack_size()));
+      EmitPatchableCall(function->address(), true);
+    } else {
+      // Return address is from the previous SET_RETURN_ADDRESS.
+      mov(rcx, qword[rsp + StackLayout::GUEST_CALL_RET_ADDR]);
+
+      EmitPatchableCall(function->address(), false);
+      synchronize_stack_on_next_instruction_ = true;
+    }
+    return;
   } else {
     // Old-style resolve.
     // Not too important because indirection table is almost always available.
-    // TODO: Overwrite the call-site with a straight call.
     CallNative(&ResolveFunction, function->address());
   }
 
@@ -721,7 +829,6 @@ void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
     mov(rcx, qword[rsp + StackLayout::GUEST_RET_ADDR]);
 
     add(rsp, static_cast<uint32_t>(stack_size()));
-    PopStackpoint();
     jmp(rax);
   } else {
     // Return address is from the previous SET_RETURN_ADDRESS.
@@ -732,6 +839,33 @@ void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
   }
 }
 
+void X64Emitter::EmitPatchableCall(uint32_t guest_address, bool is_tail_call) {
+  // The rel32 must be 4 byte aligned for X64CodeCache to patch it atomically.
+  // Functions are placed on 16 byte boundaries.
+  while ((getSize() + 1) & (X64CodeCache::kCallSiteTargetAlignment - 1)) {
+    nop();
+  }
+  size_t call_site_index = call_sites_.size();
+  call_sites_.push_back({uint32_t(getSize()), 0, guest_address});
+  // The target dword will either contain the address of the generated code
+  // or a thunk to ResolveAddress, which takes the guest address in ebx.
+  Xbyak::Label& stub = AddToTail(
+      [call_site_index, guest_address](X64Emitter& e, Xbyak::Label& thislabel) {
+        e.L(thislabel);
+        e.call_sites_[call_site_index].stub_offset = uint32_t(e.getSize());
+        e.mov(e.ebx, guest_address);
+        e.mov(e.eax, e.dword[e.rbx]);
+        e.jmp(e.rax);
+      });
+  if (is_tail_call) {
+    jmp(stub, T_NEAR);
+  } else {
+    call(stub);
+  }
+  assert_true(getSize() - call_sites_[call_site_index].code_offset ==
+              X64CodeCache::kCallSiteSize);
+}
+
 void X64Emitter::CallIndirect(const hir::Instr* instr,
                               const Xbyak::Reg64& reg) {
   ForgetMxcsrMode();
@@ -767,7 +901,6 @@ void X64Emitter::CallIndirect(const hir::Instr* instr,
     mov(rcx, qword[rsp + StackLayout::GUEST_RET_ADDR]);
 
     add(rsp, static_cast<uint32_t>(stack_size()));
-    PopStackpoint();
     jmp(rax);
   } else {
     // Return address is from the previous SET_RETURN_ADDRESS.
@@ -796,6 +929,8 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
     auto builtin_function = static_cast<const BuiltinFunction*>(function);
     if (builtin_function->handler()) {
       undefined = false;
+      // Builtin arguments are host heap objects.
+      MarkNonPersistable();
       // rcx = target function
       // rdx = arg0
       // r8  = arg1
@@ -814,7 +949,8 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
       // rdx = arg0
       // r8  = arg1
       // r9  = arg2
-      mov(rcx, reinterpret_cast<uint64_t>(extern_function->extern_handler()));
+      MovHostAddress(rcx, reinterpret_cast<const void*>(
+                              extern_function->extern_handler()));
       mov(rdx,
           qword[GetContextReg() + offsetof(ppc::PPCContext, kernel_state)]);
       call(backend()->guest_to_host_thunk());
@@ -822,6 +958,7 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
     }
   }
   if (undefined) {
+    MarkNonPersistable();
     CallNative(UndefinedCallExtern, reinterpret_cast<uint64_t>(function));
   }
 }
@@ -847,7 +984,7 @@ void X64Emitter::CallNativeSafe(void* fn) {
   // rdx = arg0
   // r8  = arg1
   // r9  = arg2
-  mov(rcx, reinterpret_cast<uint64_t>(fn));
+  MovHostAddress(rcx, fn);
   call(backend()->guest_to_host_thunk());
   // rax = host return
 }
@@ -857,6 +994,15 @@ void X64Emitter::SetReturnAddress(uint64_t value) {
   mov(qword[rsp + StackLayout::GUEST_CALL_RET_ADDR], rax);
 }
 
+void X64Emitter::MovHostAddress(const Xbyak::Reg64& reg, const void* address) {
+  // Always mov r64, imm64, so relocating the address never needs another
+  // encoding.
+  db(0x48 | (reg.getIdx() >> 3));
+  db(0xB8 | (reg.getIdx() & 7));
+  host_address_offsets_.push_back(uint32_t(getSize()));
+  dq(reinterpret_cast<uint64_t>(address));
+}
+
 Xbyak::Reg64 X64Emitter::GetNativeParam(uint32_t param) {
   if (param == 0)
     return rdx;
@@ -1671,72 +1817,6 @@ Xbyak::Address X64Emitter::GetBackendFlagsPtr() const {
   return pt;
 }
 
-void X64Emitter::HandleStackpointOverflowError(ppc::PPCContext* context) {
-  if (debugging::IsDebuggerAttached()) {
-    debugging::Break();
-  }
-  // context->lr
-  // todo: show lr in message?
-  xe::FatalError(
-      "Overflowed stackpoints! Please report this error for this title to "
-      "Xenia developers.");
-}
-
-void X64Emitter::PushStackpoint() {
-  if (!cvars::enable_host_guest_stack_synchronization) {
-    return;
-  }
-  // push the current host and guest stack pointers
-  // this is done before a stack frame is set up or any guest instructions are
-  // executed this code is probably the most intrusive part of the stackpoint
-  mov(rbx, GetBackendCtxPtr(offsetof(X64BackendContext, stackpoints)));
-  mov(eax,
-      GetBackendCtxPtr(offsetof(X64BackendContext, current_stackpoint_depth)));
-
-  mov(r8, qword[GetContextReg() + offsetof(ppc::PPCContext, r[1])]);
-
-  imul(r9d, eax, sizeof(X64BackendStackpoint));
-  add(rbx, r9);
-
-  mov(qword[rbx + offsetof(X64BackendStackpoint, host_stack_)], rsp);
-  mov(dword[rbx + offsetof(X64BackendStackpoint, guest_stack_)], r8d);
-  mov(r8d, qword[GetContextReg() + offsetof(ppc::PPCContext, lr)]);
-  mov(dword[rbx + offsetof(X64BackendStackpoint, guest_return_address_)], r8d);
-
-  if (IsFeatureEnabled(kX64FlagsIndependentVars)) {
-    inc(eax);
-  } else {
-    add(eax, 1);
-  }
-
-  mov(GetBackendCtxPtr(offsetof(X64BackendContext, current_stackpoint_depth)),
-      eax);
-
-  cmp(eax, (uint32_t)cvars::max_stackpoints);
-
-  Xbyak::Label& overflowed_stackpoints =
-      AddToTail([](X64Emitter& e, Xbyak::Label& our_tail_label) {
-        e.L(our_tail_label);
-        // we never subtracted anything from rsp, so our stack is misaligned and
-        // will fault in guesttohostthunk
-        // e.sub(e.rsp, 8);
-        e.push(e.rax);  // easier realign, 1 byte opcode vs 4 bytes for sub
-
-        e.CallNativeSafe((void*)X64Emitter::HandleStackpointOverflowError);
-      });
-  jge(overflowed_stackpoints, T_NEAR);
-}
-void X64Emitter::PopStackpoint() {
-  if (!cvars::enable_host_guest_stack_synchronization) {
-    return;
-  }
-  // todo: maybe verify that rsp and r1 == the stackpoint?
-  Xbyak::Address stackpoint_pos_pointer =
-      GetBackendCtxPtr(offsetof(X64BackendContext, current_stackpoint_depth));
-  stackpoint_pos_pointer.setBit(32);
-  dec(stackpoint_pos_pointer);
-}
-
 void X64Emitter::EnsureSynchronizedGuestAndHostStack() {
   if (!cvars::enable_host_guest_stack_synchronization) {
     return;
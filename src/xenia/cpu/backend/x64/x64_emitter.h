@@ -13,6 +13,7 @@
 #include <vector>
 
 #include "xenia/base/arena.h"
+#include "xenia/cpu/backend/x64/x64_code_cache.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/function_trace_data.h"
 #include "xenia/cpu/hir/hir_builder.h"
@@ -37,6 +38,7 @@ namespace x64 {
 using namespace amd64;
 class X64Backend;
 class X64CodeCache;
+class X64Function;
 
 struct EmitFunctionInfo;
 
@@ -264,6 +266,9 @@ class X64Emitter : public Xbyak::CodeGenerator {
                   uint64_t arg0);
   void CallNativeSafe(void* fn);
   void SetReturnAddress(uint64_t value);
+  // Loads the address of a function or data in the host executable, which
+  // moves between runs, in a form X64CodeCache relocates in persisted code.
+  void MovHostAddress(const Xbyak::Reg64& reg, const void* address);
 
   Xbyak::Reg64 GetNativeParam(uint32_t param);
 
@@ -300,12 +305,17 @@ class X64Emitter : public Xbyak::CodeGenerator {
   Xbyak::Label& AddToTail(TailEmitCallback callback, uint32_t alignment = 0);
   Xbyak::Label& NewCachedLabel();
 
-  void PushStackpoint();
-  void PopStackpoint();
-
   void EnsureSynchronizedGuestAndHostStack();
   FunctionDebugInfo* debug_info() const { return debug_info_; }
 
+  // Called by sequences that embed pointers to host heap objects, which are
+  // not stable across runs, in the code being emitted. The function will not
+  // be written to the persistent code cache.
+  void MarkNonPersistable() { persistable_ = false; }
+
+  // Emits the call counter of baseline tier code.
+  void EmitTierUpCounter();
+
   size_t stack_size() const { return stack_size_; }
   SimdDomain DeduceSimdDomain(const hir::Value* for_value);
 
@@ -384,9 +394,18 @@ class X64Emitter : public Xbyak::CodeGenerator {
   void* Emplace(const EmitFunctionInfo& func_info,
                 GuestFunction* function = nullptr);
   bool Emit(hir::HIRBuilder* builder, EmitFunctionInfo& func_info);
+  void EmitBlock(const hir::Block* block);
+  // Cold blocks are moved out of the hot path, after the epilog.
+  bool IsColdBlock(const hir::Block* block, bool use_profile);
+  // Info cache flags of the guest instruction the block starts at, if any.
+  InfoCacheFlags* GetBlockInfoCacheFlags(const hir::Block* block);
+  // Marks the block as executed for cold_block_profiling.
+  void EmitBlockProfile(const hir::Block* block);
   void EmitGetCurrentThreadId();
   void EmitTraceUserCallReturn();
-  static void HandleStackpointOverflowError(ppc::PPCContext* context);
+  // Emits a call (or jump) through the indirection table in the form
+  // X64CodeCache patches into a direct one.
+  void EmitPatchableCall(uint32_t guest_address, bool is_tail_call);
  protected:
   Processor* processor_ = nullptr;
   X64Backend* backend_ = nullptr;
@@ -398,6 +417,13 @@ class X64Emitter : public Xbyak::CodeGenerator {
   uint64_t feature_flags_ = 0;
   uint32_t current_guest_function_ = 0;
   Xbyak::Label* epilog_label_ = nullptr;
+  bool persistable_ = false;
+  // Function being emitted, if it's baseline tier code.
+  X64Function* tier_up_function_ = nullptr;
+  // Patchable call sites in the function being emitted.
+  std::vector<X64CodeCache::CallSite> call_sites_;
+  // Offsets of the host executable addresses in the code being emitted.
+  std::vector<uint32_t> host_address_offsets_;
 
   hir::Instr* current_instr_ = nullptr;
 
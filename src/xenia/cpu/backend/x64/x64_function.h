@@ -28,12 +28,35 @@ class X64Function : public GuestFunction {
 
   void Setup(uint8_t* machine_code, size_t machine_code_length);
 
+  // Whether the machine code can be stored in the persistent code cache.
+  bool persistable() const { return persistable_; }
+  void set_persistable(bool persistable) { persistable_ = persistable; }
+
+  // Decremented by baseline tier code on every call, the function is queued
+  // for retranslation when it reaches zero.
+  uint32_t* tier_up_counter() { return &tier_up_counter_; }
+
+  // Layout of the stack frame of the machine code, for walking guest stacks.
+  uint32_t stack_size() const { return stack_size_; }
+  uint32_t prolog_stack_alloc_offset() const {
+    return prolog_stack_alloc_offset_;
+  }
+  void set_frame_layout(uint32_t stack_size,
+                        uint32_t prolog_stack_alloc_offset) {
+    stack_size_ = stack_size;
+    prolog_stack_alloc_offset_ = prolog_stack_alloc_offset;
+  }
+
  protected:
   bool CallImpl(ThreadState* thread_state, uint32_t return_address) override;
 
  private:
   uint8_t* machine_code_ = nullptr;
   size_t machine_code_length_ = 0;
+  bool persistable_ = false;
+  uint32_t tier_up_counter_ = 0;
+  uint32_t stack_size_ = 0;
+  uint32_t prolog_stack_alloc_offset_ = 0;
 };
 
 }  // namespace x64
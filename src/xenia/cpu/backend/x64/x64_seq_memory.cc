@@ -567,7 +567,11 @@ struct ATOMIC_COMPARE_EXCHANGE_I32
     : Sequence<ATOMIC_COMPARE_EXCHANGE_I32,
                I<OPCODE_ATOMIC_COMPARE_EXCHANGE, I8Op, I64Op, I32Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    e.mov(e.eax, i.src2);
+    if (i.src2.is_constant) {
+      e.mov(e.eax, i.src2.constant());
+    } else {
+      e.mov(e.eax, i.src2);
+    }
     if (xe::memory::allocation_granularity() > 0x1000) {
       // Emulate the 4 KB physical address offset in 0xE0000000+ when can't do
       // it via memory mapping.
@@ -588,8 +592,15 @@ struct ATOMIC_COMPARE_EXCHANGE_I32
     } else {
       e.mov(e.ecx, i.src1.reg().cvt32());
     }
-    e.lock();
-    e.cmpxchg(e.dword[e.GetMembaseReg() + e.rcx], i.src3);
+    // cmpxchg only takes the new value from a register.
+    if (i.src3.is_constant) {
+      e.mov(e.edx, i.src3.constant());
+      e.lock();
+      e.cmpxchg(e.dword[e.GetMembaseReg() + e.rcx], e.edx);
+    } else {
+      e.lock();
+      e.cmpxchg(e.dword[e.GetMembaseReg() + e.rcx], i.src3);
+    }
     e.sete(i.dest);
   }
 };
@@ -597,7 +608,11 @@ struct ATOMIC_COMPARE_EXCHANGE_I64
     : Sequence<ATOMIC_COMPARE_EXCHANGE_I64,
                I<OPCODE_ATOMIC_COMPARE_EXCHANGE, I8Op, I64Op, I64Op, I64Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    e.mov(e.rax, i.src2);
+    if (i.src2.is_constant) {
+      e.mov(e.rax, i.src2.constant());
+    } else {
+      e.mov(e.rax, i.src2);
+    }
     if (xe::memory::allocation_granularity() > 0x1000) {
       // Emulate the 4 KB physical address offset in 0xE0000000+ when can't do
       // it via memory mapping.
@@ -618,8 +633,15 @@ struct ATOMIC_COMPARE_EXCHANGE_I64
     } else {
       e.mov(e.ecx, i.src1.reg().cvt32());
     }
-    e.lock();
-    e.cmpxchg(e.qword[e.GetMembaseReg() + e.rcx], i.src3);
+    // cmpxchg only takes the new value from a register.
+    if (i.src3.is_constant) {
+      e.mov(e.rdx, i.src3.constant());
+      e.lock();
+      e.cmpxchg(e.qword[e.GetMembaseReg() + e.rcx], e.rdx);
+    } else {
+      e.lock();
+      e.cmpxchg(e.qword[e.GetMembaseReg() + e.rcx], i.src3);
+    }
     e.sete(i.dest);
   }
 };
@@ -1124,6 +1146,7 @@ struct LOAD_MMIO_I32
     // uint64_t (context, addr)
     auto mmio_range = reinterpret_cast<MMIORange*>(i.src1.value);
     auto read_address = uint32_t(i.src2.value);
+    e.MarkNonPersistable();
     e.mov(e.GetNativeParam(0), uint64_t(mmio_range->callback_context));
     e.mov(e.GetNativeParam(1).cvt32(), read_address);
     e.CallNativeSafe(reinterpret_cast<void*>(mmio_range->read));
@@ -1149,6 +1172,7 @@ struct STORE_MMIO_I32
     // void (context, addr, value)
     auto mmio_range = reinterpret_cast<MMIORange*>(i.src1.value);
     auto write_address = uint32_t(i.src2.value);
+    e.MarkNonPersistable();
     e.mov(e.GetNativeParam(0), uint64_t(mmio_range->callback_context));
     e.mov(e.GetNativeParam(1).cvt32(), write_address);
     if (i.src3.is_constant) {
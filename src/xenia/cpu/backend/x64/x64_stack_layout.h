@@ -115,13 +115,15 @@ class StackLayout {
    *  +------------------+
    *  | call ret addr    | rsp + 96
    *  +------------------+
+   *  | guest r1         | rsp + 104
+   *  +------------------+
    *    ... locals ...
    *  +------------------+
    *  | (return address) |
    *  +------------------+
    *
    */
-  static const size_t GUEST_STACK_SIZE = 104;
+  static const size_t GUEST_STACK_SIZE = 120;
   //was GUEST_CTX_HOME, can't remove because that'd throw stack alignment off. instead, can be used as a temporary in sequences
   static const size_t GUEST_SCRATCH = 0;
   
@@ -129,6 +131,9 @@ class StackLayout {
   static const size_t GUEST_PROFILER_START = 80;
   static const size_t GUEST_RET_ADDR = 88;
   static const size_t GUEST_CALL_RET_ADDR = 96;
+  // guest r1 at function entry, only stored when host/guest stack
+  // synchronization is enabled
+  static const size_t GUEST_STACK_POINTER = 104;
 };
 
 }  // namespace x64
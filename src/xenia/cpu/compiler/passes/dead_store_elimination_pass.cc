@@ -0,0 +1,169 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/dead_store_elimination_pass.h"
+
+#include "xenia/base/cvar.h"
+#include "xenia/base/profiling.h"
+#include "xenia/cpu/ppc/ppc_context.h"
+#include "xenia/cpu/processor.h"
+
+DECLARE_bool(store_all_context_values);
+DECLARE_bool(full_optimization_even_with_debug);
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+
+namespace {
+constexpr unsigned kContextSize = unsigned(sizeof(ppc::PPCContext));
+}  // namespace
+
+DeadStoreEliminationPass::DeadStoreEliminationPass() : CompilerPass() {}
+
+DeadStoreEliminationPass::~DeadStoreEliminationPass() {}
+
+bool DeadStoreEliminationPass::Run(HIRBuilder* builder) {
+  // Dead stores break debugging as the registers can't be recovered when
+  // extracting stack traces/register values.
+  if (!cvars::full_optimization_even_with_debug &&
+      (cvars::debug || cvars::store_all_context_values)) {
+    return true;
+  }
+
+  // Backwards liveness of every context byte. A store is dead if none of the
+  // bytes it writes are live after it.
+  uint16_t block_count = 0;
+  auto block = builder->first_block();
+  while (block) {
+    block->ordinal = block_count++;
+    block = block->next;
+  }
+  live_in_.resize(block_count);
+  for (auto& live_in : live_in_) {
+    live_in.resize(kContextSize);
+    live_in.reset();
+  }
+
+  // Iterate to a fixed point for loops. Visiting the blocks in reverse order
+  // makes most functions converge in a single pass.
+  llvm::BitVector live(kContextSize);
+  bool changed;
+  do {
+    changed = false;
+    block = builder->last_block();
+    while (block) {
+      ComputeLiveOut(block, live);
+      ApplyBlock(block, live, false);
+      if (!(live == live_in_[block->ordinal])) {
+        live_in_[block->ordinal] = live;
+        changed = true;
+      }
+      block = block->prev;
+    }
+  } while (changed);
+
+  block = builder->first_block();
+  while (block) {
+    ComputeLiveOut(block, live);
+    ApplyBlock(block, live, true);
+    block = block->next;
+  }
+
+  live_in_.clear();
+  return true;
+}
+
+bool DeadStoreEliminationPass::ObservesContext(const Instr* instr) {
+  // Calls, returns, traps and atomics are volatile. Conditional branches are
+  // too, but they only transfer control within the function, which is
+  // covered by the CFG. Guest memory accesses may fault on MMIO or watched
+  // pages, and the guest state must be complete wherever that is handled, so
+  // only stores overwritten before the next access are removed, like the CR
+  // and XER updates of ALU sequences.
+  if (instr->opcode == &OPCODE_BRANCH_TRUE_info ||
+      instr->opcode == &OPCODE_BRANCH_FALSE_info) {
+    return false;
+  }
+  return (instr->opcode->flags &
+          (OPCODE_FLAG_VOLATILE | OPCODE_FLAG_MEMORY)) ||
+         instr->opcode == &OPCODE_CONTEXT_BARRIER_info;
+}
+
+void DeadStoreEliminationPass::ComputeLiveOut(Block* block,
+                                              llvm::BitVector& live_out) {
+  live_out.reset();
+  auto tail = block->instr_tail;
+  if (!tail || tail->opcode != &OPCODE_BRANCH_info) {
+    // Falls through to the next block, or leaves the function (returns and
+    // tail calls observe everything anyway).
+    if (block->next) {
+      live_out |= live_in_[block->next->ordinal];
+    } else {
+      live_out.set();
+      return;
+    }
+  }
+  // Edges are only ever removed after ControlFlowAnalysisPass, so stale ones
+  // just make this more conservative.
+  for (auto edge = block->outgoing_edge_head; edge;
+       edge = edge->outgoing_next) {
+    live_out |= live_in_[edge->dest->ordinal];
+  }
+}
+
+void DeadStoreEliminationPass::ApplyBlock(Block* block, llvm::BitVector& live,
+                                          bool remove_dead_stores) {
+  auto i = block->instr_tail;
+  while (i) {
+    auto prev = i->prev;
+    if (ObservesContext(i)) {
+      live.set();
+    } else if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
+      auto offset = unsigned(i->src1.offset);
+      auto end = offset + unsigned(GetTypeSize(i->dest->type));
+      if (end <= kContextSize) {
+        live.set(offset, end);
+      } else {
+        live.set();
+      }
+    } else if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
+      auto offset = unsigned(i->src1.offset);
+      auto end = offset + unsigned(GetTypeSize(i->src2.value->type));
+      if (end <= kContextSize) {
+        bool is_dead = true;
+        for (auto n = offset; n < end; ++n) {
+          if (live.test(n)) {
+            is_dead = false;
+            break;
+          }
+        }
+        if (is_dead && remove_dead_stores) {
+          i->UnlinkAndNOP();
+        } else {
+          live.reset(offset, end);
+        }
+      }
+    }
+    i = prev;
+  }
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,63 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_DEAD_STORE_ELIMINATION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_DEAD_STORE_ELIMINATION_PASS_H_
+
+#include <vector>
+
+#include "xenia/base/platform.h"
+#include "xenia/cpu/compiler/compiler_pass.h"
+
+#if XE_COMPILER_MSVC
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#pragma warning(disable : 4267)
+#include <llvm/ADT/BitVector.h>
+#pragma warning(pop)
+#else
+#include <llvm/ADT/BitVector.h>
+#endif  // XE_COMPILER_MSVC
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Removes context stores that are overwritten on every path before anything
+// may observe them. Unlike the block-local cleanup in ContextPromotionPass
+// this follows the CFG, so the CR and XER stores of flag-setting instructions
+// are also removed when the next store is behind a conditional branch.
+class DeadStoreEliminationPass : public CompilerPass {
+ public:
+  DeadStoreEliminationPass();
+  ~DeadStoreEliminationPass() override;
+
+  bool Run(hir::HIRBuilder* builder) override;
+
+ private:
+  // Whether the context may be read in any way other than LOAD_CONTEXT by the
+  // instruction, such as by the callee of a call or by an exception handler.
+  static bool ObservesContext(const hir::Instr* instr);
+  // Fills live_out with the context bytes that may be read after the block.
+  void ComputeLiveOut(hir::Block* block, llvm::BitVector& live_out);
+  // Turns live_out into the context bytes that may be read at the start of
+  // the block, removing dead stores if requested.
+  void ApplyBlock(hir::Block* block, llvm::BitVector& live,
+                  bool remove_dead_stores);
+
+  std::vector<llvm::BitVector> live_in_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_DEAD_STORE_ELIMINATION_PASS_H_
@@ -0,0 +1,173 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/crt_routines.h"
+
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+#include "xenia/base/memory.h"
+#include "xenia/base/xxhash.h"
+#include "xenia/cpu/ppc/ppc_context.h"
+
+namespace xe {
+namespace cpu {
+
+namespace {
+
+std::atomic<uint64_t> crt_routine_hit_counts[size_t(CrtRoutine::kCount)];
+
+void CountHit(CrtRoutine routine) {
+  crt_routine_hit_counts[size_t(routine)].fetch_add(1,
+                                                    std::memory_order_relaxed);
+}
+
+// The host memmove and memset are already vectorized for the host CPU, and
+// guest bytes are copied as they are, so no swapping is needed.
+// memcpy of overlapping ranges is undefined, so memmove serves for both.
+void CopyGuestMemory(ppc::PPCContext* ppc_context) {
+  uint32_t dest = static_cast<uint32_t>(ppc_context->r[3]);
+  uint32_t src = static_cast<uint32_t>(ppc_context->r[4]);
+  uint32_t size = static_cast<uint32_t>(ppc_context->r[5]);
+  if (size) {
+    std::memmove(ppc_context->TranslateVirtual(dest),
+                 ppc_context->TranslateVirtual(src), size);
+  }
+  // r3 still holds the destination, which is the return value.
+}
+
+void SetGuestMemory(ppc::PPCContext* ppc_context) {
+  uint32_t dest = static_cast<uint32_t>(ppc_context->r[3]);
+  uint8_t value = static_cast<uint8_t>(ppc_context->r[4]);
+  uint32_t size = static_cast<uint32_t>(ppc_context->r[5]);
+  if (size) {
+    std::memset(ppc_context->TranslateVirtual(dest), value, size);
+  }
+}
+
+void NativeMemcpy(ppc::PPCContext* ppc_context,
+                  kernel::KernelState* kernel_state) {
+  CountHit(CrtRoutine::kMemcpy);
+  CopyGuestMemory(ppc_context);
+}
+
+void NativeMemmove(ppc::PPCContext* ppc_context,
+                   kernel::KernelState* kernel_state) {
+  CountHit(CrtRoutine::kMemmove);
+  CopyGuestMemory(ppc_context);
+}
+
+void NativeMemset(ppc::PPCContext* ppc_context,
+                  kernel::KernelState* kernel_state) {
+  CountHit(CrtRoutine::kMemset);
+  SetGuestMemory(ppc_context);
+}
+
+void NativeStrlen(ppc::PPCContext* ppc_context,
+                  kernel::KernelState* kernel_state) {
+  CountHit(CrtRoutine::kStrlen);
+  uint32_t str = static_cast<uint32_t>(ppc_context->r[3]);
+  ppc_context->r[3] =
+      std::strlen(ppc_context->TranslateVirtual<const char*>(str));
+}
+
+void NativeXMemCpy(ppc::PPCContext* ppc_context,
+                   kernel::KernelState* kernel_state) {
+  CountHit(CrtRoutine::kXMemCpy);
+  CopyGuestMemory(ppc_context);
+}
+
+void NativeXMemSet(ppc::PPCContext* ppc_context,
+                   kernel::KernelState* kernel_state) {
+  CountHit(CrtRoutine::kXMemSet);
+  SetGuestMemory(ppc_context);
+}
+
+struct CrtRoutineInfo {
+  const char* name;
+  GuestFunction::ExternHandler handler;
+};
+
+// In CrtRoutine order.
+const CrtRoutineInfo crt_routine_infos[] = {
+    {"memcpy", NativeMemcpy},   {"memmove", NativeMemmove},
+    {"memset", NativeMemset},   {"strlen", NativeStrlen},
+    {"XMemCpy", NativeXMemCpy}, {"XMemSet", NativeXMemSet},
+};
+static_assert(xe::countof(crt_routine_infos) == size_t(CrtRoutine::kCount));
+
+}  // namespace
+
+const char* GetCrtRoutineName(CrtRoutine routine) {
+  return crt_routine_infos[size_t(routine)].name;
+}
+
+bool LookupCrtRoutine(const std::string_view name, CrtRoutine* out_routine) {
+  for (size_t i = 0; i < xe::countof(crt_routine_infos); ++i) {
+    if (name == crt_routine_infos[i].name) {
+      *out_routine = CrtRoutine(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+GuestFunction::ExternHandler GetCrtRoutineHandler(CrtRoutine routine) {
+  return crt_routine_infos[size_t(routine)].handler;
+}
+
+uint64_t HashCrtRoutine(const uint8_t* code, uint32_t instruction_count) {
+  std::vector<uint32_t> words(instruction_count);
+  for (uint32_t i = 0; i < instruction_count; ++i) {
+    uint32_t word = xe::load_and_swap<uint32_t>(code + i * 4);
+    uint32_t target_mask = 0;
+    int32_t offset = 0;
+    if ((word >> 26) == 18) {
+      // b/ba/bl/bla.
+      target_mask = 0x03FFFFFC;
+      offset = (int32_t(word << 6) >> 6) & ~int32_t(0x3);
+    } else if ((word >> 26) == 16) {
+      // bc/bca/bcl/bcla.
+      target_mask = 0x0000FFFC;
+      offset = int32_t(int16_t(word & 0xFFFC));
+    }
+    if (target_mask) {
+      bool absolute = (word & 0x2) != 0;
+      bool link = (word & 0x1) != 0;
+      int64_t target = int64_t(i) * 4 + offset;
+      if (absolute || link || target < 0 ||
+          target >= int64_t(instruction_count) * 4) {
+        word &= ~target_mask;
+      }
+    }
+    words[i] = word;
+  }
+  return XXH3_64bits(words.data(), words.size() * sizeof(uint32_t));
+}
+
+uint64_t GetCrtRoutineHitCount(CrtRoutine routine) {
+  return crt_routine_hit_counts[size_t(routine)].load(
+      std::memory_order_relaxed);
+}
+
+void LogCrtRoutineHitCounts() {
+  for (size_t i = 0; i < size_t(CrtRoutine::kCount); ++i) {
+    uint64_t hit_count = GetCrtRoutineHitCount(CrtRoutine(i));
+    if (hit_count) {
+      XELOGI("Native {} replacement called {} times",
+             crt_routine_infos[i].name, hit_count);
+    }
+  }
+}
+
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,61 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_CRT_ROUTINES_H_
+#define XENIA_CPU_CRT_ROUTINES_H_
+
+#include <cstdint>
+#include <string_view>
+
+#include "xenia/cpu/function.h"
+
+namespace xe {
+namespace cpu {
+
+// C runtime routines statically linked into titles that can be replaced with
+// native implementations operating directly on guest memory.
+enum class CrtRoutine : uint32_t {
+  kMemcpy,
+  kMemmove,
+  kMemset,
+  kStrlen,
+  kXMemCpy,
+  kXMemSet,
+
+  kCount,
+};
+
+// Known guest implementation of a routine, recognized by the hash of its code
+// as returned by HashCrtRoutine.
+struct CrtRoutineSignature {
+  CrtRoutine routine;
+  uint64_t hash;
+  uint32_t instruction_count;
+};
+
+const char* GetCrtRoutineName(CrtRoutine routine);
+bool LookupCrtRoutine(const std::string_view name, CrtRoutine* out_routine);
+
+// Native replacement, taking the arguments from and returning the result in
+// the guest registers like the routine it replaces.
+GuestFunction::ExternHandler GetCrtRoutineHandler(CrtRoutine routine);
+
+// Hashes instruction_count big-endian guest instructions. The targets of calls
+// and of branches out of the routine are masked out, so the hash doesn't
+// depend on where the routine and its callees were linked.
+uint64_t HashCrtRoutine(const uint8_t* code, uint32_t instruction_count);
+
+// Number of times the native replacement of the routine has been called.
+uint64_t GetCrtRoutineHitCount(CrtRoutine routine);
+void LogCrtRoutineHitCounts();
+
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_CRT_ROUTINES_H_
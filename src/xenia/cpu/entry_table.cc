@@ -9,32 +9,92 @@
 
 #include "xenia/cpu/entry_table.h"
 
+#include <algorithm>
+
+#include "xenia/base/assert.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/threading.h"
 
 namespace xe {
 namespace cpu {
 
-EntryTable::EntryTable() = default;
+EntryTable::EntryTable() : pages_(new std::atomic<Page*>[kPageCount]()) {}
 
 EntryTable::~EntryTable() {
   auto global_lock = global_critical_region_.Acquire();
+  for (uint32_t i = 0; i < kPageCount; ++i) {
+    Page* page = pages_[i].load(std::memory_order_relaxed);
+    if (!page) {
+      continue;
+    }
+    for (auto& slot : page->entries) {
+      delete slot.load(std::memory_order_relaxed);
+    }
+    delete page;
+  }
   for (auto it : map_.Values()) {
     Entry* entry = it;
     delete entry;
   }
+  for (Entry* entry : retired_entries_) {
+    delete entry;
+  }
+}
+
+std::atomic<Entry*>* EntryTable::LookupSlot(uint32_t address, bool create) {
+  assert_true(IsDirectMapped(address));
+  uint32_t offset = address - kDirectBase;
+  std::atomic<Page*>& page_slot = pages_[offset >> kPageShift];
+  Page* page = page_slot.load(std::memory_order_acquire);
+  if (!page) {
+    if (!create) {
+      return nullptr;
+    }
+    Page* new_page = new Page();
+    if (page_slot.compare_exchange_strong(page, new_page,
+                                          std::memory_order_acq_rel,
+                                          std::memory_order_acquire)) {
+      page = new_page;
+    } else {
+      // Another thread allocated it first, page now points to theirs.
+      delete new_page;
+    }
+  }
+  return &page->entries[(offset & ((1u << kPageShift) - 1)) >> 2];
+}
+
+Entry::Status EntryTable::WaitForCompilation(Entry* entry) {
+  // The function is being translated on another thread (a guest thread or one
+  // of the precompilation threads), so spin until it's published.
+  Entry::Status status = entry->status.load(std::memory_order_acquire);
+  while (status == Entry::STATUS_COMPILING) {
+    // TODO(benvanik): sleep for less time?
+    xe::threading::Sleep(std::chrono::microseconds(10));
+    status = entry->status.load(std::memory_order_acquire);
+  }
+  return status;
 }
 
 Entry* EntryTable::Get(uint32_t address) {
-  auto global_lock = global_critical_region_.Acquire();
-  uint32_t idx = map_.IndexForKey(address);
-  if (idx == map_.size() || *map_.KeyAt(idx) != address) {
-    return nullptr;
+  Entry* entry;
+  if (IsDirectMapped(address)) {
+    std::atomic<Entry*>* slot = LookupSlot(address, false);
+    if (!slot) {
+      return nullptr;
+    }
+    entry = slot->load(std::memory_order_acquire);
+  } else {
+    auto global_lock = global_critical_region_.Acquire();
+    uint32_t idx = map_.IndexForKey(address);
+    if (idx == map_.size() || *map_.KeyAt(idx) != address) {
+      return nullptr;
+    }
+    entry = *map_.ValueAt(idx);
   }
-  Entry* entry = *map_.ValueAt(idx);
   if (entry) {
     // TODO(benvanik): wait if needed?
-    if (entry->status != Entry::STATUS_READY) {
+    if (entry->status.load(std::memory_order_acquire) !=
+        Entry::STATUS_READY) {
       entry = nullptr;
     }
   }
@@ -42,65 +102,116 @@ Entry* EntryTable::Get(uint32_t address) {
 }
 
 Entry::Status EntryTable::GetOrCreate(uint32_t address, Entry** out_entry) {
-  // TODO(benvanik): replace with a map with wait-free for find.
-  // https://github.com/facebook/folly/blob/master/folly/AtomicHashMap.h
-
-  auto global_lock = global_critical_region_.Acquire();
-
-  uint32_t idx = map_.IndexForKey(address);
-
-  Entry* entry = idx != map_.size() && *map_.KeyAt(idx) == address
-                     ? *map_.ValueAt(idx)
-                     : nullptr;
-  Entry::Status status;
-  if (entry) {
-    // If we aren't ready yet spin and wait.
-    if (entry->status == Entry::STATUS_COMPILING) {
-      // chrispy: i think this is dead code, if we are compiling we're holding
-      // the global lock, arent we? so we wouldnt be executing here
-      // Still compiling, so spin.
-      do {
-        global_lock.unlock();
-        // TODO(benvanik): sleep for less time?
-        xe::threading::Sleep(std::chrono::microseconds(10));
-        global_lock.lock();
-      } while (entry->status == Entry::STATUS_COMPILING);
+  Entry* entry;
+  if (IsDirectMapped(address)) {
+    std::atomic<Entry*>* slot = LookupSlot(address, true);
+    entry = slot->load(std::memory_order_acquire);
+    if (!entry) {
+      // Create and try to claim the slot for initialization.
+      Entry* new_entry = new Entry();
+      new_entry->address = address;
+      new_entry->end_address = 0;
+      new_entry->status = Entry::STATUS_COMPILING;
+      new_entry->function = nullptr;
+      if (slot->compare_exchange_strong(entry, new_entry,
+                                        std::memory_order_acq_rel,
+                                        std::memory_order_acquire)) {
+        *out_entry = new_entry;
+        return Entry::STATUS_NEW;
+      }
+      // Lost the race, entry now is the winner's and may still be compiling.
+      delete new_entry;
     }
-    status = entry->status;
   } else {
-    // Create and return for initialization.
-    entry = new Entry();
-    entry->address = address;
-    entry->end_address = 0;
-    entry->status = Entry::STATUS_COMPILING;
-    entry->function = 0;
-    map_.InsertAt(address, entry, idx);
-    // map_[address] = entry;
-    status = Entry::STATUS_NEW;
+    auto global_lock = global_critical_region_.Acquire();
+    uint32_t idx = map_.IndexForKey(address);
+    entry = idx != map_.size() && *map_.KeyAt(idx) == address
+                ? *map_.ValueAt(idx)
+                : nullptr;
+    if (!entry) {
+      entry = new Entry();
+      entry->address = address;
+      entry->end_address = 0;
+      entry->status = Entry::STATUS_COMPILING;
+      entry->function = nullptr;
+      map_.InsertAt(address, entry, idx);
+      *out_entry = entry;
+      return Entry::STATUS_NEW;
+    }
   }
-  global_lock.unlock();
   *out_entry = entry;
-  return status;
+  return WaitForCompilation(entry);
+}
+
+void EntryTable::MarkReady(Entry* entry, Function* function,
+                           uint32_t end_address) {
+  entry->function = function;
+  entry->end_address = end_address;
+  auto global_lock = global_critical_region_.Acquire();
+  // The entry may have been deleted while its function was being translated.
+  Entry* current_entry = nullptr;
+  if (IsDirectMapped(entry->address)) {
+    current_entry = LookupSlot(entry->address, false)->load(
+        std::memory_order_relaxed);
+  } else {
+    uint32_t idx = map_.IndexForKey(entry->address);
+    if (idx != map_.size() && *map_.KeyAt(idx) == entry->address) {
+      current_entry = *map_.ValueAt(idx);
+    }
+  }
+  if (current_entry == entry) {
+    uint32_t idx = ready_ranges_.IndexForKey(entry->address);
+    assert_true(idx == ready_ranges_.size() ||
+                *ready_ranges_.KeyAt(idx) != entry->address);
+    ready_ranges_.InsertAt(entry->address, entry, idx);
+    if (end_address >= entry->address) {
+      max_ready_range_size_ =
+          std::max(max_ready_range_size_, end_address - entry->address);
+    }
+  }
+  entry->status.store(Entry::STATUS_READY, std::memory_order_release);
 }
 
 void EntryTable::Delete(uint32_t address) {
+  Entry* entry = nullptr;
   auto global_lock = global_critical_region_.Acquire();
-  // doesnt this leak memory by not deleting the entry?
-  uint32_t idx = map_.IndexForKey(address);
-  if (idx != map_.size() && *map_.KeyAt(idx) == address) {
-    map_.EraseAt(idx);
+  if (IsDirectMapped(address)) {
+    std::atomic<Entry*>* slot = LookupSlot(address, false);
+    if (slot) {
+      entry = slot->exchange(nullptr, std::memory_order_acq_rel);
+    }
+  } else {
+    uint32_t idx = map_.IndexForKey(address);
+    if (idx != map_.size() && *map_.KeyAt(idx) == address) {
+      entry = *map_.ValueAt(idx);
+      map_.EraseAt(idx);
+    }
+  }
+  if (!entry) {
+    return;
+  }
+  retired_entries_.push_back(entry);
+  uint32_t idx = ready_ranges_.IndexForKey(address);
+  if (idx != ready_ranges_.size() && *ready_ranges_.ValueAt(idx) == entry) {
+    ready_ranges_.EraseAt(idx);
   }
 }
 
 std::vector<Function*> EntryTable::FindWithAddress(uint32_t address) {
-  auto global_lock = global_critical_region_.Acquire();
   std::vector<Function*> fns;
-  for (auto& it : map_.Values()) {
-    Entry* entry = it;
-    if (address >= entry->address && address <= entry->end_address) {
-      if (entry->status == Entry::STATUS_READY) {
-        fns.push_back(entry->function);
-      }
+  auto global_lock = global_critical_region_.Acquire();
+  // Walk back from the last entry starting at or before the address, until
+  // the entries start too far before it to reach it.
+  uint32_t lowest_start =
+      address - std::min(address, max_ready_range_size_);
+  auto& starts = ready_ranges_.Keys();
+  auto& entries = ready_ranges_.Values();
+  size_t idx = std::upper_bound(starts.begin(), starts.end(), address) -
+               starts.begin();
+  while (idx && starts[idx - 1] >= lowest_start) {
+    --idx;
+    if (address <= entries[idx]->end_address) {
+      fns.push_back(entries[idx]->function);
     }
   }
   return fns;
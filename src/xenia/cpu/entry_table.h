@@ -10,7 +10,8 @@
 #ifndef XENIA_CPU_ENTRY_TABLE_H_
 #define XENIA_CPU_ENTRY_TABLE_H_
 
-#include <unordered_map>
+#include <atomic>
+#include <memory>
 #include <vector>
 
 #include "xenia/base/mutex.h"
@@ -30,7 +31,8 @@ typedef struct Entry_t {
 
   uint32_t address;
   uint32_t end_address;
-  Status status;
+  // Published with release semantics after function and end_address are set.
+  std::atomic<Status> status;
   Function* function;
 } Entry;
 
@@ -41,15 +43,48 @@ class EntryTable {
 
   Entry* Get(uint32_t address);
   Entry::Status GetOrCreate(uint32_t address, Entry** out_entry);
+  // Publishes the function of an entry that GetOrCreate returned as
+  // STATUS_NEW.
+  void MarkReady(Entry* entry, Function* function, uint32_t end_address);
   void Delete(uint32_t address);
 
   std::vector<Function*> FindWithAddress(uint32_t address);
 
  private:
+  // Guest code normally lives in 0x80000000-0x9FFFFFFF. Entries there are kept
+  // in a direct-mapped table of lazily allocated pages, so lookups and
+  // insertion are lock-free. Anything else, including addresses that aren't
+  // instruction-aligned and would share a slot, falls back to the locked map.
+  static constexpr uint32_t kDirectBase = 0x80000000u;
+  static constexpr uint32_t kDirectSize = 0x20000000u;
+  static constexpr uint32_t kPageShift = 16;
+  static constexpr uint32_t kEntriesPerPage = (1u << kPageShift) / 4;
+  static constexpr uint32_t kPageCount = kDirectSize >> kPageShift;
+
+  struct Page {
+    std::atomic<Entry*> entries[kEntriesPerPage];
+  };
+
+  static bool IsDirectMapped(uint32_t address) {
+    return address - kDirectBase < kDirectSize && !(address & 3);
+  }
+  // Returns the slot of a direct-mapped address, or nullptr if create is false
+  // and the page hasn't been allocated.
+  std::atomic<Entry*>* LookupSlot(uint32_t address, bool create);
+  static Entry::Status WaitForCompilation(Entry* entry);
+
+  std::unique_ptr<std::atomic<Page*>[]> pages_;
+
   xe::global_critical_region global_critical_region_;
-  // TODO(benvanik): replace with a better data structure.
   xe::split_map<uint32_t, Entry*> map_;
-  //std::unordered_map<uint32_t, Entry*> map_;
+  // Entries removed from the table. Other threads may still be holding them,
+  // so they're only freed with the table. Guarded by the lock.
+  std::vector<Entry*> retired_entries_;
+  // Ready entries by start address, and the largest range among them, so that
+  // FindWithAddress only visits entries starting close enough to contain the
+  // address. Guarded by the lock.
+  xe::split_map<uint32_t, Entry*> ready_ranges_;
+  uint32_t max_ready_range_size_ = 0;
 };
 
 }  // namespace cpu
@@ -10,6 +10,7 @@
 #ifndef XENIA_CPU_FUNCTION_H_
 #define XENIA_CPU_FUNCTION_H_
 
+#include <atomic>
 #include <memory>
 #include <vector>
 
@@ -119,6 +120,18 @@ class GuestFunction : public Function {
   typedef void (*ExternHandler)(ppc::PPCContext* ppc_context,
                                 kernel::KernelState* kernel_state);
 
+  // With tiered compilation, functions are first translated with only the
+  // passes required for correctness, and the baseline code counts its calls.
+  // Once it's hot the function is retranslated with all optimizations.
+  enum class Tier {
+    kBaseline,
+    // Baseline code which has been queued for retranslation.
+    kTieringUp,
+    // Baseline code superseded by the code of optimized_tier().
+    kTieredUp,
+    kOptimized,
+  };
+
   GuestFunction(Module* module, uint32_t address);
   ~GuestFunction() override;
 
@@ -127,6 +140,19 @@ class GuestFunction : public Function {
   uint32_t end_address() const { return end_address_; }
   void set_end_address(uint32_t value) { end_address_ = value; }
 
+  Tier tier() const { return tier_; }
+  void set_tier(Tier tier) { tier_ = tier; }
+  bool ChangeTier(Tier from, Tier to) {
+    return tier_.compare_exchange_strong(from, to);
+  }
+  // Optimized translation of a tiered up function, with its own machine code
+  // and source map. The baseline code and everything describing it stay valid
+  // for the threads still running it.
+  GuestFunction* optimized_tier() const { return optimized_tier_.get(); }
+  void set_optimized_tier(std::unique_ptr<GuestFunction> optimized_tier) {
+    optimized_tier_ = std::move(optimized_tier);
+  }
+
   virtual uint8_t* machine_code() const = 0;
   virtual size_t machine_code_length() const = 0;
 
@@ -160,6 +186,8 @@ class GuestFunction : public Function {
   std::vector<SourceMapEntry> source_map_;
   ExternHandler extern_handler_ = nullptr;
   Export* export_data_ = nullptr;
+  std::atomic<Tier> tier_ = Tier::kOptimized;
+  std::unique_ptr<GuestFunction> optimized_tier_;
 };
 
 }  // namespace cpu
@@ -0,0 +1,257 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/guest_profiler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "third_party/fmt/include/fmt/format.h"
+#include "xenia/base/assert.h"
+#include "xenia/base/cvar.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/cpu/backend/backend.h"
+#include "xenia/cpu/backend/code_cache.h"
+#include "xenia/cpu/function.h"
+
+DEFINE_path(guest_profile_path, "",
+            "Sample where guest code spends time, and write the profile to "
+            "this file on exit as folded stacks for flame graph tools. The "
+            "hottest functions are listed in a .functions.txt file next to "
+            "it.",
+            "CPU");
+DEFINE_int32(guest_profile_interval, 1000,
+             "Interval between guest profiler samples, in microseconds of "
+             "process CPU time.",
+             "CPU");
+
+namespace xe {
+namespace cpu {
+
+GuestProfiler::GuestProfiler(backend::Backend* backend) : backend_(backend) {}
+
+GuestProfiler::~GuestProfiler() { assert_null(drain_thread_); }
+
+bool GuestProfiler::Initialize(const std::filesystem::path& path) {
+  path_ = path;
+  sample_buffer_.reset(new SampleSlot[kSampleBufferSize]);
+  for (size_t i = 0; i < kSampleBufferSize; ++i) {
+    sample_buffer_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  shutdown_event_ = xe::threading::Event::CreateManualResetEvent(false);
+  drain_thread_ =
+      xe::threading::Thread::Create({}, [this]() { DrainThread(); });
+  if (!drain_thread_) {
+    return false;
+  }
+  drain_thread_->set_name("Guest Profiler");
+
+  uint32_t interval_us = uint32_t(std::max(cvars::guest_profile_interval, 1));
+  if (!StartSampling(interval_us)) {
+    XELOGE("Unable to start the guest profiler");
+    shutdown_event_->Set();
+    xe::threading::Wait(drain_thread_.get(), false);
+    drain_thread_.reset();
+    return false;
+  }
+  XELOGI("Guest profiler sampling every {}us, writing to {}", interval_us,
+         xe::path_to_utf8(path_));
+  return true;
+}
+
+void GuestProfiler::Shutdown() {
+  if (!drain_thread_) {
+    return;
+  }
+  StopSampling();
+  shutdown_event_->Set();
+  xe::threading::Wait(drain_thread_.get(), false);
+  drain_thread_.reset();
+  DrainSamples();
+  WriteProfile();
+}
+
+void GuestProfiler::RecordSample(uint64_t host_pc, uint64_t host_sp) {
+  uint64_t frame_host_pcs[kMaxFrames];
+  size_t frame_count = backend_->CaptureGuestFrames(host_pc, host_sp,
+                                                    frame_host_pcs, kMaxFrames);
+  if (!frame_count) {
+    host_sample_count_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  uint64_t position = sample_write_position_.load(std::memory_order_relaxed);
+  for (;;) {
+    SampleSlot& slot = sample_buffer_[position & (kSampleBufferSize - 1)];
+    uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+    if (sequence == position) {
+      if (sample_write_position_.compare_exchange_weak(
+              position, position + 1, std::memory_order_relaxed)) {
+        slot.frame_count = uint32_t(frame_count);
+        std::memcpy(slot.frame_host_pcs, frame_host_pcs,
+                    sizeof(uint64_t) * frame_count);
+        slot.sequence.store(position + 1, std::memory_order_release);
+        return;
+      }
+    } else if (sequence < position) {
+      // The slot still holds a sample from the previous lap.
+      dropped_sample_count_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    } else {
+      position = sample_write_position_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+void GuestProfiler::DrainThread() {
+  while (xe::threading::Wait(shutdown_event_.get(), false,
+                             std::chrono::milliseconds(50)) ==
+         xe::threading::WaitResult::kTimeout) {
+    DrainSamples();
+  }
+}
+
+void GuestProfiler::DrainSamples() {
+  std::vector<uint64_t> stack;
+  for (;;) {
+    SampleSlot& slot =
+        sample_buffer_[sample_read_position_ & (kSampleBufferSize - 1)];
+    if (slot.sequence.load(std::memory_order_acquire) !=
+        sample_read_position_ + 1) {
+      break;
+    }
+    stack.assign(slot.frame_host_pcs, slot.frame_host_pcs + slot.frame_count);
+    slot.sequence.store(sample_read_position_ + kSampleBufferSize,
+                        std::memory_order_release);
+    ++sample_read_position_;
+    ++stack_counts_[stack];
+  }
+}
+
+bool GuestProfiler::WriteProfile() {
+  auto code_cache = backend_->code_cache();
+
+  struct FunctionStats {
+    GuestFunction* function = nullptr;
+    uint64_t self_count = 0;
+    uint64_t total_count = 0;
+    std::unordered_map<uint32_t, uint64_t> self_guest_pc_counts;
+  };
+  std::unordered_map<GuestFunction*, FunctionStats> function_stats;
+  std::map<std::string, uint64_t> folded_stacks;
+  uint64_t guest_sample_count = 0;
+
+  std::unordered_set<GuestFunction*> stack_functions;
+  std::string folded_stack;
+  for (const auto& [stack, count] : stack_counts_) {
+    guest_sample_count += count;
+    stack_functions.clear();
+    folded_stack.clear();
+    // Folded stacks list the outermost frame first.
+    for (size_t i = stack.size(); i-- > 0;) {
+      GuestFunction* function = code_cache->LookupFunction(stack[i]);
+      if (!folded_stack.empty()) {
+        folded_stack.push_back(';');
+      }
+      if (!function) {
+        folded_stack += "[unknown]";
+        continue;
+      }
+      if (function->name().empty()) {
+        folded_stack += fmt::format("sub_{:08X}", function->address());
+      } else {
+        folded_stack += function->name();
+      }
+      auto& stats = function_stats[function];
+      stats.function = function;
+      // Recursive functions are counted once per sample.
+      if (stack_functions.insert(function).second) {
+        stats.total_count += count;
+      }
+      if (!i) {
+        stats.self_count += count;
+        stats.self_guest_pc_counts[function->MapMachineCodeToGuestAddress(
+            uintptr_t(stack[i]))] += count;
+      }
+    }
+    folded_stacks[folded_stack] += count;
+  }
+  uint64_t host_sample_count = host_sample_count_.load();
+  if (host_sample_count) {
+    folded_stacks["[host]"] += host_sample_count;
+  }
+
+  FILE* file = xe::filesystem::OpenFile(path_, "w");
+  if (!file) {
+    XELOGE("Unable to open guest profile {} for writing",
+           xe::path_to_utf8(path_));
+    return false;
+  }
+  for (const auto& [stack, count] : folded_stacks) {
+    fmt::print(file, "{} {}\n", stack, count);
+  }
+  fclose(file);
+
+  std::vector<const FunctionStats*> hottest_functions;
+  hottest_functions.reserve(function_stats.size());
+  for (const auto& it : function_stats) {
+    hottest_functions.push_back(&it.second);
+  }
+  std::sort(hottest_functions.begin(), hottest_functions.end(),
+            [](const FunctionStats* a, const FunctionStats* b) {
+              if (a->self_count != b->self_count) {
+                return a->self_count > b->self_count;
+              }
+              return a->total_count > b->total_count;
+            });
+
+  auto functions_path = path_;
+  functions_path += ".functions.txt";
+  file = xe::filesystem::OpenFile(functions_path, "w");
+  if (!file) {
+    XELOGE("Unable to open guest profile {} for writing",
+           xe::path_to_utf8(functions_path));
+    return false;
+  }
+  double sample_scale = 100.0 / double(std::max(
+                                    guest_sample_count + host_sample_count,
+                                    uint64_t(1)));
+  fmt::print(file, "# {} guest samples, {} host samples, {} dropped\n",
+             guest_sample_count, host_sample_count,
+             dropped_sample_count_.load());
+  fmt::print(file, "# self  self%  total  total%  address   hottest   name\n");
+  for (const FunctionStats* stats : hottest_functions) {
+    uint32_t hottest_guest_pc = 0;
+    uint64_t hottest_guest_pc_count = 0;
+    for (const auto& [guest_pc, count] : stats->self_guest_pc_counts) {
+      if (count > hottest_guest_pc_count) {
+        hottest_guest_pc = guest_pc;
+        hottest_guest_pc_count = count;
+      }
+    }
+    fmt::print(file, "{} {:.2f} {} {:.2f} {:08X} {:08X} {}\n",
+               stats->self_count, stats->self_count * sample_scale,
+               stats->total_count, stats->total_count * sample_scale,
+               stats->function->address(), hottest_guest_pc,
+               stats->function->name());
+  }
+  fclose(file);
+
+  XELOGI("Guest profiler wrote {} guest samples ({} host, {} dropped) to {}",
+         guest_sample_count, host_sample_count, dropped_sample_count_.load(),
+         xe::path_to_utf8(path_));
+  return true;
+}
+
+}  // namespace cpu
+}  // namespace xe
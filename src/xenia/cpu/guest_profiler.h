@@ -0,0 +1,97 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_GUEST_PROFILER_H_
+#define XENIA_CPU_GUEST_PROFILER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "xenia/base/threading.h"
+
+namespace xe {
+namespace cpu {
+namespace backend {
+class Backend;
+}  // namespace backend
+
+// Statistical profiler of guest code. A platform sample source interrupts the
+// threads running code periodically, and the guest frames of each sample are
+// walked with the backend. On shutdown, the samples are mapped to guest
+// functions and written as folded stacks (for flame graph tools) along with a
+// flat list of the hottest functions.
+class GuestProfiler {
+ public:
+  // Creates and starts the profiler if guest_profile_path is set. Returns
+  // nullptr if it's disabled or unsupported on the host.
+  static std::unique_ptr<GuestProfiler> Create(backend::Backend* backend);
+
+  virtual ~GuestProfiler();
+
+  // Stops sampling and writes the profile. Must be called while all guest
+  // functions are still alive.
+  void Shutdown();
+
+ protected:
+  explicit GuestProfiler(backend::Backend* backend);
+
+  bool Initialize(const std::filesystem::path& path);
+
+  virtual bool StartSampling(uint32_t interval_us) = 0;
+  virtual void StopSampling() = 0;
+
+  // Records a sample of the calling thread, interrupted at the given host
+  // context. Safe to call from a signal handler.
+  void RecordSample(uint64_t host_pc, uint64_t host_sp);
+
+ private:
+  static constexpr size_t kMaxFrames = 32;
+  // Must be a power of two.
+  static constexpr size_t kSampleBufferSize = 4096;
+
+  // Slot of the bounded multiple-producer, single-consumer sample queue.
+  struct SampleSlot {
+    // Equals the queue position when free for writing, and the position + 1
+    // once the sample has been written.
+    std::atomic<uint64_t> sequence;
+    uint32_t frame_count;
+    uint64_t frame_host_pcs[kMaxFrames];
+  };
+
+  void DrainThread();
+  void DrainSamples();
+  bool WriteProfile();
+
+  backend::Backend* backend_;
+  std::filesystem::path path_;
+
+  std::unique_ptr<SampleSlot[]> sample_buffer_;
+  std::atomic<uint64_t> sample_write_position_ = {0};
+  uint64_t sample_read_position_ = 0;
+  // Samples lost because the drain thread couldn't keep up.
+  std::atomic<uint64_t> dropped_sample_count_ = {0};
+  // Samples interrupting host code instead of guest code.
+  std::atomic<uint64_t> host_sample_count_ = {0};
+
+  std::unique_ptr<xe::threading::Event> shutdown_event_;
+  std::unique_ptr<xe::threading::Thread> drain_thread_;
+
+  // Aggregated host PC stacks, innermost first. Only accessed by the drain
+  // thread, and after it has exited.
+  std::map<std::vector<uint64_t>, uint64_t> stack_counts_;
+};
+
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_GUEST_PROFILER_H_
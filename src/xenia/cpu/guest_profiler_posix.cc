@@ -0,0 +1,132 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/guest_profiler.h"
+
+#include <signal.h>
+#include <sys/time.h>
+#include <ucontext.h>
+#include <cerrno>
+
+#include "xenia/base/cvar.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/platform.h"
+#include "xenia/base/threading.h"
+
+DECLARE_path(guest_profile_path);
+
+namespace xe {
+namespace cpu {
+
+// Samples the thread consuming CPU time with SIGPROF from a process-wide
+// profiling timer, so sampling is proportional to where time is spent.
+class PosixGuestProfiler : public GuestProfiler {
+ public:
+  explicit PosixGuestProfiler(backend::Backend* backend)
+      : GuestProfiler(backend) {}
+  ~PosixGuestProfiler() override { StopSampling(); }
+
+ protected:
+  bool StartSampling(uint32_t interval_us) override;
+  void StopSampling() override;
+
+ private:
+  static void SignalHandler(int signal_number, siginfo_t* signal_info,
+                            void* signal_context);
+
+  // Only one profiler may receive SIGPROF.
+  static std::atomic<PosixGuestProfiler*> active_profiler_;
+  // Signal handlers currently using active_profiler_.
+  static std::atomic<uint32_t> active_handler_count_;
+
+  bool sampling_ = false;
+  struct sigaction original_sigprof_handler_ = {};
+};
+
+std::atomic<PosixGuestProfiler*> PosixGuestProfiler::active_profiler_ = {
+    nullptr};
+std::atomic<uint32_t> PosixGuestProfiler::active_handler_count_ = {0};
+
+bool PosixGuestProfiler::StartSampling(uint32_t interval_us) {
+  PosixGuestProfiler* expected = nullptr;
+  if (!active_profiler_.compare_exchange_strong(expected, this)) {
+    XELOGE("Only one guest profiler can run at a time");
+    return false;
+  }
+
+  struct sigaction action = {};
+  action.sa_flags = SA_SIGINFO | SA_RESTART;
+  action.sa_sigaction = SignalHandler;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGPROF, &action, &original_sigprof_handler_) == -1) {
+    active_profiler_ = nullptr;
+    return false;
+  }
+
+  struct itimerval timer = {};
+  timer.it_interval.tv_sec = interval_us / 1000000;
+  timer.it_interval.tv_usec = interval_us % 1000000;
+  timer.it_value = timer.it_interval;
+  if (setitimer(ITIMER_PROF, &timer, nullptr) == -1) {
+    sigaction(SIGPROF, &original_sigprof_handler_, nullptr);
+    active_profiler_ = nullptr;
+    return false;
+  }
+  sampling_ = true;
+  return true;
+}
+
+void PosixGuestProfiler::StopSampling() {
+  if (!sampling_) {
+    return;
+  }
+  sampling_ = false;
+  struct itimerval timer = {};
+  setitimer(ITIMER_PROF, &timer, nullptr);
+  sigaction(SIGPROF, &original_sigprof_handler_, nullptr);
+  active_profiler_ = nullptr;
+  // Wait for handlers still running on other threads.
+  while (active_handler_count_.load()) {
+    xe::threading::MaybeYield();
+  }
+}
+
+void PosixGuestProfiler::SignalHandler(int signal_number,
+                                       siginfo_t* signal_info,
+                                       void* signal_context) {
+  int saved_errno = errno;
+  ++active_handler_count_;
+  PosixGuestProfiler* profiler = active_profiler_.load();
+  if (profiler) {
+#if XE_ARCH_AMD64
+    mcontext_t& mcontext =
+        reinterpret_cast<ucontext_t*>(signal_context)->uc_mcontext;
+    profiler->RecordSample(uint64_t(mcontext.gregs[REG_RIP]),
+                           uint64_t(mcontext.gregs[REG_RSP]));
+#endif  // XE_ARCH_AMD64
+  }
+  --active_handler_count_;
+  errno = saved_errno;
+}
+
+std::unique_ptr<GuestProfiler> GuestProfiler::Create(
+    backend::Backend* backend) {
+  if (cvars::guest_profile_path.empty()) {
+    return nullptr;
+  }
+  std::unique_ptr<PosixGuestProfiler> profiler(
+      new PosixGuestProfiler(backend));
+  if (!profiler->Initialize(cvars::guest_profile_path)) {
+    return nullptr;
+  }
+  return profiler;
+}
+
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,29 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/guest_profiler.h"
+
+#include "xenia/base/cvar.h"
+#include "xenia/base/logging.h"
+
+DECLARE_path(guest_profile_path);
+
+namespace xe {
+namespace cpu {
+
+std::unique_ptr<GuestProfiler> GuestProfiler::Create(
+    backend::Backend* backend) {
+  if (!cvars::guest_profile_path.empty()) {
+    XELOGW("Guest profiler unimplemented on Windows");
+  }
+  return nullptr;
+}
+
+}  // namespace cpu
+}  // namespace xe
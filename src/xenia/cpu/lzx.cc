@@ -68,6 +68,15 @@ int mspack_memory_write(mspack_file* file, void* buffer, int chars) {
   return (int)total;
 }
 
+typedef struct mspack_stream_file_t {
+  const std::function<int(void*, int)>* read;
+} mspack_stream_file;
+
+int mspack_stream_read(mspack_file* file, void* buffer, int chars) {
+  auto streamfile = (mspack_stream_file*)file;
+  return (*streamfile->read)(buffer, chars);
+}
+
 void* mspack_memory_alloc(mspack_system* sys, size_t chars) {
   return std::calloc(chars, 1);
 }
@@ -145,6 +154,38 @@ int lzx_decompress(const void* lzx_data, size_t lzx_len, void* dest,
   return result_code;
 }
 
+int lzx_decompress_stream(const std::function<int(void*, int)>& read,
+                          void* dest, size_t dest_len, uint32_t window_size) {
+  int result_code = 1;
+
+  uint32_t window_bits;
+  if (!xe::bit_scan_forward(window_size, &window_bits)) {
+    return result_code;
+  }
+
+  mspack_system* sys = mspack_memory_sys_create();
+  if (!sys) {
+    return result_code;
+  }
+  // The input is only ever passed to read, and the output to write.
+  sys->read = mspack_stream_read;
+  mspack_stream_file lzxsrc = {&read};
+  mspack_memory_file* lzxdst = mspack_memory_open(sys, dest, dest_len);
+  if (lzxdst) {
+    lzxd_stream* lzxd =
+        lzxd_init(sys, (mspack_file*)&lzxsrc, (mspack_file*)lzxdst,
+                  window_bits, 0, 0x8000, (off_t)dest_len, 0);
+    if (lzxd) {
+      result_code = lzxd_decompress(lzxd, (off_t)dest_len);
+      lzxd_free(lzxd);
+    }
+    mspack_memory_close(lzxdst);
+  }
+
+  mspack_memory_sys_destroy(sys);
+  return result_code;
+}
+
 int lzxdelta_apply_patch(xe::xex2_delta_patch* patch, size_t patch_len,
                          uint32_t window_size, void* dest) {
   void* patch_end = (char*)patch + patch_len;
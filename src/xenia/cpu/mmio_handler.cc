@@ -24,6 +24,8 @@ namespace xe {
 namespace cpu {
 
 MMIOHandler* MMIOHandler::global_handler_ = nullptr;
+thread_local const HostThreadContext* MMIOHandler::current_access_context_ =
+    nullptr;
 
 std::unique_ptr<MMIOHandler> MMIOHandler::Install(
     uint8_t* virtual_membase, uint8_t* physical_membase, uint8_t* membase_end,
@@ -492,6 +494,8 @@ bool MMIOHandler::ExceptionCallback(Exception* ex) {
   }
 #endif  // XE_ARCH_ARM64
 
+  // Lets the callbacks find the guest code doing the access.
+  current_access_context_ = &thread_context;
   uint8_t value_reg = decoded_load_store.value_reg;
   if (decoded_load_store.is_load) {
     // Load of a memory value - read from range, swap, and store in the
@@ -552,6 +556,7 @@ bool MMIOHandler::ExceptionCallback(Exception* ex) {
     range->write(nullptr, range->callback_context, fault_guest_virtual_address,
                  value);
   }
+  current_access_context_ = nullptr;
 
 #if XE_ARCH_ARM64
   // Write the base address with the pre- or the post-index offset, overwriting
@@ -62,6 +62,11 @@ class MMIOHandler {
       void* access_violation_callback_context,
       MmioAccessRecordCallback record_mmio_callback, void* record_mmio_context);
   static MMIOHandler* global_handler() { return global_handler_; }
+  // Host context of the guest access the range callbacks are being called for
+  // on this thread, or nullptr outside of an access.
+  static const HostThreadContext* current_access_context() {
+    return current_access_context_;
+  }
 
   bool RegisterRange(uint32_t virtual_address, uint32_t mask, uint32_t size,
                      void* context, MMIOReadCallback read_callback,
@@ -103,6 +108,7 @@ class MMIOHandler {
 
   void* record_mmio_context_;
   static MMIOHandler* global_handler_;
+  static thread_local const HostThreadContext* current_access_context_;
 
   xe::global_critical_region global_critical_region_;
 
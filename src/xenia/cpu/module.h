@@ -37,6 +37,10 @@ class Module {
   virtual bool is_executable() const = 0;
 
   virtual bool ContainsAddress(uint32_t address);
+  // Returns the contiguous range ContainsAddress accepts, if there is one, so
+  // the processor can binary search it. Call Processor::UpdateModuleRanges
+  // after changing it on a module that was already added.
+  virtual bool GetAddressRange(uint32_t* out_low, uint32_t* out_size);
 
   Symbol* LookupSymbol(uint32_t address, bool wait = true);
   virtual Symbol::Status DeclareFunction(uint32_t address,
@@ -79,6 +79,10 @@ int InstrEmit_branch(PPCHIRBuilder& f, const char* src, uint64_t cia,
       } else {
         f.Branch(label, branch_flags);
       }
+    } else if (lk && !cond && f.TryInlineCall(nia_value)) {
+      // Small leaf function emitted in place of the call.
+    } else if (lk && !cond && f.TryInlineExportCall(nia_value, call_flags)) {
+      // Kernel export fast path emitted in place of the call.
     } else {
       // Call function.
       auto function = f.LookupFunction(nia_value);
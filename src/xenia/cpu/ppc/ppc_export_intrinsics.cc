@@ -0,0 +1,148 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/ppc/ppc_export_intrinsics.h"
+
+#include <cstring>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/math.h"
+#include "xenia/cpu/ppc/ppc_hir_builder.h"
+
+namespace xe {
+namespace cpu {
+namespace ppc {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Label;
+using xe::cpu::hir::Value;
+
+namespace {
+
+// X_KPCR, pointed to by r13.
+constexpr uint64_t kPcrCurrentThreadOffset = 0x100;
+
+// X_RTL_CRITICAL_SECTION. lock_count is only accessed by the kernel, and is
+// -1 when the section is free and 0 when it's owned without waiters, which
+// are the same in either byte order.
+constexpr uint64_t kCriticalSectionLockCountOffset = 0x10;
+constexpr uint64_t kCriticalSectionRecursionCountOffset = 0x14;
+constexpr uint64_t kCriticalSectionOwningThreadOffset = 0x18;
+// Big-endian 1.
+constexpr uint32_t kRecursionCountOne = 0x01000000;
+
+// Loads the critical section pointer argument, branching to slow_path if it's
+// null so that the export reports it.
+Value* LoadCriticalSection(PPCHIRBuilder& f, Label* slow_path) {
+  Value* cs = f.ZeroExtend(f.Truncate(f.LoadGPR(3), INT32_TYPE), INT64_TYPE);
+  f.BranchFalse(f.IsTrue(cs), slow_path);
+  return cs;
+}
+
+// Big-endian guest pointer of the current X_KTHREAD.
+Value* LoadCurrentThread(PPCHIRBuilder& f) {
+  return f.LoadOffset(f.LoadGPR(13),
+                      f.LoadConstantUint64(kPcrCurrentThreadOffset),
+                      INT32_TYPE);
+}
+
+void StoreOwner(PPCHIRBuilder& f, Value* cs, Value* thread,
+                uint32_t recursion_count) {
+  f.StoreOffset(cs, f.LoadConstantUint64(kCriticalSectionOwningThreadOffset),
+                thread);
+  f.StoreOffset(cs, f.LoadConstantUint64(kCriticalSectionRecursionCountOffset),
+                f.LoadConstantUint32(recursion_count));
+}
+
+// Tries to take a free critical section, branching to slow_path if it's
+// already owned, including by the current thread.
+void EmitAcquireFreeCriticalSection(PPCHIRBuilder& f, Label* slow_path) {
+  Value* cs = LoadCriticalSection(f, slow_path);
+  Value* acquired = f.AtomicCompareExchange(
+      f.Add(cs, f.LoadConstantUint64(kCriticalSectionLockCountOffset)),
+      f.LoadConstantInt32(-1), f.LoadConstantInt32(0));
+  f.BranchFalse(acquired, slow_path);
+  StoreOwner(f, cs, LoadCurrentThread(f), kRecursionCountOne);
+}
+
+void EmitRtlEnterCriticalSection(PPCHIRBuilder& f, Label* slow_path) {
+  EmitAcquireFreeCriticalSection(f, slow_path);
+}
+
+void EmitRtlTryEnterCriticalSection(PPCHIRBuilder& f, Label* slow_path) {
+  EmitAcquireFreeCriticalSection(f, slow_path);
+  f.StoreGPR(3, f.LoadConstantUint64(1));
+}
+
+void EmitRtlLeaveCriticalSection(PPCHIRBuilder& f, Label* slow_path) {
+  Value* cs = LoadCriticalSection(f, slow_path);
+  // Nested leaves only decrement the counts, but they're rare enough.
+  Value* recursion_count = f.LoadOffset(
+      cs, f.LoadConstantUint64(kCriticalSectionRecursionCountOffset),
+      INT32_TYPE);
+  f.BranchFalse(
+      f.CompareEQ(recursion_count, f.LoadConstantUint32(kRecursionCountOne)),
+      slow_path);
+  // The owner must be cleared before the section can be taken by another
+  // thread.
+  StoreOwner(f, cs, f.LoadZeroInt32(), 0);
+  Value* released = f.AtomicCompareExchange(
+      f.Add(cs, f.LoadConstantUint64(kCriticalSectionLockCountOffset)),
+      f.LoadConstantInt32(0), f.LoadConstantInt32(-1));
+  Label* released_label = f.NewLabel();
+  f.BranchTrue(released, released_label);
+  // There are waiters. Nobody else could take the section meanwhile, so give
+  // it back to the export to wake one of them.
+  StoreOwner(f, cs, LoadCurrentThread(f), kRecursionCountOne);
+  f.Branch(slow_path);
+  f.MarkLabel(released_label);
+}
+
+struct ExportIntrinsic {
+  const char* name;
+  void (*emit)(PPCHIRBuilder& f, Label* slow_path);
+};
+
+const ExportIntrinsic export_intrinsics[] = {
+    {"RtlEnterCriticalSection", EmitRtlEnterCriticalSection},
+    {"RtlTryEnterCriticalSection", EmitRtlTryEnterCriticalSection},
+    {"RtlLeaveCriticalSection", EmitRtlLeaveCriticalSection},
+};
+
+const ExportIntrinsic* LookupExportIntrinsic(const Export* export_data) {
+  if (!export_data || !export_data->is_implemented() ||
+      !(export_data->tags & ExportTag::kHighFrequency)) {
+    return nullptr;
+  }
+  for (size_t i = 0; i < xe::countof(export_intrinsics); ++i) {
+    if (!std::strcmp(export_data->name, export_intrinsics[i].name)) {
+      return &export_intrinsics[i];
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+bool HasExportIntrinsic(const Export* export_data) {
+  return LookupExportIntrinsic(export_data) != nullptr;
+}
+
+void EmitExportIntrinsic(PPCHIRBuilder& f, const Export* export_data,
+                         Label* slow_path) {
+  auto intrinsic = LookupExportIntrinsic(export_data);
+  assert_not_null(intrinsic);
+  intrinsic->emit(f, slow_path);
+}
+
+}  // namespace ppc
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,36 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_PPC_PPC_EXPORT_INTRINSICS_H_
+#define XENIA_CPU_PPC_PPC_EXPORT_INTRINSICS_H_
+
+#include "xenia/cpu/export_resolver.h"
+#include "xenia/cpu/hir/label.h"
+
+namespace xe {
+namespace cpu {
+namespace ppc {
+
+class PPCHIRBuilder;
+
+// Whether the uncontended case of a kHighFrequency export can be emitted at
+// its call sites instead of going through the guest-to-host thunk.
+bool HasExportIntrinsic(const Export* export_data);
+
+// Emits the fast path of the export with its arguments in the guest
+// registers. Falls through when the call is done, and branches to slow_path
+// with the guest state unchanged when the export has to be called after all.
+void EmitExportIntrinsic(PPCHIRBuilder& f, const Export* export_data,
+                         hir::Label* slow_path);
+
+}  // namespace ppc
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_PPC_PPC_EXPORT_INTRINSICS_H_
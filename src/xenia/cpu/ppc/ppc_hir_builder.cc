@@ -24,8 +24,10 @@
 #include "xenia/cpu/hir/label.h"
 #include "xenia/cpu/ppc/ppc_context.h"
 #include "xenia/cpu/ppc/ppc_decode_data.h"
+#include "xenia/cpu/ppc/ppc_export_intrinsics.h"
 #include "xenia/cpu/ppc/ppc_frontend.h"
 #include "xenia/cpu/ppc/ppc_opcode_info.h"
+#include "xenia/cpu/ppc/ppc_scanner.h"
 #include "xenia/cpu/processor.h"
 #include "xenia/cpu/xex_module.h"
 DEFINE_bool(
@@ -33,6 +35,15 @@ DEFINE_bool(
     "Break to the host debugger (or crash if no debugger attached) if an "
     "unimplemented PowerPC instruction is encountered.",
     "CPU");
+DEFINE_int32(inline_leaf_function_size, 0,
+             "Inline direct calls to leaf guest functions of up to this many "
+             "instructions into their callers. 0 to disable.",
+             "CPU");
+DEFINE_bool(inline_export_fast_paths, true,
+            "Emit the uncontended case of frequently called kernel exports, "
+            "such as entering and leaving critical sections, at their call "
+            "sites instead of calling the export.",
+            "CPU");
 
 namespace xe {
 namespace cpu {
@@ -79,14 +90,14 @@ void PPCHIRBuilder::Reset() {
   instr_offset_list_ = NULL;
   label_list_ = NULL;
   with_debug_info_ = false;
+  inline_calls_ = false;
+  inline_return_label_ = nullptr;
   HIRBuilder::Reset();
 }
 
 bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
   SCOPE_profile_cpu_f("cpu");
 
-  Memory* memory = frontend_->memory();
-
   function_ = function;
   start_address_ = function_->address();
   // chrispy: i've seen this one happen, not sure why but i think from trying to
@@ -117,8 +128,19 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
   // Always mark entry with label.
   label_list_[0] = NewLabel();
 
-  uint32_t start_address = function_->address();
-  uint32_t end_address = function_->end_address();
+  inline_calls_ = (flags & EMIT_INLINE_CALLS) == EMIT_INLINE_CALLS;
+  EmitInstructions(function_->address(), function_->end_address());
+
+  if (false) {
+    DumpAllOpcodeCounts();
+  }
+
+  return Finalize();
+}
+
+void PPCHIRBuilder::EmitInstructions(uint32_t start_address,
+                                     uint32_t end_address) {
+  Memory* memory = frontend_->memory();
   for (uint32_t address = start_address, offset = 0; address <= end_address;
        address += 4, offset++) {
     trace_info_.dest_count = 0;
@@ -157,6 +179,12 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
     // Stash instruction offset. It's either the SOURCE_OFFSET or the COMMENT.
     instr_offset_list_[offset] = first_instr;
 
+    if (inline_return_label_ && code == 0x4E800020) {
+      // blr of an inlined function, continue after the call site.
+      Branch(inline_return_label_);
+      continue;
+    }
+
     if (opcode == PPCOpcode::kInvalid) {
       XELOGE("Invalid instruction {:08X} {:08X}", address, code);
       Comment("INVALID!");
@@ -191,12 +219,85 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
       }
     }
   }
+}
 
-  if (false) {
-    DumpAllOpcodeCounts();
+bool PPCHIRBuilder::TryInlineCall(uint32_t target_address) {
+  if (!inline_calls_ || inline_return_label_ ||
+      target_address == function_->address()) {
+    return false;
+  }
+  Function* target = LookupFunction(target_address);
+  if (!target || !target->is_guest() ||
+      target->behavior() != Function::Behavior::kDefault ||
+      target->module() != function_->module()) {
+    return false;
+  }
+  uint32_t target_end_address;
+  PPCScanner scanner(frontend_);
+  if (!scanner.IsInlinableLeaf(target_address,
+                               uint32_t(cvars::inline_leaf_function_size),
+                               &target_end_address)) {
+    return false;
   }
 
-  return Finalize();
+  if (with_debug_info_) {
+    CommentFormat("inlined fn {:08X}-{:08X}", target_address,
+                  target_end_address);
+  }
+
+  // Emit the callee with its own labels. It only branches within itself, so
+  // the labels of the caller aren't needed until it's done.
+  uint64_t caller_start_address = start_address_;
+  uint64_t caller_instr_count = instr_count_;
+  Instr** caller_instr_offset_list = instr_offset_list_;
+  Label** caller_label_list = label_list_;
+  start_address_ = target_address;
+  instr_count_ = (target_end_address - target_address) / 4 + 1;
+  size_t list_size = instr_count_ * sizeof(void*);
+  instr_offset_list_ = (Instr**)arena_->Alloc(list_size, alignof(void*));
+  label_list_ = (Label**)arena_->Alloc(list_size, alignof(void*));
+  std::memset(instr_offset_list_, 0, list_size);
+  std::memset(label_list_, 0, list_size);
+  inline_return_label_ = NewLabel();
+
+  EmitInstructions(target_address, target_end_address);
+  MarkLabel(inline_return_label_);
+
+  inline_return_label_ = nullptr;
+  start_address_ = caller_start_address;
+  instr_count_ = caller_instr_count;
+  instr_offset_list_ = caller_instr_offset_list;
+  label_list_ = caller_label_list;
+  return true;
+}
+
+bool PPCHIRBuilder::TryInlineExportCall(uint32_t target_address,
+                                        uint32_t call_flags) {
+  if (!cvars::inline_export_fast_paths) {
+    return false;
+  }
+  Function* target = LookupFunction(target_address);
+  if (!target || !target->is_guest() ||
+      target->behavior() != Function::Behavior::kExtern) {
+    return false;
+  }
+  const Export* export_data =
+      static_cast<GuestFunction*>(target)->export_data();
+  if (!HasExportIntrinsic(export_data)) {
+    return false;
+  }
+
+  if (with_debug_info_) {
+    CommentFormat("inlined export {}", export_data->name);
+  }
+  Label* slow_path = NewLabel();
+  Label* done = NewLabel();
+  EmitExportIntrinsic(*this, export_data, slow_path);
+  Branch(done);
+  MarkLabel(slow_path);
+  Call(target, call_flags);
+  MarkLabel(done);
+  return true;
 }
 
 void PPCHIRBuilder::MaybeBreakOnInstruction(uint32_t address) {
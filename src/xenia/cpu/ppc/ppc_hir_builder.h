@@ -37,9 +37,20 @@ class PPCHIRBuilder : public hir::HIRBuilder {
   enum EmitFlags {
     // Emit comment nodes.
     EMIT_DEBUG_COMMENTS = 1 << 0,
+    // Inline direct calls to small leaf functions.
+    EMIT_INLINE_CALLS = 1 << 1,
   };
   bool Emit(GuestFunction* function, uint32_t flags);
 
+  // Emits the body of the function at the given address in place of a direct
+  // call to it, if it's a leaf function small enough to be inlined. Returns
+  // false if the call must be emitted instead.
+  bool TryInlineCall(uint32_t target_address);
+  // Emits the fast path of the kernel export imported at the given address in
+  // place of a direct call to it, with a call to the export when the fast path
+  // can't complete. Returns false if the export has no fast path.
+  bool TryInlineExportCall(uint32_t target_address, uint32_t call_flags);
+
   GuestFunction* function() const { return function_; }
   Function* LookupFunction(uint32_t address);
   Label* LookupLabel(uint32_t address);
@@ -83,6 +94,7 @@ class PPCHIRBuilder : public hir::HIRBuilder {
   //calls original impl in hirbuilder, but also records the is_return_site bit into flags in the guestmodule
   void SetReturnAddress(Value* value);
  private:
+  void EmitInstructions(uint32_t start_address, uint32_t end_address);
   void MaybeBreakOnInstruction(uint32_t address);
   void AnnotateLabel(uint32_t address, Label* label);
 
@@ -98,6 +110,9 @@ class PPCHIRBuilder : public hir::HIRBuilder {
   uint64_t instr_count_;
   Instr** instr_offset_list_;
   Label** label_list_;
+  bool inline_calls_;
+  // Where blr branches to while emitting an inlined function.
+  Label* inline_return_label_;
 
   // Reset each instruction.
   struct {
@@ -41,6 +41,71 @@ bool PPCScanner::IsRestGprLr(uint32_t address) {
   return function && function->behavior() == Function::Behavior::kEpilogReturn;
 }
 
+bool PPCScanner::IsInlinableLeaf(uint32_t address,
+                                 uint32_t max_instruction_count,
+                                 uint32_t* out_end_address) {
+  Memory* memory = frontend_->memory();
+
+  uint32_t start_address = address;
+  uint32_t furthest_target = address;
+  for (uint32_t i = 0; i < max_instruction_count; ++i, address += 4) {
+    uint32_t code =
+        xe::load_and_swap<uint32_t>(memory->TranslateVirtual(address));
+    if (!code) {
+      return false;
+    }
+    if (code == 0x4E800020) {
+      // blr, the end of the function unless something branches over it.
+      if (furthest_target <= address) {
+        *out_end_address = address;
+        return true;
+      }
+      continue;
+    }
+
+    auto opcode = LookupOpcode(code);
+    PPCDecodeData d;
+    d.address = address;
+    d.code = code;
+    uint32_t target;
+    switch (opcode) {
+      case PPCOpcode::bx:
+        if (d.I.LK()) {
+          return false;
+        }
+        target = d.I.ADDR();
+        break;
+      case PPCOpcode::bcx:
+        if (d.B.LK()) {
+          return false;
+        }
+        target = d.B.ADDR();
+        break;
+      case PPCOpcode::mtspr:
+        // Changing LR would change where blr returns to.
+        if ((((d.XFX.SPR() & 0x1F) << 5) | ((d.XFX.SPR() >> 5) & 0x1F)) ==
+            8) {
+          return false;
+        }
+        continue;
+      case PPCOpcode::kInvalid:
+      case PPCOpcode::bclrx:
+      case PPCOpcode::bcctrx:
+      case PPCOpcode::sc:
+        return false;
+      default:
+        continue;
+    }
+    // Tail calls and branches backwards out of the function.
+    if (target < start_address ||
+        target >= start_address + max_instruction_count * 4) {
+      return false;
+    }
+    furthest_target = std::max(furthest_target, target);
+  }
+  return false;
+}
+
 bool PPCScanner::Scan(GuestFunction* function, FunctionDebugInfo* debug_info) {
   // This is a simple basic block analyizer. It walks the start address to the
   // end address looking for branches. Each span of instructions between
@@ -35,6 +35,12 @@ class PPCScanner {
 
   std::vector<BlockInfo> FindBlocks(GuestFunction* function);
 
+  // Checks whether the function at the given address is a leaf function of at
+  // most max_instruction_count instructions that only branches within itself
+  // and returns with blr, so it can be inlined into its callers.
+  bool IsInlinableLeaf(uint32_t address, uint32_t max_instruction_count,
+                       uint32_t* out_end_address);
+
  private:
   bool IsRestGprLr(uint32_t address);
 
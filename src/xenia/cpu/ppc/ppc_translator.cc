@@ -16,6 +16,7 @@
 #include "xenia/base/profiling.h"
 #include "xenia/base/reset_scope.h"
 #include "xenia/base/string.h"
+#include "xenia/base/xxhash.h"
 #include "xenia/cpu/compiler/compiler_passes.h"
 #include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/ppc/ppc_frontend.h"
@@ -28,6 +29,17 @@
 DEFINE_bool(dump_translated_hir_functions, false, "dumps translated hir",
             "CPU");
 
+DECLARE_bool(break_on_unimplemented_instructions);
+DECLARE_bool(ignore_trap_instructions);
+DECLARE_bool(disable_prefetch_and_cachecontrol);
+DECLARE_bool(no_reserved_ops);
+DECLARE_bool(inline_mmio_access);
+DECLARE_bool(permit_float_constant_evaluation);
+DECLARE_bool(store_all_context_values);
+DECLARE_bool(full_optimization_even_with_debug);
+DECLARE_int32(inline_leaf_function_size);
+DECLARE_bool(inline_export_fast_paths);
+
 namespace xe {
 namespace cpu {
 namespace ppc {
@@ -77,9 +89,8 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   }
   compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
-  // compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
-  // if (validate)
-  // compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
+  if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
   compiler_->AddPass(std::make_unique<passes::DeadCodeEliminationPass>());
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
 
@@ -97,10 +108,51 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
 
   // Must come last. The HIR is not really HIR after this.
   compiler_->AddPass(std::make_unique<passes::FinalizationPass>());
+
+  // Baseline tier: only what's needed to produce correct code, the HIR
+  // builder already folds the trivial constant cases.
+  baseline_compiler_.reset(new Compiler(frontend->processor()));
+  baseline_compiler_->AddPass(
+      std::make_unique<passes::ControlFlowAnalysisPass>());
+  baseline_compiler_->AddPass(
+      std::make_unique<passes::DeadCodeEliminationPass>());
+  if (validate)
+    baseline_compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  baseline_compiler_->AddPass(std::make_unique<passes::RegisterAllocationPass>(
+      backend->machine_info()));
+  if (validate)
+    baseline_compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  baseline_compiler_->AddPass(std::make_unique<passes::FinalizationPass>());
 }
 
 PPCTranslator::~PPCTranslator() = default;
 
+uint64_t PPCTranslator::ComputeConfigurationHash(Backend* backend) {
+  const uint64_t values[] = {
+      cvars::validate_hir,
+      backend->machine_info()->supports_extended_load_store,
+      cvars::pvr,
+      cvars::break_on_instruction,
+      uint64_t(int64_t(cvars::break_condition_gpr)),
+      cvars::break_condition_value,
+      XXH3_64bits(cvars::break_condition_op.data(),
+                  cvars::break_condition_op.size()),
+      cvars::break_condition_truncate,
+      cvars::break_on_debugbreak,
+      cvars::break_on_unimplemented_instructions,
+      cvars::ignore_trap_instructions,
+      cvars::disable_prefetch_and_cachecontrol,
+      cvars::no_reserved_ops,
+      cvars::inline_mmio_access,
+      cvars::permit_float_constant_evaluation,
+      cvars::store_all_context_values,
+      cvars::full_optimization_even_with_debug,
+      uint64_t(int64_t(cvars::inline_leaf_function_size)),
+      cvars::inline_export_fast_paths,
+  };
+  return XXH3_64bits(values, sizeof(values));
+}
+
 class HirBuilderScope {
   PPCHIRBuilder* builder_;
 
@@ -157,6 +209,7 @@ bool PPCTranslator::Translate(GuestFunction* function,
   // Reset() all caching when we leave.
   xe::make_reset_scope(builder_);
   xe::make_reset_scope(compiler_);
+  xe::make_reset_scope(baseline_compiler_);
   xe::make_reset_scope(assembler_);
   xe::make_reset_scope(&string_buffer_);
 
@@ -219,6 +272,12 @@ bool PPCTranslator::Translate(GuestFunction* function,
   if (debug_info) {
     emit_flags |= PPCHIRBuilder::EMIT_DEBUG_COMMENTS;
   }
+  // Breakpoints and traces are only set up for the function's own code.
+  // Baseline code is compiled as quickly as possible.
+  if (cvars::inline_leaf_function_size > 0 && !debug_info_flags &&
+      !cvars::debug && function->tier() != GuestFunction::Tier::kBaseline) {
+    emit_flags |= PPCHIRBuilder::EMIT_INLINE_CALLS;
+  }
   if (!builder_->Emit(function, emit_flags)) {
     return false;
   }
@@ -231,7 +290,10 @@ bool PPCTranslator::Translate(GuestFunction* function,
   }
 
   // Compile/optimize/etc.
-  if (!compiler_->Compile(builder_.get())) {
+  Compiler* compiler = function->tier() == GuestFunction::Tier::kBaseline
+                           ? baseline_compiler_.get()
+                           : compiler_.get();
+  if (!compiler->Compile(builder_.get())) {
     return false;
   }
 
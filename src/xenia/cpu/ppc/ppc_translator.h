@@ -31,6 +31,10 @@ class PPCTranslator {
   ~PPCTranslator();
 
   bool Translate(GuestFunction* function, uint32_t debug_info_flags);
+
+  // Hash of all frontend and compiler options that affect the generated HIR,
+  // used to validate persisted code.
+  static uint64_t ComputeConfigurationHash(backend::Backend* backend);
   void DumpHIR(GuestFunction* function, PPCHIRBuilder* builder);
   void Reset();
 
@@ -41,6 +45,8 @@ class PPCTranslator {
   std::unique_ptr<PPCScanner> scanner_;
   std::unique_ptr<PPCHIRBuilder> builder_;
   std::unique_ptr<compiler::Compiler> compiler_;
+  // Minimal pipeline for GuestFunction::Tier::kBaseline translations.
+  std::unique_ptr<compiler::Compiler> baseline_compiler_;
   std::unique_ptr<backend::Assembler> assembler_;
 
   StringBuffer string_buffer_;
@@ -0,0 +1,53 @@
+# Integer ALU kernels for xenia-cpu-ppc-benchmarks. BENCHMARK_INSTRUCTIONS is
+# the number of guest instructions executed per call.
+
+test_bench_alu_1:
+  #_ REGISTER_IN r3 0x12345678
+  #_ REGISTER_IN r4 0x0F0F0F0F
+  #_ BENCHMARK_INSTRUCTIONS 2052
+  li r11, 256
+  mtctr r11
+  li r12, 0
+bench_alu_1_loop:
+  add r5, r3, r4
+  subf r6, r4, r3
+  and r7, r3, r4
+  or r8, r3, r4
+  xor r9, r3, r4
+  rlwinm r10, r3, 8, 0, 23
+  addi r12, r12, 1
+  bdnz bench_alu_1_loop
+  blr
+  #_ REGISTER_OUT r3 0x12345678
+  #_ REGISTER_OUT r4 0x0F0F0F0F
+  #_ REGISTER_OUT r5 0x21436587
+  #_ REGISTER_OUT r6 0x03254769
+  #_ REGISTER_OUT r7 0x02040608
+  #_ REGISTER_OUT r8 0x1F3F5F7F
+  #_ REGISTER_OUT r9 0x1D3B5977
+  #_ REGISTER_OUT r10 0x34567800
+  #_ REGISTER_OUT r12 256
+
+test_bench_alu_2:
+  #_ REGISTER_IN r3 1
+  #_ REGISTER_IN r4 3
+  #_ BENCHMARK_INSTRUCTIONS 1795
+  li r11, 256
+  mtctr r11
+bench_alu_2_loop:
+  mullw r5, r3, r4
+  addc r6, r5, r4
+  adde r7, r6, r3
+  divwu r8, r7, r4
+  cntlzw r9, r8
+  srawi r10, r7, 1
+  bdnz bench_alu_2_loop
+  blr
+  #_ REGISTER_OUT r3 1
+  #_ REGISTER_OUT r4 3
+  #_ REGISTER_OUT r5 3
+  #_ REGISTER_OUT r6 6
+  #_ REGISTER_OUT r7 7
+  #_ REGISTER_OUT r8 2
+  #_ REGISTER_OUT r9 30
+  #_ REGISTER_OUT r10 3
@@ -0,0 +1,30 @@
+# Floating-point kernels for xenia-cpu-ppc-benchmarks. BENCHMARK_INSTRUCTIONS
+# is the number of guest instructions executed per call.
+
+test_bench_fpu_1:
+  #_ REGISTER_IN f1 1.5
+  #_ REGISTER_IN f2 2.0
+  #_ REGISTER_IN f3 0.25
+  #_ BENCHMARK_INSTRUCTIONS 2051
+  li r11, 256
+  mtctr r11
+bench_fpu_1_loop:
+  fadd f4, f1, f2
+  fmul f5, f1, f2
+  fmadd f6, f1, f2, f3
+  fsub f7, f2, f1
+  fdiv f8, f1, f2
+  fabs f9, f7
+  fmadds f10, f1, f3, f2
+  bdnz bench_fpu_1_loop
+  blr
+  #_ REGISTER_OUT f1 1.5
+  #_ REGISTER_OUT f2 2.0
+  #_ REGISTER_OUT f3 0.25
+  #_ REGISTER_OUT f4 3.5
+  #_ REGISTER_OUT f5 3.0
+  #_ REGISTER_OUT f6 3.25
+  #_ REGISTER_OUT f7 0.5
+  #_ REGISTER_OUT f8 0.75
+  #_ REGISTER_OUT f9 0.5
+  #_ REGISTER_OUT f10 2.375
@@ -0,0 +1,61 @@
+# Load/store kernels for xenia-cpu-ppc-benchmarks. BENCHMARK_INSTRUCTIONS is
+# the number of guest instructions executed per call.
+
+test_bench_load_store_byteswap:
+  #_ MEMORY_IN 10001000 00112233 44556677 8899AABB CCDDEEFF
+  #_ MEMORY_IN 10001010 CCCCCCCC CCCCCCCC CCCCCCCC CCCCCCCC
+  #_ REGISTER_IN r4 0x10001000
+  #_ REGISTER_IN r5 0x10001010
+  #_ BENCHMARK_INSTRUCTIONS 2308
+  li r10, 4
+  li r11, 256
+  mtctr r11
+bench_load_store_byteswap_loop:
+  lwz r6, 0(r4)
+  lwbrx r7, r0, r4
+  lhz r8, 4(r4)
+  lhbrx r9, r4, r10
+  ld r12, 8(r4)
+  stw r7, 0(r5)
+  stwbrx r6, r5, r10
+  std r12, 8(r5)
+  bdnz bench_load_store_byteswap_loop
+  blr
+  #_ REGISTER_OUT r6 0x00112233
+  #_ REGISTER_OUT r7 0x33221100
+  #_ REGISTER_OUT r8 0x4455
+  #_ REGISTER_OUT r9 0x5544
+  #_ REGISTER_OUT r12 0x8899AABBCCDDEEFF
+  #_ MEMORY_OUT 10001010 33221100 33221100 8899AABB CCDDEEFF
+
+test_bench_load_store_reserved_word:
+  #_ MEMORY_IN 10001000 00000000 CCCCCCCC
+  #_ REGISTER_IN r4 0x10001000
+  #_ BENCHMARK_INSTRUCTIONS 1283
+  li r11, 256
+  mtctr r11
+bench_load_store_reserved_word_loop:
+  lwarx r5, r0, r4
+  addi r5, r5, 1
+  stwcx. r5, r0, r4
+  bne bench_load_store_reserved_word_loop
+  bdnz bench_load_store_reserved_word_loop
+  blr
+  #_ REGISTER_OUT r5 256
+  #_ MEMORY_OUT 10001000 00000100 CCCCCCCC
+
+test_bench_load_store_reserved_doubleword:
+  #_ MEMORY_IN 10001000 00000000 00000000 CCCCCCCC
+  #_ REGISTER_IN r4 0x10001000
+  #_ BENCHMARK_INSTRUCTIONS 1283
+  li r11, 256
+  mtctr r11
+bench_load_store_reserved_doubleword_loop:
+  ldarx r5, r0, r4
+  addi r5, r5, 1
+  stdcx. r5, r0, r4
+  bne bench_load_store_reserved_doubleword_loop
+  bdnz bench_load_store_reserved_doubleword_loop
+  blr
+  #_ REGISTER_OUT r5 256
+  #_ MEMORY_OUT 10001000 00000000 00000100 CCCCCCCC
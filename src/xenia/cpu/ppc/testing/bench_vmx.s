@@ -0,0 +1,50 @@
+# VMX/VMX128 kernels for xenia-cpu-ppc-benchmarks. BENCHMARK_INSTRUCTIONS is
+# the number of guest instructions executed per call.
+
+test_bench_vmx_permute_pack:
+  #_ REGISTER_IN v3 [00010203, 04050607, 08090A0B, 0C0D0E0F]
+  #_ REGISTER_IN v12 [10111213, 14151617, 18191A1B, 1C1D1E1F]
+  #_ REGISTER_IN v5 [00100111, 02120313, 04140515, 06160717]
+  #_ BENCHMARK_INSTRUCTIONS 1795
+  li r11, 256
+  mtctr r11
+bench_vmx_permute_pack_loop:
+  vperm v6, v3, v12, v5
+  vmrghw v7, v3, v12
+  vsldoi v8, v3, v12, 4
+  vpkshss128 v9, v3, v12
+  vupkhsb128 v10, v12
+  # vpermwi128 v4, v3, 0xE4
+  .long 0x18841BD0
+  bdnz bench_vmx_permute_pack_loop
+  blr
+  #_ REGISTER_OUT v3 [00010203, 04050607, 08090A0B, 0C0D0E0F]
+  #_ REGISTER_OUT v12 [10111213, 14151617, 18191A1B, 1C1D1E1F]
+  #_ REGISTER_OUT v4 [0C0D0E0F, 08090A0B, 04050607, 00010203]
+  #_ REGISTER_OUT v6 [00100111, 02120313, 04140515, 06160717]
+  #_ REGISTER_OUT v7 [00010203, 10111213, 04050607, 14151617]
+  #_ REGISTER_OUT v8 [04050607, 08090A0B, 0C0D0E0F, 10111213]
+  #_ REGISTER_OUT v9 [017F7F7F, 7F7F7F7F, 7F7F7F7F, 7F7F7F7F]
+  #_ REGISTER_OUT v10 [00100011, 00120013, 00140015, 00160017]
+
+test_bench_vmx_float:
+  #_ REGISTER_IN v3 [3F800000, 3FC00000, 3F8CCCCD, 3FF33333]
+  #_ REGISTER_IN v4 [40000000, 40700000, 4013D70A, 40B051EB]
+  #_ BENCHMARK_INSTRUCTIONS 1539
+  li r11, 256
+  mtctr r11
+bench_vmx_float_loop:
+  vaddfp128 v5, v3, v4
+  vsubfp128 v6, v4, v3
+  vmulfp128 v7, v3, v4
+  vmaxfp128 v8, v3, v4
+  vmsum4fp128 v9, v3, v4
+  bdnz bench_vmx_float_loop
+  blr
+  #_ REGISTER_OUT v3 [3F800000, 3FC00000, 3F8CCCCD, 3FF33333]
+  #_ REGISTER_OUT v4 [40000000, 40700000, 4013D70A, 40B051EB]
+  #_ REGISTER_OUT v5 [40400000, 40A80000, 405A3D70, 40ED1EB8]
+  #_ REGISTER_OUT v6 [3F800000, 40100000, 3F9AE147, 40670A3C]
+  #_ REGISTER_OUT v7 [40000000, 40B40000, 40229FBE, 41278106]
+  #_ REGISTER_OUT v8 [40000000, 40700000, 4013D70A, 40B051EB]
+  #_ REGISTER_OUT v9 [41A5147B, 41A5147B, 41A5147B, 41A5147B]
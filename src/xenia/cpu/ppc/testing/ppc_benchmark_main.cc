@@ -0,0 +1,278 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <memory>
+
+#include "third_party/fmt/include/fmt/format.h"
+#include "xenia/base/console_app_main.h"
+#include "xenia/base/cvar.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/string_util.h"
+#include "xenia/base/utf8.h"
+#include "xenia/cpu/ppc/testing/ppc_test_runner.h"
+
+#if XE_ARCH_AMD64
+#include "xenia/base/platform_amd64.h"
+#endif  // XE_ARCH_AMD64
+
+DEFINE_path(test_path, "src/xenia/cpu/ppc/testing/",
+            "Directory scanned for test files.", "Other");
+DEFINE_path(test_bin_path, "src/xenia/cpu/ppc/testing/bin/",
+            "Directory with binary outputs of the test files.", "Other");
+DEFINE_transient_string(test_name, "",
+                        "Test suite name. All bench_ suites are run if empty.",
+                        "General");
+DEFINE_int32(benchmark_iterations, 1000,
+             "Number of calls of a test function timed in each batch.",
+             "Other");
+DEFINE_string(benchmark_feature_levels, "avx,avx2,avx512,xop",
+              "Comma-separated x64 feature levels to benchmark [avx, avx2, "
+              "avx512, xop]. Levels not supported by the host are skipped.",
+              "Other");
+DEFINE_path(benchmark_output_path, "",
+            "File to write the results to as CSV, one row per test and feature "
+            "level.",
+            "Other");
+
+namespace xe {
+namespace cpu {
+namespace test {
+
+// Batches timed per test; the fastest one is reported.
+constexpr int kBenchmarkBatchCount = 5;
+
+struct FeatureLevel {
+  const char* name;
+  // Value of x64_extension_mask.
+  uint64_t extension_mask;
+  // Host features without which the level is skipped.
+  uint64_t required_features;
+};
+
+#if XE_ARCH_AMD64
+constexpr uint64_t kAVX2ExtensionMask =
+    amd64::kX64EmitAVX2 | amd64::kX64EmitFMA | amd64::kX64EmitLZCNT |
+    amd64::kX64EmitBMI1 | amd64::kX64EmitBMI2 | amd64::kX64EmitPrefetchW |
+    amd64::kX64EmitMovbe | amd64::kX64EmitGFNI;
+const FeatureLevel kFeatureLevels[] = {
+    {"avx", 0, 0},
+    {"avx2", kAVX2ExtensionMask, amd64::kX64EmitAVX2},
+    {"avx512",
+     kAVX2ExtensionMask | amd64::kX64EmitAVX512F | amd64::kX64EmitAVX512VL |
+         amd64::kX64EmitAVX512BW | amd64::kX64EmitAVX512DQ |
+         amd64::kX64EmitAVX512VBMI,
+     amd64::kX64EmitAVX512F | amd64::kX64EmitAVX512VL},
+    {"xop",
+     kAVX2ExtensionMask | amd64::kX64EmitXOP | amd64::kX64EmitFMA4 |
+         amd64::kX64EmitTBM,
+     amd64::kX64EmitXOP},
+};
+#else
+const FeatureLevel kFeatureLevels[] = {
+    {"default", 0, 0},
+};
+#endif  // XE_ARCH_AMD64
+
+struct BenchmarkResult {
+  std::string feature_level;
+  std::string suite;
+  std::string test;
+  uint32_t guest_instructions;
+  uint32_t iterations;
+  double ns_per_call;
+};
+
+// Reconfigures code generation for the feature level. Only affects
+// processors set up afterwards.
+bool SelectFeatureLevel(const FeatureLevel& feature_level) {
+#if XE_ARCH_AMD64
+  cvars::x64_extension_mask = int64_t(feature_level.extension_mask);
+  amd64::InitFeatureFlags();
+  return (amd64::GetFeatureFlags() & feature_level.required_features) ==
+         feature_level.required_features;
+#else
+  return true;
+#endif  // XE_ARCH_AMD64
+}
+
+// Number of guest instructions executed by one call, from the
+// BENCHMARK_INSTRUCTIONS annotation of looping kernels, or the size of the
+// function for straight-line tests.
+uint32_t GetGuestInstructionCount(const TestCase& test_case,
+                                  const Function* fn) {
+  for (auto& it : test_case.annotations) {
+    if (it.first == "BENCHMARK_INSTRUCTIONS") {
+      return string_util::from_string<uint32_t>(it.second);
+    }
+  }
+  if (!fn->has_end_address()) {
+    return 1;
+  }
+  return (fn->end_address() - fn->address()) / 4 + 1;
+}
+
+bool BenchmarkTest(TestSuite& test_suite, TestRunner& runner,
+                   TestCase& test_case, BenchmarkResult& result) {
+  if (!runner.Setup(test_suite, DebugInfoFlags::kDebugInfoNone)) {
+    XELOGE("    TEST FAILED SETUP");
+    return false;
+  }
+  // The first call also translates the function, and makes sure the code for
+  // this feature level is still correct before timing it.
+  if (!runner.Run(test_case)) {
+    XELOGE("    TEST FAILED");
+    return false;
+  }
+
+  auto fn = runner.processor_->ResolveFunction(test_case.address);
+  auto thread_state = runner.thread_state_.get();
+  auto ctx = thread_state->context();
+  runner.SetupTestState(test_case);
+  ctx->lr = 0xBCBCBCBC;
+  // Tests may loop on their inputs, so every call starts from the same
+  // context. Restoring it is timed along with the call.
+  auto initial_context = std::make_unique<PPCContext>();
+  std::memcpy(initial_context.get(), ctx, sizeof(PPCContext));
+
+  uint32_t iterations = uint32_t(std::max(cvars::benchmark_iterations, 1));
+  double best_ns = std::numeric_limits<double>::max();
+  for (int batch = 0; batch < kBenchmarkBatchCount; ++batch) {
+    auto begin = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iterations; ++i) {
+      std::memcpy(ctx, initial_context.get(), sizeof(PPCContext));
+      fn->Call(thread_state, 0xBCBCBCBC);
+    }
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - begin;
+    best_ns = std::min(best_ns, elapsed.count());
+  }
+
+  result.suite = test_suite.name();
+  result.test = test_case.name;
+  result.guest_instructions = GetGuestInstructionCount(test_case, fn);
+  result.iterations = iterations;
+  result.ns_per_call = best_ns / iterations;
+  return true;
+}
+
+bool WriteResults(const std::filesystem::path& path,
+                  const std::vector<BenchmarkResult>& results) {
+  FILE* file = xe::filesystem::OpenFile(path, "w");
+  if (!file) {
+    XELOGE("Unable to open benchmark results {} for writing",
+           xe::path_to_utf8(path));
+    return false;
+  }
+  fmt::print(file,
+             "feature_level,suite,test,guest_instructions,iterations,"
+             "ns_per_call,ns_per_guest_instruction\n");
+  for (const BenchmarkResult& result : results) {
+    fmt::print(file, "{},{},{},{},{},{:.3f},{:.4f}\n", result.feature_level,
+               result.suite, result.test, result.guest_instructions,
+               result.iterations, result.ns_per_call,
+               result.ns_per_call / result.guest_instructions);
+  }
+  fclose(file);
+  XELOGI("Wrote {} benchmark results to {}", results.size(),
+         xe::path_to_utf8(path));
+  return true;
+}
+
+bool RunBenchmarks(const std::string_view test_name) {
+  auto test_path_root = cvars::test_path;
+  std::vector<std::filesystem::path> test_files;
+  if (!DiscoverTests(test_path_root, test_files)) {
+    return false;
+  }
+
+  std::vector<TestSuite> test_suites;
+  for (auto& test_path : test_files) {
+    TestSuite test_suite(test_path);
+    bool selected = test_name.empty()
+                        ? xe::utf8::starts_with(test_suite.name(), "bench_")
+                        : test_suite.name() == test_name;
+    if (!selected) {
+      continue;
+    }
+    if (!test_suite.Load()) {
+      XELOGE("TEST SUITE {} FAILED TO LOAD", xe::path_to_utf8(test_path));
+      return false;
+    }
+    test_suites.push_back(std::move(test_suite));
+  }
+  if (test_suites.empty()) {
+    XELOGE("No benchmarks discovered - invalid path?");
+    return false;
+  }
+
+#if XE_ARCH_AMD64
+  int64_t original_extension_mask = cvars::x64_extension_mask;
+#endif  // XE_ARCH_AMD64
+  auto requested_levels =
+      xe::utf8::split(cvars::benchmark_feature_levels, ",");
+
+  std::vector<BenchmarkResult> results;
+  int failed_count = 0;
+  TestRunner runner;
+  for (const FeatureLevel& feature_level : kFeatureLevels) {
+    if (std::find(requested_levels.begin(), requested_levels.end(),
+                  feature_level.name) == requested_levels.end()) {
+      continue;
+    }
+    if (!SelectFeatureLevel(feature_level)) {
+      XELOGI("Skipping feature level {}, not supported by the host.",
+             feature_level.name);
+      continue;
+    }
+    XELOGI("Feature level {}:", feature_level.name);
+    for (auto& test_suite : test_suites) {
+      XELOGI("  {}.s:", test_suite.name());
+      for (auto& test_case : test_suite.test_cases()) {
+        BenchmarkResult result;
+        if (!BenchmarkTest(test_suite, runner, test_case, result)) {
+          XELOGE("  - {}", test_case.name);
+          ++failed_count;
+          continue;
+        }
+        result.feature_level = feature_level.name;
+        XELOGI("  - {}: {:.1f} ns/call, {:.3f} ns/guest instruction",
+               test_case.name, result.ns_per_call,
+               result.ns_per_call / result.guest_instructions);
+        results.push_back(std::move(result));
+      }
+    }
+  }
+
+#if XE_ARCH_AMD64
+  cvars::x64_extension_mask = original_extension_mask;
+  amd64::InitFeatureFlags();
+#endif  // XE_ARCH_AMD64
+
+  if (!cvars::benchmark_output_path.empty() &&
+      !WriteResults(cvars::benchmark_output_path, results)) {
+    return false;
+  }
+  return !failed_count;
+}
+
+int main(const std::vector<std::string>& args) {
+  return RunBenchmarks(cvars::test_name) ? 0 : 1;
+}
+
+}  // namespace test
+}  // namespace cpu
+}  // namespace xe
+
+XE_DEFINE_CONSOLE_APP("xenia-cpu-ppc-benchmark", xe::cpu::test::main,
+                      "[test name]", "test_name");
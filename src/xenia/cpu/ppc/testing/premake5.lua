@@ -18,6 +18,7 @@ project("xenia-cpu-ppc-tests")
     "xenia-patcher",
   })
   files({
+    "ppc_test_runner.h",
     "ppc_testing_main.cc",
     "../../../base/console_app_main_"..platform_suffix..".cc",
   })
@@ -40,6 +41,36 @@ project("xenia-cpu-ppc-tests")
     -- xenia-base needs this
     links({"xenia-ui"})
 
+project("xenia-cpu-ppc-benchmarks")
+  uuid("6d0e8a5c-3b7f-4f61-9a2e-5c1d7b4e9f32")
+  kind("ConsoleApp")
+  language("C++")
+  links({
+    "capstone", -- cpu-backend-x64
+    "fmt",
+    "mspack",
+    "imgui",
+    "xenia-core",
+    "xenia-cpu",
+    "xenia-base",
+    "xenia-kernel",
+    "xenia-patcher",
+  })
+  files({
+    "ppc_benchmark_main.cc",
+    "ppc_test_runner.h",
+    "../../../base/console_app_main_"..platform_suffix..".cc",
+  })
+  filter("architecture:x86_64")
+    links({
+      "xenia-cpu-backend-x64",
+    })
+  filter("platforms:Windows")
+    debugdir(project_root)
+
+    -- xenia-base needs this
+    links({"xenia-ui"})
+
 if ARCH == "ppc64" or ARCH == "powerpc64" then
 
 project("xenia-cpu-ppc-nativetests")
@@ -9,6 +9,8 @@
 
 #include "xenia/cpu/processor.h"
 
+#include <algorithm>
+
 #include "xenia/base/assert.h"
 #include "xenia/base/atomic.h"
 #include "xenia/base/byte_order.h"
@@ -24,10 +26,12 @@
 #include "xenia/base/threading.h"
 #include "xenia/cpu/breakpoint.h"
 #include "xenia/cpu/cpu_flags.h"
+#include "xenia/cpu/crt_routines.h"
 #include "xenia/cpu/export_resolver.h"
 #include "xenia/cpu/module.h"
 #include "xenia/cpu/ppc/ppc_decode_data.h"
 #include "xenia/cpu/ppc/ppc_frontend.h"
+#include "xenia/cpu/ppc/ppc_translator.h"
 #include "xenia/cpu/stack_walker.h"
 #include "xenia/cpu/thread.h"
 #include "xenia/cpu/thread_state.h"
@@ -48,6 +52,28 @@ DEFINE_path(trace_function_data_path, "", "File to write trace data to.",
             "CPU");
 DEFINE_bool(break_on_start, false, "Break into the debugger on startup.",
             "CPU");
+DEFINE_int32(
+    precompilation_threads, -1,
+    "Number of threads used for ahead-of-time translation of discovered guest "
+    "functions (with enable_early_precompilation). -1 to calculate "
+    "automatically (50% of logical CPU cores), 0 to translate them on the "
+    "module loading thread. Retranslations of tiered_compilation always use "
+    "at least one thread.",
+    "CPU");
+DEFINE_bool(tiered_compilation, false,
+            "Translate guest functions with a minimal set of optimization "
+            "passes first, and retranslate them with all optimizations once "
+            "they've been called tier_up_call_count times.",
+            "CPU");
+DEFINE_int32(tier_up_call_count, 1000,
+             "Number of calls after which a function translated with "
+             "tiered_compilation is retranslated with all optimizations.",
+             "CPU");
+DEFINE_bool(persistent_code_cache, false,
+            "Store translated guest code in the cache directory on exit and "
+            "reuse it on the next launch of the same executable, skipping "
+            "translation of already discovered functions.",
+            "CPU");
 
 namespace xe {
 namespace kernel {
@@ -72,6 +98,11 @@ class BuiltinModule : public Module {
   bool ContainsAddress(uint32_t address) override {
     return (address & 0xFFFFFFF0) == 0xFFFFFFF0;
   }
+  bool GetAddressRange(uint32_t* out_low, uint32_t* out_size) override {
+    *out_low = 0xFFFFFFF0;
+    *out_size = 0x10;
+    return true;
+  }
 
  protected:
   std::unique_ptr<Function> CreateFunction(uint32_t address) override {
@@ -86,9 +117,29 @@ Processor::Processor(xe::Memory* memory, ExportResolver* export_resolver)
     : memory_(memory), export_resolver_(export_resolver) {}
 
 Processor::~Processor() {
+  ShutdownPrecompilationThreads();
+  LogCrtRoutineHitCounts();
+
+  if (guest_profiler_) {
+    guest_profiler_->Shutdown();
+    guest_profiler_.reset();
+  }
+
+  // Persist code while the functions it belongs to are still alive. No guest
+  // threads are running anymore, so the lock isn't needed for the writes.
+  if (backend_) {
+    uint64_t configuration_hash =
+        ppc::PPCTranslator::ComputeConfigurationHash(backend_.get());
+    for (const auto& [module, path] : persistent_code_paths_) {
+      std::filesystem::create_directories(path.parent_path());
+      backend_->SavePersistentCode(module, path, configuration_hash);
+    }
+  }
+
   {
     auto global_lock = global_critical_region_.Acquire();
     modules_.clear();
+    PublishModuleRanges();
   }
 
   frontend_.reset();
@@ -113,6 +164,7 @@ bool Processor::Setup(std::unique_ptr<backend::Backend> backend) {
   std::unique_ptr<Module> builtin_module(new BuiltinModule(this));
   builtin_module_ = builtin_module.get();
   modules_.push_back(std::move(builtin_module));
+  PublishModuleRanges();
 
   if (frontend_ || backend_) {
     return false;
@@ -147,6 +199,8 @@ bool Processor::Setup(std::unique_ptr<backend::Backend> backend) {
     }
   }
 
+  guest_profiler_ = GuestProfiler::Create(backend_.get());
+
   // Open the trace data path, if requested.
   functions_trace_path_ = cvars::trace_function_data_path;
   if (!functions_trace_path_.empty()) {
@@ -169,9 +223,163 @@ void Processor::PreLaunch() {
   }
 }
 
+void Processor::LoadPersistentCode(Module* module,
+                                   const std::filesystem::path& path) {
+  if (!cvars::persistent_code_cache || !backend_) {
+    return;
+  }
+  // Tracing and debugging embed per-run data in the generated code.
+  if (debug_info_flags_ || cvars::debug) {
+    return;
+  }
+  {
+    auto global_lock = global_critical_region_.Acquire();
+    persistent_code_paths_[module] = path;
+  }
+  backend_->LoadPersistentCode(
+      module, path,
+      ppc::PPCTranslator::ComputeConfigurationHash(backend_.get()));
+}
+
+void Processor::QueuePrecompilation(const std::vector<uint32_t>& addresses) {
+  if (addresses.empty()) {
+    return;
+  }
+  if (!cvars::precompilation_threads) {
+    for (uint32_t address : addresses) {
+      ResolveFunction(address);
+    }
+    return;
+  }
+  {
+    std::lock_guard<xe_mutex> lock(precompilation_request_lock_);
+    EnsurePrecompilationThreads();
+    precompilation_queue_.insert(precompilation_queue_.end(),
+                                 addresses.cbegin(), addresses.cend());
+  }
+  precompilation_request_cond_.notify_all();
+}
+
+void Processor::QueueTierUp(GuestFunction* function) {
+  // The baseline call counter may trigger more than once if it races.
+  if (!function->ChangeTier(GuestFunction::Tier::kBaseline,
+                            GuestFunction::Tier::kTieringUp)) {
+    return;
+  }
+  // Never translated on the guest thread that happened to trigger it.
+  {
+    std::lock_guard<xe_mutex> lock(precompilation_request_lock_);
+    EnsurePrecompilationThreads();
+    tier_up_queue_.push_back(function);
+  }
+  precompilation_request_cond_.notify_one();
+}
+
+void Processor::TierUp(GuestFunction* function) {
+  // The optimized code is translated into a function of its own, so the
+  // machine code, source map and debug info of the baseline code are never
+  // touched while other threads run it or resolve host PCs in it. The
+  // assembler only switches the indirection table entry, and the call sites
+  // patched from it, once the new function is fully set up.
+  auto optimized =
+      backend_->CreateGuestFunction(function->module(), function->address());
+  optimized->set_name(function->name());
+  optimized->set_end_address(function->end_address());
+  optimized->set_behavior(function->behavior());
+  if (function->IsSaverest()) {
+    optimized->SetSaverest(function->SaverestType(), function->IsRestore(),
+                           function->SaverestIndex());
+  }
+  if (!frontend_->DefineFunction(optimized.get(), debug_info_flags_)) {
+    // Stays kTieringUp, so it's not queued again.
+    XELOGE("Failed to retranslate hot function {:08X}, keeping baseline code",
+           function->address());
+    return;
+  }
+  optimized->set_status(Symbol::Status::kDefined);
+  // The baseline tier is never freed. Guest threads may keep return addresses
+  // into it on their stacks indefinitely, so no point is known after which
+  // none is in it, and the code cache doesn't reclaim code anyway.
+  function->set_optimized_tier(std::move(optimized));
+  function->set_tier(GuestFunction::Tier::kTieredUp);
+}
+
+void Processor::EnsurePrecompilationThreads() {
+  if (!precompilation_threads_.empty()) {
+    return;
+  }
+  uint32_t logical_processor_count = xe::threading::logical_processor_count();
+  size_t thread_count;
+  if (cvars::precompilation_threads < 0) {
+    thread_count = std::max(logical_processor_count / 2, uint32_t(1));
+  } else {
+    // With 0, ahead-of-time translation doesn't get here, but tiering up
+    // still needs a thread.
+    thread_count = std::max(std::min(uint32_t(cvars::precompilation_threads),
+                                     logical_processor_count),
+                            uint32_t(1));
+  }
+  for (size_t i = 0; i < thread_count; ++i) {
+    auto thread = xe::threading::Thread::Create(
+        {}, [this]() { PrecompilationThread(); });
+    assert_not_null(thread);
+    thread->set_name("CPU Precompilation");
+    precompilation_threads_.push_back(std::move(thread));
+  }
+}
+
+void Processor::PrecompilationThread() {
+  while (true) {
+    uint32_t address = 0;
+    GuestFunction* tier_up_function = nullptr;
+    {
+      std::unique_lock<xe_mutex> lock(precompilation_request_lock_);
+      if (precompilation_threads_shutdown_) {
+        return;
+      }
+      // Hot functions take priority over ahead-of-time translation.
+      if (!tier_up_queue_.empty()) {
+        tier_up_function = tier_up_queue_.front();
+        tier_up_queue_.pop_front();
+      } else if (!precompilation_queue_.empty()) {
+        address = precompilation_queue_.front();
+        precompilation_queue_.pop_front();
+      } else {
+        precompilation_request_cond_.wait(lock);
+        continue;
+      }
+    }
+    if (tier_up_function) {
+      TierUp(tier_up_function);
+    } else {
+      // The entry table makes sure only one thread translates the function,
+      // any other thread resolving it meanwhile waits for it to become ready.
+      ResolveFunction(address);
+    }
+  }
+}
+
+void Processor::ShutdownPrecompilationThreads() {
+  {
+    std::lock_guard<xe_mutex> lock(precompilation_request_lock_);
+    if (precompilation_threads_.empty()) {
+      return;
+    }
+    precompilation_threads_shutdown_ = true;
+    precompilation_queue_.clear();
+    tier_up_queue_.clear();
+  }
+  precompilation_request_cond_.notify_all();
+  for (auto& thread : precompilation_threads_) {
+    xe::threading::Wait(thread.get(), false);
+  }
+  precompilation_threads_.clear();
+}
+
 bool Processor::AddModule(std::unique_ptr<Module> module) {
   auto global_lock = global_critical_region_.Acquire();
   modules_.push_back(std::move(module));
+  PublishModuleRanges();
   return true;
 }
 
@@ -189,6 +397,7 @@ void Processor::RemoveModule(const std::string_view name) {
         (*itr)->GetAddressedFunctions();
 
     modules_.erase(itr);
+    PublishModuleRanges();
 
     for (const uint32_t entry : addressed_functions) {
       RemoveFunctionByAddress(entry);
@@ -208,13 +417,64 @@ Module* Processor::GetModule(const std::string_view name) {
 
 std::vector<Module*> Processor::GetModules() {
   auto global_lock = global_critical_region_.Acquire();
-  std::vector<Module*> clone(modules_.size());
+  std::vector<Module*> clone;
+  clone.reserve(modules_.size());
   for (const auto& module : modules_) {
     clone.push_back(module.get());
   }
   return clone;
 }
 
+void Processor::UpdateModuleRanges() {
+  auto global_lock = global_critical_region_.Acquire();
+  PublishModuleRanges();
+}
+
+void Processor::PublishModuleRanges() {
+  // Generations are unique across processors, as the per-thread cache in
+  // LookupModule isn't.
+  static std::atomic<uint64_t> next_generation(1);
+
+  auto snapshot = std::make_unique<ModuleRanges>();
+  snapshot->generation = next_generation++;
+  std::vector<ModuleRanges::Range> ranges;
+  for (size_t i = 0; i < modules_.size(); ++i) {
+    Module* module = modules_[i].get();
+    uint32_t low, size;
+    if (!module->GetAddressRange(&low, &size)) {
+      snapshot->unranged_modules.emplace_back(i, module);
+    } else if (size) {
+      ranges.push_back({low, uint64_t(low) + size, i, module});
+    }
+  }
+  std::sort(ranges.begin(), ranges.end(),
+            [](const ModuleRanges::Range& a, const ModuleRanges::Range& b) {
+              return a.low < b.low;
+            });
+  // Overlaps aren't expected, but keep the priority of the linear scan by
+  // checking the later of two overlapping modules with ContainsAddress.
+  for (const auto& range : ranges) {
+    if (snapshot->ranges.empty() || range.low >= snapshot->ranges.back().end) {
+      snapshot->ranges.push_back(range);
+      continue;
+    }
+    ModuleRanges::Range& previous_range = snapshot->ranges.back();
+    XELOGW("Module {} overlaps module {}", range.module->name(),
+           previous_range.module->name());
+    if (range.order < previous_range.order) {
+      snapshot->unranged_modules.emplace_back(previous_range.order,
+                                              previous_range.module);
+      previous_range = range;
+    } else {
+      snapshot->unranged_modules.emplace_back(range.order, range.module);
+    }
+  }
+  std::sort(snapshot->unranged_modules.begin(),
+            snapshot->unranged_modules.end());
+  module_ranges_.store(snapshot.get(), std::memory_order_release);
+  module_ranges_snapshots_.push_back(std::move(snapshot));
+}
+
 Function* Processor::DefineBuiltin(const std::string_view name,
                                    BuiltinFunction::Handler handler, void* arg0,
                                    void* arg1) {
@@ -278,9 +538,8 @@ Function* Processor::ResolveFunction(uint32_t address) {
       }
     }
 
-    entry->function = function;
-    entry->end_address = function->end_address();
-    status = entry->status = Entry::STATUS_READY;
+    entry_table_.MarkReady(entry, function, function->end_address());
+    status = Entry::STATUS_READY;
   }
   if (status == Entry::STATUS_READY) {
     // Ready to use.
@@ -291,15 +550,56 @@ Function* Processor::ResolveFunction(uint32_t address) {
   }
 }
 Module* Processor::LookupModule(uint32_t address) {
-  auto global_lock = global_critical_region_.Acquire();
-  // TODO(benvanik): sort by code address (if contiguous) so can bsearch.
-  // TODO(benvanik): cache last module low/high, as likely to be in there.
-  for (const auto& module : modules_) {
+  // Last module hit by this thread, valid while the snapshot generation it was
+  // found in is still the published one.
+  struct LastModule {
+    uint64_t generation;
+    uint32_t low;
+    uint64_t end;
+    Module* module;
+  };
+  thread_local LastModule last_module = {};
+
+  const ModuleRanges* snapshot =
+      module_ranges_.load(std::memory_order_acquire);
+  if (!snapshot) {
+    return nullptr;
+  }
+  if (last_module.generation == snapshot->generation &&
+      address >= last_module.low && address < last_module.end) {
+    return last_module.module;
+  }
+
+  const ModuleRanges::Range* range = nullptr;
+  auto it = std::upper_bound(
+      snapshot->ranges.cbegin(), snapshot->ranges.cend(), address,
+      [](uint32_t address, const ModuleRanges::Range& range) {
+        return address < range.low;
+      });
+  if (it != snapshot->ranges.cbegin() && address < (it - 1)->end) {
+    range = &*(it - 1);
+  }
+
+  // Modules that can't be binary searched still take priority when they come
+  // first in modules_.
+  for (const auto& [order, module] : snapshot->unranged_modules) {
+    if (range && order > range->order) {
+      break;
+    }
     if (module->ContainsAddress(address)) {
-      return module.get();
+      return module;
     }
   }
-  return nullptr;
+  if (!range) {
+    return nullptr;
+  }
+  // Only cache hits that no unranged module could have shadowed.
+  if (snapshot->unranged_modules.empty() ||
+      snapshot->unranged_modules.front().first > range->order) {
+    last_module = {snapshot->generation, range->low, range->end,
+                   range->module};
+  }
+  return range->module;
 }
 Function* Processor::LookupFunction(uint32_t address) {
   // TODO(benvanik): fast reject invalid addresses/log errors.
@@ -340,6 +640,10 @@ bool Processor::DemandFunction(Function* function) {
   if (symbol_status == Symbol::Status::kNew) {
     // Symbol is undefined, so define now.
     assert_true(function->is_guest());
+    if (cvars::tiered_compilation && !debug_info_flags_) {
+      static_cast<GuestFunction*>(function)->set_tier(
+          GuestFunction::Tier::kBaseline);
+    }
     if (!frontend_->DefineFunction(static_cast<GuestFunction*>(function),
                                    debug_info_flags_)) {
       function->set_status(Symbol::Status::kFailed);
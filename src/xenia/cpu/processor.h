@@ -10,6 +10,9 @@
 #ifndef XENIA_CPU_PROCESSOR_H_
 #define XENIA_CPU_PROCESSOR_H_
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <map>
 #include <memory>
 #include <string>
@@ -18,11 +21,13 @@
 #include "xenia/base/cvar.h"
 #include "xenia/base/mapped_memory.h"
 #include "xenia/base/mutex.h"
+#include "xenia/base/threading.h"
 #include "xenia/cpu/backend/backend.h"
 #include "xenia/cpu/debug_listener.h"
 #include "xenia/cpu/entry_table.h"
 #include "xenia/cpu/export_resolver.h"
 #include "xenia/cpu/function.h"
+#include "xenia/cpu/guest_profiler.h"
 #include "xenia/cpu/module.h"
 #include "xenia/cpu/ppc/ppc_frontend.h"
 #include "xenia/cpu/thread_debug_info.h"
@@ -104,6 +109,9 @@ class Processor {
   void RemoveModule(const std::string_view name);
   Module* GetModule(const std::string_view name);
   std::vector<Module*> GetModules();
+  // Republishes the address ranges used by LookupModule. Must be called
+  // whenever the range of an added module changes.
+  void UpdateModuleRanges();
 
   Module* builtin_module() const { return builtin_module_; }
   Function* DefineBuiltin(const std::string_view name,
@@ -115,10 +123,26 @@ class Processor {
   void RemoveFunctionByAddress(uint32_t address);
 
   Function* LookupFunction(uint32_t address);
+  // Lock-free, uses the published module ranges.
   Module* LookupModule(uint32_t address);
   Function* LookupFunction(Module* module, uint32_t address);
   Function* ResolveFunction(uint32_t address);
 
+  // Restores previously translated code of the module from the given file,
+  // if the persistent code cache is enabled. The code of the module is
+  // written back to the same file on shutdown.
+  void LoadPersistentCode(Module* module, const std::filesystem::path& path);
+
+  // Translates the functions at the given addresses ahead of time on the
+  // precompilation threads, in order. Guest threads calling a function while
+  // it's being translated wait for it in ResolveFunction. Falls back to
+  // translating on the calling thread if precompilation threads are disabled.
+  void QueuePrecompilation(const std::vector<uint32_t>& addresses);
+  // Called by baseline tier code once it has been called often enough.
+  // Queues the function for retranslation with all optimizations on a
+  // precompilation thread.
+  void QueueTierUp(GuestFunction* function);
+
   bool Execute(ThreadState* thread_state, uint32_t address);
   bool ExecuteRaw(ThreadState* thread_state, uint32_t address);
   uint64_t Execute(ThreadState* thread_state, uint32_t address, uint64_t args[],
@@ -241,8 +265,35 @@ class Processor {
 
   bool DemandFunction(Function* function);
 
+  void TierUp(GuestFunction* function);
+  // Must be called with precompilation_request_lock_ held.
+  void EnsurePrecompilationThreads();
+  void PrecompilationThread();
+  void ShutdownPrecompilationThreads();
+
+  // Immutable snapshot of the module address ranges, replaced as a whole
+  // whenever modules change so LookupModule can read it without locking.
+  struct ModuleRanges {
+    struct Range {
+      uint32_t low;
+      uint64_t end;
+      // Position in modules_, earlier modules take priority.
+      size_t order;
+      Module* module;
+    };
+    uint64_t generation;
+    // Sorted by low address, non-overlapping.
+    std::vector<Range> ranges;
+    // Modules without a contiguous range (such as ones accepting all
+    // addresses), checked with ContainsAddress in modules_ order.
+    std::vector<std::pair<size_t, Module*>> unranged_modules;
+  };
+  // Must be called with global_critical_region_ held.
+  void PublishModuleRanges();
+
   Memory* memory_ = nullptr;
   std::unique_ptr<StackWalker> stack_walker_;
+  std::unique_ptr<GuestProfiler> guest_profiler_;
 
   std::function<DebugListener*(Processor*)> debug_listener_handler_;
   DebugListener* debug_listener_ = nullptr;
@@ -262,6 +313,12 @@ class Processor {
   ExecutionState execution_state_ = ExecutionState::kPaused;
   std::vector<std::unique_ptr<Module>> modules_;
   Module* builtin_module_ = nullptr;
+  std::atomic<const ModuleRanges*> module_ranges_{nullptr};
+  // Replaced snapshots, kept alive as lookups may still be reading them.
+  // Modules are rarely added or removed, so this doesn't grow much.
+  std::vector<std::unique_ptr<const ModuleRanges>> module_ranges_snapshots_;
+  // Files to write the persistent code of each module to on shutdown.
+  std::map<Module*, std::filesystem::path> persistent_code_paths_;
   uint32_t next_builtin_address_ = 0xFFFF0000u;
 
   // Maps thread ID to state. Updated on thread create, and threads are never
@@ -271,6 +328,19 @@ class Processor {
   // TODO(benvanik): cleanup/change structures.
   std::vector<Breakpoint*> breakpoints_;
 
+  xe_mutex precompilation_request_lock_;
+  std::condition_variable_any precompilation_request_cond_;
+  // Protected with precompilation_request_lock_, notify_one
+  // precompilation_request_cond_ when adding.
+  std::deque<uint32_t> precompilation_queue_;
+  // Protected with precompilation_request_lock_, notify_one
+  // precompilation_request_cond_ when adding.
+  std::deque<GuestFunction*> tier_up_queue_;
+  // Protected with precompilation_request_lock_, notify_all
+  // precompilation_request_cond_ when set.
+  bool precompilation_threads_shutdown_ = false;
+  std::vector<std::unique_ptr<xe::threading::Thread>> precompilation_threads_;
+
   Irql irql_;
 };
 
@@ -48,7 +48,7 @@ TestModule::TestModule(Processor* processor, const std::string_view name,
   compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
   compiler_->AddPass(std::make_unique<passes::ConstantPropagationPass>());
   compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
-  // compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
+  compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
   compiler_->AddPass(std::make_unique<passes::DeadCodeEliminationPass>());
 
   //// Removes all unneeded variables. Try not to add new ones after this.
@@ -0,0 +1,81 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+#include "xenia/base/memory.h"
+#include "xenia/cpu/crt_routines.h"
+
+namespace xe {
+namespace cpu {
+namespace test {
+
+static std::vector<uint8_t> AssembleWords(
+    const std::vector<uint32_t>& words) {
+  std::vector<uint8_t> code(words.size() * 4);
+  for (size_t i = 0; i < words.size(); ++i) {
+    xe::store_and_swap<uint32_t>(code.data() + i * 4, words[i]);
+  }
+  return code;
+}
+
+TEST_CASE("CRT routine hash ignores external branch targets", "[crt]") {
+  // Simplified strlen calling a helper, with a null check branching out of
+  // the routine, a loop and a tail call.
+  std::vector<uint32_t> words = {
+      0x2C030000,  // cmpwi r3, 0
+      0x41820400,  // beq +0x400
+      0x7C6B1B78,  // mr r11, r3
+      0x880B0000,  // lbz r0, 0(r11)
+      0x396B0001,  // addi r11, r11, 1
+      0x2C000000,  // cmpwi r0, 0
+      0x4082FFF4,  // bne -12
+      0x48001235,  // bl +0x1234
+      0x7C635850,  // subf r3, r3, r11
+      0x4BFFF000,  // b -0x1000
+  };
+  auto code = AssembleWords(words);
+  uint64_t hash = HashCrtRoutine(code.data(), uint32_t(words.size()));
+
+  // Linked elsewhere, calling the helper and tail calling at other addresses.
+  auto relocated_words = words;
+  relocated_words[1] = 0x4182F000;
+  relocated_words[7] = 0x48FF0001;
+  relocated_words[9] = 0x48020000;
+  auto relocated = AssembleWords(relocated_words);
+  REQUIRE(HashCrtRoutine(relocated.data(), uint32_t(words.size())) == hash);
+
+  // Branches within the routine are part of it.
+  auto changed_loop_words = words;
+  changed_loop_words[6] = 0x4082FFF8;
+  auto changed_loop = AssembleWords(changed_loop_words);
+  REQUIRE(HashCrtRoutine(changed_loop.data(), uint32_t(words.size())) != hash);
+
+  // So are the other instructions.
+  auto changed_words = words;
+  changed_words[4] = 0x396B0002;
+  auto changed = AssembleWords(changed_words);
+  REQUIRE(HashCrtRoutine(changed.data(), uint32_t(words.size())) != hash);
+}
+
+TEST_CASE("CRT routines are looked up by name", "[crt]") {
+  for (uint32_t i = 0; i < uint32_t(CrtRoutine::kCount); ++i) {
+    CrtRoutine routine;
+    REQUIRE(LookupCrtRoutine(GetCrtRoutineName(CrtRoutine(i)), &routine));
+    REQUIRE(routine == CrtRoutine(i));
+    REQUIRE(GetCrtRoutineHandler(routine) != nullptr);
+  }
+  CrtRoutine routine;
+  REQUIRE(!LookupCrtRoutine("memcmp", &routine));
+}
+
+}  // namespace test
+}  // namespace cpu
+}  // namespace xe
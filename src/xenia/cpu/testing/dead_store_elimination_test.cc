@@ -0,0 +1,84 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/testing/util.h"
+
+using namespace xe::cpu::hir;
+using namespace xe::cpu;
+using namespace xe::cpu::testing;
+using xe::cpu::ppc::PPCContext;
+
+TEST_CASE("DSE_OVERWRITTEN_STORE", "[dse]") {
+  TestFunction test([](HIRBuilder& b) {
+    StoreGPR(b, 3, LoadGPR(b, 4));
+    StoreGPR(b, 3, LoadGPR(b, 5));
+    b.Return();
+  });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[3] = 0;
+        ctx->r[4] = 10;
+        ctx->r[5] = 25;
+      },
+      [](PPCContext* ctx) { REQUIRE(ctx->r[3] == 25); });
+}
+
+TEST_CASE("DSE_STORE_LIVE_ON_ONE_PATH", "[dse]") {
+  TestFunction test([](HIRBuilder& b) {
+    auto skip = b.NewLabel();
+    StoreGPR(b, 3, LoadGPR(b, 4));
+    b.BranchTrue(b.IsTrue(LoadGPR(b, 6)), skip);
+    StoreGPR(b, 3, LoadGPR(b, 5));
+    b.MarkLabel(skip);
+    b.Return();
+  });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[3] = 0;
+        ctx->r[4] = 10;
+        ctx->r[5] = 25;
+        ctx->r[6] = 1;
+      },
+      [](PPCContext* ctx) { REQUIRE(ctx->r[3] == 10); });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[3] = 0;
+        ctx->r[4] = 10;
+        ctx->r[5] = 25;
+        ctx->r[6] = 0;
+      },
+      [](PPCContext* ctx) { REQUIRE(ctx->r[3] == 25); });
+}
+
+// Copies r3 to r6, so that the call observes the stores to r3 before it.
+static void CopyR3ToR6(PPCContext* ctx, void* arg0, void* arg1) {
+  ctx->r[6] = ctx->r[3];
+}
+
+TEST_CASE("DSE_STORE_OBSERVED_BY_CALL", "[dse]") {
+  BuiltinFunction copy_r3(nullptr, 0);
+  copy_r3.SetupBuiltin(CopyR3ToR6, nullptr, nullptr);
+  TestFunction test([&copy_r3](HIRBuilder& b) {
+    StoreGPR(b, 3, LoadGPR(b, 4));
+    b.CallExtern(&copy_r3);
+    StoreGPR(b, 3, LoadGPR(b, 5));
+    b.Return();
+  });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[3] = 0;
+        ctx->r[4] = 10;
+        ctx->r[5] = 25;
+        ctx->r[6] = 0;
+      },
+      [](PPCContext* ctx) {
+        REQUIRE(ctx->r[6] == 10);
+        REQUIRE(ctx->r[3] == 25);
+      });
+}
@@ -0,0 +1,249 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+#include "xenia/base/mutex.h"
+#include "xenia/base/split_map.h"
+#include "xenia/base/testing/benchmark.h"
+#include "xenia/base/threading.h"
+#include "xenia/cpu/entry_table.h"
+
+namespace xe {
+namespace cpu {
+namespace test {
+
+// The previous EntryTable implementation (global lock + split_map), kept for
+// comparison in the contention benchmark.
+class LockedEntryTable {
+ public:
+  ~LockedEntryTable() {
+    for (Entry* entry : map_.Values()) {
+      delete entry;
+    }
+  }
+
+  Entry::Status GetOrCreate(uint32_t address, Entry** out_entry) {
+    auto global_lock = global_critical_region_.Acquire();
+    uint32_t idx = map_.IndexForKey(address);
+    Entry* entry = idx != map_.size() && *map_.KeyAt(idx) == address
+                       ? *map_.ValueAt(idx)
+                       : nullptr;
+    Entry::Status status;
+    if (entry) {
+      while (entry->status == Entry::STATUS_COMPILING) {
+        global_lock.unlock();
+        xe::threading::Sleep(std::chrono::microseconds(10));
+        global_lock.lock();
+      }
+      status = entry->status;
+    } else {
+      entry = new Entry();
+      entry->address = address;
+      entry->end_address = 0;
+      entry->status = Entry::STATUS_COMPILING;
+      entry->function = nullptr;
+      map_.InsertAt(address, entry, idx);
+      status = Entry::STATUS_NEW;
+    }
+    global_lock.unlock();
+    *out_entry = entry;
+    return status;
+  }
+
+ private:
+  xe::global_critical_region global_critical_region_;
+  xe::split_map<uint32_t, Entry*> map_;
+};
+
+template <typename T>
+static void ResolveAll(T& table, const std::vector<uint32_t>& addresses) {
+  for (uint32_t address : addresses) {
+    Entry* entry;
+    if (table.GetOrCreate(address, &entry) == Entry::STATUS_NEW) {
+      entry->end_address = address + 4;
+      entry->status = Entry::STATUS_READY;
+    }
+  }
+}
+
+TEST_CASE("EntryTable GetOrCreate", "[entry_table]") {
+  EntryTable table;
+  // Direct-mapped range and the fallback map.
+  for (uint32_t address : {0x82000000u, 0x9FFFFFFCu, 0x00010000u}) {
+    Entry* entry = nullptr;
+    REQUIRE(table.GetOrCreate(address, &entry) == Entry::STATUS_NEW);
+    REQUIRE(entry != nullptr);
+    REQUIRE(entry->address == address);
+    REQUIRE(table.Get(address) == nullptr);
+
+    entry->end_address = address + 4;
+    entry->status = Entry::STATUS_READY;
+    REQUIRE(table.Get(address) == entry);
+
+    Entry* existing = nullptr;
+    REQUIRE(table.GetOrCreate(address, &existing) == Entry::STATUS_READY);
+    REQUIRE(existing == entry);
+
+    table.Delete(address);
+    REQUIRE(table.Get(address) == nullptr);
+    REQUIRE(table.GetOrCreate(address, &existing) == Entry::STATUS_NEW);
+    REQUIRE(existing != entry);
+    existing->status = Entry::STATUS_FAILED;
+  }
+}
+
+TEST_CASE("EntryTable keeps unaligned addresses apart", "[entry_table]") {
+  EntryTable table;
+  // Never looked up before, so the page of the direct-mapped range is missing.
+  REQUIRE(table.Get(0x90000000u) == nullptr);
+
+  Entry* aligned = nullptr;
+  REQUIRE(table.GetOrCreate(0x82000000u, &aligned) == Entry::STATUS_NEW);
+  aligned->status = Entry::STATUS_READY;
+  Entry* unaligned = nullptr;
+  REQUIRE(table.GetOrCreate(0x82000002u, &unaligned) == Entry::STATUS_NEW);
+  unaligned->status = Entry::STATUS_READY;
+  REQUIRE(unaligned != aligned);
+  REQUIRE(table.Get(0x82000000u) == aligned);
+  REQUIRE(table.Get(0x82000002u) == unaligned);
+
+  table.Delete(0x82000002u);
+  REQUIRE(table.Get(0x82000000u) == aligned);
+  REQUIRE(table.Get(0x82000002u) == nullptr);
+}
+
+TEST_CASE("EntryTable finds functions containing an address",
+          "[entry_table]") {
+  EntryTable table;
+  // Only compared, never called.
+  auto outer = reinterpret_cast<Function*>(uintptr_t(0x10));
+  auto inner = reinterpret_cast<Function*>(uintptr_t(0x20));
+  auto later = reinterpret_cast<Function*>(uintptr_t(0x30));
+  auto mapped = reinterpret_cast<Function*>(uintptr_t(0x40));
+  auto add = [&table](uint32_t address, uint32_t end_address,
+                      Function* function) {
+    Entry* entry;
+    REQUIRE(table.GetOrCreate(address, &entry) == Entry::STATUS_NEW);
+    table.MarkReady(entry, function, end_address);
+  };
+  add(0x82000000u, 0x82000100u, outer);
+  add(0x82000040u, 0x82000080u, inner);
+  add(0x82000200u, 0x82000300u, later);
+  add(0x00010000u, 0x00010020u, mapped);
+
+  auto find = [&table](uint32_t address) {
+    auto functions = table.FindWithAddress(address);
+    std::sort(functions.begin(), functions.end());
+    return functions;
+  };
+  REQUIRE(find(0x82000050u) == std::vector<Function*>{outer, inner});
+  REQUIRE(find(0x82000100u) == std::vector<Function*>{outer});
+  REQUIRE(find(0x82000180u).empty());
+  REQUIRE(find(0x82000300u) == std::vector<Function*>{later});
+  REQUIRE(find(0x00010010u) == std::vector<Function*>{mapped});
+
+  table.Delete(0x82000040u);
+  REQUIRE(find(0x82000050u) == std::vector<Function*>{outer});
+
+  // Deleted while its function was being translated.
+  Entry* entry;
+  REQUIRE(table.GetOrCreate(0x82000400u, &entry) == Entry::STATUS_NEW);
+  table.Delete(0x82000400u);
+  table.MarkReady(entry, outer, 0x82000500u);
+  REQUIRE(find(0x82000480u).empty());
+}
+
+TEST_CASE("EntryTable concurrent creation", "[entry_table]") {
+  EntryTable table;
+  std::vector<uint32_t> addresses;
+  for (uint32_t i = 0; i < 4096; ++i) {
+    addresses.push_back(0x82000000u + i * 0x40);
+  }
+  std::atomic<uint32_t> new_count(0);
+  // Catch assertions aren't thread safe, count failures instead.
+  std::atomic<uint32_t> unpublished_count(0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 6; ++i) {
+    threads.emplace_back([&]() {
+      for (uint32_t address : addresses) {
+        Entry* entry;
+        Entry::Status status = table.GetOrCreate(address, &entry);
+        if (status == Entry::STATUS_NEW) {
+          ++new_count;
+          entry->end_address = address + 4;
+          entry->status = Entry::STATUS_READY;
+        } else if (status != Entry::STATUS_READY ||
+                   entry->end_address != address + 4) {
+          // Losers must only return once the winner has published it.
+          ++unpublished_count;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  REQUIRE(new_count == addresses.size());
+  REQUIRE(unpublished_count == 0);
+}
+
+template <typename T>
+static double MeasureLookups(T& table, const std::vector<uint32_t>& addresses,
+                             size_t thread_count, size_t iterations) {
+  ResolveAll(table, addresses);
+  std::atomic<bool> start(false);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < thread_count; ++i) {
+    threads.emplace_back([&, i]() {
+      while (!start) {
+      }
+      Entry* entry;
+      for (size_t j = 0; j < iterations; ++j) {
+        uint32_t address = addresses[(j * 7 + i * 131) % addresses.size()];
+        table.GetOrCreate(address, &entry);
+      }
+    });
+  }
+  return base::test::MeasureNanoseconds(thread_count * iterations, [&]() {
+    start = true;
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  });
+}
+
+XE_BENCHMARK_CASE("EntryTable lookup contention") {
+  constexpr size_t kThreadCount = 6;
+  constexpr size_t kIterations = 1000000;
+  std::vector<uint32_t> addresses;
+  for (uint32_t i = 0; i < 16384; ++i) {
+    addresses.push_back(0x82000000u + i * 0x80);
+  }
+
+  LockedEntryTable locked_table;
+  base::test::ReportBenchmark(
+      fmt::format("locked, {} threads", kThreadCount),
+      MeasureLookups(locked_table, addresses, kThreadCount, kIterations),
+      "ns per lookup");
+  EntryTable table;
+  base::test::ReportBenchmark(
+      fmt::format("lock-free, {} threads", kThreadCount),
+      MeasureLookups(table, addresses, kThreadCount, kIterations),
+      "ns per lookup");
+}
+
+}  // namespace test
+}  // namespace cpu
+}  // namespace xe
@@ -10,6 +10,11 @@
 #include "xenia/cpu/xex_module.h"
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
 
 #include "third_party/fmt/include/fmt/format.h"
 
@@ -18,6 +23,7 @@
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
+#include "xenia/base/threading.h"
 
 #include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/export_resolver.h"
@@ -33,6 +39,7 @@
 #include "third_party/pe/pe_image.h"
 #include "xenia/cpu/ppc/ppc_decode_data.h"
 #include "xenia/cpu/ppc/ppc_instr.h"
+#include "xenia/cpu/ppc/ppc_scanner.h"
 DEFINE_bool(disable_instruction_infocache, false,
             "Disables caching records of called instructions/mmio accesses.",
             "CPU");
@@ -48,6 +55,16 @@ DEFINE_bool(
     "finding/stress testing with the JIT",
     "CPU");
 
+DEFINE_int32(xex_load_threads, 0,
+             "Number of threads decrypting XEX images while they are loaded. "
+             "0 uses all logical processors.",
+             "CPU");
+
+DEFINE_bool(replace_crt_routines, true,
+            "Replaces statically linked C runtime routines recognized by the "
+            "CRT signature database with native implementations.",
+            "CPU");
+
 DECLARE_bool(allow_plugins);
 
 static const uint8_t xe_xex2_retail_key[16] = {
@@ -82,6 +99,285 @@ namespace cpu {
 
 using xe::kernel::KernelState;
 
+namespace {
+
+// Bytes of an image decrypted at once by a load thread. A multiple of the AES
+// block size.
+constexpr size_t kXexDecryptChunkSize = 256 * 1024;
+
+using XexLoadClock = std::chrono::steady_clock;
+
+double MillisecondsSince(XexLoadClock::time_point begin) {
+  return std::chrono::duration<double, std::milli>(XexLoadClock::now() - begin)
+      .count();
+}
+
+size_t GetXexLoadThreadCount(size_t work_item_count) {
+  size_t thread_count = cvars::xex_load_threads > 0
+                            ? size_t(cvars::xex_load_threads)
+                            : size_t(xe::threading::logical_processor_count());
+  return std::max(std::min(thread_count, work_item_count), size_t(1));
+}
+
+// Calls work on thread_count threads, including the calling one, and returns
+// once it has returned on all of them.
+void RunXexLoadThreads(size_t thread_count, const std::function<void()>& work) {
+  std::vector<std::unique_ptr<xe::threading::Thread>> threads;
+  for (size_t i = 1; i < thread_count; ++i) {
+    threads.push_back(xe::threading::Thread::Create({}, work));
+    threads.back()->set_name("XEX Load");
+  }
+  work();
+  for (auto& thread : threads) {
+    xe::threading::Wait(thread.get(), false);
+  }
+}
+
+// Decrypts size bytes of AES-128-CBC ciphertext. iv is the ciphertext block
+// preceding it, or null at the start of the stream. As each plaintext block
+// only depends on its own and the previous ciphertext block, any range of the
+// stream can be decrypted independently.
+void AesDecryptRange(const uint32_t* rk, int32_t nr, const uint8_t* iv,
+                     const uint8_t* input, size_t size, uint8_t* output) {
+  uint8_t ivec[16] = {0};
+  if (iv) {
+    std::memcpy(ivec, iv, 16);
+  }
+  const uint8_t* ct = input;
+  uint8_t* pt = output;
+  for (size_t n = 0; n < size; n += 16, ct += 16, pt += 16) {
+    // Decrypt 16 uint8_ts from input -> output.
+    rijndaelDecrypt(rk, nr, ct, pt);
+    for (size_t i = 0; i < 16; i++) {
+      // XOR with previous.
+      pt[i] ^= ivec[i];
+      // Set previous.
+      ivec[i] = ct[i];
+    }
+  }
+}
+
+// Decrypts a buffer on background threads in chunks, taken roughly in order,
+// so the start of it can be used while the rest is still being decrypted.
+class XexDecryptPipeline {
+ public:
+  XexDecryptPipeline(const uint8_t* session_key, const uint8_t* input,
+                     uint8_t* output, size_t size)
+      : input_(input),
+        output_(output),
+        size_(size),
+        chunk_count_(xe::round_up(size, kXexDecryptChunkSize, false) /
+                     kXexDecryptChunkSize),
+        chunk_decrypted_(chunk_count_, false) {
+    nr_ = rijndaelKeySetupDec(rk_, session_key, 128);
+  }
+  ~XexDecryptPipeline() {
+    // Chunks not taken yet are abandoned if the data turned out to be invalid.
+    next_chunk_ = chunk_count_;
+    for (auto& thread : threads_) {
+      xe::threading::Wait(thread.get(), false);
+    }
+  }
+
+  size_t chunk_count() const { return chunk_count_; }
+
+  // With a single thread, decrypts everything before returning.
+  void Start(size_t thread_count) {
+    begin_ = XexLoadClock::now();
+    if (thread_count <= 1) {
+      DecryptChunks();
+      return;
+    }
+    for (size_t i = 0; i < thread_count; ++i) {
+      threads_.push_back(
+          xe::threading::Thread::Create({}, [this]() { DecryptChunks(); }));
+      threads_.back()->set_name("XEX Decrypt");
+    }
+  }
+
+  // Waits until the bytes before end are decrypted.
+  void WaitForDecrypted(size_t end) {
+    size_t chunk_end = std::min(
+        xe::round_up(end, kXexDecryptChunkSize, false) / kXexDecryptChunkSize,
+        chunk_count_);
+    std::unique_lock<std::mutex> lock(mutex_);
+    decrypted_cv_.wait(lock, [this, chunk_end]() {
+      return decrypted_chunk_prefix_ >= chunk_end;
+    });
+  }
+
+  // Waits until everything is decrypted and returns how long it took.
+  double WaitForAll() {
+    WaitForDecrypted(size_);
+    std::lock_guard<std::mutex> lock(mutex_);
+    return std::chrono::duration<double, std::milli>(end_ - begin_).count();
+  }
+
+ private:
+  void DecryptChunks() {
+    for (;;) {
+      size_t chunk = next_chunk_.fetch_add(1);
+      if (chunk >= chunk_count_) {
+        return;
+      }
+      size_t offset = chunk * kXexDecryptChunkSize;
+      AesDecryptRange(rk_, nr_, offset ? input_ + offset - 16 : nullptr,
+                      input_ + offset,
+                      std::min(kXexDecryptChunkSize, size_ - offset),
+                      output_ + offset);
+      std::lock_guard<std::mutex> lock(mutex_);
+      chunk_decrypted_[chunk] = true;
+      size_t prefix = decrypted_chunk_prefix_;
+      while (prefix < chunk_count_ && chunk_decrypted_[prefix]) {
+        ++prefix;
+      }
+      if (prefix != decrypted_chunk_prefix_) {
+        decrypted_chunk_prefix_ = prefix;
+        if (prefix == chunk_count_) {
+          end_ = XexLoadClock::now();
+        }
+        decrypted_cv_.notify_all();
+      }
+    }
+  }
+
+  uint32_t rk_[4 * (MAXNR + 1)];
+  int32_t nr_;
+  const uint8_t* input_;
+  uint8_t* output_;
+  size_t size_;
+  size_t chunk_count_;
+  std::atomic<size_t> next_chunk_{0};
+  std::vector<std::unique_ptr<xe::threading::Thread>> threads_;
+  XexLoadClock::time_point begin_;
+
+  std::mutex mutex_;
+  std::condition_variable decrypted_cv_;
+  std::vector<bool> chunk_decrypted_;
+  // Number of chunks from the start that are all decrypted.
+  size_t decrypted_chunk_prefix_ = 0;
+  XexLoadClock::time_point end_;
+};
+
+// Reads the LZX data out of the blocks of a normally compressed image, as
+// decryption of the image progresses, checking the hash of each block before
+// its data is used. Each block starts with the size and hash of the next one,
+// followed by chunks of data, each prefixed with its big endian 16-bit size,
+// and a zero size.
+class XexCompressedBlockReader {
+ public:
+  XexCompressedBlockReader(const uint8_t* input, size_t input_size,
+                           const xex2_compressed_block_info& first_block,
+                           XexDecryptPipeline* pipeline)
+      : input_(input),
+        input_size_(input_size),
+        pipeline_(pipeline),
+        block_size_(first_block.block_size) {
+    std::memcpy(block_hash_, first_block.block_hash, sizeof(block_hash_));
+  }
+
+  bool hash_mismatch() const { return hash_mismatch_; }
+  double verify_ms() const { return verify_ms_; }
+  double wait_ms() const { return wait_ms_; }
+
+  int Read(void* buffer, int size) {
+    auto out = static_cast<uint8_t*>(buffer);
+    int read = 0;
+    while (read < size) {
+      if (!chunk_remaining_ && !BeginChunk()) {
+        break;
+      }
+      size_t length = std::min(chunk_remaining_, size_t(size - read));
+      std::memcpy(out + read, input_ + position_, length);
+      position_ += length;
+      chunk_remaining_ -= length;
+      read += int(length);
+    }
+    return error_ ? -1 : read;
+  }
+
+ private:
+  bool BeginChunk() {
+    for (;;) {
+      if (error_ || !block_size_) {
+        return false;
+      }
+      size_t block_end = block_offset_ + block_size_;
+      if (!in_block_) {
+        if (block_size_ < sizeof(xex2_compressed_block_info) ||
+            block_size_ > input_size_ - block_offset_) {
+          error_ = true;
+          return false;
+        }
+        if (pipeline_) {
+          auto wait_begin = XexLoadClock::now();
+          pipeline_->WaitForDecrypted(block_end);
+          wait_ms_ += MillisecondsSince(wait_begin);
+        }
+        // Compare block hash, if no match we probably used wrong decrypt key
+        auto verify_begin = XexLoadClock::now();
+        uint8_t block_calced_digest[0x14];
+        sha1::SHA1 s;
+        s.processBytes(input_ + block_offset_, block_size_);
+        s.finalize(block_calced_digest);
+        verify_ms_ += MillisecondsSince(verify_begin);
+        if (std::memcmp(block_calced_digest, block_hash_, 0x14) != 0) {
+          hash_mismatch_ = true;
+          error_ = true;
+          return false;
+        }
+        auto next_block = reinterpret_cast<const xex2_compressed_block_info*>(
+            input_ + block_offset_);
+        next_block_size_ = next_block->block_size;
+        std::memcpy(next_block_hash_, next_block->block_hash,
+                    sizeof(next_block_hash_));
+        position_ = block_offset_ + sizeof(xex2_compressed_block_info);
+        in_block_ = true;
+      }
+      if (block_end - position_ < 2) {
+        error_ = true;
+        return false;
+      }
+      const size_t chunk_size =
+          (input_[position_] << 8) | input_[position_ + 1];
+      position_ += 2;
+      if (!chunk_size) {
+        block_offset_ = block_end;
+        block_size_ = next_block_size_;
+        std::memcpy(block_hash_, next_block_hash_, sizeof(block_hash_));
+        in_block_ = false;
+        continue;
+      }
+      if (chunk_size > block_end - position_) {
+        error_ = true;
+        return false;
+      }
+      chunk_remaining_ = chunk_size;
+      return true;
+    }
+  }
+
+  const uint8_t* input_;
+  size_t input_size_;
+  XexDecryptPipeline* pipeline_;
+
+  size_t block_offset_ = 0;
+  uint32_t block_size_;
+  uint8_t block_hash_[0x14];
+  uint32_t next_block_size_ = 0;
+  uint8_t next_block_hash_[0x14];
+  bool in_block_ = false;
+  size_t position_ = 0;
+  size_t chunk_remaining_ = 0;
+
+  bool error_ = false;
+  bool hash_mismatch_ = false;
+  double verify_ms_ = 0.0;
+  double wait_ms_ = 0.0;
+};
+
+}  // namespace
+
 XexModule::XexModule(Processor* processor, KernelState* kernel_state)
     : Module(processor), processor_(processor), kernel_state_(kernel_state) {}
 
@@ -570,10 +866,15 @@ int XexModule::ReadImageUncompressed(const void* xex_addr, size_t xex_length) {
       }
       memcpy(buffer, p, exe_length);
       return 0;
-    case XEX_ENCRYPTION_NORMAL:
-      aes_decrypt_buffer(session_key_, p, exe_length, buffer,
-                         uncompressed_size);
+    case XEX_ENCRYPTION_NORMAL: {
+      XexDecryptPipeline pipeline(session_key_, p, buffer, exe_length);
+      size_t thread_count = GetXexLoadThreadCount(pipeline.chunk_count());
+      pipeline.Start(thread_count);
+      double decrypt_ms = pipeline.WaitForAll();
+      XELOGI("XEX image {}: decrypted {} bytes in {:.1f} ms on {} threads",
+             name_, exe_length, decrypt_ms, thread_count);
       return 0;
+    }
     default:
       assert_always();
       return 1;
@@ -628,47 +929,85 @@ int XexModule::ReadImageBasicCompressed(const void* xex_addr,
 
   uint8_t* buffer = memory()->TranslateVirtual(base_address_);
   std::memset(buffer, 0, total_size);  // Quickly zero the contents.
-  uint8_t* d = buffer;
 
-  uint32_t rk[4 * (MAXNR + 1)];
-  uint8_t ivec[16] = {0};
-  int32_t Nr = rijndaelKeySetupDec(rk, session_key_, 128);
+  auto begin = XexLoadClock::now();
+  const bool encrypted =
+      opt_file_format_info()->encryption_type == XEX_ENCRYPTION_NORMAL;
+  if (!encrypted &&
+      opt_file_format_info()->encryption_type != XEX_ENCRYPTION_NONE) {
+    assert_always();
+    return 1;
+  }
 
-  for (size_t n = 0; n < block_count; n++) {
+  // Split the blocks into pieces that can be copied or decrypted
+  // independently. The data of the blocks is contiguous in the file, and each
+  // block continues the CBC chain of the previous one.
+  struct DataPiece {
+    const uint8_t* iv;
+    const uint8_t* source;
+    uint8_t* dest;
+    uint32_t size;
+  };
+  std::vector<DataPiece> pieces;
+  const uint8_t* iv = nullptr;
+  // Decryption writes whole AES blocks, which may cover the start of the next
+  // block if a size isn't a multiple of 16, so the pieces must then be done
+  // in order.
+  bool pieces_overlap = false;
+  size_t source_offset = 0;
+  size_t dest_offset = 0;
+  for (uint32_t n = 0; n < block_count; n++) {
     const uint32_t data_size = comp_info.blocks[n].data_size;
     const uint32_t zero_size = comp_info.blocks[n].zero_size;
-
-    switch (opt_file_format_info()->encryption_type) {
-      case XEX_ENCRYPTION_NONE:
-        if (data_size > uncompressed_size - (d - buffer)) {
-          // Overflow.
-          return 1;
-        }
-        memcpy(d, p, data_size);
-        break;
-      case XEX_ENCRYPTION_NORMAL: {
-        const uint8_t* ct = p;
-        uint8_t* pt = d;
-        for (size_t m = 0; m < data_size; m += 16, ct += 16, pt += 16) {
-          // Decrypt 16 uint8_ts from input -> output.
-          rijndaelDecrypt(rk, Nr, ct, pt);
-          for (size_t i = 0; i < 16; i++) {
-            // XOR with previous.
-            pt[i] ^= ivec[i];
-            // Set previous.
-            ivec[i] = ct[i];
-          }
-        }
-      } break;
-      default:
-        assert_always();
-        return 1;
+    const size_t written_size =
+        encrypted ? xe::round_up(data_size, 16u, false) : data_size;
+    if (data_size > exe_length - source_offset ||
+        written_size > total_size - dest_offset) {
+      // Overflow.
+      return 1;
+    }
+    if (written_size > size_t(data_size) + zero_size) {
+      pieces_overlap = true;
+    }
+    for (uint32_t offset = 0; offset < data_size;
+         offset += uint32_t(kXexDecryptChunkSize)) {
+      pieces.push_back(
+          {offset ? p + offset - 16 : iv, p + offset,
+           buffer + dest_offset + offset,
+           std::min(data_size - offset, uint32_t(kXexDecryptChunkSize))});
+    }
+    if (data_size) {
+      iv = p + written_size - 16;
     }
-
     p += data_size;
-    d += data_size + zero_size;
+    source_offset += data_size;
+    dest_offset += size_t(data_size) + zero_size;
   }
 
+  uint32_t rk[4 * (MAXNR + 1)];
+  int32_t Nr = rijndaelKeySetupDec(rk, session_key_, 128);
+  size_t thread_count =
+      pieces_overlap ? 1 : GetXexLoadThreadCount(pieces.size());
+  std::atomic<size_t> next_piece(0);
+  RunXexLoadThreads(thread_count, [&]() {
+    for (;;) {
+      size_t i = next_piece.fetch_add(1);
+      if (i >= pieces.size()) {
+        return;
+      }
+      const DataPiece& piece = pieces[i];
+      if (encrypted) {
+        AesDecryptRange(rk, Nr, piece.iv, piece.source, piece.size,
+                        piece.dest);
+      } else {
+        std::memcpy(piece.dest, piece.source, piece.size);
+      }
+    }
+  });
+  XELOGI("XEX image {}: {} {} bytes in {} blocks in {:.1f} ms on {} threads",
+         name_, encrypted ? "decrypted" : "copied", source_offset, block_count,
+         MillisecondsSince(begin), thread_count);
+
   return 0;
 }
 
@@ -685,27 +1024,29 @@ int XexModule::ReadImageCompressed(const void* xex_addr, size_t xex_length) {
   //   20b hash of entire next block (including size/hash)
   //    Nb block uint8_ts
   // - decompress block contents
+  // Decryption runs on other threads, ahead of de-blocking and decompression,
+  // which consume the image as it gets decrypted.
 
-  uint8_t* compress_buffer = NULL;
-  const uint8_t* p = NULL;
-  uint8_t* d = NULL;
-  sha1::SHA1 s;
+  auto begin = XexLoadClock::now();
 
   // Decrypt (if needed).
-  bool free_input = false;
   const uint8_t* input_buffer = exe_buffer;
-  size_t input_size = exe_length;
+  std::vector<uint8_t> decrypted_buffer;
+  std::unique_ptr<XexDecryptPipeline> decrypt_pipeline;
+  size_t decrypt_thread_count = 0;
 
   switch (opt_file_format_info()->encryption_type) {
     case XEX_ENCRYPTION_NONE:
       // No-op.
       break;
     case XEX_ENCRYPTION_NORMAL:
-      // TODO: a way to do without a copy/alloc?
-      free_input = true;
-      input_buffer = (const uint8_t*)calloc(1, exe_length);
-      aes_decrypt_buffer(session_key_, exe_buffer, exe_length,
-                         (uint8_t*)input_buffer, exe_length);
+      decrypted_buffer.resize(exe_length);
+      input_buffer = decrypted_buffer.data();
+      decrypt_pipeline = std::make_unique<XexDecryptPipeline>(
+          session_key_, exe_buffer, decrypted_buffer.data(), exe_length);
+      decrypt_thread_count =
+          GetXexLoadThreadCount(decrypt_pipeline->chunk_count());
+      decrypt_pipeline->Start(decrypt_thread_count);
       break;
     default:
       assert_always();
@@ -713,85 +1054,59 @@ int XexModule::ReadImageCompressed(const void* xex_addr, size_t xex_length) {
   }
 
   const auto* compression_info = &opt_file_format_info()->compression_info;
-  const xex2_compressed_block_info* cur_block =
-      &compression_info->normal.first_block;
-
-  compress_buffer = (uint8_t*)calloc(1, exe_length);
-
-  p = input_buffer;
-  d = compress_buffer;
-
-  // De-block.
-  int result_code = 0;
-
-  uint8_t block_calced_digest[0x14];
-  while (cur_block->block_size) {
-    const uint8_t* pnext = p + cur_block->block_size;
-    const auto* next_block = (const xex2_compressed_block_info*)p;
-
-    // Compare block hash, if no match we probably used wrong decrypt key
-    s.reset();
-    s.processBytes(p, cur_block->block_size);
-    s.finalize(block_calced_digest);
-    if (memcmp(block_calced_digest, cur_block->block_hash, 0x14) != 0) {
-      result_code = 2;
-      break;
-    }
+  XexCompressedBlockReader block_reader(input_buffer, exe_length,
+                                        compression_info->normal.first_block,
+                                        decrypt_pipeline.get());
 
-    // skip block info
-    p += 4;
-    p += 20;
+  uint32_t uncompressed_size = image_size();
 
-    while (true) {
-      const size_t chunk_size = (p[0] << 8) | p[1];
-      p += 2;
-      if (!chunk_size) {
-        break;
-      }
-
-      memcpy(d, p, chunk_size);
-      p += chunk_size;
-      d += chunk_size;
-    }
-
-    p = pnext;
-    cur_block = next_block;
+  // Allocate in-place the XEX memory.
+  bool alloc_result =
+      memory()
+          ->LookupHeap(base_address_)
+          ->AllocFixed(
+              base_address_, uncompressed_size, 4096,
+              xe::kMemoryAllocationReserve | xe::kMemoryAllocationCommit,
+              xe::kMemoryProtectRead | xe::kMemoryProtectWrite);
+  if (!alloc_result) {
+    XELOGE("Unable to allocate XEX memory at {:08X}-{:08X}.", base_address_,
+           uncompressed_size);
+    return 3;
   }
 
-  if (!result_code) {
-    uint32_t uncompressed_size = image_size();
-
-    // Allocate in-place the XEX memory.
-    bool alloc_result =
-        memory()
-            ->LookupHeap(base_address_)
-            ->AllocFixed(
-                base_address_, uncompressed_size, 4096,
-                xe::kMemoryAllocationReserve | xe::kMemoryAllocationCommit,
-                xe::kMemoryProtectRead | xe::kMemoryProtectWrite);
-
-    if (alloc_result) {
-      uint8_t* buffer = memory()->TranslateVirtual(base_address_);
-      std::memset(buffer, 0, uncompressed_size);
+  uint8_t* buffer = memory()->TranslateVirtual(base_address_);
+  std::memset(buffer, 0, uncompressed_size);
 
-      // Decompress into XEX base
-      result_code = lzx_decompress(
-          compress_buffer, d - compress_buffer, buffer, uncompressed_size,
-          compression_info->normal.window_size, nullptr, 0);
-    } else {
-      XELOGE("Unable to allocate XEX memory at {:08X}-{:08X}.", base_address_,
-             uncompressed_size);
-      result_code = 3;
-    }
+  // Decompress into XEX base
+  auto decompress_begin = XexLoadClock::now();
+  int result_code = lzx_decompress_stream(
+      [&block_reader](void* read_buffer, int read_size) {
+        return block_reader.Read(read_buffer, read_size);
+      },
+      buffer, uncompressed_size, compression_info->normal.window_size);
+  if (block_reader.hash_mismatch()) {
+    // Probably used the wrong decrypt key.
+    return 2;
   }
-
-  if (compress_buffer) {
-    free((void*)compress_buffer);
+  if (result_code) {
+    return result_code;
   }
-  if (free_input) {
-    free((void*)input_buffer);
+  double decompress_ms = MillisecondsSince(decompress_begin);
+
+  if (decrypt_pipeline) {
+    XELOGI(
+        "XEX image {}: decrypted in {:.1f} ms on {} threads, decompressed in "
+        "{:.1f} ms ({:.1f} ms verifying blocks, {:.1f} ms waiting for "
+        "decryption), {:.1f} ms total",
+        name_, decrypt_pipeline->WaitForAll(), decrypt_thread_count,
+        decompress_ms, block_reader.verify_ms(), block_reader.wait_ms(),
+        MillisecondsSince(begin));
+  } else {
+    XELOGI(
+        "XEX image {}: decompressed in {:.1f} ms ({:.1f} ms verifying blocks)",
+        name_, decompress_ms, block_reader.verify_ms());
   }
-  return result_code;
+  return 0;
 }
 
 int XexModule::ReadPEHeaders() {
@@ -1023,6 +1338,7 @@ bool XexModule::LoadContinue() {
 
   // Notify backend that we have an executable range.
   processor_->backend()->CommitExecutableRange(low_address_, high_address_);
+  processor_->UpdateModuleRanges();
 
   // Add all imports (variables/functions).
   xex2_opt_import_libraries* opt_import_libraries = nullptr;
@@ -1107,6 +1423,78 @@ bool XexModule::LoadContinue() {
   return true;
 }
 
+void XexModule::BindCrtRoutines(
+    const std::vector<CrtRoutineSignature>& signatures) {
+  if (!cvars::replace_crt_routines || signatures.empty()) {
+    return;
+  }
+  auto begin = XexLoadClock::now();
+  ppc::PPCScanner scanner(processor_->frontend());
+  uint32_t bound_count = 0;
+  for (uint32_t address : PreanalyzeCode()) {
+    if (address < low_address_ || address >= high_address_ ||
+        LookupSymbol(address, false)) {
+      continue;
+    }
+    // Scan a function that isn't declared, so nothing is left behind for the
+    // candidates that don't match.
+    auto candidate = CreateFunction(address);
+    auto guest_candidate = static_cast<GuestFunction*>(candidate.get());
+    if (!scanner.Scan(guest_candidate, nullptr) ||
+        guest_candidate->end_address() < address) {
+      continue;
+    }
+    uint32_t instruction_count =
+        (guest_candidate->end_address() - address) / 4 + 1;
+    const CrtRoutineSignature* match = nullptr;
+    uint64_t hash = 0;
+    bool hashed = false;
+    for (const CrtRoutineSignature& signature : signatures) {
+      if (signature.instruction_count != instruction_count) {
+        continue;
+      }
+      if (!hashed) {
+        hash = HashCrtRoutine(memory()->TranslateVirtual(address),
+                              instruction_count);
+        hashed = true;
+      }
+      if (signature.hash == hash) {
+        match = &signature;
+        break;
+      }
+    }
+    if (!match) {
+      continue;
+    }
+
+    // Like import thunks, the routine now starts with:
+    //     sc 2
+    //     blr
+    // The rest of the routine is left as it is.
+    BaseHeap* heap = memory()->LookupHeap(address);
+    uint32_t old_protect = 0;
+    heap->QueryProtect(address, &old_protect);
+    heap->Protect(address, 8, kMemoryProtectRead | kMemoryProtectWrite);
+    uint8_t* p = memory()->TranslateVirtual(address);
+    xe::store_and_swap<uint32_t>(p + 0x0, 0x44000042);
+    xe::store_and_swap<uint32_t>(p + 0x4, 0x4E800020);
+    heap->Protect(address, 8, old_protect);
+
+    Function* function;
+    DeclareFunction(address, &function);
+    function->set_end_address(address + 4);
+    function->set_name(GetCrtRoutineName(match->routine));
+    static_cast<GuestFunction*>(function)->SetupExtern(
+        GetCrtRoutineHandler(match->routine));
+    function->set_status(Symbol::Status::kDeclared);
+    XELOGD("Replacing {} at {:08X} ({} instructions) with a native one",
+           GetCrtRoutineName(match->routine), address, instruction_count);
+    ++bound_count;
+  }
+  XELOGI("Replaced {} C runtime routines in {} with native ones in {:.1f} ms",
+         bound_count, name_, MillisecondsSince(begin));
+}
+
 void XexModule::Precompile() {
   sha1::SHA1 final_image_sha_;
 
@@ -1124,6 +1512,8 @@ void XexModule::Precompile() {
     sprintf_s(fmtbuf, "%X", image_sha_bytes_[i]);
     image_sha_str_ += &fmtbuf[0];
   }
+  cache_directory_ =
+      kernel_state_->emulator()->cache_root() / "modules" / image_sha_str_;
 
   // Find __savegprlr_* and __restgprlr_* and the others.
   // We can flag these for special handling (inlining/etc).
@@ -1132,6 +1522,10 @@ void XexModule::Precompile() {
   }
 
   info_cache_.Init(this);
+  // Must happen before any code of the module is translated.
+  if (!cvars::writable_code_segments) {
+    processor_->LoadPersistentCode(this, cache_directory_ / "code_cache.bin");
+  }
   PrecompileDiscoveredFunctions();
 }
 bool XexModule::Unload() {
@@ -1336,6 +1730,12 @@ bool XexModule::ContainsAddress(uint32_t address) {
   return address >= low_address_ && address < high_address_;
 }
 
+bool XexModule::GetAddressRange(uint32_t* out_low, uint32_t* out_size) {
+  *out_low = low_address_;
+  *out_size = high_address_ > low_address_ ? high_address_ - low_address_ : 0;
+  return true;
+}
+
 std::unique_ptr<Function> XexModule::CreateFunction(uint32_t address) {
   return std::unique_ptr<Function>(
       processor_->backend()->CreateGuestFunction(this, address));
@@ -1345,12 +1745,7 @@ void XexInfoCache::Init(XexModule* xexmod) {
     return;
   }
 
-  auto emu = xexmod->kernel_state_->emulator();
-  std::filesystem::path infocache_path = emu->cache_root();
-
-  infocache_path.append(L"modules");
-
-  infocache_path.append(xexmod->image_sha_str_);
+  std::filesystem::path infocache_path = xexmod->cache_directory();
 
   std::filesystem::create_directories(infocache_path);
   infocache_path.append("executable_addr_flags.bin");
@@ -1403,40 +1798,45 @@ void XexModule::PrecompileDiscoveredFunctions() {
   if (!cvars::enable_early_precompilation) {
     return;
   }
-  auto others = PreanalyzeCode();
+  // Functions that were called on previous runs go first, as they're the most
+  // likely to be needed soon. They're returned in ascending order.
+  std::vector<uint32_t> addresses = PrecompileKnownFunctions();
+  size_t known_count = addresses.size();
 
-  for (auto&& other : others) {
+  std::vector<uint32_t> others = PreanalyzeCode();
+  for (uint32_t other : others) {
     if (other < low_address_ || other >= high_address_) {
       continue;
     }
+    if (std::binary_search(addresses.cbegin(),
+                           addresses.cbegin() + known_count, other)) {
+      continue;
+    }
     auto sym = processor_->LookupFunction(other);
-
     if (!sym || sym->status() != Symbol::Status::kDefined) {
-      processor_->ResolveFunction(other);
+      addresses.push_back(other);
     }
   }
+  processor_->QueuePrecompilation(addresses);
 }
-void XexModule::PrecompileKnownFunctions() {
-  if (!cvars::enable_early_precompilation) {
-    return;
-  }
-  uint32_t start = 0;
+std::vector<uint32_t> XexModule::PrecompileKnownFunctions() {
+  std::vector<uint32_t> addresses;
   uint32_t end = (high_address_ - low_address_) / 4;
   auto flags = info_cache_.LookupFlags(0);
   if (!flags) {
-    return;
+    return addresses;
   }
-  // maybe should pre-acquire global crit?
   for (uint32_t i = 0; i < end; i++) {
     if (flags[i].was_resolved) {
       uint32_t addr = low_address_ + (i * 4);
       auto sym = processor_->LookupFunction(addr);
 
       if (!sym || sym->status() != Symbol::Status::kDefined) {
-        processor_->ResolveFunction(addr);
+        addresses.push_back(addr);
       }
     }
   }
+  return addresses;
 }
 
 static uint32_t GetBLCalledFunction(XexModule* xexmod, uint32_t current_base,
@@ -10,9 +10,11 @@
 #ifndef XENIA_CPU_XEX_MODULE_H_
 #define XENIA_CPU_XEX_MODULE_H_
 
+#include <filesystem>
 #include <string>
 #include <vector>
 #include "xenia/base/mapped_memory.h"
+#include "xenia/cpu/crt_routines.h"
 #include "xenia/cpu/module.h"
 #include "xenia/kernel/util/xex2_info.h"
 
@@ -37,7 +39,9 @@ struct InfoCacheFlags {
   uint32_t is_syscall_func : 1;
   uint32_t is_return_site : 1;  // address can be reached from another function
                                 // by returning
-  uint32_t reserved : 28;
+  uint32_t was_executed : 1;    // a block starting here has been run by
+                                // baseline code (with cold_block_profiling)
+  uint32_t reserved : 27;
 };
 static_assert(sizeof(InfoCacheFlags) == 4,
               "InfoCacheFlags size should be equal to sizeof ppc instruction.");
@@ -205,6 +209,7 @@ class XexModule : public xe::cpu::Module {
   bool Unload();
 
   bool ContainsAddress(uint32_t address) override;
+  bool GetAddressRange(uint32_t* out_low, uint32_t* out_size) override;
 
   const std::string& name() const override { return name_; }
   bool is_executable() const override {
@@ -232,13 +237,25 @@ class XexModule : public xe::cpu::Module {
 
   InfoCacheFlags* GetInstructionAddressFlags(uint32_t guest_addr);
 
+  // Per-image directory for cached data, keyed by the hash of the loaded
+  // image. Empty until Precompile has been called.
+  const std::filesystem::path& cache_directory() const {
+    return cache_directory_;
+  }
+
+  // Replaces the statically linked C runtime routines matching the signatures
+  // with their native implementations. Must be called before Precompile, as
+  // the entries of the routines are rewritten.
+  void BindCrtRoutines(const std::vector<CrtRoutineSignature>& signatures);
+
   virtual void Precompile() override;
 
  protected:
   std::unique_ptr<Function> CreateFunction(uint32_t address) override;
 
  private:
-  void PrecompileKnownFunctions();
+  // Returns the not yet defined functions that were resolved on previous runs.
+  std::vector<uint32_t> PrecompileKnownFunctions();
   void PrecompileDiscoveredFunctions();
   std::vector<uint32_t> PreanalyzeCode();
   friend struct XexInfoCache;
@@ -284,6 +301,7 @@ class XexModule : public xe::cpu::Module {
 
   uint8_t image_sha_bytes_[16];
   std::string image_sha_str_;
+  std::filesystem::path cache_directory_;
   XexInfoCache info_cache_;
 };
 
@@ -28,6 +28,8 @@
 #include "xenia/cpu/ppc/ppc_opcode_info.h"
 #include "xenia/cpu/stack_walker.h"
 #include "xenia/gpu/graphics_system.h"
+#include "xenia/kernel/kernel_flags.h"
+#include "xenia/kernel/util/kernel_call_profiler.h"
 #include "xenia/kernel/xmodule.h"
 #include "xenia/kernel/xthread.h"
 #include "xenia/ui/graphics_provider.h"
@@ -216,6 +218,9 @@ void DebugWindow::DrawFrame(ImGuiIO& io) {
   ImGui::SameLine();
   ImGui::RadioButton("Memory", &state_.right_pane_tab,
                      ImState::kRightPaneMemory);
+  ImGui::SameLine();
+  ImGui::RadioButton("Kernel Calls", &state_.right_pane_tab,
+                     ImState::kRightPaneKernelCalls);
   ImGui::EndGroup();
   ImGui::Separator();
   switch (state_.right_pane_tab) {
@@ -229,6 +234,11 @@ void DebugWindow::DrawFrame(ImGuiIO& io) {
       DrawMemoryPane();
       ImGui::EndChild();
       break;
+    case ImState::kRightPaneKernelCalls:
+      ImGui::BeginChild("##kernel_calls_pane");
+      DrawKernelCallsPane();
+      ImGui::EndChild();
+      break;
   }
   ImGui::EndChild();
   ImGui::InvisibleButton("##hsplitter0", ImVec2(-1, kSplitterWidth));
@@ -1113,6 +1123,44 @@ void DebugWindow::DrawMemoryPane() {
   // https://github.com/ocornut/imgui/wiki/memory_editor_example
 }
 
+void DebugWindow::DrawKernelCallsPane() {
+  if (!cvars::profile_kernel_calls) {
+    ImGui::Text("Enable profile_kernel_calls to profile kernel calls.");
+    return;
+  }
+  if (ImGui::Button("Reset")) {
+    kernel::util::KernelCallProfiler::ResetStats();
+  }
+  ImGui::Separator();
+  ImGui::BeginChild("##kernel_calls");
+  ImGui::Columns(5);
+  ImGui::Text("Export");
+  ImGui::NextColumn();
+  ImGui::Text("Calls");
+  ImGui::NextColumn();
+  ImGui::Text("Total ms");
+  ImGui::NextColumn();
+  ImGui::Text("p50 ns");
+  ImGui::NextColumn();
+  ImGui::Text("p99 ns");
+  ImGui::NextColumn();
+  ImGui::Separator();
+  for (const auto& stats : kernel::util::KernelCallProfiler::CollectStats()) {
+    ImGui::Text("%s!%s", stats.module_name, stats.export_entry->name);
+    ImGui::NextColumn();
+    ImGui::Text("%" PRIu64, stats.call_count);
+    ImGui::NextColumn();
+    ImGui::Text("%.3f", stats.total_ns / 1000000.0);
+    ImGui::NextColumn();
+    ImGui::Text("%" PRIu64, stats.EstimateLatencyPercentile(0.5));
+    ImGui::NextColumn();
+    ImGui::Text("%" PRIu64, stats.EstimateLatencyPercentile(0.99));
+    ImGui::NextColumn();
+  }
+  ImGui::Columns(1);
+  ImGui::EndChild();
+}
+
 void DebugWindow::DrawBreakpointsPane() {
   auto& state = state_.breakpoints;
 
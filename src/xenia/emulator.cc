@@ -141,6 +141,8 @@ Emulator::Emulator(const std::filesystem::path& command_line,
 }
 
 Emulator::~Emulator() {
+  WaitForPendingSave();
+
   // Note that we delete things in the reverse order they were initialized.
 
   // Give the systems time to shutdown before we delete them.
@@ -540,36 +542,62 @@ void Emulator::Resume() {
 }
 
 bool Emulator::SaveToFile(const std::filesystem::path& path) {
+  // The previous save must be complete for this one to be relative to it.
+  WaitForPendingSave();
+
   Pause();
 
+  std::shared_ptr<Memory::SaveCapture> memory_capture =
+      memory_->CaptureSave(path);
+
   filesystem::CreateEmptyFile(path);
-  auto map = MappedMemory::Open(path, MappedMemory::Mode::kReadWrite, 0, 2_GiB);
+  std::shared_ptr<MappedMemory> map =
+      MappedMemory::Open(path, MappedMemory::Mode::kReadWrite, 0, 2_GiB);
   if (!map) {
+    Resume();
     return false;
   }
 
   // Save the emulator state to a file
-  ByteStream stream(map->data(), map->size());
-  stream.Write(kEmulatorSaveSignature);
-  stream.Write(title_id_.has_value());
+  auto stream = std::make_shared<ByteStream>(map->data(), map->size());
+  stream->Write(kEmulatorSaveSignature);
+  stream->Write(title_id_.has_value());
   if (title_id_.has_value()) {
-    stream.Write(title_id_.value());
+    stream->Write(title_id_.value());
   }
 
   // It's important we don't hold the global lock here! XThreads need to step
   // forward (possibly through guarded regions) without worry!
-  processor_->Save(&stream);
-  graphics_system_->Save(&stream);
-  audio_system_->Save(&stream);
-  kernel_state_->Save(&stream);
-  memory_->Save(&stream);
-  map->Close(stream.offset());
+  processor_->Save(stream.get());
+  graphics_system_->Save(stream.get());
+  audio_system_->Save(stream.get());
+  kernel_state_->Save(stream.get());
 
   Resume();
+
+  // Compressing and writing the memory, most of the save state, doesn't need
+  // the guest to be paused.
+  save_thread_ = threading::Thread::Create(
+      {}, [this, path, map, stream, memory_capture]() {
+        memory_->WriteSave(*memory_capture, stream.get());
+        map->Close(stream->offset());
+        XELOGI("Saved state to {}, {} bytes", xe::path_to_utf8(path),
+               stream->offset());
+      });
+  save_thread_->set_name("Save State Writer");
   return true;
 }
 
+void Emulator::WaitForPendingSave() {
+  if (save_thread_) {
+    threading::Wait(save_thread_.get(), false);
+    save_thread_.reset();
+  }
+}
+
 bool Emulator::RestoreFromFile(const std::filesystem::path& path) {
+  WaitForPendingSave();
+
   // Restore the emulator state from a file
   auto map = MappedMemory::Open(path, MappedMemory::Mode::kReadWrite);
   if (!map) {
@@ -51,7 +51,7 @@ class Window;
 
 namespace xe {
 
-constexpr fourcc_t kEmulatorSaveSignature = make_fourcc("XSAV");
+constexpr fourcc_t kEmulatorSaveSignature = make_fourcc("XSV2");
 
 // The main type that runs the whole emulator.
 // This is responsible for initializing and managing all the various subsystems.
@@ -241,6 +241,9 @@ class Emulator {
   X_STATUS CompleteLaunch(const std::filesystem::path& path,
                           const std::string_view module_path);
 
+  // Waits until the memory of the last save state has been written.
+  void WaitForPendingSave();
+
   std::filesystem::path command_line_;
   std::filesystem::path storage_root_;
   std::filesystem::path content_root_;
@@ -282,6 +285,8 @@ class Emulator {
   bool paused_;
   bool restoring_;
   threading::Fence restore_fence_;  // Fired on restore finish.
+  // Writes the memory of the last save state in the background.
+  std::unique_ptr<threading::Thread> save_thread_;
 };
 
 }  // namespace xe
@@ -265,6 +265,11 @@ void CommandProcessor::WorkerThreadMain() {
     }
     assert_true(read_ptr_index_ != write_ptr_index);
 
+    // The guest has written the data used by the commands before submitting
+    // them, so this is where the GPU copies of it are invalidated if the
+    // writes are not detected immediately.
+    memory_->CollectPhysicalMemoryWrites();
+
     // Execute. Note that we handle wraparound transparently.
     read_ptr_index_ = ExecutePrimaryBuffer(read_ptr_index_, write_ptr_index);
 
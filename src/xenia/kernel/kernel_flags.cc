@@ -14,3 +14,12 @@ DEFINE_bool(headless, false,
             "UI");
 DEFINE_bool(log_high_frequency_kernel_calls, false,
             "Log kernel calls with the kHighFrequency tag.", "Kernel");
+DEFINE_bool(profile_kernel_calls, false,
+            "Count the calls to each kernel export and measure their "
+            "latency. The stats are shown in the debugger and dumped at "
+            "exit.",
+            "Kernel");
+DEFINE_path(kernel_call_profile_path, "",
+            "File to write the kernel call stats to at exit when "
+            "profile_kernel_calls is enabled. Written to the log if empty.",
+            "Kernel");
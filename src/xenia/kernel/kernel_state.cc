@@ -16,10 +16,13 @@
 #include "xenia/base/byte_stream.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/string.h"
+#include "xenia/cpu/crt_routines.h"
 #include "xenia/cpu/processor.h"
 #include "xenia/emulator.h"
 #include "xenia/hid/input_system.h"
+#include "xenia/kernel/kernel_flags.h"
 #include "xenia/kernel/user_module.h"
+#include "xenia/kernel/util/kernel_call_profiler.h"
 #include "xenia/kernel/util/shim_utils.h"
 #include "xenia/kernel/xam/xam_module.h"
 #include "xenia/kernel/xboxkrnl/xboxkrnl_module.h"
@@ -79,6 +82,10 @@ KernelState::KernelState(Emulator* emulator)
 }
 
 KernelState::~KernelState() {
+  if (cvars::profile_kernel_calls) {
+    util::KernelCallProfiler::DumpStats(cvars::kernel_call_profile_path);
+  }
+
   SetExecutableModule(nullptr);
 
   if (dispatch_thread_running_) {
@@ -449,6 +456,22 @@ object_ref<UserModule> KernelState::LoadUserModule(
   return module;
 }
 
+static std::vector<cpu::CrtRoutineSignature> GetCrtRoutineSignatures(
+    const patcher::Patcher* patcher) {
+  std::vector<cpu::CrtRoutineSignature> signatures;
+  for (const patcher::CrtSignatureEntry& entry : patcher->GetCrtSignatures()) {
+    cpu::CrtRoutineSignature signature;
+    if (!cpu::LookupCrtRoutine(entry.routine_name, &signature.routine)) {
+      XELOGW("No native implementation of CRT routine {}", entry.routine_name);
+      continue;
+    }
+    signature.hash = entry.hash;
+    signature.instruction_count = entry.instruction_count;
+    signatures.push_back(signature);
+  }
+  return signatures;
+}
+
 X_RESULT KernelState::FinishLoadingUserModule(
     const object_ref<UserModule> module, bool call_entry) {
   // TODO(Gliniak): Apply custom patches here
@@ -461,6 +484,8 @@ X_RESULT KernelState::FinishLoadingUserModule(
                                              module->hash());
   emulator_->on_patch_apply();
   if (module->xex_module()) {
+    module->xex_module()->BindCrtRoutines(
+        GetCrtRoutineSignatures(emulator_->patcher()));
     module->xex_module()->Precompile();
   }
 
@@ -25,3 +25,5 @@ project("xenia-kernel")
   files({
     "debug_visualizers.natvis",
   })
+
+include("testing")
@@ -0,0 +1,207 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/kernel/util/object_table.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+#include "xenia/base/testing/benchmark.h"
+#include "xenia/kernel/xevent.h"
+
+namespace xe {
+namespace kernel {
+namespace test {
+
+using util::ObjectTable;
+
+// Auto reset event without a kernel state or guest object, added to the table.
+static object_ref<XEvent> CreateTableEvent(ObjectTable& table,
+                                           X_HANDLE* out_handle) {
+  auto event = object_ref<XEvent>(new XEvent(nullptr));
+  X_DISPATCH_HEADER header = {};
+  header.type = 0x01;  // EventSynchronizationObject
+  event->InitializeNative(&header, &header);
+  REQUIRE(XSUCCEEDED(table.AddHandle(event.get(), out_handle)));
+  return event;
+}
+
+TEST_CASE("ObjectTable looks up handles until they're removed",
+          "[object_table]") {
+  ObjectTable table;
+  std::vector<X_HANDLE> handles;
+  std::vector<object_ref<XEvent>> events;
+  // More than the initial capacity, so that the table grows.
+  for (int i = 0; i < 20000; ++i) {
+    X_HANDLE handle;
+    events.push_back(CreateTableEvent(table, &handle));
+    handles.push_back(handle);
+  }
+  for (size_t i = 0; i < handles.size(); ++i) {
+    REQUIRE(table.LookupObject<XEvent>(handles[i]).get() == events[i].get());
+  }
+  REQUIRE(!table.LookupObject<XEvent>(XObject::kHandleBase + 0x400000));
+
+  for (size_t i = 0; i < handles.size(); i += 2) {
+    REQUIRE(XSUCCEEDED(table.RemoveHandle(handles[i])));
+  }
+  for (size_t i = 0; i < handles.size(); ++i) {
+    auto event = table.LookupObject<XEvent>(handles[i]);
+    REQUIRE(event.get() == ((i & 1) ? events[i].get() : nullptr));
+  }
+
+  for (size_t i = 1; i < handles.size(); i += 2) {
+    REQUIRE(XSUCCEEDED(table.RemoveHandle(handles[i])));
+  }
+}
+
+TEST_CASE("ObjectTable lookups race handle removal", "[object_table]") {
+  ObjectTable table;
+  constexpr size_t kHandleCount = 64;
+  std::vector<X_HANDLE> handles(kHandleCount);
+  for (X_HANDLE& handle : handles) {
+    CreateTableEvent(table, &handle);
+  }
+
+  // The handles are closed and reopened, mostly in the same slots, while the
+  // other threads look them up, and must get either nothing or a live event.
+  // The table holds the only other reference, so an event that a lookup
+  // failed to retain is destroyed while it is still being signalled and
+  // waited on here.
+  std::atomic<bool> stop{false};
+  std::atomic<size_t> bad_lookup_count{0};
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < 4; ++i) {
+    threads.emplace_back([&, i]() {
+      size_t n = i;
+      uint64_t timeout = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        auto event = table.LookupObject<XEvent>(handles[n++ % kHandleCount]);
+        if (!event) {
+          continue;
+        }
+        event->Set(0, false);
+        X_STATUS status = event->Wait(0, 0, 0, &timeout);
+        // Another thread may have taken the signal first.
+        if (status != X_STATUS_SUCCESS && status != X_STATUS_TIMEOUT) {
+          ++bad_lookup_count;
+        }
+      }
+    });
+  }
+  for (size_t i = 0; i < 20000; ++i) {
+    X_HANDLE& handle = handles[i % kHandleCount];
+    REQUIRE(XSUCCEEDED(table.RemoveHandle(handle)));
+    CreateTableEvent(table, &handle);
+  }
+  stop = true;
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  REQUIRE(bad_lookup_count == 0);
+
+  for (X_HANDLE handle : handles) {
+    REQUIRE(XSUCCEEDED(table.RemoveHandle(handle)));
+  }
+}
+
+// Pairs of threads signalling the event of the other and waiting on their own,
+// looking the handles up each time like NtSetEvent and
+// NtWaitForSingleObjectEx. Returns the nanoseconds per round trip of all pairs.
+static double MeasureEventPingPong(ObjectTable& table, size_t pair_count) {
+  constexpr size_t kIterations = 20000;
+  std::vector<X_HANDLE> handles(pair_count * 2);
+  for (X_HANDLE& handle : handles) {
+    CreateTableEvent(table, &handle);
+  }
+
+  auto signal = [&table](X_HANDLE handle) {
+    table.LookupObject<XEvent>(handle)->Set(0, false);
+  };
+  auto wait = [&table](X_HANDLE handle) {
+    table.LookupObject<XEvent>(handle)->Wait(0, 0, 0, nullptr);
+  };
+  double nanoseconds =
+      base::test::MeasureNanoseconds(pair_count * kIterations, [&]() {
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < pair_count; ++i) {
+          X_HANDLE ping = handles[i * 2];
+          X_HANDLE pong = handles[i * 2 + 1];
+          threads.emplace_back([&, ping, pong]() {
+            for (size_t n = 0; n < kIterations; ++n) {
+              signal(pong);
+              wait(ping);
+            }
+          });
+          threads.emplace_back([&, ping, pong]() {
+            for (size_t n = 0; n < kIterations; ++n) {
+              wait(pong);
+              signal(ping);
+            }
+          });
+        }
+        for (std::thread& thread : threads) {
+          thread.join();
+        }
+      });
+
+  for (X_HANDLE handle : handles) {
+    REQUIRE(XSUCCEEDED(table.RemoveHandle(handle)));
+  }
+  return nanoseconds;
+}
+
+// Threads each looking up a handle of their own. Returns the nanoseconds per
+// lookup on each thread.
+static double MeasureLookups(ObjectTable& table, size_t thread_count) {
+  constexpr size_t kIterations = 1000000;
+  std::vector<X_HANDLE> handles(thread_count);
+  for (X_HANDLE& handle : handles) {
+    CreateTableEvent(table, &handle);
+  }
+
+  double nanoseconds = base::test::MeasureNanoseconds(kIterations, [&]() {
+    std::vector<std::thread> threads;
+    for (X_HANDLE handle : handles) {
+      threads.emplace_back([&table, handle]() {
+        for (size_t n = 0; n < kIterations; ++n) {
+          table.LookupObject<XEvent>(handle);
+        }
+      });
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+  });
+
+  for (X_HANDLE handle : handles) {
+    REQUIRE(XSUCCEEDED(table.RemoveHandle(handle)));
+  }
+  return nanoseconds;
+}
+
+XE_BENCHMARK_CASE("ObjectTable event signalling across threads") {
+  ObjectTable table;
+  for (size_t thread_count : {1u, 2u, 4u, 8u}) {
+    base::test::ReportBenchmark(fmt::format("{} threads", thread_count),
+                                MeasureLookups(table, thread_count),
+                                "ns per lookup");
+  }
+  for (size_t pair_count : {1u, 2u, 4u}) {
+    base::test::ReportBenchmark(fmt::format("{} thread pairs", pair_count),
+                                MeasureEventPingPong(table, pair_count),
+                                "ns per event round trip");
+  }
+}
+
+}  // namespace test
+}  // namespace kernel
+}  // namespace xe
@@ -0,0 +1,271 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/kernel/util/kernel_call_profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+
+#include "third_party/fmt/include/fmt/format.h"
+#include "xenia/base/assert.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+
+namespace xe {
+namespace kernel {
+namespace util {
+
+namespace {
+
+constexpr size_t kLatencyBucketCount = KernelCallProfiler::kLatencyBucketCount;
+constexpr uint32_t kSlotsPerChunk = 64;
+constexpr uint32_t kMaxChunks = 64;
+constexpr uint32_t kMaxSlots = kSlotsPerChunk * kMaxChunks;
+constexpr uint32_t kInvalidSlot = UINT32_MAX;
+
+// Only written by the thread owning them, atomic so that they can be read
+// while the thread is running.
+struct CallCounters {
+  std::atomic<uint64_t> call_count;
+  std::atomic<uint64_t> total_ns;
+  std::atomic<uint64_t> latency_histogram[kLatencyBucketCount];
+};
+
+struct CounterChunk {
+  CallCounters counters[kSlotsPerChunk];
+};
+
+struct CallTotals {
+  uint64_t call_count = 0;
+  uint64_t total_ns = 0;
+  std::array<uint64_t, kLatencyBucketCount> latency_histogram = {};
+
+  void Add(const CallCounters& counters) {
+    call_count += counters.call_count.load(std::memory_order_relaxed);
+    total_ns += counters.total_ns.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < kLatencyBucketCount; ++i) {
+      latency_histogram[i] +=
+          counters.latency_histogram[i].load(std::memory_order_relaxed);
+    }
+  }
+};
+
+class ThreadCounters;
+
+struct Registry {
+  std::mutex mutex;
+  std::vector<std::pair<const char*, const cpu::Export*>> exports;
+  std::vector<ThreadCounters*> threads;
+  // Counts of the threads that have exited.
+  std::vector<CallTotals> retired;
+  // Counts at the last reset, subtracted from the collected ones.
+  std::vector<CallTotals> baseline;
+};
+
+// Never destroyed, as threads may still exit during shutdown.
+Registry& registry() {
+  static auto registry = new Registry();
+  return *registry;
+}
+
+class ThreadCounters {
+ public:
+  ThreadCounters() {
+    auto& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.threads.push_back(this);
+  }
+
+  ~ThreadCounters() {
+    auto& r = registry();
+    {
+      std::lock_guard<std::mutex> lock(r.mutex);
+      r.retired.resize(r.exports.size());
+      AddTo(r.retired);
+      r.threads.erase(std::find(r.threads.begin(), r.threads.end(), this));
+    }
+    for (auto& chunk : chunks_) {
+      delete chunk.load(std::memory_order_relaxed);
+    }
+  }
+
+  CallCounters& Get(uint32_t slot) {
+    auto& chunk = chunks_[slot / kSlotsPerChunk];
+    CounterChunk* counter_chunk = chunk.load(std::memory_order_relaxed);
+    if (!counter_chunk) {
+      counter_chunk = new CounterChunk();
+      chunk.store(counter_chunk, std::memory_order_release);
+    }
+    return counter_chunk->counters[slot % kSlotsPerChunk];
+  }
+
+  // Must be called with the registry mutex held.
+  void AddTo(std::vector<CallTotals>& totals) const {
+    for (uint32_t slot = 0; slot < totals.size(); ++slot) {
+      const CounterChunk* counter_chunk =
+          chunks_[slot / kSlotsPerChunk].load(std::memory_order_acquire);
+      if (!counter_chunk) {
+        slot += kSlotsPerChunk - 1 - slot % kSlotsPerChunk;
+        continue;
+      }
+      totals[slot].Add(counter_chunk->counters[slot % kSlotsPerChunk]);
+    }
+  }
+
+ private:
+  std::atomic<CounterChunk*> chunks_[kMaxChunks] = {};
+};
+
+void Increment(std::atomic<uint64_t>& counter, uint64_t value) {
+  counter.store(counter.load(std::memory_order_relaxed) + value,
+                std::memory_order_relaxed);
+}
+
+// Must be called with the registry mutex held.
+std::vector<CallTotals> MergeTotals(Registry& r) {
+  std::vector<CallTotals> totals = r.retired;
+  totals.resize(r.exports.size());
+  for (const ThreadCounters* thread : r.threads) {
+    thread->AddTo(totals);
+  }
+  return totals;
+}
+
+}  // namespace
+
+uint64_t KernelCallProfiler::ExportStats::EstimateLatencyPercentile(
+    double fraction) const {
+  uint64_t remaining =
+      std::max(uint64_t(std::ceil(double(call_count) * fraction)), uint64_t(1));
+  for (size_t i = 0; i < kLatencyBucketCount; ++i) {
+    if (latency_histogram[i] >= remaining) {
+      return uint64_t(1) << (i + 1);
+    }
+    remaining -= latency_histogram[i];
+  }
+  return uint64_t(1) << kLatencyBucketCount;
+}
+
+uint32_t KernelCallProfiler::RegisterExport(const char* module_name,
+                                            const cpu::Export* export_entry) {
+  auto& r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  if (r.exports.size() >= kMaxSlots) {
+    assert_always();
+    return kInvalidSlot;
+  }
+  r.exports.emplace_back(module_name, export_entry);
+  return uint32_t(r.exports.size() - 1);
+}
+
+void KernelCallProfiler::RecordCall(uint32_t slot, uint64_t start_tick_count) {
+  static const double ns_per_tick =
+      1000000000.0 / double(Clock::QueryHostTickFrequency());
+  uint64_t ns = uint64_t(
+      double(Clock::QueryHostTickCount() - start_tick_count) * ns_per_tick);
+  if (slot == kInvalidSlot) {
+    return;
+  }
+  thread_local ThreadCounters thread_counters;
+  CallCounters& counters = thread_counters.Get(slot);
+  Increment(counters.call_count, 1);
+  Increment(counters.total_ns, ns);
+  size_t bucket =
+      ns ? std::min(size_t(xe::log2_floor(ns)), kLatencyBucketCount - 1) : 0;
+  Increment(counters.latency_histogram[bucket], 1);
+}
+
+std::vector<KernelCallProfiler::ExportStats>
+KernelCallProfiler::CollectStats() {
+  auto& r = registry();
+  std::vector<ExportStats> stats;
+  std::lock_guard<std::mutex> lock(r.mutex);
+  std::vector<CallTotals> totals = MergeTotals(r);
+  for (size_t slot = 0; slot < totals.size(); ++slot) {
+    CallTotals total = totals[slot];
+    if (slot < r.baseline.size()) {
+      const CallTotals& baseline = r.baseline[slot];
+      total.call_count -= baseline.call_count;
+      total.total_ns -= baseline.total_ns;
+      for (size_t i = 0; i < kLatencyBucketCount; ++i) {
+        total.latency_histogram[i] -= baseline.latency_histogram[i];
+      }
+    }
+    if (!total.call_count) {
+      continue;
+    }
+    stats.push_back({r.exports[slot].first, r.exports[slot].second,
+                     total.call_count, total.total_ns,
+                     total.latency_histogram});
+  }
+  std::sort(stats.begin(), stats.end(),
+            [](const ExportStats& a, const ExportStats& b) {
+              return a.total_ns > b.total_ns;
+            });
+  return stats;
+}
+
+void KernelCallProfiler::ResetStats() {
+  auto& r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  r.baseline = MergeTotals(r);
+}
+
+std::string KernelCallProfiler::FormatStats(
+    const std::vector<ExportStats>& stats) {
+  std::string text = fmt::format(
+      "{:<48} {:>7} {:>10} {:>12} {:>10} {:>10} {:>10}\n", "Export", "Ordinal",
+      "Calls", "Total ms", "Avg ns", "p50 ns", "p99 ns");
+  for (const ExportStats& export_stats : stats) {
+    text += fmt::format(
+        "{:<48} {:>7X} {:>10} {:>12.3f} {:>10} {:>10} {:>10}\n",
+        fmt::format("{}!{}", export_stats.module_name,
+                    export_stats.export_entry->name),
+        export_stats.export_entry->ordinal, export_stats.call_count,
+        export_stats.total_ns / 1000000.0,
+        export_stats.total_ns / export_stats.call_count,
+        export_stats.EstimateLatencyPercentile(0.5),
+        export_stats.EstimateLatencyPercentile(0.99));
+    // Calls per latency bucket, by the lower bound of the bucket.
+    text += " ";
+    for (size_t i = 0; i < kLatencyBucketCount; ++i) {
+      if (export_stats.latency_histogram[i]) {
+        text += fmt::format(" {}ns:{}", i ? uint64_t(1) << i : 0,
+                            export_stats.latency_histogram[i]);
+      }
+    }
+    text += "\n";
+  }
+  return text;
+}
+
+void KernelCallProfiler::DumpStats(const std::filesystem::path& path) {
+  std::string text = FormatStats(CollectStats());
+  if (path.empty()) {
+    XELOGI("Kernel calls:\n{}", text);
+    return;
+  }
+  FILE* file = xe::filesystem::OpenFile(path, "w");
+  if (!file) {
+    XELOGE("Failed to open {} to write the kernel call profile",
+           xe::path_to_utf8(path));
+    return;
+  }
+  fwrite(text.data(), 1, text.size(), file);
+  fclose(file);
+  XELOGI("Wrote the kernel call profile to {}", xe::path_to_utf8(path));
+}
+
+}  // namespace util
+}  // namespace kernel
+}  // namespace xe
@@ -0,0 +1,68 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_KERNEL_UTIL_KERNEL_CALL_PROFILER_H_
+#define XENIA_KERNEL_UTIL_KERNEL_CALL_PROFILER_H_
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "xenia/cpu/export_resolver.h"
+
+namespace xe {
+namespace kernel {
+namespace util {
+
+// Call counts and latencies of the exports implemented by the kernel modules,
+// recorded by their trampolines when profile_kernel_calls is enabled. Each
+// thread counts into its own counters, which are only merged when the stats
+// are collected.
+class KernelCallProfiler {
+ public:
+  // Bucket i counts calls taking [2^i, 2^(i+1)) ns, with 0 ns in bucket 0.
+  static constexpr size_t kLatencyBucketCount = 32;
+
+  struct ExportStats {
+    const char* module_name;
+    const cpu::Export* export_entry;
+    uint64_t call_count;
+    uint64_t total_ns;
+    std::array<uint64_t, kLatencyBucketCount> latency_histogram;
+
+    // Upper bound of the latency of the given fraction of the calls.
+    uint64_t EstimateLatencyPercentile(double fraction) const;
+  };
+
+  // Called once per export when it's registered, returns the slot its calls
+  // are recorded in.
+  static uint32_t RegisterExport(const char* module_name,
+                                 const cpu::Export* export_entry);
+
+  // Records a call that started at the given host tick count.
+  static void RecordCall(uint32_t slot, uint64_t start_tick_count);
+
+  // Stats of all exports called at least once since the last reset, merged
+  // from all threads and sorted by total time.
+  static std::vector<ExportStats> CollectStats();
+  static void ResetStats();
+
+  static std::string FormatStats(const std::vector<ExportStats>& stats);
+  // Writes the stats to the file at the given path, or to the log if it's
+  // empty.
+  static void DumpStats(const std::filesystem::path& path);
+};
+
+}  // namespace util
+}  // namespace kernel
+}  // namespace xe
+
+#endif  // XENIA_KERNEL_UTIL_KERNEL_CALL_PROFILER_H_
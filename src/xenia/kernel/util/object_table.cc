@@ -10,10 +10,11 @@
 #include "xenia/kernel/util/object_table.h"
 
 #include <algorithm>
-#include <cstring>
+#include <new>
 
 #include "xenia/base/byte_stream.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/threading.h"
 #include "xenia/kernel/xobject.h"
 #include "xenia/kernel/xthread.h"
 
@@ -29,37 +30,93 @@ void ObjectTable::Reset() {
   auto global_lock = global_critical_region_.Acquire();
 
   // Release all objects.
-  for (uint32_t n = 0; n < table_capacity_; n++) {
-    ObjectTableEntry& entry = table_[n];
-    if (entry.object) {
-      entry.object->Release();
-    }
-  }
-  for (uint32_t n = 0; n < host_table_capacity_; n++) {
-    ObjectTableEntry& entry = host_table_[n];
-    if (entry.object) {
-      entry.object->Release();
+  for (SlotTable* table : {&table_, &host_table_}) {
+    for (uint32_t n = 0; n < table->capacity(); n++) {
+      XObject* object = DetachObject(*table->entry(n));
+      if (object) {
+        object->Release();
+      }
     }
   }
 
-  table_capacity_ = 0;
-  host_table_capacity_ = 0;
   last_free_entry_ = 0;
   last_free_host_entry_ = 0;
-  free(table_);
-  table_ = nullptr;
-  free(host_table_);
-  host_table_ = nullptr;
+  // Nothing may look handles up anymore by the time the table is reset.
+  table_.Clear();
+  host_table_.Clear();
+}
+
+ObjectTable::ObjectTableEntry* ObjectTable::SlotTable::entry(
+    uint32_t slot) const {
+  Directory* directory = directory_.load(std::memory_order_acquire);
+  if (!directory || slot >= directory->capacity) {
+    return nullptr;
+  }
+  return &directory->chunks[slot / kEntriesPerChunk][slot % kEntriesPerChunk];
+}
+
+bool ObjectTable::SlotTable::Grow(uint32_t new_capacity) {
+  uint32_t chunk_count =
+      (new_capacity + kEntriesPerChunk - 1) / kEntriesPerChunk;
+  uint32_t old_chunk_count = capacity_ / kEntriesPerChunk;
+  if (chunk_count <= old_chunk_count) {
+    return true;
+  }
+
+  auto directory = std::make_unique<Directory>();
+  directory->chunks.reset(new (std::nothrow) ObjectTableEntry*[chunk_count]);
+  if (!directory->chunks) {
+    return false;
+  }
+  if (old_chunk_count) {
+    std::copy_n(directory_.load(std::memory_order_relaxed)->chunks.get(),
+                old_chunk_count, directory->chunks.get());
+  }
+  for (uint32_t i = old_chunk_count; i < chunk_count; i++) {
+    auto chunk = std::unique_ptr<ObjectTableEntry[]>(
+        new (std::nothrow) ObjectTableEntry[kEntriesPerChunk]);
+    if (!chunk) {
+      return false;
+    }
+    directory->chunks[i] = chunk.get();
+    chunks_.push_back(std::move(chunk));
+  }
+  directory->capacity = chunk_count * kEntriesPerChunk;
+
+  // Entries of the new chunks are initialized before lookups can see them.
+  capacity_ = directory->capacity;
+  directory_.store(directory.get(), std::memory_order_release);
+  directories_.push_back(std::move(directory));
+  return true;
+}
+
+void ObjectTable::SlotTable::Clear() {
+  capacity_ = 0;
+  directory_.store(nullptr, std::memory_order_release);
+  directories_.clear();
+  chunks_.clear();
+}
+
+XObject* ObjectTable::DetachObject(ObjectTableEntry& entry) {
+  // Either a lookup announced itself before the object was cleared, and it's
+  // waited for here, or it will read nullptr.
+  XObject* object = entry.object.exchange(nullptr);
+  if (object) {
+    while (entry.lookup_count.load()) {
+      xe::threading::MaybeYield();
+    }
+  }
+  return object;
 }
 
 X_STATUS ObjectTable::FindFreeSlot(uint32_t* out_slot, bool host) {
   // Find a free slot.
   uint32_t slot = host ? last_free_host_entry_ : last_free_entry_;
-  uint32_t capacity = host ? host_table_capacity_ : table_capacity_;
+  SlotTable& table = host ? host_table_ : table_;
+  uint32_t capacity = table.capacity();
   uint32_t scan_count = 0;
   while (scan_count < capacity) {
-    ObjectTableEntry& entry = host ? host_table_[slot] : table_[slot];
-    if (!entry.object) {
+    if (!table.entry(slot)->object.load(std::memory_order_relaxed)) {
       *out_slot = slot;
       return X_STATUS_SUCCESS;
     }
@@ -86,29 +143,16 @@ X_STATUS ObjectTable::FindFreeSlot(uint32_t* out_slot, bool host) {
 }
 
 bool ObjectTable::Resize(uint32_t new_capacity, bool host) {
-  uint32_t capacity = host ? host_table_capacity_ : table_capacity_;
-  uint32_t new_size = new_capacity * sizeof(ObjectTableEntry);
-  uint32_t old_size = capacity * sizeof(ObjectTableEntry);
-  auto new_table = reinterpret_cast<ObjectTableEntry*>(
-      realloc(host ? host_table_ : table_, new_size));
-  if (!new_table) {
+  SlotTable& table = host ? host_table_ : table_;
+  uint32_t capacity = table.capacity();
+  if (!table.Grow(new_capacity)) {
     return false;
   }
 
-  // Zero out new entries.
-  if (new_size > old_size) {
-    std::memset(reinterpret_cast<uint8_t*>(new_table) + old_size, 0,
-                new_size - old_size);
-  }
-
   if (host) {
     last_free_host_entry_ = capacity;
-    host_table_capacity_ = new_capacity;
-    host_table_ = new_table;
   } else {
     last_free_entry_ = capacity;
-    table_capacity_ = new_capacity;
-    table_ = new_table;
   }
 
   return true;
@@ -128,9 +172,9 @@ X_STATUS ObjectTable::AddHandle(XObject* object, X_HANDLE* out_handle) {
 
     // Stash.
     if (XSUCCEEDED(result)) {
-      ObjectTableEntry& entry = host_object ? host_table_[slot] : table_[slot];
-      entry.object = object;
-      entry.handle_ref_count = 1;
+      ObjectTableEntry* entry =
+          (host_object ? host_table_ : table_).entry(slot);
+      entry->handle_ref_count = 1;
       handle = slot << 2;
       if (!host_object) {
         if (object->type() != XObject::Type::Socket) {
@@ -143,6 +187,7 @@ X_STATUS ObjectTable::AddHandle(XObject* object, X_HANDLE* out_handle) {
 
       // Retain so long as the object is in the table.
       object->Retain();
+      entry->object.store(object, std::memory_order_release);
 
       XELOGI("Added handle:{:08X} for {}", handle, typeid(*object).name());
     }
@@ -218,9 +263,7 @@ X_STATUS ObjectTable::RemoveHandle(X_HANDLE handle) {
     return X_STATUS_INVALID_HANDLE;
   }
 
-  if (entry->object) {
-    auto object = entry->object;
-    entry->object = nullptr;
+  if (XObject* object = DetachObject(*entry)) {
     assert_zero(entry->handle_ref_count);
     entry->handle_ref_count = 0;
 
@@ -248,20 +291,15 @@ std::vector<object_ref<XObject>> ObjectTable::GetAllObjects() {
   auto lock = global_critical_region_.Acquire();
   std::vector<object_ref<XObject>> results;
 
-  for (uint32_t slot = 0; slot < host_table_capacity_; slot++) {
-    auto& entry = host_table_[slot];
-    if (entry.object && std::find(results.begin(), results.end(),
-                                  entry.object) == results.end()) {
-      entry.object->Retain();
-      results.push_back(object_ref<XObject>(entry.object));
-    }
-  }
-  for (uint32_t slot = 0; slot < table_capacity_; slot++) {
-    auto& entry = table_[slot];
-    if (entry.object && std::find(results.begin(), results.end(),
-                                  entry.object) == results.end()) {
-      entry.object->Retain();
-      results.push_back(object_ref<XObject>(entry.object));
+  for (SlotTable* table : {&host_table_, &table_}) {
+    for (uint32_t slot = 0; slot < table->capacity(); slot++) {
+      XObject* object =
+          table->entry(slot)->object.load(std::memory_order_relaxed);
+      if (object && std::find(results.begin(), results.end(), object) ==
+                        results.end()) {
+        object->Retain();
+        results.push_back(object_ref<XObject>(object));
+      }
     }
   }
 
@@ -270,13 +308,11 @@ std::vector<object_ref<XObject>> ObjectTable::GetAllObjects() {
 
 void ObjectTable::PurgeAllObjects() {
   auto lock = global_critical_region_.Acquire();
-  for (uint32_t slot = 0; slot < table_capacity_; slot++) {
-    auto& entry = table_[slot];
-    if (entry.object) {
+  for (uint32_t slot = 0; slot < table_.capacity(); slot++) {
+    auto& entry = *table_.entry(slot);
+    if (XObject* object = DetachObject(entry)) {
       entry.handle_ref_count = 0;
-      entry.object->Release();
-
-      entry.object = nullptr;
+      object->Release();
     }
   }
 }
@@ -294,15 +330,7 @@ ObjectTable::ObjectTableEntry* ObjectTable::LookupTableInLock(X_HANDLE handle) {
 
   const bool is_host_object = XObject::is_handle_host_object(handle);
   uint32_t slot = GetHandleSlot(handle, is_host_object);
-  if (is_host_object) {
-    if (slot <= host_table_capacity_) {
-      return &host_table_[slot];
-    }
-  } else if (slot <= table_capacity_) {
-    return &table_[slot];
-  }
-
-  return nullptr;
+  return (is_host_object ? host_table_ : table_).entry(slot);
 }
 
 // Generic lookup
@@ -320,37 +348,24 @@ XObject* ObjectTable::LookupObject(X_HANDLE handle, bool already_locked) {
     return nullptr;
   }
 
-  XObject* object = nullptr;
-  if (!already_locked) {
-    global_critical_region_.mutex().lock();
-  }
-
   const bool is_host_object = XObject::is_handle_host_object(handle);
   uint32_t slot = GetHandleSlot(handle, is_host_object);
 
   // Verify slot.
-  if (is_host_object) {
-    if (slot < host_table_capacity_) {
-      ObjectTableEntry& entry = host_table_[slot];
-      if (entry.object) {
-        object = entry.object;
-      }
-    }
-  } else if (slot < table_capacity_) {
-    ObjectTableEntry& entry = table_[slot];
-    if (entry.object) {
-      object = entry.object;
-    }
+  ObjectTableEntry* entry =
+      (is_host_object ? host_table_ : table_).entry(slot);
+  if (!entry) {
+    return nullptr;
   }
 
-  // Retain the object pointer.
+  // Announce the lookup before reading the object, so that the object can't
+  // be released by the table until it's retained here (see DetachObject).
+  entry->lookup_count.fetch_add(1);
+  XObject* object = entry->object.load();
   if (object) {
     object->Retain();
   }
-
-  if (!already_locked) {
-    global_critical_region_.mutex().unlock();
-  }
+  entry->lookup_count.fetch_sub(1, std::memory_order_release);
 
   return object;
 }
@@ -358,21 +373,15 @@ XObject* ObjectTable::LookupObject(X_HANDLE handle, bool already_locked) {
 void ObjectTable::GetObjectsByType(XObject::Type type,
                                    std::vector<object_ref<XObject>>* results) {
   auto global_lock = global_critical_region_.Acquire();
-  for (uint32_t slot = 0; slot < host_table_capacity_; ++slot) {
-    auto& entry = host_table_[slot];
-    if (entry.object) {
-      if (entry.object->type() == type) {
-        entry.object->Retain();
-        results->push_back(object_ref<XObject>(entry.object));
-      }
-    }
-  }
-  for (uint32_t slot = 0; slot < table_capacity_; ++slot) {
-    auto& entry = table_[slot];
-    if (entry.object) {
-      if (entry.object->type() == type) {
-        entry.object->Retain();
-        results->push_back(object_ref<XObject>(entry.object));
+  for (SlotTable* table : {&host_table_, &table_}) {
+    for (uint32_t slot = 0; slot < table->capacity(); ++slot) {
+      XObject* object =
+          table->entry(slot)->object.load(std::memory_order_relaxed);
+      if (object) {
+        if (object->type() == type) {
+          object->Retain();
+          results->push_back(object_ref<XObject>(object));
+        }
       }
     }
   }
@@ -431,16 +440,14 @@ X_STATUS ObjectTable::GetObjectByName(const std::string_view name,
 }
 
 bool ObjectTable::Save(ByteStream* stream) {
-  stream->Write<uint32_t>(host_table_capacity_);
-  for (uint32_t i = 0; i < host_table_capacity_; i++) {
-    auto& entry = host_table_[i];
-    stream->Write<int32_t>(entry.handle_ref_count);
+  stream->Write<uint32_t>(host_table_.capacity());
+  for (uint32_t i = 0; i < host_table_.capacity(); i++) {
+    stream->Write<int32_t>(host_table_.entry(i)->handle_ref_count);
   }
 
-  stream->Write<uint32_t>(table_capacity_);
-  for (uint32_t i = 0; i < table_capacity_; i++) {
-    auto& entry = table_[i];
-    stream->Write<int32_t>(entry.handle_ref_count);
+  stream->Write<uint32_t>(table_.capacity());
+  for (uint32_t i = 0; i < table_.capacity(); i++) {
+    stream->Write<int32_t>(table_.entry(i)->handle_ref_count);
   }
 
   return true;
@@ -448,15 +455,15 @@ bool ObjectTable::Save(ByteStream* stream) {
 
 bool ObjectTable::Restore(ByteStream* stream) {
   Resize(stream->Read<uint32_t>(), true);
-  for (uint32_t i = 0; i < host_table_capacity_; i++) {
-    auto& entry = host_table_[i];
+  for (uint32_t i = 0; i < host_table_.capacity(); i++) {
+    auto& entry = *host_table_.entry(i);
     // entry.object = nullptr;
     entry.handle_ref_count = stream->Read<int32_t>();
   }
 
   Resize(stream->Read<uint32_t>(), false);
-  for (uint32_t i = 0; i < table_capacity_; i++) {
-    auto& entry = table_[i];
+  for (uint32_t i = 0; i < table_.capacity(); i++) {
+    auto& entry = *table_.entry(i);
     // entry.object = nullptr;
     entry.handle_ref_count = stream->Read<int32_t>();
   }
@@ -467,13 +474,13 @@ bool ObjectTable::Restore(ByteStream* stream) {
 X_STATUS ObjectTable::RestoreHandle(X_HANDLE handle, XObject* object) {
   const bool is_host_object = XObject::is_handle_host_object(handle);
   uint32_t slot = GetHandleSlot(handle, is_host_object);
-  uint32_t capacity = is_host_object ? host_table_capacity_ : table_capacity_;
-  assert_true(capacity >= slot);
+  ObjectTableEntry* entry =
+      (is_host_object ? host_table_ : table_).entry(slot);
+  assert_not_null(entry);
 
-  if (capacity >= slot) {
-    auto& entry = is_host_object ? host_table_[slot] : table_[slot];
-    entry.object = object;
+  if (entry) {
     object->Retain();
+    entry->object.store(object, std::memory_order_release);
   }
 
   return X_STATUS_SUCCESS;
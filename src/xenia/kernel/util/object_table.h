@@ -10,6 +10,8 @@
 #ifndef XENIA_KERNEL_UTIL_OBJECT_TABLE_H_
 #define XENIA_KERNEL_UTIL_OBJECT_TABLE_H_
 
+#include <atomic>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -47,6 +49,8 @@ class ObjectTable {
   // Restores a XObject reference with a handle. Mainly for internal use - do
   // not use.
   X_STATUS RestoreHandle(X_HANDLE handle, XObject* object);
+  // Lookups don't take the lock, already_locked is only kept for callers that
+  // hold it anyway.
   template <typename T>
   object_ref<T> LookupObject(X_HANDLE handle, bool already_locked = false) {
     auto object = LookupObject(handle, already_locked);
@@ -83,8 +87,39 @@ class ObjectTable {
  private:
   struct ObjectTableEntry {
     int handle_ref_count = 0;
-    XObject* object = nullptr;
+    // Written under the lock, read without it by lookups.
+    std::atomic<XObject*> object{nullptr};
+    // Lookups that may be about to retain object. Whoever clears object waits
+    // for this to drop to zero before releasing the reference of the table.
+    std::atomic<uint32_t> lookup_count{0};
   };
+
+  // Entries are allocated in chunks that never move, and the directory of the
+  // chunks is republished when the table grows, so lookups can index it
+  // without the lock. Replaced directories are freed with the table.
+  class SlotTable {
+   public:
+    ~SlotTable() { Clear(); }
+
+    // Only valid under the lock.
+    uint32_t capacity() const { return capacity_; }
+    // Safe without the lock, nullptr if the slot is out of range.
+    ObjectTableEntry* entry(uint32_t slot) const;
+    bool Grow(uint32_t new_capacity);
+    void Clear();
+
+   private:
+    static constexpr uint32_t kEntriesPerChunk = 1024;
+    struct Directory {
+      uint32_t capacity = 0;
+      std::unique_ptr<ObjectTableEntry*[]> chunks;
+    };
+    uint32_t capacity_ = 0;
+    std::atomic<Directory*> directory_{nullptr};
+    std::vector<std::unique_ptr<Directory>> directories_;
+    std::vector<std::unique_ptr<ObjectTableEntry[]>> chunks_;
+  };
+
   ObjectTableEntry* LookupTableInLock(X_HANDLE handle);
   ObjectTableEntry* LookupTable(X_HANDLE handle);
   XObject* LookupObject(X_HANDLE handle, bool already_locked);
@@ -98,12 +133,13 @@ class ObjectTable {
   }
   X_STATUS FindFreeSlot(uint32_t* out_slot, bool host);
   bool Resize(uint32_t new_capacity, bool host);
+  // Clears the object of the entry once no lookup can still retain it, and
+  // returns it with the reference of the table still held.
+  static XObject* DetachObject(ObjectTableEntry& entry);
 
   xe::global_critical_region global_critical_region_;
-  uint32_t table_capacity_ = 0;
-  uint32_t host_table_capacity_ = 0;
-  ObjectTableEntry* table_ = nullptr;
-  ObjectTableEntry* host_table_ = nullptr;
+  SlotTable table_;
+  SlotTable host_table_;
   uint32_t last_free_entry_ = 0;
   uint32_t last_free_host_entry_ = 0;
   std::unordered_map<string_key_case, X_HANDLE> name_table_;
@@ -16,6 +16,7 @@
 
 #include "third_party/fmt/include/fmt/format.h"
 #include "xenia/base/byte_order.h"
+#include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/string_buffer.h"
@@ -23,6 +24,7 @@
 #include "xenia/cpu/ppc/ppc_context.h"
 #include "xenia/kernel/kernel_flags.h"
 #include "xenia/kernel/kernel_state.h"
+#include "xenia/kernel/util/kernel_call_profiler.h"
 
 namespace xe {
 namespace kernel {
@@ -503,6 +505,18 @@ enum class KernelModuleId {
   xbdm,
 };
 
+constexpr const char* GetKernelModuleName(KernelModuleId module) {
+  switch (module) {
+    case KernelModuleId::xboxkrnl:
+      return "xboxkrnl";
+    case KernelModuleId::xam:
+      return "xam";
+    case KernelModuleId::xbdm:
+      return "xbdm";
+  }
+  return "";
+}
+
 template <size_t I = 0, typename... Ps>
 typename std::enable_if<I == sizeof...(Ps)>::type AppendKernelCallParams(
     StringBuffer& string_buffer, xe::cpu::Export* export_entry,
@@ -565,6 +579,9 @@ struct ExportRegistrerHelper {
 
     static const auto export_entry =
         new cpu::Export(ORDINAL, xe::cpu::Export::Type::kFunction, name, TAGS);
+    static const uint32_t profile_slot =
+        util::KernelCallProfiler::RegisterExport(GetKernelModuleName(MODULE),
+                                                 export_entry);
     struct X {
       static void Trampoline(PPCContext* ppc_context) {
         Param::Init init = {
@@ -581,6 +598,8 @@ struct ExportRegistrerHelper {
              cvars::log_high_frequency_kernel_calls)) {
           PrintKernelCall(export_entry, params);
         }
+        uint64_t profile_start_tick_count =
+            cvars::profile_kernel_calls ? Clock::QueryHostTickCount() : 0;
         if constexpr (std::is_void<R>::value) {
           KernelTrampoline(fn, std::forward<std::tuple<Ps...>>(params),
                            std::make_index_sequence<sizeof...(Ps)>());
@@ -594,6 +613,10 @@ struct ExportRegistrerHelper {
             // TODO(benvanik): log result.
           }
         }
+        if (profile_start_tick_count) {
+          util::KernelCallProfiler::RecordCall(profile_slot,
+                                               profile_start_tick_count);
+        }
       }
     };
     struct Y {
@@ -10,12 +10,14 @@
 #include "xenia/kernel/xboxkrnl/xboxkrnl_rtl.h"
 
 #include <algorithm>
+#include <atomic>
 #include <string>
 
 #include "third_party/pe/pe_image.h"
 #include "xenia/base/atomic.h"
 #include "xenia/base/chrono.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/platform.h"
 #include "xenia/base/string.h"
 #include "xenia/base/threading.h"
 #include "xenia/kernel/kernel_state.h"
@@ -25,6 +27,12 @@
 #include "xenia/kernel/xboxkrnl/xboxkrnl_threading.h"
 #include "xenia/kernel/xevent.h"
 #include "xenia/kernel/xthread.h"
+
+DEFINE_bool(adaptive_critical_section_spinning, true,
+            "Learn how long to spin on each contended critical section before "
+            "waiting, and stop spinning when the owning thread is blocked.",
+            "Kernel");
+
 namespace xe {
 namespace kernel {
 namespace xboxkrnl {
@@ -589,6 +597,86 @@ static void CriticalSectionPrefetchW(const void* vp) {
 #endif
 }
 
+// Spin budgets learned for contended critical sections, indexed by a hash of
+// their addresses. Collisions only make the budgets less accurate. Budgets
+// are counted in pauses, so that the backoff doesn't make a section spin for
+// longer than its spin count allows.
+constexpr uint32_t kCriticalSectionSpinBudgetCount = 4096;
+constexpr uint32_t kMinCriticalSectionSpinBudget = 16;
+constexpr uint32_t kInitialCriticalSectionSpinBudget = 256;
+constexpr uint32_t kMaxCriticalSectionSpinPauses = 64;
+static std::atomic<uint16_t>
+    critical_section_spin_budgets[kCriticalSectionSpinBudgetCount];
+
+static void CriticalSectionSpinPause(uint32_t pause_count) {
+  for (uint32_t i = 0; i < pause_count; ++i) {
+#if XE_ARCH_AMD64 == 1
+    _mm_pause();
+#endif
+  }
+}
+
+// Looks up the thread owning a critical section by the handle stashed in its
+// guest object.
+static object_ref<XThread> LookupCriticalSectionOwner(uint32_t owning_thread) {
+  if (!owning_thread) {
+    return nullptr;
+  }
+  auto header =
+      kernel_memory()->TranslateVirtual<X_DISPATCH_HEADER*>(owning_thread);
+  if (header->wait_list_flink != kXObjSignature) {
+    return nullptr;
+  }
+  return kernel_state()->object_table()->LookupObject<XThread>(
+      header->wait_list_blink);
+}
+
+// Spins until the critical section is free for up to its learned budget, with
+// exponential backoff between attempts. Gives up early if the owner is blocked
+// or suspended, as it won't leave the section before being woken up.
+static bool SpinOnCriticalSection(X_RTL_CRITICAL_SECTION* cs, uint32_t cs_ptr,
+                                  uint32_t spin_limit) {
+  auto& budget_entry = critical_section_spin_budgets
+      [((cs_ptr >> 2) ^ (cs_ptr >> 14)) % kCriticalSectionSpinBudgetCount];
+  uint32_t budget = budget_entry.load(std::memory_order_relaxed);
+  if (!budget) {
+    budget = kInitialCriticalSectionSpinBudget;
+  }
+  budget = std::min(budget, spin_limit);
+
+  uint32_t owning_thread = 0;
+  object_ref<XThread> owner;
+  uint32_t pause_count = 1;
+  for (uint32_t spin = 0, paused = 0; paused < budget; ++spin) {
+    if (xe::atomic_cas(-1, 0, &cs->lock_count)) {
+      // Aim for twice the pauses that were needed, moving slowly so that a
+      // single long wait doesn't inflate the budget.
+      int32_t target = int32_t(std::clamp(
+          paused * 2, kMinCriticalSectionSpinBudget, spin_limit));
+      budget = uint32_t(int32_t(budget) + (target - int32_t(budget)) / 8);
+      budget_entry.store(uint16_t(std::max(budget, 1u)),
+                         std::memory_order_relaxed);
+      return true;
+    }
+    if (!(spin & 15)) {
+      uint32_t new_owning_thread = cs->owning_thread;
+      if (new_owning_thread != owning_thread) {
+        owning_thread = new_owning_thread;
+        owner = LookupCriticalSectionOwner(owning_thread);
+      }
+      if (owner && (owner->is_blocked() || owner->suspend_count())) {
+        return false;
+      }
+    }
+    CriticalSectionSpinPause(pause_count);
+    paused += pause_count;
+    pause_count = std::min(pause_count * 2, kMaxCriticalSectionSpinPauses);
+  }
+  budget = std::max(budget - budget / 8, kMinCriticalSectionSpinBudget);
+  budget_entry.store(uint16_t(budget), std::memory_order_relaxed);
+  return false;
+}
+
 void RtlEnterCriticalSection_entry(pointer_t<X_RTL_CRITICAL_SECTION> cs) {
   if (!cs.guest_address()) {
     XELOGE("Null critical section in RtlEnterCriticalSection!");
@@ -605,14 +693,25 @@ void RtlEnterCriticalSection_entry(pointer_t<X_RTL_CRITICAL_SECTION> cs) {
     return;
   }
 
-  // Spin loop
-  while (spin_count--) {
-    if (xe::atomic_cas(-1, 0, &cs->lock_count)) {
-      // Acquired.
+  if (cvars::adaptive_critical_section_spinning) {
+    // Sections without a spin count wait right away, as they would on the
+    // console.
+    if (spin_count &&
+        SpinOnCriticalSection(cs, cs.guest_address(), spin_count)) {
       cs->owning_thread = cur_thread;
       cs->recursion_count = 1;
       return;
     }
+  } else {
+    // Spin loop
+    while (spin_count--) {
+      if (xe::atomic_cas(-1, 0, &cs->lock_count)) {
+        // Acquired.
+        cs->owning_thread = cur_thread;
+        cs->recursion_count = 1;
+        return;
+      }
+    }
   }
 
   if (xe::atomic_inc(&cs->lock_count) != 0) {
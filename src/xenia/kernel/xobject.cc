@@ -205,8 +205,12 @@ X_STATUS XObject::Wait(uint32_t wait_reason, uint32_t processor_mode,
                         TimeoutTicksToMs(*opt_timeout)))
                   : std::chrono::milliseconds::max();
 
-  auto result =
-      xe::threading::Wait(wait_handle, alertable ? true : false, timeout_ms);
+  xe::threading::WaitResult result;
+  {
+    XThread::BlockedScope blocked_scope;
+    result =
+        xe::threading::Wait(wait_handle, alertable ? true : false, timeout_ms);
+  }
   switch (result) {
     case xe::threading::WaitResult::kSuccess:
       WaitCallback();
@@ -232,9 +236,13 @@ X_STATUS XObject::SignalAndWait(XObject* signal_object, XObject* wait_object,
                         TimeoutTicksToMs(*opt_timeout)))
                   : std::chrono::milliseconds::max();
 
-  auto result = xe::threading::SignalAndWait(
-      signal_object->GetWaitHandle(), wait_object->GetWaitHandle(),
-      alertable ? true : false, timeout_ms);
+  xe::threading::WaitResult result;
+  {
+    XThread::BlockedScope blocked_scope;
+    result = xe::threading::SignalAndWait(
+        signal_object->GetWaitHandle(), wait_object->GetWaitHandle(),
+        alertable ? true : false, timeout_ms);
+  }
   switch (result) {
     case xe::threading::WaitResult::kSuccess:
       wait_object->WaitCallback();
@@ -268,6 +276,7 @@ X_STATUS XObject::WaitMultiple(uint32_t count, XObject** objects,
                         TimeoutTicksToMs(*opt_timeout)))
                   : std::chrono::milliseconds::max();
 
+  XThread::BlockedScope blocked_scope;
   if (wait_type) {
     auto result = xe::threading::WaitAny(wait_handles, count,
                                          alertable ? true : false, timeout_ms);
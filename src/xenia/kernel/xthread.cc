@@ -122,6 +122,18 @@ XThread* XThread::GetCurrentThread() {
   return thread;
 }
 
+XThread::BlockedScope::BlockedScope() : thread_(current_xthread_tls_) {
+  if (thread_) {
+    thread_->blocked_count_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+XThread::BlockedScope::~BlockedScope() {
+  if (thread_) {
+    thread_->blocked_count_.fetch_sub(1, std::memory_order_relaxed);
+  }
+}
+
 uint32_t XThread::GetCurrentThreadHandle() {
   XThread* thread = XThread::GetCurrentThread();
   return thread->handle();
@@ -860,6 +872,7 @@ X_STATUS XThread::Delay(uint32_t processor_mode, uint32_t alertable,
     timeout_ms = 0;
   }
   timeout_ms = Clock::ScaleGuestDurationMillis(timeout_ms);
+  BlockedScope blocked_scope;
   if (alertable) {
     auto result =
         xe::threading::AlertableSleep(std::chrono::milliseconds(timeout_ms));
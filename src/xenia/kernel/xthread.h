@@ -199,6 +199,21 @@ class XThread : public XObject, public cpu::Thread {
   bool is_guest_thread() const { return guest_thread_; }
   bool main_thread() const { return main_thread_; }
   bool is_running() const { return running_; }
+  // Whether the thread is blocked in a kernel wait or delay rather than
+  // running guest code.
+  bool is_blocked() const {
+    return blocked_count_.load(std::memory_order_relaxed) != 0;
+  }
+
+  // Marks the current thread as blocked while it exists.
+  class BlockedScope {
+   public:
+    BlockedScope();
+    ~BlockedScope();
+
+   private:
+    XThread* thread_;
+  };
 
   uint32_t thread_id() const { return thread_id_; }
   uint32_t last_error();
@@ -293,6 +308,7 @@ class XThread : public XObject, public cpu::Thread {
 
   xe::global_critical_region global_critical_region_;
   std::atomic<uint32_t> irql_ = {0};
+  std::atomic<uint32_t> blocked_count_ = {0};
   util::NativeList apc_list_;
 };
 
@@ -10,17 +10,27 @@
 #include "xenia/memory.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cstdio>
 #include <cstring>
+#include <filesystem>
+#include <string>
+#include <type_traits>
 #include <utility>
 
 #include "third_party/fmt/include/fmt/format.h"
+#include "third_party/snappy/snappy.h"
 #include "xenia/base/assert.h"
 #include "xenia/base/byte_stream.h"
 #include "xenia/base/clock.h"
 #include "xenia/base/cvar.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/literals.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/mapped_memory.h"
 #include "xenia/base/math.h"
 #include "xenia/base/threading.h"
+#include "xenia/base/xxhash.h"
 #include "xenia/cpu/mmio_handler.h"
 
 // TODO(benvanik): move xbox.h out
@@ -32,8 +42,39 @@ DEFINE_bool(protect_on_release, false,
             "Protect released memory to prevent accesses.", "Memory");
 DEFINE_bool(scribble_heap, false,
             "Scribble 0xCD into all allocated heap memory.", "Memory");
+DEFINE_bool(save_state_delta, true,
+            "Store only the memory pages changed since the first save state "
+            "in the following ones. The memory of the first one is stored in "
+            "<path>.<time>.base, which all of them need to be restored. A base "
+            "is deleted once no save in its folder refers to it anymore.",
+            "Memory");
+DEFINE_bool(
+    batched_write_watch, false,
+    "Unwatch written physical memory in fewer host protection changes, "
+    "spanning pages that are already writable, and unwatch pages ahead of "
+    "sequential write faults in advance.",
+    "Memory");
+DEFINE_int32(write_watch_speculation_pages, 64,
+             "Maximum number of system pages unwatched ahead of sequential "
+             "write faults with batched_write_watch.",
+             "Memory");
+DEFINE_string(
+    physical_write_watch, "protect",
+    "How guest writes to physical memory used by the GPU are detected.\n"
+    "  protect: Write protection, with an access violation on the first write "
+    "to each page.\n"
+    "  write_tracking: Written pages collected in bulk when the GPU processes "
+    "commands, without faults in the process. Requires Linux 6.7 or newer, "
+    "falls back to protect otherwise.",
+    "Memory");
+DEFINE_bool(log_write_watch_stats, false,
+            "Log physical memory write faults and unwatched pages per frame.",
+            "Memory");
 
 namespace xe {
+
+using namespace xe::literals;
+
 uint32_t get_page_count(uint32_t value, uint32_t page_size) {
   return xe::round_up(value, page_size) / page_size;
 }
@@ -195,6 +236,15 @@ bool Memory::Initialize() {
       kMemoryAllocationReserve | kMemoryAllocationCommit,
       kMemoryProtectRead | kMemoryProtectWrite);
 
+  if (cvars::physical_write_watch == "write_tracking") {
+    physical_write_tracker_ = xe::memory::WriteTracker::Create();
+    if (!physical_write_tracker_) {
+      XELOGW(
+          "Write tracking is not supported by the host, protecting physical "
+          "memory instead");
+    }
+  }
+
   // Add handlers for MMIO.
   mmio_handler_ = cpu::MMIOHandler::Install(
       virtual_membase_, physical_membase_, physical_membase_ + 0x1FFFFFFF,
@@ -528,9 +578,53 @@ bool Memory::AccessViolationCallback(
   //
   // Will be rounded to physical page boundaries internally, so just pass 1 as
   // the length - guranteed not to cross page boundaries also.
+  uint32_t length = 1;
+  uint32_t speculated_pages = 0;
+  if (cvars::batched_write_watch && is_write) {
+    // Streaming writes fault on each page in order, unwatch the pages that
+    // are likely to be written next along with the faulting one.
+    uint32_t page = virtual_address / system_page_size_;
+    if (write_watch_last_fault_page_ != UINT32_MAX &&
+        (page == write_watch_last_fault_page_ + 1 ||
+         page == write_watch_last_fault_page_ - 1)) {
+      bool descending = page < write_watch_last_fault_page_;
+      if (!write_watch_sequential_faults_ ||
+          descending == write_watch_faults_descending_) {
+        ++write_watch_sequential_faults_;
+      } else {
+        write_watch_sequential_faults_ = 1;
+      }
+      write_watch_faults_descending_ = descending;
+    } else {
+      write_watch_sequential_faults_ = 0;
+    }
+    if (write_watch_sequential_faults_) {
+      speculated_pages = std::min(
+          uint32_t(1) << std::min(write_watch_sequential_faults_, uint32_t(16)),
+          uint32_t(std::max(cvars::write_watch_speculation_pages, 0)));
+      uint32_t first_page = page;
+      if (write_watch_faults_descending_) {
+        first_page -= std::min(speculated_pages, page);
+        speculated_pages = page - first_page;
+      }
+      virtual_address = first_page * system_page_size_;
+      length = (speculated_pages + 1) * system_page_size_;
+      // The next fault continues from the end of the unwatched range.
+      page = write_watch_faults_descending_ ? first_page
+                                            : page + speculated_pages;
+    }
+    write_watch_last_fault_page_ = page;
+  }
   auto physical_heap = static_cast<PhysicalHeap*>(heap);
-  return physical_heap->TriggerCallbacks(std::move(global_lock_locked_once),
-                                         virtual_address, 1, is_write, false);
+  if (!physical_heap->TriggerCallbacks(std::move(global_lock_locked_once),
+                                       virtual_address, length, is_write,
+                                       false)) {
+    return false;
+  }
+  write_watch_stats_.faults.fetch_add(1, std::memory_order_relaxed);
+  write_watch_stats_.pages_speculated.fetch_add(speculated_pages,
+                                                std::memory_order_relaxed);
+  return true;
 }
 
 bool Memory::AccessViolationCallbackThunk(
@@ -553,6 +647,35 @@ bool Memory::TriggerPhysicalMemoryCallbacks(
   return false;
 }
 
+void Memory::CollectPhysicalMemoryWrites() {
+  if (!physical_write_tracker_) {
+    return;
+  }
+  heaps_.vA0000000.CollectWrites(physical_write_tracker_.get());
+  heaps_.vC0000000.CollectWrites(physical_write_tracker_.get());
+  heaps_.vE0000000.CollectWrites(physical_write_tracker_.get());
+}
+
+Memory::WriteWatchStats Memory::EndWriteWatchFrame() {
+  WriteWatchStats stats;
+  stats.faults =
+      write_watch_stats_.faults.exchange(0, std::memory_order_relaxed);
+  stats.protect_calls =
+      write_watch_stats_.protect_calls.exchange(0, std::memory_order_relaxed);
+  stats.pages_unwatched =
+      write_watch_stats_.pages_unwatched.exchange(0, std::memory_order_relaxed);
+  stats.pages_speculated = write_watch_stats_.pages_speculated.exchange(
+      0, std::memory_order_relaxed);
+  if (cvars::log_write_watch_stats && stats.pages_unwatched) {
+    XELOGI(
+        "Write watch: {} faults, {} protection changes, {} pages unwatched, "
+        "{} speculatively",
+        stats.faults, stats.protect_calls, stats.pages_unwatched,
+        stats.pages_speculated);
+  }
+  return stats;
+}
+
 void* Memory::RegisterPhysicalMemoryInvalidationCallback(
     PhysicalMemoryInvalidationCallback callback, void* callback_context) {
   auto entry = new std::pair<PhysicalMemoryInvalidationCallback, void*>(
@@ -647,24 +770,212 @@ void Memory::DumpMap() {
   XELOGE("");
 }
 
-bool Memory::Save(ByteStream* stream) {
-  XELOGD("Serializing memory...");
-  heaps_.v00000000.Save(stream);
-  heaps_.v40000000.Save(stream);
-  heaps_.v80000000.Save(stream);
-  heaps_.v90000000.Save(stream);
-  heaps_.physical.Save(stream);
+std::unique_ptr<Memory::SaveCapture> Memory::CaptureSave(
+    const std::filesystem::path& path) {
+  auto capture = std::make_unique<SaveCapture>();
+  capture->path = path;
+  bool delta = cvars::save_state_delta && !save_base_path_.empty();
+  if (delta) {
+    capture->base_path = save_base_path_;
+  } else {
+    save_base_path_.clear();
+    if (cvars::save_state_delta) {
+      // The base gets a file of its own that no save is written to, so that
+      // overwriting this save doesn't break the incremental saves after it.
+      capture->base_path = path;
+      capture->base_path +=
+          fmt::format(".{:016X}.base", Clock::QueryHostTickCount());
+      capture->is_new_base = true;
+    }
+  }
 
+  XELOGD("Capturing memory...");
+  BaseHeap* heaps[] = {&heaps_.v00000000, &heaps_.v40000000,
+                       &heaps_.v80000000, &heaps_.v90000000, &heaps_.physical};
+  static_assert(xe::countof(heaps) ==
+                std::extent_v<decltype(SaveCapture::heaps)>);
+  for (size_t i = 0; i < xe::countof(heaps); ++i) {
+    heaps[i]->CaptureSave(&capture->heaps[i], delta);
+  }
+  return capture;
+}
+
+bool Memory::WriteSaveBase(const SaveCapture& capture) {
+  XELOGD("Serializing the save state base {}...",
+         xe::path_to_utf8(capture.base_path));
+  filesystem::CreateEmptyFile(capture.base_path);
+  auto map = MappedMemory::Open(capture.base_path,
+                                MappedMemory::Mode::kReadWrite, 0, 2_GiB);
+  if (!map) {
+    return false;
+  }
+  ByteStream stream(map->data(), map->size());
+  stream.Write(false);
+  for (const HeapSaveCapture& heap : capture.heaps) {
+    BaseHeap::WriteSave(heap, &stream, true);
+  }
+  map->Close(stream.offset());
   return true;
 }
 
+void Memory::WriteSave(const SaveCapture& capture, ByteStream* stream) {
+  bool is_delta = !capture.base_path.empty();
+  if (capture.is_new_base && !WriteSaveBase(capture)) {
+    XELOGW("Unable to write the save state base {}, saving in full",
+           xe::path_to_utf8(capture.base_path));
+    std::error_code error;
+    std::filesystem::remove(capture.base_path, error);
+    is_delta = false;
+  }
+  XELOGD("Serializing memory...");
+  stream->Write(is_delta);
+  if (is_delta) {
+    stream->Write(xe::path_to_utf8(capture.base_path));
+  }
+  // The pages of a new base are only stored in the base.
+  bool write_pages = !(capture.is_new_base && is_delta);
+  for (const HeapSaveCapture& heap : capture.heaps) {
+    BaseHeap::WriteSave(heap, stream, write_pages);
+  }
+  if (!write_pages) {
+    save_base_path_ = capture.base_path;
+  }
+  UpdateSaveBaseReferences(capture, is_delta);
+}
+
+// The saves referring to a save state base are listed in <base>.saves, one
+// path per line.
+static std::filesystem::path GetSaveBaseReferencesPath(
+    const std::filesystem::path& base_path) {
+  auto references_path = base_path;
+  references_path += ".saves";
+  return references_path;
+}
+
+static std::vector<std::filesystem::path> ReadSaveBaseReferences(
+    const std::filesystem::path& base_path) {
+  std::vector<std::filesystem::path> references;
+  FILE* file =
+      filesystem::OpenFile(GetSaveBaseReferencesPath(base_path), "rb");
+  if (!file) {
+    return references;
+  }
+  std::string contents;
+  char buffer[4096];
+  size_t read_size;
+  while ((read_size = fread(buffer, 1, sizeof(buffer), file)) != 0) {
+    contents.append(buffer, read_size);
+  }
+  fclose(file);
+  size_t line_start = 0;
+  while (line_start < contents.size()) {
+    size_t line_end = contents.find('\n', line_start);
+    if (line_end == std::string::npos) {
+      line_end = contents.size();
+    }
+    if (line_end != line_start) {
+      references.push_back(xe::to_path(std::string_view(
+          contents.data() + line_start, line_end - line_start)));
+    }
+    line_start = line_end + 1;
+  }
+  return references;
+}
+
+static void WriteSaveBaseReferences(
+    const std::filesystem::path& base_path,
+    const std::vector<std::filesystem::path>& references) {
+  FILE* file =
+      filesystem::OpenFile(GetSaveBaseReferencesPath(base_path), "wb");
+  if (!file) {
+    XELOGW("Unable to write the saves referring to the save state base {}",
+           xe::path_to_utf8(base_path));
+    return;
+  }
+  for (const std::filesystem::path& reference : references) {
+    std::string line = xe::path_to_utf8(reference) + '\n';
+    fwrite(line.data(), 1, line.size(), file);
+  }
+  fclose(file);
+}
+
+void Memory::UpdateSaveBaseReferences(const SaveCapture& capture,
+                                      bool is_delta) {
+  if (is_delta) {
+    auto references = ReadSaveBaseReferences(capture.base_path);
+    if (std::find(references.begin(), references.end(), capture.path) ==
+        references.end()) {
+      references.push_back(capture.path);
+      WriteSaveBaseReferences(capture.base_path, references);
+    }
+  }
+
+  // The save may have referred to another base before it was overwritten.
+  // Bases are created next to the first save relative to them, so only those
+  // in the folder of the save are checked.
+  auto folder = capture.path.parent_path();
+  for (const filesystem::FileInfo& file :
+       filesystem::ListFiles(folder.empty() ? "." : folder)) {
+    if (file.type != filesystem::FileInfo::Type::kFile ||
+        file.name.extension() != ".base") {
+      continue;
+    }
+    auto base_path = folder / file.name;
+    if (is_delta && base_path == capture.base_path) {
+      continue;
+    }
+    auto references = ReadSaveBaseReferences(base_path);
+    size_t reference_count = references.size();
+    references.erase(
+        std::remove_if(references.begin(), references.end(),
+                       [&capture](const std::filesystem::path& reference) {
+                         return reference == capture.path ||
+                                !std::filesystem::exists(reference);
+                       }),
+        references.end());
+    if (references.size() == reference_count) {
+      continue;
+    }
+    if (!references.empty()) {
+      WriteSaveBaseReferences(base_path, references);
+      continue;
+    }
+    XELOGI("Deleting the save state base {}, no save refers to it anymore",
+           xe::path_to_utf8(base_path));
+    std::error_code error;
+    std::filesystem::remove(base_path, error);
+    std::filesystem::remove(GetSaveBaseReferencesPath(base_path), error);
+  }
+}
+
 bool Memory::Restore(ByteStream* stream) {
   XELOGD("Restoring memory...");
-  heaps_.v00000000.Restore(stream);
-  heaps_.v40000000.Restore(stream);
-  heaps_.v80000000.Restore(stream);
-  heaps_.v90000000.Restore(stream);
-  heaps_.physical.Restore(stream);
+  std::unique_ptr<MappedMemory> base_map;
+  std::unique_ptr<ByteStream> base_stream;
+  if (stream->Read<bool>()) {
+    auto base_path = xe::to_path(stream->Read<std::string>());
+    base_map = MappedMemory::Open(base_path, MappedMemory::Mode::kRead);
+    if (!base_map) {
+      XELOGE("Unable to open the save state base {}",
+             xe::path_to_utf8(base_path));
+      return false;
+    }
+    base_stream =
+        std::make_unique<ByteStream>(base_map->data(), base_map->size());
+    if (base_stream->Read<bool>()) {
+      XELOGE("Save state base {} is not a full save state",
+             xe::path_to_utf8(base_path));
+      return false;
+    }
+  }
+
+  BaseHeap* heaps[] = {&heaps_.v00000000, &heaps_.v40000000,
+                       &heaps_.v80000000, &heaps_.v90000000, &heaps_.physical};
+  for (BaseHeap* heap : heaps) {
+    if (!heap->Restore(stream, base_stream.get())) {
+      return false;
+    }
+  }
 
   return true;
 }
@@ -720,6 +1031,7 @@ void BaseHeap::Initialize(Memory* memory, uint8_t* membase, HeapType heap_type,
   host_address_offset_ = host_address_offset;
   page_table_.resize(heap_size / page_size);
   unreserved_page_count_ = uint32_t(page_table_.size());
+  free_pages_.Reset(uint32_t(page_table_.size()));
 }
 
 void BaseHeap::Dispose() {
@@ -786,81 +1098,242 @@ void BaseHeap::DumpMap() {
   }
 }
 
-bool BaseHeap::Save(ByteStream* stream) {
-  XELOGD("Heap {:08X}-{:08X}", heap_base_, heap_base_ + (heap_size_ - 1));
+namespace {
 
-  for (size_t i = 0; i < page_table_.size(); i++) {
-    auto& page = page_table_[i];
-    stream->Write(page.qword);
-    if (!page.state) {
-      // Unallocated.
-      continue;
+// Page number ending the list of pages of a heap in a save state.
+constexpr uint32_t kSavePageListEnd = UINT32_MAX;
+// Pages decompressed by a restore thread at once.
+constexpr size_t kSavePageRestoreBatch = 64;
+
+struct SavePageSource {
+  const uint8_t* compressed = nullptr;
+  uint32_t compressed_length = 0;
+};
+
+// Locates the compressed pages of a heap, skipping pages already found in a
+// newer save state.
+bool ReadSavePageSources(ByteStream* stream,
+                         std::vector<SavePageSource>& sources) {
+  for (;;) {
+    if (stream->offset() + sizeof(uint32_t) > stream->data_length()) {
+      return false;
+    }
+    uint32_t page_number = stream->Read<uint32_t>();
+    if (page_number == kSavePageListEnd) {
+      return true;
+    }
+    if (page_number >= sources.size() ||
+        stream->offset() + sizeof(uint32_t) > stream->data_length()) {
+      return false;
+    }
+    uint32_t compressed_length = stream->Read<uint32_t>();
+    if (compressed_length > stream->data_length() - stream->offset()) {
+      return false;
     }
+    SavePageSource& source = sources[page_number];
+    if (!source.compressed) {
+      source.compressed = stream->data() + stream->offset();
+      source.compressed_length = compressed_length;
+    }
+    stream->Advance(compressed_length);
+  }
+}
 
-    // TODO(DrChat): write compressed with snappy.
-    if (page.state & kMemoryAllocationCommit) {
-      void* addr = TranslateRelative(i * page_size_);
+struct SavePageRestore {
+  uint8_t* host_address;
+  SavePageSource source;
+};
 
-      memory::PageAccess old_access;
-      memory::Protect(addr, page_size_, memory::PageAccess::kReadWrite,
-                      &old_access);
+// Decompresses the pages on all logical processors.
+bool DecompressSavePages(const std::vector<SavePageRestore>& pages,
+                         uint32_t page_size) {
+  std::atomic<size_t> next_page(0);
+  std::atomic<bool> failed(false);
+  auto decompress = [&]() {
+    for (;;) {
+      size_t first = next_page.fetch_add(kSavePageRestoreBatch);
+      if (first >= pages.size()) {
+        return;
+      }
+      size_t end = std::min(first + kSavePageRestoreBatch, pages.size());
+      for (size_t i = first; i < end; ++i) {
+        const SavePageRestore& page = pages[i];
+        auto compressed = reinterpret_cast<const char*>(page.source.compressed);
+        auto uncompressed = reinterpret_cast<char*>(page.host_address);
+        size_t length;
+        if (!snappy::GetUncompressedLength(
+                compressed, page.source.compressed_length, &length) ||
+            length != page_size ||
+            !snappy::RawUncompress(compressed, page.source.compressed_length,
+                                   uncompressed)) {
+          failed = true;
+        }
+      }
+    }
+  };
+  size_t thread_count =
+      std::min(size_t(xe::threading::logical_processor_count()),
+               xe::round_up(pages.size(), kSavePageRestoreBatch, false) /
+                   kSavePageRestoreBatch);
+  std::vector<std::unique_ptr<xe::threading::Thread>> threads;
+  for (size_t i = 1; i < thread_count; ++i) {
+    threads.push_back(xe::threading::Thread::Create({}, decompress));
+    threads.back()->set_name("Save State Restore");
+  }
+  decompress();
+  for (auto& thread : threads) {
+    xe::threading::Wait(thread.get(), false);
+  }
+  return !failed;
+}
+
+}  // namespace
+
+void BaseHeap::CaptureSave(HeapSaveCapture* capture, bool delta) {
+  auto global_lock = global_critical_region_.Acquire();
 
-      stream->Write(addr, page_size_);
+  capture->page_table = page_table_;
+  capture->page_size = page_size_;
+  capture->page_numbers.clear();
+  capture->page_data.clear();
+  if (!delta) {
+    save_base_page_hashes_.assign(page_table_.size(), 0);
+    size_t committed_count = std::count_if(
+        page_table_.begin(), page_table_.end(), [](const PageEntry& page) {
+          return (page.state & kMemoryAllocationCommit) != 0;
+        });
+    capture->page_numbers.reserve(committed_count);
+    capture->page_data.reserve(committed_count * page_size_);
+  }
+  assert_true(save_base_page_hashes_.size() == page_table_.size());
 
+  for (uint32_t i = 0; i < uint32_t(page_table_.size()); ++i) {
+    const PageEntry& page = page_table_[i];
+    if (!(page.state & kMemoryAllocationCommit)) {
+      continue;
+    }
+    void* addr = TranslateRelative(size_t(i) * page_size_);
+    // Only pages not readable by the guest need their protection changed.
+    bool unprotect = !(page.current_protect & kMemoryProtectRead);
+    memory::PageAccess old_access;
+    if (unprotect) {
+      memory::Protect(addr, page_size_, memory::PageAccess::kReadOnly,
+                      &old_access);
+    }
+    // 0 marks pages not in the base.
+    uint64_t hash = std::max(XXH3_64bits(addr, page_size_), uint64_t(1));
+    if (!delta || hash != save_base_page_hashes_[i]) {
+      capture->page_numbers.push_back(i);
+      size_t data_offset = capture->page_data.size();
+      capture->page_data.resize(data_offset + page_size_);
+      std::memcpy(capture->page_data.data() + data_offset, addr, page_size_);
+      if (!delta) {
+        save_base_page_hashes_[i] = hash;
+      }
+    }
+    if (unprotect) {
       memory::Protect(addr, page_size_, old_access, nullptr);
     }
   }
+}
 
-  return true;
+void BaseHeap::WriteSave(const HeapSaveCapture& capture, ByteStream* stream,
+                         bool write_pages) {
+  stream->Write(capture.page_table.data(),
+                capture.page_table.size() * sizeof(PageEntry));
+  if (!write_pages) {
+    stream->Write(kSavePageListEnd);
+    return;
+  }
+
+  std::vector<char> compressed(snappy::MaxCompressedLength(capture.page_size));
+  auto page_data = reinterpret_cast<const char*>(capture.page_data.data());
+  for (size_t i = 0; i < capture.page_numbers.size(); ++i) {
+    size_t compressed_length;
+    snappy::RawCompress(page_data + i * capture.page_size, capture.page_size,
+                        compressed.data(), &compressed_length);
+    stream->Write(capture.page_numbers[i]);
+    stream->Write(uint32_t(compressed_length));
+    stream->Write(compressed.data(), compressed_length);
+  }
+  stream->Write(kSavePageListEnd);
 }
 
-bool BaseHeap::Restore(ByteStream* stream) {
+bool BaseHeap::Restore(ByteStream* stream, ByteStream* base_stream) {
   XELOGD("Heap {:08X}-{:08X}", heap_base_, heap_base_ + (heap_size_ - 1));
 
+  size_t page_table_length = page_table_.size() * sizeof(PageEntry);
+  if (stream->offset() + page_table_length > stream->data_length()) {
+    return false;
+  }
+  stream->Read(page_table_.data(), page_table_length);
+  std::vector<SavePageSource> sources(page_table_.size());
+  if (!ReadSavePageSources(stream, sources)) {
+    XELOGE("Corrupted pages in the save state");
+    return false;
+  }
+  if (base_stream) {
+    // The page table of the delta is the current one.
+    if (base_stream->offset() + page_table_length >
+        base_stream->data_length()) {
+      return false;
+    }
+    base_stream->Advance(page_table_length);
+    if (!ReadSavePageSources(base_stream, sources)) {
+      XELOGE("Corrupted pages in the save state base");
+      return false;
+    }
+  }
+
+  free_pages_.Reset(uint32_t(page_table_.size()));
+  std::vector<SavePageRestore> restores;
   for (size_t i = 0; i < page_table_.size(); i++) {
     auto& page = page_table_[i];
-    page.qword = stream->Read<uint64_t>();
     if (!page.state) {
       // Unallocated.
       continue;
     }
-
-    memory::PageAccess page_access = memory::PageAccess::kNoAccess;
-    if ((page.current_protect & kMemoryProtectRead) &&
-        (page.current_protect & kMemoryProtectWrite)) {
-      page_access = memory::PageAccess::kReadWrite;
-    } else if (page.current_protect & kMemoryProtectRead) {
-      page_access = memory::PageAccess::kReadOnly;
-    }
+    free_pages_.MarkUsed(uint32_t(i), 1);
 
     // Commit the memory if it isn't already. We do not need to reserve any
     // memory, as the mapping has already taken care of that.
-    if (page.state & kMemoryAllocationCommit) {
-      xe::memory::AllocFixed(TranslateRelative(i * page_size_), page_size_,
-                             memory::AllocationType::kCommit,
-                             memory::PageAccess::kReadWrite);
-    }
-
-    // Now read into memory. We'll set R/W protection first, then set the
-    // protection back to its previous state.
-    // TODO(DrChat): read compressed with snappy.
     if (page.state & kMemoryAllocationCommit) {
       void* addr = TranslateRelative(i * page_size_);
+      xe::memory::AllocFixed(addr, page_size_, memory::AllocationType::kCommit,
+                             memory::PageAccess::kReadWrite);
+      // Set R/W protection first, the protection is set back to its previous
+      // state once the pages have been read.
       xe::memory::Protect(addr, page_size_, memory::PageAccess::kReadWrite,
                           nullptr);
+      if (sources[i].compressed) {
+        restores.push_back({reinterpret_cast<uint8_t*>(addr), sources[i]});
+      } else {
+        std::memset(addr, 0, page_size_);
+      }
+    }
+  }
 
-      stream->Read(addr, page_size_);
+  bool decompressed = DecompressSavePages(restores, page_size_);
 
-      xe::memory::Protect(addr, page_size_, page_access, nullptr);
+  for (size_t i = 0; i < page_table_.size(); i++) {
+    auto& page = page_table_[i];
+    if (page.state & kMemoryAllocationCommit) {
+      xe::memory::Protect(TranslateRelative(i * page_size_), page_size_,
+                          ToPageAccess(page.current_protect), nullptr);
     }
   }
 
+  if (!decompressed) {
+    XELOGE("Unable to decompress pages from the save state");
+    return false;
+  }
   return true;
 }
 
 void BaseHeap::Reset() {
   // TODO(DrChat): protect pages.
   std::memset(page_table_.data(), 0, sizeof(PageEntry) * page_table_.size());
+  free_pages_.Reset(uint32_t(page_table_.size()));
   // TODO(Triang3l): Remove access callbacks from pages if this is a physical
   // memory heap.
 }
@@ -960,6 +1433,7 @@ bool BaseHeap::AllocFixed(uint32_t base_address, uint32_t size,
     }
     page_entry.state = kMemoryAllocationReserve | allocation_type;
   }
+  free_pages_.MarkUsed(start_page_number, page_count);
 
   return true;
 }
@@ -998,86 +1472,30 @@ bool BaseHeap::AllocRange(uint32_t low_address, uint32_t high_address,
   auto global_lock = global_critical_region_.Acquire();
 
   // Find a free page range.
-  // The base page must match the requested alignment, so we first scan for
-  // a free aligned page and only then check for continuous free pages.
-  // TODO(benvanik): optimized searching (free list buckets, bitmap, etc).
+  // The base page must match the requested alignment, free_pages_ finds the
+  // lowest or the highest aligned run of free pages in the range.
   uint32_t start_page_number = UINT_MAX;
   uint32_t end_page_number = UINT_MAX;
   // chrispy:todo, page_scan_stride is probably always a power of two...
   uint32_t page_scan_stride = alignment >> page_size_shift_;
   high_page_number =
       high_page_number - QuickMod(high_page_number, page_scan_stride);
+  uint32_t search_page_count = std::max(page_count, uint32_t(1));
   if (top_down) {
-    for (int64_t base_page_number =
-             high_page_number - xe::round_up(page_count, page_scan_stride);
-         base_page_number >= low_page_number;
-         base_page_number -= page_scan_stride) {
-      if (page_table_[base_page_number].state != 0) {
-        // Base page not free, skip to next usable page.
-        continue;
-      }
-      // Check requested range to ensure free.
-      start_page_number = uint32_t(base_page_number);
-      end_page_number = uint32_t(base_page_number) + page_count - 1;
-      assert_true(end_page_number < page_table_.size());
-      bool any_taken = false;
-      for (uint32_t page_number = uint32_t(base_page_number);
-           !any_taken && page_number <= end_page_number; ++page_number) {
-        bool is_free = page_table_[page_number].state == 0;
-        if (!is_free) {
-          // At least one page in the range is used, skip to next.
-          // We know we'll be starting at least before this page.
-          any_taken = true;
-          if (page_count > page_number) {
-            // Not enough space left to fit entire page range. Breaks outer
-            // loop.
-            base_page_number = -1;
-          } else {
-            base_page_number = page_number - page_count;
-            base_page_number -= QuickMod(base_page_number, page_scan_stride);
-            base_page_number += page_scan_stride;  // cancel out loop logic
-          }
-          break;
-        }
-      }
-      if (!any_taken) {
-        // Found our place.
-        break;
-      }
-      // Retry.
-      start_page_number = end_page_number = UINT_MAX;
+    uint32_t aligned_page_count = xe::round_up(page_count, page_scan_stride);
+    if (aligned_page_count <= high_page_number) {
+      start_page_number = free_pages_.FindLast(
+          low_page_number, high_page_number - aligned_page_count,
+          search_page_count, page_scan_stride);
     }
   } else {
-    for (uint32_t base_page_number = low_page_number;
-         base_page_number <= high_page_number - page_count;
-         base_page_number += page_scan_stride) {
-      if (page_table_[base_page_number].state != 0) {
-        // Base page not free, skip to next usable page.
-        continue;
-      }
-      // Check requested range to ensure free.
-      start_page_number = base_page_number;
-      end_page_number = base_page_number + page_count - 1;
-      bool any_taken = false;
-      for (uint32_t page_number = base_page_number;
-           !any_taken && page_number <= end_page_number; ++page_number) {
-        bool is_free = page_table_[page_number].state == 0;
-        if (!is_free) {
-          // At least one page in the range is used, skip to next.
-          // We know we'll be starting at least after this page.
-          any_taken = true;
-          base_page_number = xe::round_up(page_number + 1, page_scan_stride);
-          base_page_number -= page_scan_stride;  // cancel out loop logic
-          break;
-        }
-      }
-      if (!any_taken) {
-        // Found our place.
-        break;
-      }
-      // Retry.
-      start_page_number = end_page_number = UINT_MAX;
-    }
+    start_page_number =
+        free_pages_.FindFirst(low_page_number, high_page_number - page_count,
+                              search_page_count, page_scan_stride);
+  }
+  if (start_page_number != FreeRunTree::kNotFound) {
+    end_page_number = start_page_number + page_count - 1;
+    assert_true(end_page_number < page_table_.size());
   }
   if (start_page_number == UINT_MAX || end_page_number == UINT_MAX) {
     // Out of memory.
@@ -1117,6 +1535,7 @@ bool BaseHeap::AllocRange(uint32_t low_address, uint32_t high_address,
     page_entry.state = kMemoryAllocationReserve | allocation_type;
     unreserved_page_count_--;
   }
+  free_pages_.MarkUsed(start_page_number, page_count);
 
   *out_address = heap_base_ + (start_page_number << page_size_shift_);
   return true;
@@ -1226,6 +1645,7 @@ bool BaseHeap::Release(uint32_t base_address, uint32_t* out_region_size) {
     page_entry.qword = 0;
     unreserved_page_count_++;
   }
+  free_pages_.MarkFree(base_page_number, base_page_entry.region_page_count);
 
   return true;
 }
@@ -1717,6 +2137,18 @@ XE_NOINLINE void PhysicalHeap::EnableAccessCallbacksInner(
     xe::memory::PageAccess protect_access) XE_RESTRICT {
   uint8_t* protect_base = membase_ + heap_base_;
   uint32_t protect_system_page_first = UINT32_MAX;
+  xe::memory::WriteTracker* write_tracker =
+      protect_access == xe::memory::PageAccess::kReadOnly
+          ? memory_->physical_write_tracker_.get()
+          : nullptr;
+  auto protect_system_pages = [&](uint32_t first, uint32_t last) {
+    void* address = protect_base + (first << system_page_shift_);
+    size_t length = size_t(last + 1 - first) << system_page_shift_;
+    // Fall back to protection if the pages can't be tracked.
+    if (!write_tracker || !write_tracker->Watch(address, length)) {
+      xe::memory::Protect(address, length, protect_access);
+    }
+  };
 
   SystemPageFlagsBlock* XE_RESTRICT sys_page_flags = system_page_flags_.data();
   PageEntry* XE_RESTRICT page_table_ptr = page_table_.data();
@@ -1790,21 +2222,48 @@ XE_NOINLINE void PhysicalHeap::EnableAccessCallbacksInner(
       }
     } else {
       if (protect_system_page_first != UINT32_MAX) {
-        xe::memory::Protect(
-            protect_base + (protect_system_page_first << system_page_shift_),
-            (i - protect_system_page_first) << system_page_shift_,
-            protect_access);
+        protect_system_pages(protect_system_page_first, i - 1);
         protect_system_page_first = UINT32_MAX;
       }
     }
   }
 
   if (protect_system_page_first != UINT32_MAX) {
-    xe::memory::Protect(
-        protect_base + (protect_system_page_first << system_page_shift_),
-        (system_page_last + 1 - protect_system_page_first)
-            << system_page_shift_,
-        protect_access);
+    protect_system_pages(protect_system_page_first, system_page_last);
+  }
+}
+
+void PhysicalHeap::CollectWrites(xe::memory::WriteTracker* write_tracker) {
+  uint8_t* protect_base = membase_ + heap_base_;
+  auto global_lock = global_critical_region_.Acquire();
+  // Only blocks with watched pages are scanned, in ranges of consecutive ones.
+  uint32_t block_count = uint32_t(system_page_flags_.size());
+  for (uint32_t block_first = 0; block_first < block_count;) {
+    if (!system_page_flags_[block_first].notify_on_invalidation) {
+      ++block_first;
+      continue;
+    }
+    uint32_t block_end = block_first + 1;
+    while (block_end < block_count &&
+           system_page_flags_[block_end].notify_on_invalidation) {
+      ++block_end;
+    }
+    uint32_t system_page_first = block_first << 6;
+    uint32_t system_page_end = std::min(block_end << 6, system_page_count_);
+    write_tracker->CollectWrites(
+        protect_base + (size_t(system_page_first) << system_page_shift_),
+        size_t(system_page_end - system_page_first) << system_page_shift_,
+        [&](void* base_address, size_t length) {
+          uint32_t heap_relative_address = xe::sat_sub(
+              uint32_t(static_cast<uint8_t*>(base_address) - protect_base),
+              host_address_offset());
+          // Already holding the global lock, which is recursive. The pages
+          // are already writable.
+          TriggerCallbacks(global_critical_region_.Acquire(),
+                           heap_base_ + heap_relative_address,
+                           uint32_t(length), true, true, false);
+        });
+    block_first = block_end;
   }
 }
 bool PhysicalHeap::TriggerCallbacks(
@@ -1924,47 +2383,91 @@ bool PhysicalHeap::TriggerCallbacks(
   }
 
   // Unprotect ranges that need unprotection.
+  uint32_t protect_calls = 0;
   if (unprotect) {
     uint8_t* protect_base = membase_ + heap_base_;
-    uint32_t unprotect_system_page_first = UINT32_MAX;
-    for (uint32_t i = system_page_first; i <= system_page_last; ++i) {
-      // Check if need to allow writing to this page.
-      bool unprotect_page = (system_page_flags_[i >> 6].notify_on_invalidation &
-                             (uint64_t(1) << (i & 63))) != 0;
-      if (unprotect_page) {
+    auto unprotect_system_pages = [&](uint32_t first, uint32_t last) {
+      xe::memory::Protect(protect_base + (first << system_page_shift_),
+                          (last + 1 - first) << system_page_shift_,
+                          xe::memory::PageAccess::kReadWrite);
+      ++protect_calls;
+    };
+    if (cvars::batched_write_watch) {
+      // Pages writable by the guest and not watched are already writable by
+      // the host, so a single protection change may span them between the
+      // watched pages. Only the pages not writable by the guest, and blocks
+      // with no watched pages, end the range.
+      uint32_t unprotect_system_page_first = UINT32_MAX;
+      uint32_t unprotect_system_page_last = 0;
+      for (uint32_t i = system_page_first; i <= system_page_last; ++i) {
+        uint64_t block = system_page_flags_[i >> 6].notify_on_invalidation;
+        if (!block) {
+          if (unprotect_system_page_first != UINT32_MAX) {
+            unprotect_system_pages(unprotect_system_page_first,
+                                   unprotect_system_page_last);
+            unprotect_system_page_first = UINT32_MAX;
+          }
+          i |= 63;
+          continue;
+        }
         uint32_t guest_page_number =
             xe::sat_sub(i << system_page_shift_, host_address_offset()) >>
             page_size_shift_;
         if (ToPageAccess(page_table_[guest_page_number].current_protect) !=
             xe::memory::PageAccess::kReadWrite) {
-          unprotect_page = false;
+          if (unprotect_system_page_first != UINT32_MAX) {
+            unprotect_system_pages(unprotect_system_page_first,
+                                   unprotect_system_page_last);
+            unprotect_system_page_first = UINT32_MAX;
+          }
+          continue;
+        }
+        if (block & (uint64_t(1) << (i & 63))) {
+          if (unprotect_system_page_first == UINT32_MAX) {
+            unprotect_system_page_first = i;
+          }
+          unprotect_system_page_last = i;
         }
       }
-      if (unprotect_page) {
-        if (unprotect_system_page_first == UINT32_MAX) {
-          unprotect_system_page_first = i;
+      if (unprotect_system_page_first != UINT32_MAX) {
+        unprotect_system_pages(unprotect_system_page_first,
+                               unprotect_system_page_last);
+      }
+    } else {
+      uint32_t unprotect_system_page_first = UINT32_MAX;
+      for (uint32_t i = system_page_first; i <= system_page_last; ++i) {
+        // Check if need to allow writing to this page.
+        bool unprotect_page =
+            (system_page_flags_[i >> 6].notify_on_invalidation &
+             (uint64_t(1) << (i & 63))) != 0;
+        if (unprotect_page) {
+          uint32_t guest_page_number =
+              xe::sat_sub(i << system_page_shift_, host_address_offset()) >>
+              page_size_shift_;
+          if (ToPageAccess(page_table_[guest_page_number].current_protect) !=
+              xe::memory::PageAccess::kReadWrite) {
+            unprotect_page = false;
+          }
         }
-      } else {
-        if (unprotect_system_page_first != UINT32_MAX) {
-          xe::memory::Protect(
-              protect_base +
-                  (unprotect_system_page_first << system_page_shift_),
-              (i - unprotect_system_page_first) << system_page_shift_,
-              xe::memory::PageAccess::kReadWrite);
-          unprotect_system_page_first = UINT32_MAX;
+        if (unprotect_page) {
+          if (unprotect_system_page_first == UINT32_MAX) {
+            unprotect_system_page_first = i;
+          }
+        } else {
+          if (unprotect_system_page_first != UINT32_MAX) {
+            unprotect_system_pages(unprotect_system_page_first, i - 1);
+            unprotect_system_page_first = UINT32_MAX;
+          }
         }
       }
-    }
-    if (unprotect_system_page_first != UINT32_MAX) {
-      xe::memory::Protect(
-          protect_base + (unprotect_system_page_first << system_page_shift_),
-          (system_page_last + 1 - unprotect_system_page_first)
-              << system_page_shift_,
-          xe::memory::PageAccess::kReadWrite);
+      if (unprotect_system_page_first != UINT32_MAX) {
+        unprotect_system_pages(unprotect_system_page_first, system_page_last);
+      }
     }
   }
 
   // Mark pages as not write-watched.
+  uint32_t pages_unwatched = 0;
   for (uint32_t i = block_index_first; i <= block_index_last; ++i) {
     uint64_t mask = 0;
     if (i == block_index_first) {
@@ -1973,8 +2476,11 @@ bool PhysicalHeap::TriggerCallbacks(
     if (i == block_index_last && (system_page_last & 63) != 63) {
       mask |= ~((uint64_t(1) << ((system_page_last & 63) + 1)) - 1);
     }
+    pages_unwatched += xe::bit_count(
+        system_page_flags_[i].notify_on_invalidation & ~mask);
     system_page_flags_[i].notify_on_invalidation &= mask;
   }
+  memory_->RecordWriteWatchProtect(protect_calls, pages_unwatched);
 
   return true;
 }
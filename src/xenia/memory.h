@@ -10,6 +10,7 @@
 #ifndef XENIA_MEMORY_H_
 #define XENIA_MEMORY_H_
 
+#include <atomic>
 #include <cstdint>
 #include <memory>
 #include <mutex>
@@ -17,6 +18,7 @@
 #include <utility>
 #include <vector>
 
+#include "xenia/base/free_run_tree.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/mutex.h"
 #include "xenia/cpu/mmio_handler.h"
@@ -98,6 +100,17 @@ union PageEntry {
   };
 };
 
+// State of a heap copied while the emulator is paused for a save, written out
+// and compressed afterwards.
+struct HeapSaveCapture {
+  std::vector<PageEntry> page_table;
+  // Committed pages stored in the save, in ascending order.
+  std::vector<uint32_t> page_numbers;
+  // Contents of the pages in page_numbers, page_size bytes each.
+  std::vector<uint8_t> page_data;
+  uint32_t page_size = 0;
+};
+
 // Heap abstraction for page-based allocation.
 class BaseHeap {
  public:
@@ -198,8 +211,18 @@ class BaseHeap {
   xe::memory::PageAccess QueryRangeAccess(uint32_t low_address,
                                           uint32_t high_address);
 
-  bool Save(ByteStream* stream);
-  bool Restore(ByteStream* stream);
+  // Copies the page table and the committed pages into the capture. For a
+  // delta, only the pages whose contents differ from the save base are copied,
+  // otherwise the copied pages become the new save base. Either way, every
+  // committed page is hashed while the guest is paused.
+  void CaptureSave(HeapSaveCapture* capture, bool delta);
+  // Writes the page table and, if write_pages is set, the captured pages
+  // compressed with snappy.
+  static void WriteSave(const HeapSaveCapture& capture, ByteStream* stream,
+                        bool write_pages);
+  // Restores the page table and the pages stored in the stream. For a delta,
+  // pages not stored in it are taken from the base stream.
+  bool Restore(ByteStream* stream, ByteStream* base_stream);
 
   void Reset();
 
@@ -221,6 +244,10 @@ class BaseHeap {
   uint32_t unreserved_page_count_;
   xe::global_critical_region global_critical_region_;
   std::vector<PageEntry> page_table_;
+  // Unreserved pages of page_table_, for finding free ranges to allocate.
+  xe::FreeRunTree free_pages_;
+  // Hashes of the pages of the last full save, 0 for pages not stored in it.
+  std::vector<uint64_t> save_base_page_hashes_;
 };
 
 // Normal heap allowing allocations from guest virtual address ranges.
@@ -276,6 +303,10 @@ class PhysicalHeap : public BaseHeap {
       const uint32_t system_page_first, const uint32_t system_page_last,
       xe::memory::PageAccess protect_access) XE_RESTRICT;
 
+  // Triggers the callbacks for the watched pages written to since they were
+  // watched by the write tracker.
+  void CollectWrites(xe::memory::WriteTracker* write_tracker);
+
   // Returns true if any page in the range was watched.
   bool TriggerCallbacks(global_unique_lock_type global_lock_locked_once,
                         uint32_t virtual_address, uint32_t length,
@@ -492,6 +523,34 @@ class Memory {
       uint32_t length, bool is_write, bool unwatch_exact_range,
       bool unprotect = true);
 
+  // Triggers the callbacks for the watched physical memory written to since it
+  // was watched, if writes are detected with the write tracker rather than
+  // with access violations. Must be called without the global critical region
+  // locked, before using the data from physical memory.
+  void CollectPhysicalMemoryWrites();
+
+  // Physical memory write watch activity during a frame.
+  struct WriteWatchStats {
+    // Guest writes that faulted on watched pages.
+    uint32_t faults = 0;
+    // Host protection changes done to unwatch pages.
+    uint32_t protect_calls = 0;
+    // System pages that stopped being watched.
+    uint32_t pages_unwatched = 0;
+    // System pages unwatched ahead of sequential faults.
+    uint32_t pages_speculated = 0;
+  };
+  // Returns the write watch activity since the last call and resets it, to be
+  // called at the end of each frame.
+  WriteWatchStats EndWriteWatchFrame();
+  void RecordWriteWatchProtect(uint32_t protect_calls,
+                               uint32_t pages_unwatched) {
+    write_watch_stats_.protect_calls.fetch_add(protect_calls,
+                                               std::memory_order_relaxed);
+    write_watch_stats_.pages_unwatched.fetch_add(pages_unwatched,
+                                                 std::memory_order_relaxed);
+  }
+
   // Allocates virtual memory from the 'system' heap.
   // System memory is kept separate from game memory but is still accessible
   // using normal guest virtual addresses. Kernel structures and other internal
@@ -525,13 +584,39 @@ class Memory {
   // Dumps a map of all allocated memory to the log.
   void DumpMap();
 
-  bool Save(ByteStream* stream);
+  // Memory state captured while the emulator is paused for a save.
+  struct SaveCapture {
+    // Path of the save the capture is for.
+    std::filesystem::path path;
+    // Save state base holding the pages not stored in the save, empty for a
+    // full save.
+    std::filesystem::path base_path;
+    // Whether all committed pages were captured, to be written to base_path
+    // as the base of this and the following saves.
+    bool is_new_base = false;
+    HeapSaveCapture heaps[5];
+  };
+
+  // Captures the memory state for a save to the given path, only the pages
+  // changed since the save base if incremental saves are enabled. Must be
+  // called while the guest is paused.
+  std::unique_ptr<SaveCapture> CaptureSave(const std::filesystem::path& path);
+  // Serializes a capture, writing the file of a new base first. May be called
+  // from any thread, but must be complete before the next capture.
+  void WriteSave(const SaveCapture& capture, ByteStream* stream);
   bool Restore(ByteStream* stream);
 
   void SetMMIOExceptionRecordingCallback(cpu::MmioAccessRecordCallback callback,
                                          void* context);
 
  private:
+  // Writes all the pages of a capture to its base_path.
+  static bool WriteSaveBase(const SaveCapture& capture);
+  // Records that the save of a capture refers to its base, if it's
+  // incremental, and deletes the bases that no save refers to anymore.
+  static void UpdateSaveBaseReferences(const SaveCapture& capture,
+                                       bool is_delta);
+
   int MapViews(uint8_t* mapping_base);
   void UnmapViews();
 
@@ -545,6 +630,8 @@ class Memory {
       void* host_address, bool is_write);
 
   std::filesystem::path file_name_;
+  // Save state base that incremental saves are relative to, empty if none.
+  std::filesystem::path save_base_path_;
   uint32_t system_page_size_ = 0;
   uint32_t system_allocation_granularity_ = 0;
   uint8_t* virtual_membase_ = nullptr;
@@ -588,6 +675,24 @@ class Memory {
   xe::global_critical_region global_critical_region_;
   std::vector<std::pair<PhysicalMemoryInvalidationCallback, void*>*>
       physical_memory_invalidation_callbacks_;
+
+  // Detects writes to watched physical memory instead of protection if
+  // enabled and supported.
+  std::unique_ptr<xe::memory::WriteTracker> physical_write_tracker_;
+
+  // Updated from the access violation callback and read at the end of frames.
+  struct {
+    std::atomic<uint32_t> faults{0};
+    std::atomic<uint32_t> protect_calls{0};
+    std::atomic<uint32_t> pages_unwatched{0};
+    std::atomic<uint32_t> pages_speculated{0};
+  } write_watch_stats_;
+  // Protected by global_critical_region. Last system page (in the guest
+  // virtual address space) where a write to watched memory faulted, and the
+  // number of preceding faults on each next or each previous page.
+  uint32_t write_watch_last_fault_page_ = UINT32_MAX;
+  uint32_t write_watch_sequential_faults_ = 0;
+  bool write_watch_faults_descending_ = false;
 };
 
 }  // namespace xe
@@ -25,6 +25,7 @@ namespace patcher {
 PatchDB::PatchDB(const std::filesystem::path patches_root) {
   patches_root_ = patches_root;
   LoadPatches();
+  LoadCrtSignatures();
 }
 
 PatchDB::~PatchDB() {}
@@ -57,6 +58,59 @@ void PatchDB::LoadPatches() {
   XELOGI("PatchDB: Loaded patches for {} titles", loaded_patches_.size());
 }
 
+void PatchDB::LoadCrtSignatures() {
+  // Not title specific, all files in the directory are loaded. Each has a list
+  // of signatures:
+  //   [[signature]]
+  //   routine = "memcpy"
+  //   hash = "0123456789ABCDEF"
+  //   instructions = 64
+  const std::filesystem::path signatures_directory =
+      patches_root_ / "crt_signatures";
+  const std::vector<xe::filesystem::FileInfo> signature_files =
+      filesystem::ListFiles(signatures_directory);
+
+  for (const xe::filesystem::FileInfo& signature_file : signature_files) {
+    if (signature_file.type != xe::filesystem::FileInfo::Type::kFile ||
+        signature_file.name.extension() != ".toml") {
+      continue;
+    }
+    const std::filesystem::path file_path =
+        signature_file.path / signature_file.name;
+    std::shared_ptr<cpptoml::table> signature_toml_fields;
+    try {
+      signature_toml_fields = ParseFile(file_path);
+    } catch (...) {
+      XELOGE("PatchDB: Cannot load CRT signature file: {}",
+             path_to_utf8(file_path));
+      continue;
+    }
+
+    auto signature_table = signature_toml_fields->get_table_array("signature");
+    if (!signature_table) {
+      continue;
+    }
+    for (auto signature_table_entry : *signature_table) {
+      auto routine = signature_table_entry->get_as<std::string>("routine");
+      auto hash = signature_table_entry->get_as<std::string>("hash");
+      auto instructions =
+          signature_table_entry->get_as<uint32_t>("instructions");
+      if (!routine || !hash || !instructions) {
+        XELOGE("PatchDB: Skipped incomplete CRT signature in {}",
+               path_to_utf8(file_path));
+        continue;
+      }
+      CrtSignatureEntry signature;
+      signature.routine_name = *routine;
+      signature.hash = strtoull((*hash).c_str(), NULL, 16);
+      signature.instruction_count = *instructions;
+      loaded_crt_signatures_.push_back(signature);
+    }
+  }
+  XELOGI("PatchDB: Loaded {} CRT routine signatures",
+         loaded_crt_signatures_.size());
+}
+
 PatchFileEntry PatchDB::ReadPatchFile(const std::filesystem::path& file_path) {
   PatchFileEntry patch_file;
   std::shared_ptr<cpptoml::table> patch_toml_fields;
@@ -70,6 +70,15 @@ struct PatchFileEntry {
   std::vector<PatchInfoEntry> patch_info;
 };
 
+// Known guest implementation of a C runtime routine, to be replaced with the
+// native one of the same name.
+struct CrtSignatureEntry {
+  std::string routine_name;
+  // Hash of the code, see cpu::HashCrtRoutine.
+  uint64_t hash;
+  uint32_t instruction_count;
+};
+
 enum class PatchDataType {
   kBE8,
   kBE16,
@@ -95,6 +104,7 @@ class PatchDB {
   ~PatchDB();
 
   void LoadPatches();
+  void LoadCrtSignatures();
 
   PatchFileEntry ReadPatchFile(const std::filesystem::path& file_path);
   bool ReadPatchData(std::vector<PatchDataEntry>& patch_data,
@@ -104,6 +114,9 @@ class PatchDB {
   std::vector<PatchFileEntry> GetTitlePatches(
       const uint32_t title_id, const std::optional<uint64_t> hash);
   std::vector<PatchFileEntry>& GetAllPatches() { return loaded_patches_; }
+  const std::vector<CrtSignatureEntry>& GetCrtSignatures() const {
+    return loaded_crt_signatures_;
+  }
 
  private:
   void ReadHashes(PatchFileEntry& patch_entry,
@@ -124,6 +137,7 @@ class PatchDB {
       {"be8", PatchData(sizeof(uint8_t), PatchDataType::kBE8)}};
 
   std::vector<PatchFileEntry> loaded_patches_;
+  std::vector<CrtSignatureEntry> loaded_crt_signatures_;
   std::filesystem::path patches_root_;
 };
 }  // namespace patcher
@@ -26,6 +26,10 @@ class Patcher {
 
   bool IsAnyPatchApplied() { return is_any_patch_applied_; }
 
+  const std::vector<CrtSignatureEntry>& GetCrtSignatures() const {
+    return patch_db_->GetCrtSignatures();
+  }
+
  private:
   PatchDB* patch_db_;
   bool is_any_patch_applied_;
@@ -8,7 +8,9 @@ project("xenia-core")
   language("C++")
   links({
     "fmt",
+    "snappy",
     "xenia-base",
+    "xxhash",
   })
   defines({
     "CURL_STATICLIB"